@@ -25,11 +25,36 @@
 #include <pololu/orangutan.h>
 #include <avr/io.h>         //gives us names for registers
 #include <avr/interrupt.h>
+#include <stdio.h>
 #include "timer_1284p.h"
 #include "menu.h"
+#include "param_store.h"
+#include "ram_profile.h"
+#include "soft_pwm.h"
+#include "timer_wheel.h"
 
 #define PRINT_COUNTERS 0
 
+// Green LED on OC1A: Timer1 toggles the pin on every compare match and
+// TIMER1_COMPA_vect stays disabled.  The toggle count is worked out from the
+// timer when it is asked for (see green_hw_count).  Set to 0 to toggle
+// from the compare ISR instead.
+#define GREEN_LED_HW_TOGGLE 1
+
+// Shortest green period with GREEN_LED_HW_TOGGLE: the toggle count needs
+// get_ms(), good to a couple of ms, to fall within half a period
+#define GREEN_PERIOD_MS_MIN 10
+
+// Yellow LED as a channel of the Timer3 software PWM engine (soft_pwm.h),
+// which can also dim it ('D Y <percent>').  Set to 0 for the 10 Hz Timer3
+// tick.
+#define YELLOW_LED_SOFT_PWM 1
+#define LED_PWM_HZ 1000
+
+// Stack headroom check, a "RAM low" line when below the threshold
+#define RAM_CHECK_MS 1000
+#define RAM_WARN_BYTES 256
+
 // Timer frequencies
 #define TIMER0_HZ 1000
 #define BUSY_WAIT_HZ 100
@@ -58,6 +83,9 @@
 #define DEFAULT_PERIOD_MS_GREEN     1000
 #define DEFAULT_PERIOD_MS_YELLOW    1000
 
+// Bump when lab1_params_t changes so old blocks are not loaded
+#define LAB1_PARAMS_VERSION 1
+
 // Initial LED
 #define DEFAULT_LED_VALUE 0
 
@@ -71,11 +99,27 @@
 #define LED_PORT_RED_BIT    DDD2
 #define LED_PORT_YELLOW_BIT DDD0
 #define LED_PORT_GREEN_BIT  DDD5
+#define LED_OUT_YELLOW      PORTA
+#define LED_OUT_YELLOW_BIT  PORTA0
+
+// LED periods kept in EEPROM (param_store.h)
+typedef struct
+{
+    int period_ms_red;
+    int period_ms_green;
+    int period_ms_yellow;
+} lab1_params_t;
+
+static lab1_params_t params;
 
 static int release;
 static int use_busy_wait;
 
 static int tick_threshold_red;
+static timer_wheel_timer_t red_timer;
+static timer_wheel_timer_t ram_timer;
+static int ram_warn_bytes;
+static uint16_t ram_warned;                 // headroom last warned about
 static int tick_threshold_red_busy;
 static int tick_threshold_green;
 static int tick_threshold_yellow;
@@ -83,8 +127,25 @@ static float timer1_hz;
 
 static int toggle_counter_ms_red;
 static int toggle_counter_ms_green;
+
+#if GREEN_LED_HW_TOGGLE
+static unsigned long green_anchor_ms;       // get_ms() at the last count
+static unsigned int green_anchor_tcnt;      // TCNT1 at the last count
+static int green_toggles_at_anchor;
+static int green_toggles_cleared;           // count at the last 'Z'
+#endif
 static int toggle_counter_ms_yellow;
 
+#if YELLOW_LED_SOFT_PWM
+static signed char yellow_channel;
+static uint8_t yellow_level;
+
+// Dummy channels for 'B', driving bytes in RAM instead of pins
+static volatile uint8_t bench_port[2];
+static signed char bench_channel[SOFT_PWM_CHANNELS];
+static uint8_t bench_channels;
+#endif
+
 void task_red_led( void );
 void task_green_led( void );
 void task_yellow_led( void );
@@ -94,19 +155,45 @@ void clr_green_toggle_counter( void );
 void clr_yellow_toggle_counter( void );
 
 void set_red_period( int );
-void set_green_period( int );
+int set_green_period( int );
 void set_yellow_period( int );
+void set_yellow_level( int );
+void set_soft_pwm_bench( int );
+void report_soft_pwm( void );
+void report_memory( int );
+unsigned char save_led_periods( void );
+
+static void red_release( void * );
+static void ram_check( void * );
 
 void set_timer0( void );
 void set_timer1( void );
 void set_timer3( void );
 
+#if GREEN_LED_HW_TOGGLE
+static int green_hw_count( unsigned int, unsigned int, unsigned long );
+static int green_hw_toggles( void );
+static void green_hw_anchor( void );
+#endif
+#if YELLOW_LED_SOFT_PWM
+static void yellow_soft_pwm_update( void );
+#endif
+
 int main()
 {
 
     // Clear interrupts right away
     cli();
 
+    // Software timers on the Timer0 tick
+    timer_wheel_init();
+    timer_wheel_setup( &red_timer, red_release, 0, 0 );
+
+    ram_warn_bytes = RAM_WARN_BYTES;
+    ram_warned = 0xFFFF;
+    timer_wheel_setup( &ram_timer, ram_check, 0, TIMER_WHEEL_DEFERRED );
+    timer_wheel_arm( &ram_timer, RAM_CHECK_MS, RAM_CHECK_MS );
+
     release = 0;
     use_busy_wait = 0;
     tick_threshold_red = 0;
@@ -117,6 +204,11 @@ int main()
     toggle_counter_ms_green = 0;
     toggle_counter_ms_yellow = 0;
     timer1_hz = 0.0f;
+#if YELLOW_LED_SOFT_PWM
+    yellow_channel = -1;
+    yellow_level = SOFT_PWM_LEVEL_ON;
+    bench_channels = 0;
+#endif
     clear();
 
     // Set up IO
@@ -128,10 +220,16 @@ int main()
     lcd_init_printf();
     init_menu();
 
+    // Restore the saved periods, if any
+    params.period_ms_red = DEFAULT_PERIOD_MS_RED;
+    params.period_ms_green = DEFAULT_PERIOD_MS_GREEN;
+    params.period_ms_yellow = DEFAULT_PERIOD_MS_YELLOW;
+    param_store_load( LAB1_PARAMS_VERSION, &params, sizeof(params) );
+
     // Set up timers
-    set_red_period( DEFAULT_PERIOD_MS_RED );
-    set_green_period( DEFAULT_PERIOD_MS_GREEN ); // This needs to be called before setting the timers
-    set_yellow_period( DEFAULT_PERIOD_MS_YELLOW );
+    set_red_period( params.period_ms_red );
+    set_green_period( params.period_ms_green ); // This needs to be called before setting the timers
+    set_yellow_period( params.period_ms_yellow );
     set_timer0();
     set_timer1();
     set_timer3();
@@ -152,6 +250,7 @@ int main()
 
         serial_check();
         check_for_new_bytes_received();
+        timer_wheel_run_deferred();
 
         if ( use_busy_wait )
         {
@@ -189,22 +288,22 @@ int main()
 ISR(TIMER0_COMPA_vect)
 {
     char cSREG;
-    static int task0_tick = 0;
 
     cSREG = SREG;
 
-    task0_tick++;
-
-    // If task is enabled and reached its 'release' time
-    if ( ( tick_threshold_red != 0 ) && ( task0_tick >= tick_threshold_red ) )
-    {
-        task0_tick = 0;
-        release = 1;
-    }
+    timer_wheel_tick();
 
     SREG = cSREG;
 }
 
+// red_timer expired (in the Timer0 ISR): release the red task
+static void red_release( void *context )
+{
+    (void)context;
+
+    release = 1;
+}
+
 ISR(TIMER1_COMPA_vect)
 {
     char cSREG;
@@ -220,6 +319,8 @@ ISR(TIMER1_COMPA_vect)
     SREG = cSREG;
 }
 
+#if !YELLOW_LED_SOFT_PWM
+// With YELLOW_LED_SOFT_PWM this vector belongs to soft_pwm.c
 ISR(TIMER3_COMPA_vect)
 {
     char cSREG;
@@ -238,6 +339,7 @@ ISR(TIMER3_COMPA_vect)
 
     SREG = cSREG;
 }
+#endif
 
 void task_red_led( void )
 {
@@ -250,81 +352,385 @@ void task_red_led( void )
 
 void task_green_led( void )
 {
+#if GREEN_LED_HW_TOGGLE
+    // OC1A toggles the LED in hardware and the count comes from the timer
+#else
     // This function should only be used to increment the toggle counter, but until the LED is connected to OC1A, use the green_led function
 
     static int green_LED_value = DEFAULT_LED_VALUE;
     green_led(green_LED_value);
     green_LED_value ^= 0x1;
     toggle_counter_ms_green++;
+#endif
 }
 
 void task_yellow_led( void )
 {
+#if YELLOW_LED_SOFT_PWM
+    // The PWM engine blinks the LED and counts the toggles
+#else
     static int yellow_LED_value = DEFAULT_LED_VALUE;
     set_digital_output(LED_YELLOW, yellow_LED_value);
     yellow_LED_value ^= 0x1;
     toggle_counter_ms_yellow++;
+#endif
 }
 
+// The counters are bumped by the timer ISRs, which can interrupt the menu,
+// so they are read and cleared with interrupts off
 void clr_red_toggle_counter( void )
 {
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
     toggle_counter_ms_red = 0;
+    SREG = cSREG;
 }
 
 void clr_green_toggle_counter( void )
 {
+#if GREEN_LED_HW_TOGGLE
+    green_toggles_cleared = green_hw_toggles();
+#else
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
     toggle_counter_ms_green = 0;
+    SREG = cSREG;
+#endif
 }
 
 void clr_yellow_toggle_counter( void )
 {
+    char cSREG;
+
+#if YELLOW_LED_SOFT_PWM
+    if ( yellow_channel >= 0 )
+    {
+        soft_pwm_clr_toggles( yellow_channel );
+    }
+#endif
+    cSREG = SREG;
+    cli();
     toggle_counter_ms_yellow = 0;
+    SREG = cSREG;
 }
 
 int get_red_toggle_counter( void )
 {
-    return toggle_counter_ms_red;
+    char cSREG;
+    int count;
+
+    cSREG = SREG;
+    cli();
+    count = toggle_counter_ms_red;
+    SREG = cSREG;
+
+    return count;
 }
 
 int get_green_toggle_counter( void )
 {
-    return toggle_counter_ms_green;
+    char cSREG;
+    int count;
+
+#if GREEN_LED_HW_TOGGLE
+    toggle_counter_ms_green = green_hw_toggles() - green_toggles_cleared;
+#endif
+    cSREG = SREG;
+    cli();
+    count = toggle_counter_ms_green;
+    SREG = cSREG;
+
+    return count;
 }
 
 int get_yellow_toggle_counter( void )
 {
-    return toggle_counter_ms_yellow;
+    char cSREG;
+    int count;
+
+#if YELLOW_LED_SOFT_PWM
+    if ( yellow_channel >= 0 )
+    {
+        toggle_counter_ms_yellow = soft_pwm_get_toggles( yellow_channel );
+    }
+#endif
+    cSREG = SREG;
+    cli();
+    count = toggle_counter_ms_yellow;
+    SREG = cSREG;
+
+    return count;
 }
 
 void set_red_period( int new_period )
 {
+    params.period_ms_red = new_period;
     tick_threshold_red      = (int) ((float)new_period / (float)MS_PER_S * (float)TIMER0_HZ);
     tick_threshold_red_busy = (int) ((float)new_period / (float)MS_PER_S * (float)BUSY_WAIT_HZ);
+
+    if ( tick_threshold_red != 0 )
+    {
+        timer_wheel_arm( &red_timer, tick_threshold_red, tick_threshold_red );
+    }
+    else
+    {
+        timer_wheel_cancel( &red_timer );
+    }
 }
 
-void set_green_period( int new_period )
+// Returns the period set, which with GREEN_LED_HW_TOGGLE is at least
+// GREEN_PERIOD_MS_MIN unless it is 0 (off)
+int set_green_period( int new_period )
 {
+    char cSREG;
+    float new_hz;
     int timer1_counter;
+#if GREEN_LED_HW_TOGGLE
+    unsigned long now_ms;
+    unsigned int tcnt, top;
+    char running;
 
-    cli();
+    if ( ( new_period > 0 ) && ( new_period < GREEN_PERIOD_MS_MIN ) )
+    {
+        new_period = GREEN_PERIOD_MS_MIN;
+    }
+    running = ( timer1_hz != 0 );
+#endif
+
+    params.period_ms_green = new_period;
 
     if ( new_period )
     {
-        timer1_hz = (float)MS_PER_S / (float)new_period;
-        timer1_counter = (int) ((float)CPU_FREQ/timer1_hz/(float)TIMER1_PRESCALER);
+        new_hz = (float)MS_PER_S / (float)new_period;
+        timer1_counter = (int) ((float)CPU_FREQ/new_hz/(float)TIMER1_PRESCALER);
     }
     else
     {
-        timer1_hz = 0;
+        new_hz = 0;
         timer1_counter = 0xFFFF;
     }
 
+    cSREG = SREG;
+    cli();
+
+#if GREEN_LED_HW_TOGGLE
+    // Where the old period had got to, counted once interrupts are back on
+    tcnt = timer_1284p_get_counter( TIMER_1284P_1 );
+    top = OCR1A;
+    now_ms = get_ms();
+#endif
+
+    timer1_hz = new_hz;
     timer_1284p_set_OCR( TIMER_1284P_1, TIMER_1284P_A, timer1_counter - 1 );
+
+#if GREEN_LED_HW_TOGGLE
+    // Period 0 leaves the LED where it is
+    timer_1284p_set_COM( TIMER_1284P_1, TIMER_1284P_A, timer1_hz ? TIMER_1284P_COM_TOGGLE : TIMER_1284P_COM_NO_COMPARE );
+    timer_1284p_clr_counter( TIMER_1284P_1 );
+#endif
+
+    SREG = cSREG;
+
+#if GREEN_LED_HW_TOGGLE
+    // Bank the toggles made at the old period; TCNT1 restarted at now_ms
+    if ( running )
+    {
+        green_toggles_at_anchor = green_hw_count( tcnt, top, now_ms );
+    }
+    green_anchor_tcnt = 0;
+    green_anchor_ms = now_ms;
+#endif
+
+    return new_period;
 }
 
 void set_yellow_period( int new_period )
 {
+    params.period_ms_yellow = new_period;
     tick_threshold_yellow = (int) ((float)new_period / (float)MS_PER_S * (float)TIMER3_HZ);
+#if YELLOW_LED_SOFT_PWM
+    yellow_soft_pwm_update();
+#endif
+}
+
+// Yellow brightness in percent, only with YELLOW_LED_SOFT_PWM
+void set_yellow_level( int percent )
+{
+#if YELLOW_LED_SOFT_PWM
+    if ( percent < 0 )
+    {
+        percent = 0;
+    }
+    else if ( percent > 100 )
+    {
+        percent = 100;
+    }
+
+    yellow_level = (uint8_t)( (long)percent * SOFT_PWM_LEVEL_ON / 100 );
+    yellow_soft_pwm_update();
+#endif
+}
+
+#if YELLOW_LED_SOFT_PWM
+// Blink the yellow channel with the current period and level.  Period 0
+// turns it off.
+static void yellow_soft_pwm_update( void )
+{
+    uint16_t periods;
+
+    if ( yellow_channel < 0 )
+    {
+        return;
+    }
+
+    periods = (uint16_t)( (long)params.period_ms_yellow * LED_PWM_HZ / MS_PER_S );
+
+    if ( params.period_ms_yellow && !periods )
+    {
+        periods = 1;
+    }
+
+    soft_pwm_set_level( yellow_channel, params.period_ms_yellow ? yellow_level : SOFT_PWM_LEVEL_OFF );
+    soft_pwm_set_blink( yellow_channel, periods, periods );
+    soft_pwm_commit();
+}
+#endif
+
+// Replace the 'B' dummy channels with 'count' new ones, each with its own
+// duty, and restart the engine statistics
+void set_soft_pwm_bench( int count )
+{
+#if YELLOW_LED_SOFT_PWM
+    uint8_t i;
+    signed char channel;
+
+    for ( i = 0; i < bench_channels; i++ )
+    {
+        soft_pwm_remove( bench_channel[i] );
+    }
+    bench_channels = 0;
+
+    if ( count < 0 )
+    {
+        count = 0;
+    }
+
+    for ( i = 0; i < count; i++ )
+    {
+        channel = soft_pwm_add( &bench_port[i / 8], 1 << ( i % 8 ) );
+        if ( channel < 0 )
+        {
+            break;
+        }
+
+        soft_pwm_set_level( channel, (uint8_t)( (long)( i + 1 ) * SOFT_PWM_LEVEL_ON / ( count + 1 ) ) );
+        bench_channel[bench_channels++] = channel;
+    }
+
+    soft_pwm_commit();
+    soft_pwm_clr_stats();
+#endif
+}
+
+// Engine cost so far, in CPU cycles (ISR bodies only), and what that allows
+// at 100 Hz and 1 kHz within half the CPU
+void report_soft_pwm( void )
+{
+#if YELLOW_LED_SOFT_PWM
+    char tempBuffer[32];
+    soft_pwm_stats_t stats;
+
+    soft_pwm_get_stats( &stats );
+
+    snprintf( tempBuffer, sizeof(tempBuffer), "PWM ch:%d late:%u\r\n", bench_channels, stats.late );
+    print_usb( tempBuffer );
+
+    if ( stats.edges )
+    {
+        snprintf( tempBuffer, sizeof(tempBuffer), "edge avg:%lu max:%u\r\n",
+                 (unsigned long)( stats.edge_ticks * SOFT_PWM_PRESCALER / stats.edges ),
+                 stats.edge_ticks_max * SOFT_PWM_PRESCALER );
+        print_usb( tempBuffer );
+    }
+
+    if ( stats.boundaries )
+    {
+        snprintf( tempBuffer, sizeof(tempBuffer), "bound avg:%lu max:%u\r\n",
+                 (unsigned long)( stats.boundary_ticks * SOFT_PWM_PRESCALER / stats.boundaries ),
+                 stats.boundary_ticks_max * SOFT_PWM_PRESCALER );
+        print_usb( tempBuffer );
+    }
+
+    snprintf( tempBuffer, sizeof(tempBuffer), "max ch 100Hz:%u 1kHz:%u\r\n",
+             soft_pwm_max_channels( 100, 50 ), soft_pwm_max_channels( 1000, 50 ) );
+    print_usb( tempBuffer );
+#else
+    print_usb( "No soft PWM\r\n" );
+#endif
+}
+
+// ram_timer, from the main loop: warn once per new low below the threshold
+static void ram_check( void *context )
+{
+    char tempBuffer[32];
+    uint16_t headroom;
+
+    (void)context;
+
+    if ( ram_warn_bytes <= 0 )
+    {
+        return;
+    }
+
+    headroom = ram_profile_headroom();
+    if ( ( headroom < (uint16_t)ram_warn_bytes ) && ( headroom < ram_warned ) )
+    {
+        ram_warned = headroom;
+        snprintf( tempBuffer, sizeof(tempBuffer), "RAM low: %u free\r\n", headroom );
+        print_usb( tempBuffer );
+    }
+}
+
+// SRAM layout and stack high water mark.  'bytes' > 0 sets the warning
+// threshold, < 0 turns the periodic check off.
+void report_memory( int bytes )
+{
+    char tempBuffer[32];
+    ram_profile_t profile;
+
+    if ( bytes > 0 )
+    {
+        ram_warn_bytes = bytes;
+        ram_warned = 0xFFFF;
+    }
+    else if ( bytes < 0 )
+    {
+        ram_warn_bytes = 0;
+    }
+
+    ram_profile_get( &profile );
+
+    snprintf( tempBuffer, sizeof(tempBuffer), "data %04x %u\r\n", profile.data_start, profile.data_bytes );
+    print_usb( tempBuffer );
+    snprintf( tempBuffer, sizeof(tempBuffer), "bss %04x %u\r\n", profile.bss_start, profile.bss_bytes );
+    print_usb( tempBuffer );
+    snprintf( tempBuffer, sizeof(tempBuffer), "heap %04x %u\r\n", profile.heap_start, profile.heap_bytes );
+    print_usb( tempBuffer );
+    snprintf( tempBuffer, sizeof(tempBuffer), "stack max:%u now:%u\r\n", profile.stack_max, profile.stack_now );
+    print_usb( tempBuffer );
+    snprintf( tempBuffer, sizeof(tempBuffer), "free:%u warn:%d\r\n", profile.headroom, ram_warn_bytes );
+    print_usb( tempBuffer );
+}
+
+// Start writing the current periods to EEPROM, returns 0 if a save is
+// still in progress
+unsigned char save_led_periods( void )
+{
+    return param_store_save( LAB1_PARAMS_VERSION, &params, sizeof(params) );
 }
 
 void set_timer0( void )
@@ -409,16 +815,35 @@ void set_timer1( void )
     // Timer period of 78 (16-bit register)
     timer_1284p_set_OCR( TIMER_1284P_1, TIMER_1284P_A, timer1_counter - 1 );
 
+#if GREEN_LED_HW_TOGGLE
+    // No Timer1 interrupts at all, OC1A does the toggling
+    if ( !timer1_hz )
+    {
+        timer_1284p_set_COM( TIMER_1284P_1, TIMER_1284P_A, TIMER_1284P_COM_NO_COMPARE );
+    }
+    timer_1284p_clr_IE( TIMER_1284P_1, TIMER_1284P_IE_B );
+    timer_1284p_clr_IE( TIMER_1284P_1, TIMER_1284P_IE_A );
+    timer_1284p_clr_IE( TIMER_1284P_1, TIMER_1284P_IE_OVERFLOW );
+    green_hw_anchor();
+#else
     // Disable interrupts for 0B, enable for 0A, and disable for 0 overflow
     timer_1284p_clr_IE( TIMER_1284P_1, TIMER_1284P_IE_B );
     timer_1284p_set_IE( TIMER_1284P_1, TIMER_1284P_IE_A );
     timer_1284p_clr_IE( TIMER_1284P_1, TIMER_1284P_IE_OVERFLOW );
+#endif
 }
 
 void set_timer3( void )
 {
     cli();
 
+#if YELLOW_LED_SOFT_PWM
+    // Timer3 runs the PWM engine, the yellow LED is one of its channels
+    soft_pwm_init( SOFT_PWM_HZ_TO_TICKS( LED_PWM_HZ ) );
+    yellow_channel = soft_pwm_add( &LED_OUT_YELLOW, 1 << LED_OUT_YELLOW_BIT );
+    yellow_soft_pwm_update();
+#else
+
     /*
     ** freq_interrupt = (CPU_freq / 1 second) * (1 count / prescaler ticks) * (1 interrput / timer_period counts)
     **
@@ -452,4 +877,87 @@ void set_timer3( void )
     timer_1284p_clr_IE( TIMER_1284P_3, TIMER_1284P_IE_B );
     timer_1284p_set_IE( TIMER_1284P_3, TIMER_1284P_IE_A );
     timer_1284p_clr_IE( TIMER_1284P_3, TIMER_1284P_IE_OVERFLOW );
+#endif
+}
+
+#if GREEN_LED_HW_TOGGLE
+// Restart TCNT1 and the elapsed time together
+static void green_hw_anchor( void )
+{
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    timer_1284p_clr_counter( TIMER_1284P_1 );
+    green_anchor_tcnt = 0;
+    green_anchor_ms = get_ms();
+
+    SREG = cSREG;
 }
+
+// Compare matches (= OC1A toggles) since boot, from TCNT1, its TOP and
+// get_ms() read together.
+//
+// TCNT1 has gone from green_anchor_tcnt to tcnt in T Timer1 ticks, so T is
+// a whole number of periods plus the part period between the two.  get_ms()
+// gives T to within a couple of ms, which picks the number of periods as
+// long as that is under half a period (GREEN_PERIOD_MS_MIN).  There is one
+// match each time TCNT1 reaches TOP.
+static int green_hw_count( unsigned int tcnt, unsigned int top, unsigned long now_ms )
+{
+    uint32_t elapsed_ms, elapsed_ticks, period, part, periods;
+
+    period = (uint32_t)top + 1;
+    elapsed_ms = now_ms - green_anchor_ms;
+
+    // ms to Timer1 ticks, split so it stays in 32 bits for ~60 hours
+    elapsed_ticks = elapsed_ms / TIMER1_PRESCALER * ( CPU_FREQ / MS_PER_S )
+                  + elapsed_ms % TIMER1_PRESCALER * ( CPU_FREQ / MS_PER_S ) / TIMER1_PRESCALER;
+
+    part = ( tcnt >= green_anchor_tcnt ) ? tcnt - green_anchor_tcnt : tcnt + period - green_anchor_tcnt;
+
+    periods = 0;
+    if ( elapsed_ticks + period / 2 > part )
+    {
+        periods = ( elapsed_ticks + period / 2 - part ) / period;
+    }
+
+    // Plus TOP passed in the part period, less a match at the anchor, which
+    // was counted then
+    periods += ( tcnt < green_anchor_tcnt );
+    periods += ( tcnt == top );
+    periods -= ( green_anchor_tcnt == top );
+
+    return green_toggles_at_anchor + (int)periods;
+}
+
+// Count up to now and move the anchor there, so the next count only has to
+// place the time since this one
+static int green_hw_toggles( void )
+{
+    char cSREG;
+    unsigned long now_ms;
+    unsigned int tcnt, top;
+
+    if ( !timer1_hz )
+    {
+        return green_toggles_at_anchor;
+    }
+
+    cSREG = SREG;
+    cli();
+
+    tcnt = timer_1284p_get_counter( TIMER_1284P_1 );
+    top = OCR1A;
+    now_ms = get_ms();
+
+    SREG = cSREG;
+
+    green_toggles_at_anchor = green_hw_count( tcnt, top, now_ms );
+    green_anchor_tcnt = tcnt;
+    green_anchor_ms = now_ms;
+
+    return green_toggles_at_anchor;
+}
+#endif
@@ -11,8 +11,13 @@ int get_red_toggle_counter( void );
 int get_green_toggle_counter( void );
 int get_yellow_toggle_counter( void );
 void set_red_period( int new_period );
-void set_green_period( int new_period );
+int set_green_period( int new_period );
 void set_yellow_period( int new_period );
+unsigned char save_led_periods( void );
+void set_yellow_level( int percent );
+void set_soft_pwm_bench( int count );
+void report_soft_pwm( void );
+void report_memory( int );
 
 //#define ECHO2LCD
 
@@ -69,23 +74,37 @@ void init_menu() {
 void process_received_string(const char* buffer)
 {
 	// Used to pass to USB_COMM for serial communication
-	char tempBuffer[32];
+	char tempBuffer[48];
 	
 	// parse and echo back to serial comm window (and optionally the LCD)
 	char color;
 	char op_char;
 	int value;
+	int green_period;
 	int parsed;
 
-    cli();
-
 	parsed = sscanf(buffer, "%c %c %d", &op_char, &color, &value);
 #ifdef ECHO2LCD
 	lcd_goto_xy(0,0);
 	printf("Got %c %c %d\n", op_char, color, value);
 #endif
-	sprintf( tempBuffer, "Op:%c C:%c V:%d\r\n", op_char, color, value );
+	snprintf( tempBuffer, sizeof(tempBuffer), "Op:%c C:%c V:%d\r\n", op_char, color, value );
 	print_usb( tempBuffer );
+
+    // Save takes no color
+    if ( ( op_char == 'S' ) || ( op_char == 's' ) )
+    {
+        if ( save_led_periods() )
+        {
+            print_usb( "Saving periods\r\n" );
+        }
+        else
+        {
+            print_usb( "Save busy, try again\r\n" );
+        }
+        print_usb( MENU );
+        return;
+    }
 	
 	// convert color to upper and check if valid
 	color -= 32*(color>='a' && color<='z');
@@ -108,24 +127,24 @@ void process_received_string(const char* buffer)
 		    switch(color) {
     		    case 'R':
     		        set_red_period( value );
-    		        sprintf( tempBuffer, "R freq: %d\r\n", value );
+    		        snprintf( tempBuffer, sizeof(tempBuffer), "R freq: %d\r\n", value );
     		        print_usb( tempBuffer );
     		        break;
     		    case 'G':
-    		        set_green_period( value );
-    		        sprintf( tempBuffer, "G freq: %d\r\n", value );
+    		        value = set_green_period( value );
+    		        snprintf( tempBuffer, sizeof(tempBuffer), "G freq: %d\r\n", value );
     		        print_usb( tempBuffer );
     		        break;
     		    case 'Y':
     		        set_yellow_period( value );
-    		        sprintf( tempBuffer, "Y freq: %d\r\n", value );
+    		        snprintf( tempBuffer, sizeof(tempBuffer), "Y freq: %d\r\n", value );
     		        print_usb( tempBuffer );
     		        break;
     		    case 'A':
     		        set_red_period( value );
-    		        set_green_period( value );
+    		        green_period = set_green_period( value );
     		        set_yellow_period( value );
-    		        sprintf( tempBuffer, "Freq R:%d G:%d Y:%d\r\n", value, value, value );
+    		        snprintf( tempBuffer, sizeof(tempBuffer), "Freq R:%d G:%d Y:%d\r\n", value, green_period, value );
     		        print_usb( tempBuffer );
     		        break;
     		    default: print_usb("Default in t(color). How?\r\n" );
@@ -136,19 +155,19 @@ void process_received_string(const char* buffer)
 		case 'p':
 			switch(color) {
 				case 'R': 
-					sprintf( tempBuffer, "R toggles: %d\r\n", get_red_toggle_counter() );
+					snprintf( tempBuffer, sizeof(tempBuffer), "R toggles: %d\r\n", get_red_toggle_counter() );
 					print_usb( tempBuffer ); 
 					break;
 				case 'G': 
-					sprintf( tempBuffer, "G toggles: %d\r\n", get_green_toggle_counter() );
+					snprintf( tempBuffer, sizeof(tempBuffer), "G toggles: %d\r\n", get_green_toggle_counter() );
 					print_usb( tempBuffer ); 
 					break;
 				case 'Y': 
-					sprintf( tempBuffer, "Y toggles: %d\r\n", get_yellow_toggle_counter() );
+					snprintf( tempBuffer, sizeof(tempBuffer), "Y toggles: %d\r\n", get_yellow_toggle_counter() );
 					print_usb( tempBuffer ); 
 					break;
 				case 'A': 
-					sprintf( tempBuffer, "Toggles R:%d G:%d Y:%d\r\n", get_red_toggle_counter(), get_green_toggle_counter(), get_yellow_toggle_counter() );
+					snprintf( tempBuffer, sizeof(tempBuffer), "Toggles R:%d G:%d Y:%d\r\n", get_red_toggle_counter(), get_green_toggle_counter(), get_yellow_toggle_counter() );
 					print_usb( tempBuffer ); 
 					break;
 				default: print_usb("Default in p(color). How?\r\n" );
@@ -161,16 +180,16 @@ void process_received_string(const char* buffer)
 			switch(color) {
 				case 'R':
                     clr_red_toggle_counter();
-                    sprintf( tempBuffer, "Zero R\r\n" );
+                    snprintf( tempBuffer, sizeof(tempBuffer), "Zero R\r\n" );
                     print_usb( tempBuffer );
                     break;
 				case 'G':
                     clr_green_toggle_counter();
-                    sprintf( tempBuffer, "Zero G\r\n" );
+                    snprintf( tempBuffer, sizeof(tempBuffer), "Zero G\r\n" );
                     print_usb( tempBuffer );
                     break;
 				case 'Y':
-				    sprintf( tempBuffer, "Zero Y\r\n" );
+				    snprintf( tempBuffer, sizeof(tempBuffer), "Zero Y\r\n" );
 				    print_usb( tempBuffer );
                     clr_yellow_toggle_counter();
                     break;
@@ -178,20 +197,46 @@ void process_received_string(const char* buffer)
                     clr_red_toggle_counter();
                     clr_green_toggle_counter();
                     clr_yellow_toggle_counter();
-                    sprintf( tempBuffer, "Zero All\r\n" );
+                    snprintf( tempBuffer, sizeof(tempBuffer), "Zero All\r\n" );
                     print_usb( tempBuffer );
                     break;
 				default: print_usb("Default in z(color). How?\r\n" );
 			}
 			break;
+		// dim <color> LED, only yellow is on the PWM engine
+		case 'D':
+		case 'd':
+		    if ( color == 'Y' )
+		    {
+		        set_yellow_level( value );
+		        snprintf( tempBuffer, sizeof(tempBuffer), "Y level: %d%%\r\n", value );
+		        print_usb( tempBuffer );
+		    }
+		    else
+		    {
+		        print_usb( "Only Y dims\r\n" );
+		    }
+		    break;
+
+		// PWM engine statistics, then <value> benchmark channels
+		case 'B':
+		case 'b':
+		    report_soft_pwm();
+		    set_soft_pwm_bench( value );
+		    break;
+
+		// RAM layout and stack high water mark, <value> > 0 sets the
+		// warning threshold, < 0 turns the check off
+		case 'M':
+		case 'm':
+		    report_memory( value );
+		    break;
 		default:
 			print_usb( "Command does not compute.\r\n" );
 		} // end switch(op_char) 
 		
 	print_usb( MENU );
 
-    sei();
-
 } //end menu()
 
 //---------------------------------------------------------------------------------------
@@ -206,44 +251,23 @@ void check_for_new_bytes_received()
 	Both of these are incremented % (size-of-buffer) to move through the buffer, and once the end is reached, to start back at the beginning.
 	This process and data structures are from the Pololu library. See examples/serial2/test.c and src/OrangutanSerial/ *
 	
-	A carriage return from your comm window initiates the transfer of your keystrokes.
-	All key strokes prior to the carriage return will be processed with a single call to this function (with multiple passes through this loop).
-	On the next function call, the carriage return is processes with a single pass through the loop.
-	The menuBuffer is used to hold all keystrokes prior to the carriage return. The "received" variable, which indexes menuBuffer, is reset to 0
-	after each carriage return.
+	A carriage return (or a line feed) from your comm window ends a command, which is processed as soon as
+	it has been read, so several commands that arrive together are each processed in turn.  The menuBuffer
+	holds the keystrokes of the command being received, across calls.  A command longer than menuBuffer is
+	dropped whole with a "Line too long" reply rather than written past the end, and empty lines (the
+	line feed of a "\r\n") are ignored.
 	*/ 
-	char menuBuffer[32];
+	static char menuBuffer[32];
 	static int received = 0;
-    int evaluate = 0;
-	
+	static unsigned char overflow = 0;
+	char c;
+
 	// while there are unprocessed keystrokes in the receive_buffer, grab them and buffer
 	// them into the menuBuffer
 	while(serial_get_received_bytes(USB_COMM) != receive_buffer_position)
 	{
-		// place in a buffer for processing
-		menuBuffer[received] = receive_buffer[receive_buffer_position];
-
-print_usb_char( menuBuffer[received] );
-
-#ifdef ECHO2LCD
-lcd_goto_xy(0,0);
-print("RX: (");
-print_long(menuBuffer[received]);
-print_character(')');
-for (int i=0; i<received; i++)
-{
-    print_character(menuBuffer[i]);
-}
-#endif
-
-        if ( menuBuffer[received] == '\r' )
-        {
-            print_usb( "\n" );
-            evaluate = 1;
-        }
+		c = receive_buffer[receive_buffer_position];
 
-		++received;
-		
 		// Increment receive_buffer_position, but wrap around when it gets to
 		// the end of the buffer. 
 		if ( receive_buffer_position == sizeof(receive_buffer) - 1 )
@@ -254,39 +278,49 @@ for (int i=0; i<received; i++)
 		{
 			receive_buffer_position++;
 		}
-	}
-#ifdef ECHO2LCD
-		lcd_goto_xy(0,1);
-		print("RX: (");
-		print_long(received);
-		print_character(')');
-		for (int i=0; i<received; i++)
-		{
-			print_character(menuBuffer[i]);
-		}
-#endif
-	// If there were keystrokes processed, check if a menu command
-	if ( evaluate ) {/*
-		// if only 1 received, it was MOST LIKELY a carriage return. 
-		// Even if it was a single keystroke, it is not a menu command, so ignore it.
-		if ( 1 == received ) {
-			received = 0;
-			return;
-		}*/
-		// Process buffer: terminate string, process, reset index to beginning of array to receive another command
-		menuBuffer[received] = '\0';
+
+print_usb_char( c );
+
+        if ( ( c == '\r' ) || ( c == '\n' ) )
+        {
+            if ( c == '\r' )
+            {
+                print_usb( "\n" );
+            }
+
+            if ( overflow )
+            {
+                print_usb( "Line too long\r\n" );
+                print_usb( MENU );
+            }
+            else if ( received > 0 )
+            {
+                // Process buffer: terminate string, process, reset index to beginning of array to receive another command
+                menuBuffer[received] = '\0';
 #ifdef ECHO2LCD
-		lcd_goto_xy(0,1);
-		print("RX: (");
-		print_long(received);
-		print_character(')');
-		for (int i=0; i<received; i++)
-		{
-			print_character(menuBuffer[i]);
-		}
+                lcd_goto_xy(0,1);
+                print("RX: (");
+                print_long(received);
+                print_character(')');
+                for (int i=0; i<received; i++)
+                {
+                    print_character(menuBuffer[i]);
+                }
 #endif
-		process_received_string(menuBuffer);
-		received = 0;
+                process_received_string(menuBuffer);
+            }
+
+            received = 0;
+            overflow = 0;
+        }
+        else if ( received < (int)sizeof(menuBuffer) - 1 )
+        {
+            menuBuffer[received++] = c;
+        }
+        else
+        {
+            overflow = 1;
+        }
 	}
 }
 	
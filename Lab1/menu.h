@@ -8,7 +8,7 @@
 
 #include <pololu/orangutan.h>  
 
-#define MENU "\rMenu: {TPZ} {RGYA} <int>: "
+#define MENU "\rMenu: {TPZDBM} {RGYA} <int>, S to save periods: "
 
 /* This is a customization of the serial2 example from the Pololu library examples. (ACL)
  *
@@ -0,0 +1,205 @@
+/* param_store.c
+ *
+ * Persistent parameter block in EEPROM, see param_store.h
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "param_store.h"
+
+// Byte offsets in a slot
+#define PARAM_STORE_SEQUENCE    0
+#define PARAM_STORE_VERSION     1
+#define PARAM_STORE_LENGTH      2
+#define PARAM_STORE_CRC_LO      3
+#define PARAM_STORE_CRC_HI      4
+#define PARAM_STORE_PAYLOAD     PARAM_STORE_HEADER_SIZE
+
+// Slot being loaded or written
+static uint8_t image[PARAM_STORE_SLOT_SIZE];
+
+static uint8_t newest_slot;
+static uint8_t newest_sequence;
+static unsigned char have_newest;
+
+// Written from the EEPROM ready interrupt: positions 1 .. write_length - 1,
+// then position write_length stands for the sequence byte
+static volatile uint8_t write_slot;
+static volatile uint8_t write_length;
+static volatile uint8_t write_position;
+static volatile unsigned char writing;
+static volatile unsigned char saves;
+
+static uint16_t slot_address( uint8_t slot )
+{
+    return PARAM_STORE_BASE_ADDRESS + (uint16_t)slot * PARAM_STORE_SLOT_SIZE;
+}
+
+static uint16_t image_crc( void )
+{
+    uint16_t crc = 0xFFFF;
+    uint8_t i;
+
+    crc = _crc16_update( crc, image[PARAM_STORE_SEQUENCE] );
+    crc = _crc16_update( crc, image[PARAM_STORE_VERSION] );
+    crc = _crc16_update( crc, image[PARAM_STORE_LENGTH] );
+
+    for ( i = 0; i < image[PARAM_STORE_LENGTH]; i++ )
+    {
+        crc = _crc16_update( crc, image[PARAM_STORE_PAYLOAD + i] );
+    }
+
+    return crc;
+}
+
+static unsigned char image_valid( unsigned char version, unsigned char size )
+{
+    uint16_t crc;
+
+    if ( ( image[PARAM_STORE_VERSION] != version ) || ( image[PARAM_STORE_LENGTH] != size ) )
+    {
+        return 0;
+    }
+
+    crc = image[PARAM_STORE_CRC_LO] | ( (uint16_t)image[PARAM_STORE_CRC_HI] << 8 );
+
+    return ( crc == image_crc() );
+}
+
+unsigned char param_store_load( unsigned char version, void *params, unsigned char size )
+{
+    uint8_t sequence[PARAM_STORE_SLOTS];
+    uint8_t newest = 0;
+    uint8_t i, slot;
+
+    have_newest = 0;
+
+    if ( size > PARAM_STORE_PAYLOAD_MAX )
+    {
+        return 0;
+    }
+
+    for ( i = 0; i < PARAM_STORE_SLOTS; i++ )
+    {
+        sequence[i] = eeprom_read_byte( (const uint8_t *)(uintptr_t)slot_address( i ) );
+    }
+
+    // The newest slot is the one the next slot's sequence does not follow on
+    // from (erased EEPROM has no valid slots and ends up at slot 0)
+    for ( i = 0; i < PARAM_STORE_SLOTS; i++ )
+    {
+        if ( sequence[( i + 1 ) % PARAM_STORE_SLOTS] != (uint8_t)( sequence[i] + 1 ) )
+        {
+            newest = i;
+            break;
+        }
+    }
+
+    for ( i = 0; i < PARAM_STORE_SLOTS; i++ )
+    {
+        slot = ( newest + PARAM_STORE_SLOTS - i ) % PARAM_STORE_SLOTS;
+
+        eeprom_read_block( image, (const void *)(uintptr_t)slot_address( slot ), PARAM_STORE_SLOT_SIZE );
+
+        if ( image_valid( version, size ) )
+        {
+            memcpy( params, &image[PARAM_STORE_PAYLOAD], size );
+            newest_slot = slot;
+            newest_sequence = image[PARAM_STORE_SEQUENCE];
+            have_newest = 1;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+unsigned char param_store_save( unsigned char version, const void *params, unsigned char size )
+{
+    uint16_t crc;
+
+    if ( writing || ( size > PARAM_STORE_PAYLOAD_MAX ) )
+    {
+        return 0;
+    }
+
+    if ( have_newest )
+    {
+        newest_slot = ( newest_slot + 1 ) % PARAM_STORE_SLOTS;
+        newest_sequence++;
+    }
+    else
+    {
+        newest_slot = 0;
+        newest_sequence = 0;
+        have_newest = 1;
+    }
+
+    image[PARAM_STORE_SEQUENCE] = newest_sequence;
+    image[PARAM_STORE_VERSION] = version;
+    image[PARAM_STORE_LENGTH] = size;
+    memcpy( &image[PARAM_STORE_PAYLOAD], params, size );
+
+    crc = image_crc();
+    image[PARAM_STORE_CRC_LO] = crc & 0xFF;
+    image[PARAM_STORE_CRC_HI] = crc >> 8;
+
+    write_slot = newest_slot;
+    write_length = PARAM_STORE_HEADER_SIZE + size;
+    write_position = 1;
+    writing = 1;
+
+    // Fires straight away if the EEPROM is idle
+    EECR |= ( 1 << EERIE );
+
+    return 1;
+}
+
+unsigned char param_store_busy( void )
+{
+    return writing;
+}
+
+unsigned char param_store_get_saves( void )
+{
+    return saves;
+}
+
+unsigned char param_store_get_slot( void )
+{
+    return newest_slot;
+}
+
+// One byte per interrupt.  Runs when the previous write has finished, so the
+// EEPROM is free to read and write here.
+ISR(EE_READY_vect)
+{
+    uint8_t index;
+    uint16_t address;
+
+    while ( write_position <= write_length )
+    {
+        index = ( write_position < write_length ) ? write_position : PARAM_STORE_SEQUENCE;
+        address = slot_address( write_slot ) + index;
+        write_position++;
+
+        if ( eeprom_read_byte( (const uint8_t *)(uintptr_t)address ) != image[index] )
+        {
+            EEAR = address;
+            EEDR = image[index];
+            EECR |= ( 1 << EEMPE );
+            EECR |= ( 1 << EEPE );
+            return;
+        }
+    }
+
+    EECR &= ~( 1 << EERIE );
+    writing = 0;
+    saves++;
+}
@@ -0,0 +1,51 @@
+/* param_store.h
+ *
+ * Persistent parameter block in EEPROM.
+ *
+ * The application keeps its parameters in a small struct.  The store keeps
+ * copies of it in PARAM_STORE_SLOTS fixed size slots used round robin, so
+ * each save wears a different slot.  A slot holds
+ *
+ *      sequence  version  length  crc (2)  payload (length bytes)
+ *
+ * The sequence counts up by one per save and is written last, so a slot only
+ * becomes the newest once all of it is in EEPROM; a save cut short by a reset
+ * leaves the previous slot as the newest.  The CRC covers the sequence,
+ * version, length and payload.
+ *
+ * param_store_load() finds the newest slot from the sequence bytes and reads
+ * it with a single eeprom_read_block(), falling back to older slots only if
+ * its CRC does not match.
+ *
+ * param_store_save() only builds the slot image; the bytes are written one
+ * at a time from the EEPROM ready interrupt (about 3.4 ms each), so nothing
+ * ever waits on the EEPROM.  Bytes that already hold the right value are
+ * skipped.
+ */
+
+#ifndef __PARAM_STORE_H
+#define __PARAM_STORE_H
+
+#define PARAM_STORE_BASE_ADDRESS    0
+#define PARAM_STORE_SLOT_SIZE       32
+#define PARAM_STORE_SLOTS           16
+#define PARAM_STORE_HEADER_SIZE     5
+#define PARAM_STORE_PAYLOAD_MAX     ( PARAM_STORE_SLOT_SIZE - PARAM_STORE_HEADER_SIZE )
+
+// Copy the newest valid block into 'params'.  Returns 1 if one was found with
+// this version and size, otherwise 0 and 'params' is left as it was (the
+// caller fills in the defaults first).  Call once at boot, before any save.
+unsigned char param_store_load( unsigned char version, void *params, unsigned char size );
+
+// Start saving 'params' to the next slot.  Returns 0 (nothing started) if a
+// save is still being written or the block does not fit in a slot.
+unsigned char param_store_save( unsigned char version, const void *params, unsigned char size );
+
+// 1 while a save is being written
+unsigned char param_store_busy( void );
+
+// Completed saves since boot, and the slot the newest block is in
+unsigned char param_store_get_saves( void );
+unsigned char param_store_get_slot( void );
+
+#endif //__PARAM_STORE_H
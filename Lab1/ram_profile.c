@@ -0,0 +1,99 @@
+/* ram_profile.c
+ *
+ * SRAM layout and stack high water mark, see ram_profile.h
+ */
+
+#include <avr/io.h>
+
+#include <inttypes.h>
+
+#include "ram_profile.h"
+
+// Linker and malloc() symbols
+extern uint8_t __data_start;
+extern uint8_t __bss_start;
+extern uint8_t __heap_start;
+extern char *__brkval;
+
+// Lowest stack byte known to be used, 0 until the first scan
+static uint8_t *low_water;
+
+void ram_profile_paint( void ) __attribute__ ( ( naked, used, section( ".init3" ) ) );
+
+// No C here: nothing is initialised yet and r1 is the only register known
+// to hold anything (zero)
+void ram_profile_paint( void )
+{
+    asm volatile (  "ldi r30, lo8(__heap_start)     \n\t"
+                    "ldi r31, hi8(__heap_start)     \n\t"
+                    "ldi r24, %[paint]              \n\t"
+                    "in r26, __SP_L__               \n\t"
+                    "in r27, __SP_H__               \n\t"
+                    "1:                             \n\t"
+                    "cp r30, r26                    \n\t"
+                    "cpc r31, r27                   \n\t"
+                    "brsh 2f                        \n\t"
+                    "st z+, r24                     \n\t"
+                    "rjmp 1b                        \n\t"
+                    "2:                             \n\t"
+                    :: [paint] "M" ( RAM_PROFILE_PAINT ) );
+}
+
+static uint8_t *heap_end( void )
+{
+    return __brkval ? (uint8_t *)__brkval : &__heap_start;
+}
+
+void ram_profile_get( ram_profile_t *profile )
+{
+    uint8_t *bottom = heap_end();
+    uint8_t *p = bottom;
+    uint16_t sp = SP;
+
+    while ( ( p <= (uint8_t *)RAMEND ) && ( *p == RAM_PROFILE_PAINT ) )
+    {
+        p++;
+    }
+    low_water = p;
+
+    profile->data_start = (uint16_t)(uintptr_t)&__data_start;
+    profile->bss_start = (uint16_t)(uintptr_t)&__bss_start;
+    profile->heap_start = (uint16_t)(uintptr_t)&__heap_start;
+    profile->heap_end = (uint16_t)(uintptr_t)bottom;
+    profile->low_water = (uint16_t)(uintptr_t)low_water;
+    profile->sp = sp;
+    profile->ram_end = RAMEND;
+
+    profile->data_bytes = profile->bss_start - profile->data_start;
+    profile->bss_bytes = profile->heap_start - profile->bss_start;
+    profile->heap_bytes = profile->heap_end - profile->heap_start;
+    profile->stack_max = RAMEND - profile->low_water + 1;
+    profile->stack_now = ( sp > profile->heap_end ) ? RAMEND - sp : 0;
+    profile->headroom = profile->low_water - profile->heap_end;
+}
+
+uint16_t ram_profile_headroom( void )
+{
+    uint8_t *bottom = heap_end();
+    uint8_t *p = bottom;
+
+    if ( !low_water )
+    {
+        ram_profile_t profile;
+
+        ram_profile_get( &profile );
+        return profile.headroom;
+    }
+
+    // Up from the heap, as ram_profile_get() does, but no further than the
+    // old mark.  A walk down from the mark would stop at the first byte a
+    // deeper frame left painted (the unused end of a buffer) and miss the
+    // use below it.
+    while ( ( p < low_water ) && ( *p == RAM_PROFILE_PAINT ) )
+    {
+        p++;
+    }
+    low_water = p;
+
+    return (uint16_t)( low_water - bottom );
+}
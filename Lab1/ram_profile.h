@@ -0,0 +1,57 @@
+/* ram_profile.h
+ *
+ * SRAM layout and stack high water mark.
+ *
+ * Before main() (in .init3, once the stack pointer is set up and before
+ * .data/.bss are initialised) everything from the start of the heap up to
+ * the stack pointer is filled with RAM_PROFILE_PAINT.  The stack grows down
+ * into that gap, so the lowest byte that no longer holds the paint is the
+ * deepest the stack has been:
+ *
+ *      __data_start    .data
+ *      __bss_start     .bss
+ *      __heap_start    heap            (up to __brkval once malloc() is used)
+ *                      never touched   <- headroom
+ *      low water       deepest main / ISR stack so far
+ *      SP              current stack
+ *      RAMEND
+ *
+ * Stack bytes below the lowest one written (the unused end of the deepest
+ * frame's buffers) or that happen to hold the paint value read as unused,
+ * so the figures can be optimistic by that much.
+ */
+
+#ifndef __RAM_PROFILE_H
+#define __RAM_PROFILE_H
+
+#include <inttypes.h>
+
+#define RAM_PROFILE_PAINT 0xC5
+
+typedef struct
+{
+    uint16_t data_start;
+    uint16_t bss_start;
+    uint16_t heap_start;
+    uint16_t heap_end;              // __brkval, or heap_start without malloc()
+    uint16_t low_water;             // lowest stack address used so far
+    uint16_t sp;
+    uint16_t ram_end;
+
+    uint16_t data_bytes;
+    uint16_t bss_bytes;
+    uint16_t heap_bytes;
+    uint16_t stack_max;             // deepest stack use, bytes
+    uint16_t stack_now;             // 0 when SP is not above the heap
+    uint16_t headroom;              // heap_end up to low_water, never used
+} ram_profile_t;
+
+// Full scan for the low water mark plus the layout
+void ram_profile_get( ram_profile_t *profile );
+
+// Bytes between the heap and the deepest stack use.  Cheaper than
+// ram_profile_get() for a periodic check: the scan stops at the last low
+// water mark instead of running on to RAMEND.
+uint16_t ram_profile_headroom( void );
+
+#endif //__RAM_PROFILE_H
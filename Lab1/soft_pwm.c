@@ -0,0 +1,528 @@
+/* soft_pwm.c
+ *
+ * Software PWM / blink engine on Timer3, see soft_pwm.h
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "soft_pwm.h"
+#include "timer_1284p.h"
+
+// edge_index value while the next event is the period boundary
+#define SOFT_PWM_BOUNDARY 0xFF
+
+typedef struct
+{
+    uint16_t time;                  // ticks after the boundary
+    uint8_t port;                   // port slot
+    uint8_t mask;
+} soft_pwm_edge_t;
+
+// Everything the interrupt needs for one period
+typedef struct
+{
+    uint16_t period;
+
+    uint8_t ports;
+    volatile uint8_t *port[SOFT_PWM_PORTS];
+    uint8_t all_mask[SOFT_PWM_PORTS];       // every channel on the port
+    uint8_t lit_mask[SOFT_PWM_PORTS];       // channels with a level above 0
+
+    uint8_t edge_count;
+    soft_pwm_edge_t edge[SOFT_PWM_CHANNELS];
+
+    uint8_t blinkers;
+    uint8_t blinker[SOFT_PWM_CHANNELS];     // channel numbers
+    uint8_t channel_port[SOFT_PWM_CHANNELS];
+    uint8_t channel_mask[SOFT_PWM_CHANNELS];
+    uint16_t blink_on[SOFT_PWM_CHANNELS];
+    uint16_t blink_total[SOFT_PWM_CHANNELS];
+} soft_pwm_frame_t;
+
+// Shadow settings, main context only
+typedef struct
+{
+    volatile uint8_t *port;
+    uint8_t mask;
+    uint8_t level;
+    uint16_t blink_on;
+    uint16_t blink_off;
+    unsigned char used;
+} soft_pwm_channel_t;
+
+static soft_pwm_channel_t channels[SOFT_PWM_CHANNELS];
+static uint16_t shadow_period;
+
+static soft_pwm_frame_t frames[2];
+static volatile uint8_t active;
+static volatile unsigned char pending;
+
+// Interrupt state
+static uint16_t period_start;
+static uint8_t edge_index;
+static uint16_t blink_phase[SOFT_PWM_CHANNELS];
+static uint8_t blink_dark[SOFT_PWM_CHANNELS];
+static volatile uint16_t toggles[SOFT_PWM_CHANNELS];
+static soft_pwm_stats_t stats;
+
+void soft_pwm_init( uint16_t period_ticks )
+{
+    memset( channels, 0, sizeof(channels) );
+    memset( frames, 0, sizeof(frames) );
+    memset( blink_phase, 0, sizeof(blink_phase) );
+    memset( blink_dark, 0, sizeof(blink_dark) );
+    memset( (void *)toggles, 0, sizeof(toggles) );
+    memset( &stats, 0, sizeof(stats) );
+
+    shadow_period = period_ticks;
+    frames[0].period = period_ticks;
+    active = 0;
+    pending = 0;
+
+    // Free running, OCR3A moves along with the events
+    timer_1284p_set_COM( TIMER_1284P_3, TIMER_1284P_A, TIMER_1284P_COM_NO_COMPARE );
+    timer_1284p_set_COM( TIMER_1284P_3, TIMER_1284P_B, TIMER_1284P_COM_NO_COMPARE );
+    timer_1284p_set_WGM( TIMER_1284P_3, TIMER_1284P_WGM_NORMAL );
+    timer_1284p_clr_counter( TIMER_1284P_3 );
+
+    period_start = 0;
+    edge_index = SOFT_PWM_BOUNDARY;
+    OCR3A = period_ticks;
+
+    timer_1284p_clr_IE( TIMER_1284P_3, TIMER_1284P_IE_B );
+    timer_1284p_clr_IE( TIMER_1284P_3, TIMER_1284P_IE_OVERFLOW );
+    timer_1284p_set_IE( TIMER_1284P_3, TIMER_1284P_IE_A );
+
+    timer_1284p_set_CS( TIMER_1284P_3, TIMER_1284P_CS_PRESCALE_DIV8 );
+}
+
+static uint8_t ports_in_use( volatile uint8_t *extra )
+{
+    volatile uint8_t *seen[SOFT_PWM_PORTS + 1];
+    uint8_t count = 0;
+    uint8_t i, j;
+
+    for ( i = 0; i <= SOFT_PWM_CHANNELS; i++ )
+    {
+        volatile uint8_t *port;
+
+        if ( i < SOFT_PWM_CHANNELS )
+        {
+            if ( !channels[i].used )
+            {
+                continue;
+            }
+            port = channels[i].port;
+        }
+        else
+        {
+            port = extra;
+        }
+
+        for ( j = 0; ( j < count ) && ( seen[j] != port ); j++ );
+
+        if ( j == count )
+        {
+            if ( count > SOFT_PWM_PORTS )
+            {
+                break;
+            }
+            seen[count++] = port;
+        }
+    }
+
+    return count;
+}
+
+signed char soft_pwm_add( volatile uint8_t *port, uint8_t mask )
+{
+    uint8_t i;
+
+    if ( ports_in_use( port ) > SOFT_PWM_PORTS )
+    {
+        return -1;
+    }
+
+    for ( i = 0; i < SOFT_PWM_CHANNELS; i++ )
+    {
+        if ( !channels[i].used )
+        {
+            memset( &channels[i], 0, sizeof(channels[i]) );
+            channels[i].port = port;
+            channels[i].mask = mask;
+            channels[i].used = 1;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void soft_pwm_remove( uint8_t channel )
+{
+    if ( channel < SOFT_PWM_CHANNELS )
+    {
+        channels[channel].used = 0;
+    }
+}
+
+void soft_pwm_set_level( uint8_t channel, uint8_t level )
+{
+    if ( channel < SOFT_PWM_CHANNELS )
+    {
+        channels[channel].level = level;
+    }
+}
+
+void soft_pwm_set_blink( uint8_t channel, uint16_t on_periods, uint16_t off_periods )
+{
+    if ( channel < SOFT_PWM_CHANNELS )
+    {
+        channels[channel].blink_on = on_periods;
+        channels[channel].blink_off = off_periods;
+    }
+}
+
+void soft_pwm_set_period( uint16_t period_ticks )
+{
+    shadow_period = period_ticks;
+}
+
+uint16_t soft_pwm_get_period( void )
+{
+    return shadow_period;
+}
+
+static uint8_t port_slot( soft_pwm_frame_t *frame, volatile uint8_t *port )
+{
+    uint8_t slot;
+
+    for ( slot = 0; slot < frame->ports; slot++ )
+    {
+        if ( frame->port[slot] == port )
+        {
+            return slot;
+        }
+    }
+
+    // soft_pwm_add() keeps the number of ports within SOFT_PWM_PORTS
+    frame->port[slot] = port;
+    frame->ports++;
+
+    return slot;
+}
+
+// Fill 'frame' from the shadow settings: port masks, blinkers, and the edges
+// sorted by time with same time, same port edges merged
+static void build_frame( soft_pwm_frame_t *frame )
+{
+    soft_pwm_channel_t *channel;
+    soft_pwm_edge_t edge;
+    uint16_t duty;
+    uint8_t i, j, slot;
+
+    memset( frame, 0, sizeof(*frame) );
+    frame->period = shadow_period;
+
+    for ( i = 0; i < SOFT_PWM_CHANNELS; i++ )
+    {
+        channel = &channels[i];
+
+        if ( !channel->used )
+        {
+            continue;
+        }
+
+        slot = port_slot( frame, channel->port );
+        frame->all_mask[slot] |= channel->mask;
+        frame->channel_port[i] = slot;
+        frame->channel_mask[i] = channel->mask;
+
+        if ( channel->blink_on || channel->blink_off )
+        {
+            frame->blinker[frame->blinkers++] = i;
+            frame->blink_on[i] = channel->blink_on;
+            frame->blink_total[i] = channel->blink_on + channel->blink_off;
+        }
+
+        if ( channel->level == SOFT_PWM_LEVEL_OFF )
+        {
+            continue;
+        }
+
+        frame->lit_mask[slot] |= channel->mask;
+
+        duty = (uint16_t)( (uint32_t)frame->period * channel->level / SOFT_PWM_LEVEL_ON );
+
+        // Fully on, or too short to show, has no edge
+        if ( ( channel->level == SOFT_PWM_LEVEL_ON ) || ( duty >= frame->period ) )
+        {
+            continue;
+        }
+        if ( duty == 0 )
+        {
+            duty = 1;
+        }
+
+        // Insertion sort, merging with an equal edge on the same port
+        edge.time = duty;
+        edge.port = slot;
+        edge.mask = channel->mask;
+
+        for ( j = 0; j < frame->edge_count; j++ )
+        {
+            if ( ( frame->edge[j].time == edge.time ) && ( frame->edge[j].port == edge.port ) )
+            {
+                frame->edge[j].mask |= edge.mask;
+                break;
+            }
+        }
+
+        if ( j < frame->edge_count )
+        {
+            continue;
+        }
+
+        for ( j = frame->edge_count; ( j > 0 ) && ( frame->edge[j - 1].time > edge.time ); j-- )
+        {
+            frame->edge[j] = frame->edge[j - 1];
+        }
+
+        frame->edge[j] = edge;
+        frame->edge_count++;
+    }
+}
+
+void soft_pwm_commit( void )
+{
+    char cSREG;
+    uint8_t spare;
+
+    // Withdraw any commit not picked up yet, after that the interrupt does
+    // not touch the spare frame
+    cSREG = SREG;
+    cli();
+    pending = 0;
+    spare = active ^ 1;
+    SREG = cSREG;
+
+    build_frame( &frames[spare] );
+
+    cSREG = SREG;
+    cli();
+    pending = 1;
+    SREG = cSREG;
+}
+
+uint16_t soft_pwm_get_toggles( uint8_t channel )
+{
+    char cSREG;
+    uint16_t count = 0;
+
+    if ( channel < SOFT_PWM_CHANNELS )
+    {
+        cSREG = SREG;
+        cli();
+        count = toggles[channel];
+        SREG = cSREG;
+    }
+
+    return count;
+}
+
+void soft_pwm_clr_toggles( uint8_t channel )
+{
+    char cSREG;
+
+    if ( channel < SOFT_PWM_CHANNELS )
+    {
+        cSREG = SREG;
+        cli();
+        toggles[channel] = 0;
+        SREG = cSREG;
+    }
+}
+
+void soft_pwm_get_stats( soft_pwm_stats_t *copy )
+{
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+    *copy = stats;
+    SREG = cSREG;
+}
+
+void soft_pwm_clr_stats( void )
+{
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+    memset( &stats, 0, sizeof(stats) );
+    SREG = cSREG;
+}
+
+unsigned int soft_pwm_max_channels( unsigned int hz, uint8_t cpu_percent )
+{
+    soft_pwm_stats_t measured;
+    uint32_t budget, boundary_cycles, edge_cycles;
+
+    soft_pwm_get_stats( &measured );
+
+    if ( !measured.edges || !measured.boundaries || !hz )
+    {
+        return 0;
+    }
+
+    // An edge that gets its own interrupt also pays for the vector
+    edge_cycles = ( measured.edge_ticks * SOFT_PWM_PRESCALER + measured.edge_isrs * SOFT_PWM_ISR_ENTRY_CYCLES ) / measured.edges;
+    boundary_cycles = measured.boundary_ticks * SOFT_PWM_PRESCALER / measured.boundaries + SOFT_PWM_ISR_ENTRY_CYCLES;
+
+    budget = SOFT_PWM_CPU_FREQ / hz * cpu_percent / 100;
+
+    if ( ( budget <= boundary_cycles ) || ( edge_cycles == 0 ) )
+    {
+        return 0;
+    }
+
+    return ( budget - boundary_cycles ) / edge_cycles;
+}
+
+// Start of a period: pick up a new frame, step the blinkers and switch the
+// lit channels on
+static void period_boundary( void )
+{
+    soft_pwm_frame_t *frame;
+    uint8_t lit[SOFT_PWM_PORTS];
+    uint8_t i, channel, slot;
+    uint16_t phase;
+    uint8_t dark;
+
+    period_start += frames[active].period;
+
+    if ( pending )
+    {
+        active ^= 1;
+        pending = 0;
+    }
+
+    frame = &frames[active];
+
+    for ( slot = 0; slot < frame->ports; slot++ )
+    {
+        lit[slot] = frame->lit_mask[slot];
+    }
+
+    for ( i = 0; i < frame->blinkers; i++ )
+    {
+        channel = frame->blinker[i];
+
+        phase = blink_phase[channel] + 1;
+        if ( phase >= frame->blink_total[channel] )
+        {
+            phase = 0;
+        }
+        blink_phase[channel] = phase;
+
+        dark = ( phase >= frame->blink_on[channel] );
+        if ( dark != blink_dark[channel] )
+        {
+            blink_dark[channel] = dark;
+            toggles[channel]++;
+        }
+
+        if ( dark )
+        {
+            lit[frame->channel_port[channel]] &= ~frame->channel_mask[channel];
+        }
+    }
+
+    for ( slot = 0; slot < frame->ports; slot++ )
+    {
+        *frame->port[slot] = ( *frame->port[slot] & ~frame->all_mask[slot] ) | lit[slot];
+    }
+
+    edge_index = frame->edge_count ? 0 : SOFT_PWM_BOUNDARY;
+}
+
+ISR(TIMER3_COMPA_vect)
+{
+    soft_pwm_frame_t *frame;
+    soft_pwm_edge_t *edge;
+    uint16_t entry, due, ticks;
+    uint8_t events = 0;
+    unsigned char boundary = 0;
+
+    entry = TCNT3;
+
+    // Handle the event that is due, then any that follow too closely
+    do
+    {
+        if ( edge_index == SOFT_PWM_BOUNDARY )
+        {
+            period_boundary();
+            boundary = 1;
+        }
+        else
+        {
+            frame = &frames[active];
+            edge = &frame->edge[edge_index];
+            *frame->port[edge->port] &= ~edge->mask;
+
+            edge_index++;
+            if ( edge_index >= frame->edge_count )
+            {
+                edge_index = SOFT_PWM_BOUNDARY;
+            }
+            events++;
+        }
+
+        frame = &frames[active];
+        if ( edge_index == SOFT_PWM_BOUNDARY )
+        {
+            due = period_start + frame->period;
+        }
+        else
+        {
+            due = period_start + frame->edge[edge_index].time;
+        }
+
+        if ( (int16_t)( due - TCNT3 ) < SOFT_PWM_MIN_LEAD_TICKS )
+        {
+            stats.late++;
+        }
+        else
+        {
+            break;
+        }
+    } while ( 1 );
+
+    OCR3A = due;
+
+    ticks = TCNT3 - entry;
+
+    if ( boundary )
+    {
+        stats.boundaries++;
+        stats.boundary_ticks += ticks;
+        if ( ticks > stats.boundary_ticks_max )
+        {
+            stats.boundary_ticks_max = ticks;
+        }
+    }
+    else
+    {
+        stats.edge_isrs++;
+        stats.edges += events;
+        stats.edge_ticks += ticks;
+        if ( ticks > stats.edge_ticks_max )
+        {
+            stats.edge_ticks_max = ticks;
+        }
+    }
+}
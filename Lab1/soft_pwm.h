@@ -0,0 +1,107 @@
+/* soft_pwm.h
+ *
+ * Software PWM / blink engine for many LEDs on one timer.
+ *
+ * Timer3 free runs at CPU/8 (0.4 us per tick) and only its compare A
+ * interrupt is used.  Instead of ticking at a fixed rate, the interrupt
+ * handles one event and programs OCR3A for the next one:
+ *
+ *      boundary   start of a PWM period: every lit channel is switched on
+ *      edge       a channel's duty is up: switch it off
+ *
+ * Edges are kept sorted by time, with channels on the same port that switch
+ * off together merged into one edge, so a period costs one interrupt per
+ * distinct duty plus one for the boundary no matter how fine the duty
+ * resolution is.  Events closer together than SOFT_PWM_MIN_LEAD_TICKS are
+ * handled in the same interrupt.
+ *
+ * Blinking is done in whole PWM periods at the boundary: a blinking channel
+ * stays lit for 'on' periods and dark for 'off' periods.
+ *
+ * The soft_pwm_set_*() calls only change a shadow copy.  soft_pwm_commit()
+ * sorts the edges into the spare of two frames and hands it to the interrupt,
+ * which swaps frames at the next boundary, so a period never mixes old and
+ * new settings.  A commit that has not been picked up yet is replaced by the
+ * next one.
+ *
+ * The interrupt times itself with TCNT3 (8 cycle resolution, the vector
+ * prologue/epilogue is not included), see soft_pwm_get_stats().
+ */
+
+#ifndef __SOFT_PWM_H
+#define __SOFT_PWM_H
+
+#include <inttypes.h>
+
+#define SOFT_PWM_CPU_FREQ       20000000UL
+#define SOFT_PWM_PRESCALER      8
+#define SOFT_PWM_TICKS_PER_S    ( SOFT_PWM_CPU_FREQ / SOFT_PWM_PRESCALER )
+#define SOFT_PWM_HZ_TO_TICKS(hz) ( (uint16_t)( SOFT_PWM_TICKS_PER_S / (hz) ) )
+
+// Periods longer than 26 ms (slower than ~40 Hz) do not fit in 16 bits
+#define SOFT_PWM_MIN_HZ         ( SOFT_PWM_TICKS_PER_S / 0xFFFF + 1 )
+
+#define SOFT_PWM_CHANNELS       16
+#define SOFT_PWM_PORTS          4       // distinct PORTx registers
+
+// An event due sooner than this after the previous one is handled in the
+// same interrupt rather than risking a compare value that is already past
+#define SOFT_PWM_MIN_LEAD_TICKS 8
+
+// Cycles for the interrupt vector itself (register saves and reti), which
+// the TCNT3 timing cannot see.  From the generated code, used only for
+// soft_pwm_max_channels().
+#define SOFT_PWM_ISR_ENTRY_CYCLES 40
+
+#define SOFT_PWM_LEVEL_OFF      0
+#define SOFT_PWM_LEVEL_ON       255
+
+typedef struct
+{
+    uint32_t edge_isrs;             // interrupts with only edges in them
+    uint32_t edges;                 // edges handled by those interrupts
+    uint32_t edge_ticks;            // Timer3 ticks spent in them
+    uint16_t edge_ticks_max;
+    uint32_t boundaries;            // interrupts that started a period
+    uint32_t boundary_ticks;
+    uint16_t boundary_ticks_max;
+    uint16_t late;                  // events handled back to back
+} soft_pwm_stats_t;
+
+// Take over Timer3 with no channels and the given period (Timer3 ticks, see
+// SOFT_PWM_HZ_TO_TICKS).  Call with interrupts disabled.
+void soft_pwm_init( uint16_t period_ticks );
+
+// Add a channel driving 'mask' on the PORTx register 'port' (the pin must
+// already be an output).  It starts off with no blinking.  Returns the
+// channel number, or -1 if all channels, or all port slots, are in use.
+signed char soft_pwm_add( volatile uint8_t *port, uint8_t mask );
+
+// Stop driving the channel; the pin keeps whatever state it was last in
+void soft_pwm_remove( uint8_t channel );
+
+// 0 is off, 255 is on all period
+void soft_pwm_set_level( uint8_t channel, uint8_t level );
+
+// Lit for 'on_periods', dark for 'off_periods'.  0, 0 stops blinking.
+void soft_pwm_set_blink( uint8_t channel, uint16_t on_periods, uint16_t off_periods );
+
+void soft_pwm_set_period( uint16_t period_ticks );
+uint16_t soft_pwm_get_period( void );
+
+// Publish the shadow settings, taking effect at the next period boundary
+void soft_pwm_commit( void );
+
+// Blink transitions (lit <-> dark) since the count was last cleared
+uint16_t soft_pwm_get_toggles( uint8_t channel );
+void soft_pwm_clr_toggles( uint8_t channel );
+
+void soft_pwm_get_stats( soft_pwm_stats_t *stats );
+void soft_pwm_clr_stats( void );
+
+// Channels, each with its own duty, that fit in 'cpu_percent' of the CPU at
+// a PWM rate of 'hz', from the measured cost per edge and per boundary.
+// Returns 0 until both have been measured.
+unsigned int soft_pwm_max_channels( unsigned int hz, uint8_t cpu_percent );
+
+#endif //__SOFT_PWM_H
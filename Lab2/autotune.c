@@ -0,0 +1,210 @@
+/* autotune.c
+ *
+ * Relay feedback auto-tuning, see autotune.h
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <math.h>
+
+#include "autotune.h"
+#include "controller.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static autotune_result_t result;
+static unsigned char result_changes;
+
+static int center;
+static signed char relay_output;
+static float calc_period;
+static float velocity_window;
+static unsigned int calcs;
+static unsigned int last_rising_calc;
+static int cycle_min, cycle_max;
+static unsigned int period_sum;
+static unsigned int amplitude_sum_x2;
+static int measured;
+
+static void autotune_fail( AUTOTUNE_FAIL_E fail )
+{
+    result.state = AUTOTUNE_FAILED;
+    result.fail = fail;
+    result_changes++;
+}
+
+static void autotune_finish( void )
+{
+    float a, a2, h2, Td;
+
+    // amplitude_sum_x2 holds (max - min) per cycle, i.e. 2a
+    a = (float)amplitude_sum_x2 / 2.0f / measured;
+    a2 = a * a;
+    h2 = (float)AUTOTUNE_HYSTERESIS_COUNTS * AUTOTUNE_HYSTERESIS_COUNTS;
+
+    result.amplitude_counts = a;
+    result.Tu_s = (float)period_sum / measured * calc_period;
+
+    if ( a2 <= h2 )
+    {
+        autotune_fail( AUTOTUNE_FAIL_NO_OSCILLATION );
+        return;
+    }
+
+    result.Ku = 4.0f * AUTOTUNE_RELAY_TORQUE / ( (float)M_PI * sqrtf( a2 - h2 ) );
+
+    switch ( result.rule )
+    {
+        case AUTOTUNE_RULE_SOME_OVERSHOOT:
+            result.Kp = 0.33f * result.Ku;
+            Td = result.Tu_s / 3.0f;
+            break;
+        case AUTOTUNE_RULE_NO_OVERSHOOT:
+            result.Kp = 0.2f * result.Ku;
+            Td = result.Tu_s / 3.0f;
+            break;
+        case AUTOTUNE_RULE_ZN_PD:
+        default:
+            result.Kp = 0.8f * result.Ku;
+            Td = result.Tu_s / 8.0f;
+            break;
+    }
+
+    // D term is Kp * Td * dPe/dt = -Kp * Td * Vm / velocity_window
+    result.Kd = result.Kp * Td / velocity_window;
+
+    result.state = AUTOTUNE_DONE;
+    result_changes++;
+}
+
+void autotune_start( int center_counts, AUTOTUNE_RULE_E rule, float calc_period_s, float velocity_window_s )
+{
+    center = center_counts;
+    relay_output = 1;
+    calc_period = calc_period_s;
+    velocity_window = velocity_window_s;
+    calcs = 0;
+    last_rising_calc = 0;
+    cycle_min = cycle_max = center_counts;
+    period_sum = 0;
+    amplitude_sum_x2 = 0;
+    measured = 0;
+
+    result.state = AUTOTUNE_RUNNING;
+    result.fail = AUTOTUNE_FAIL_NONE;
+    result.rule = ( rule < AUTOTUNE_RULE_NUM ) ? rule : AUTOTUNE_RULE_ZN_PD;
+    result.cycles = 0;
+    result.amplitude_counts = 0.0f;
+    result.Tu_s = 0.0f;
+    result.Ku = 0.0f;
+    result.Kp = 0.0f;
+    result.Kd = 0.0f;
+    result_changes++;
+}
+
+void autotune_abort( void )
+{
+    if ( result.state == AUTOTUNE_RUNNING )
+    {
+        autotune_fail( AUTOTUNE_FAIL_ABORTED );
+    }
+}
+
+int autotune_step( int position_counts )
+{
+    int error;
+
+    if ( result.state != AUTOTUNE_RUNNING )
+    {
+        return 0;
+    }
+
+    calcs++;
+    error = center - position_counts;
+
+    if ( ( error > POSITION_ERROR_COUNT_MAX ) || ( error < -POSITION_ERROR_COUNT_MAX ) )
+    {
+        autotune_fail( AUTOTUNE_FAIL_POSITION_LIMIT );
+        return 0;
+    }
+
+    if ( calcs > AUTOTUNE_TIMEOUT_CALCS )
+    {
+        autotune_fail( AUTOTUNE_FAIL_TIMEOUT );
+        return 0;
+    }
+
+    if ( position_counts > cycle_max )
+    {
+        cycle_max = position_counts;
+    }
+    if ( position_counts < cycle_min )
+    {
+        cycle_min = position_counts;
+    }
+
+    if ( ( error < -AUTOTUNE_HYSTERESIS_COUNTS ) && ( relay_output > 0 ) )
+    {
+        relay_output = -1;
+    }
+    else if ( ( error > AUTOTUNE_HYSTERESIS_COUNTS ) && ( relay_output < 0 ) )
+    {
+        // Rising switch, one full oscillation since the last one
+        relay_output = 1;
+
+        if ( last_rising_calc != 0 )
+        {
+            result.cycles++;
+            result.amplitude_counts = ( cycle_max - cycle_min ) / 2.0f;
+            result.Tu_s = ( calcs - last_rising_calc ) * calc_period;
+
+            if ( result.cycles > AUTOTUNE_SETTLE_CYCLES )
+            {
+                period_sum += calcs - last_rising_calc;
+                amplitude_sum_x2 += cycle_max - cycle_min;
+                measured++;
+            }
+
+            result_changes++;
+        }
+
+        last_rising_calc = calcs;
+        cycle_min = cycle_max = position_counts;
+
+        if ( measured >= AUTOTUNE_MEASURE_CYCLES )
+        {
+            autotune_finish();
+            return 0;
+        }
+    }
+
+    return relay_output * AUTOTUNE_RELAY_TORQUE;
+}
+
+AUTOTUNE_STATE_E autotune_get_state( void )
+{
+    return result.state;
+}
+
+int autotune_get_center( void )
+{
+    return center;
+}
+
+unsigned char autotune_get_result( autotune_result_t *copy )
+{
+    unsigned char changes;
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    *copy = result;
+    changes = result_changes;
+
+    SREG = cSREG;
+
+    return changes;
+}
@@ -0,0 +1,94 @@
+/* autotune.h
+ *
+ * Relay feedback (bang-bang) auto-tuning of the Lab2 PD gains.
+ *
+ * While running, the relay replaces the PD law in calculate(): it drives the
+ * motor at +relay torque while the position is below the starting point and
+ * -relay torque while above it (with a small hysteresis).  The loop settles
+ * into a limit cycle whose period is the ultimate period Tu, and whose
+ * amplitude a gives the ultimate gain
+ *
+ *      Ku = 4 * relay / ( pi * sqrt( a^2 - hysteresis^2 ) )     [torque / count]
+ *
+ * Kp and Kd are then taken from Ku and Tu with the selected rule.  The gains
+ * are in the units calculate() uses: T = Kp * Pe - Kd * Vm, so a damping Kd
+ * comes out positive.
+ *
+ * The module does not touch the controller state itself; it is stepped from
+ * calculate() with the measured position and returns the torque to apply.
+ */
+
+#ifndef __AUTOTUNE_H
+#define __AUTOTUNE_H
+
+// Relay torque, kept inside the MOTOR_SPEED_MAX clamp in calculate()
+#define AUTOTUNE_RELAY_TORQUE           60
+
+// Hysteresis around the starting position (counts) so encoder jitter does
+// not chatter the relay
+#define AUTOTUNE_HYSTERESIS_COUNTS      1
+
+// Oscillation cycles to let settle before measuring, then cycles to average
+#define AUTOTUNE_SETTLE_CYCLES          2
+#define AUTOTUNE_MEASURE_CYCLES         4
+
+// Give up if no limit cycle was measured in this many calculate() calls
+#define AUTOTUNE_TIMEOUT_CALCS          300
+
+typedef enum
+{
+    AUTOTUNE_RULE_ZN_PD,            // Ziegler-Nichols PD:  Kp = 0.8 Ku,  Td = Tu / 8
+    AUTOTUNE_RULE_SOME_OVERSHOOT,   //                      Kp = 0.33 Ku, Td = Tu / 3
+    AUTOTUNE_RULE_NO_OVERSHOOT,     //                      Kp = 0.2 Ku,  Td = Tu / 3
+    AUTOTUNE_RULE_NUM
+} AUTOTUNE_RULE_E;
+
+typedef enum
+{
+    AUTOTUNE_IDLE,
+    AUTOTUNE_RUNNING,
+    AUTOTUNE_DONE,
+    AUTOTUNE_FAILED
+} AUTOTUNE_STATE_E;
+
+typedef enum
+{
+    AUTOTUNE_FAIL_NONE,
+    AUTOTUNE_FAIL_POSITION_LIMIT,   // swung further than POSITION_ERROR_COUNT_MAX
+    AUTOTUNE_FAIL_TIMEOUT,
+    AUTOTUNE_FAIL_NO_OSCILLATION,   // amplitude not above the hysteresis
+    AUTOTUNE_FAIL_ABORTED
+} AUTOTUNE_FAIL_E;
+
+typedef struct
+{
+    AUTOTUNE_STATE_E state;
+    AUTOTUNE_FAIL_E fail;
+    AUTOTUNE_RULE_E rule;
+    int cycles;                     // completed oscillation cycles
+    float amplitude_counts;         // a, averaged over the measured cycles
+    float Tu_s;
+    float Ku;
+    float Kp;
+    float Kd;
+} autotune_result_t;
+
+// Start an experiment around 'center_counts'.  'calc_period_s' is the time
+// between autotune_step() calls and 'velocity_window_s' the span Vm is
+// measured over in calculate().
+void autotune_start( int center_counts, AUTOTUNE_RULE_E rule, float calc_period_s, float velocity_window_s );
+
+// Stop a running experiment (state becomes AUTOTUNE_FAILED / ABORTED)
+void autotune_abort( void );
+
+// One control cycle.  Returns the torque to apply.
+int autotune_step( int position_counts );
+
+AUTOTUNE_STATE_E autotune_get_state( void );
+int autotune_get_center( void );
+
+// Copy of the progress/result, with a change counter so the main loop can
+// report each new cycle once.  Returns the counter.
+unsigned char autotune_get_result( autotune_result_t *result );
+
+#endif //__AUTOTUNE_H
@@ -0,0 +1,273 @@
+/* capture.c
+ *
+ * Triggered capture of the controller signals, see capture.h
+ */
+
+#include <pololu/orangutan.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "capture.h"
+#include "controller.h"
+#include "menu.h"
+#include "ring.h"
+#include "telemetry.h"
+
+#define LINE_SIZE 64
+
+RING_DECLARE( capture_ring, capture_record_t, CAPTURE_RECORDS )
+
+static const char *trigger_names[CAPTURE_TRIGGER_NUM] = { "manual", "reference", "error" };
+static const char *state_names[] = { "idle", "armed", "triggered", "done" };
+
+// Settings, latched by capture_arm()
+static uint8_t pre_setting;
+static uint8_t post_setting;
+static int threshold;
+
+// Shared with capture_sample() in the timer ISR / control task
+static capture_ring_t ring;             // newest CAPTURE_RECORDS samples
+static volatile uint8_t state;
+static volatile uint8_t manual;
+static volatile uint8_t dump_pending;
+static uint8_t trigger;
+static uint8_t pre;
+static uint8_t post;
+static uint8_t post_left;
+static capture_ring_index_t trigger_index;  // running index of the triggering sample
+static uint8_t pre_have;                // samples held before it
+static int last_Pr;
+static uint8_t have_last_Pr;
+
+// Dump progress, main loop only
+static uint8_t dumping;
+static int dump_next;                   // next line, -pre_have - 1 is the header
+
+void capture_init( void )
+{
+    pre_setting = CAPTURE_DEFAULT_PRE;
+    post_setting = CAPTURE_DEFAULT_POST;
+    threshold = CAPTURE_DEFAULT_THRESHOLD;
+    state = CAPTURE_IDLE;
+    manual = 0;
+    dump_pending = 0;
+    dumping = 0;
+    capture_ring_init( &ring );
+    pre_have = 0;
+    post = 0;
+}
+
+void capture_set_pre( uint8_t samples )
+{
+    pre_setting = samples;
+}
+
+void capture_set_post( uint8_t samples )
+{
+    post_setting = samples;
+}
+
+void capture_set_threshold( int counts )
+{
+    char cSREG;
+
+    // Two bytes, read by capture_sample() in the timer ISR
+    cSREG = SREG;
+    cli();
+    threshold = counts;
+    SREG = cSREG;
+}
+
+void capture_arm( CAPTURE_TRIGGER_E new_trigger )
+{
+    char cSREG;
+    uint8_t new_post;
+    uint8_t new_pre;
+
+    new_post = post_setting;
+    if ( new_post < 1 )
+    {
+        new_post = 1;
+    }
+    if ( new_post > CAPTURE_RECORDS )
+    {
+        new_post = CAPTURE_RECORDS;
+    }
+
+    new_pre = pre_setting;
+    if ( new_pre > CAPTURE_RECORDS - new_post )
+    {
+        new_pre = CAPTURE_RECORDS - new_post;
+    }
+
+    cSREG = SREG;
+    cli();
+
+    trigger = ( new_trigger < CAPTURE_TRIGGER_NUM ) ? new_trigger : CAPTURE_TRIGGER_MANUAL;
+    pre = new_pre;
+    post = new_post;
+    capture_ring_init( &ring );
+    pre_have = 0;
+    manual = 0;
+    have_last_Pr = 0;
+    dump_pending = 0;
+    state = CAPTURE_ARMED;
+
+    SREG = cSREG;
+
+    dumping = 0;
+}
+
+void capture_trigger( void )
+{
+    manual = 1;
+}
+
+void capture_stop( void )
+{
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    if ( ( state == CAPTURE_ARMED ) || ( state == CAPTURE_TRIGGERED ) )
+    {
+        state = CAPTURE_IDLE;
+    }
+
+    SREG = cSREG;
+}
+
+CAPTURE_STATE_E capture_get_state( void )
+{
+    return (CAPTURE_STATE_E)state;
+}
+
+void capture_sample( int Pr, int Pe, int Pm, int Vm, int T )
+{
+    capture_record_t *record;
+    uint8_t fire;
+
+    if ( state == CAPTURE_ARMED )
+    {
+        fire = manual;
+        if ( ( trigger == CAPTURE_TRIGGER_REFERENCE ) && have_last_Pr && ( Pr != last_Pr ) )
+        {
+            fire = 1;
+        }
+        if ( ( trigger == CAPTURE_TRIGGER_ERROR ) && ( abs( Pe ) > threshold ) )
+        {
+            fire = 1;
+        }
+        last_Pr = Pr;
+        have_last_Pr = 1;
+
+        if ( fire )
+        {
+            trigger_index = ring.head;
+            pre_have = ( capture_ring_count( &ring ) < pre ) ? capture_ring_count( &ring ) : pre;
+            post_left = post;
+            state = CAPTURE_TRIGGERED;
+        }
+    }
+    else if ( state != CAPTURE_TRIGGERED )
+    {
+        return;
+    }
+
+    record = capture_ring_overwrite( &ring );
+    record->Pe = Pe;
+    record->Pm = Pm;
+    record->Vm = Vm;
+    record->T = T;
+
+    if ( ( state == CAPTURE_TRIGGERED ) && ( --post_left == 0 ) )
+    {
+        state = CAPTURE_DONE;
+        dump_pending = 1;
+    }
+}
+
+void capture_poll( void )
+{
+    char line[LINE_SIZE];
+    const capture_record_t *record;
+    uint8_t lines;
+    int length;
+
+    if ( dump_pending )
+    {
+        dump_pending = 0;
+        dumping = 1;
+        dump_next = -(int)pre_have - 1;
+    }
+
+    for ( lines = 0; dumping && ( lines < CAPTURE_LINES_PER_PASS ); lines++ )
+    {
+        if ( dump_next < -(int)pre_have )
+        {
+            length = snprintf( line, LINE_SIZE, "d,capture %s pre %u post %u every %d ms\r\n",
+                               trigger_names[trigger], pre_have, post, NUM_MS_PER_CALC );
+        }
+        else if ( dump_next < (int)post )
+        {
+            record = capture_ring_at( &ring, (capture_ring_index_t)( trigger_index + dump_next ) );
+            length = snprintf( line, LINE_SIZE, "c,%d,%d,%d,%d,%d\r\n",
+                               dump_next, record->Pe, record->Pm, record->Vm, record->T );
+        }
+        else
+        {
+            length = snprintf( line, LINE_SIZE, "d,capture end\r\n" );
+            dumping = 0;
+        }
+
+        telemetry_write( line, length );
+        dump_next++;
+    }
+}
+
+void capture_command( int op, int arg )
+{
+    char reply[LINE_SIZE];
+
+    switch ( op )
+    {
+        case 0:
+            if ( state == CAPTURE_DONE )
+            {
+                dump_pending = 1;
+                return;
+            }
+            break;
+        case 1:
+            capture_arm( (CAPTURE_TRIGGER_E)arg );
+            break;
+        case 2:
+            capture_trigger();
+            break;
+        case 3:
+            capture_set_pre( arg < 0 ? 0 : ( arg > CAPTURE_RECORDS ? CAPTURE_RECORDS : arg ) );
+            break;
+        case 4:
+            capture_set_post( arg < 0 ? 0 : ( arg > CAPTURE_RECORDS ? CAPTURE_RECORDS : arg ) );
+            break;
+        case 5:
+            capture_set_threshold( arg );
+            break;
+        case 6:
+            capture_stop();
+            break;
+        default:
+            print_usb( "d,capture op 0 dump 1 arm 2 trigger 3 pre 4 post 5 level 6 stop\r\n" );
+            return;
+    }
+
+    snprintf( reply, LINE_SIZE, "d,capture %s %s pre %u post %u level %d\r\n",
+              state_names[state], trigger_names[trigger], pre_setting, post_setting, threshold );
+    print_usb( reply );
+}
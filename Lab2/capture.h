@@ -0,0 +1,101 @@
+/* capture.h
+ *
+ * Triggered capture of the controller signals (oscilloscope mode).
+ *
+ * calculate() hands every control cycle's Pe, Pm, Vm and T to
+ * capture_sample(), which keeps them in a RAM ring while the capture is
+ * armed.  The ring always holds the newest 'pre' samples; when the trigger
+ * fires 'post' more are recorded (the triggering sample is the first of
+ * them) and the capture stops.  Triggers:
+ *
+ *      CAPTURE_TRIGGER_MANUAL      capture_trigger(), menu 'C,2'
+ *      CAPTURE_TRIGGER_REFERENCE   the reference Pr changes
+ *      CAPTURE_TRIGGER_ERROR       |Pe| above the threshold (counts)
+ *
+ * A manual trigger also works in the other modes.  A trigger before 'pre'
+ * samples have been seen gives a shorter pre-trigger part.
+ *
+ * A finished capture is dumped by service_serial() through telemetry.h, a
+ * few lines per pass so the control and menu keep running, in the same
+ * comma separated style as the "v," lines:
+ *
+ *      d,capture <trigger> pre <n> post <n> every <ms> ms
+ *      c,<i>,<Pe>,<Pm>,<Vm>,<T>        i from -pre to post - 1, 0 = trigger
+ *      d,capture end
+ *
+ * The ring samples every NUM_MS_PER_CALC, so CAPTURE_RECORDS covers
+ * 25.6 s at 200 ms.  Turn logging off ('L,0') to keep the link free for
+ * the dump alone.
+ */
+
+#ifndef __CAPTURE_H
+#define __CAPTURE_H
+
+#include <inttypes.h>
+
+#define CAPTURE_RECORDS             128     // power of two (ring.h), at most 128
+#define CAPTURE_DEFAULT_PRE         16
+#define CAPTURE_DEFAULT_POST        64
+#define CAPTURE_DEFAULT_THRESHOLD   32      // counts, CAPTURE_TRIGGER_ERROR
+#define CAPTURE_LINES_PER_PASS      4       // dump lines per service_serial()
+
+typedef enum
+{
+    CAPTURE_TRIGGER_MANUAL,
+    CAPTURE_TRIGGER_REFERENCE,
+    CAPTURE_TRIGGER_ERROR,
+    CAPTURE_TRIGGER_NUM
+} CAPTURE_TRIGGER_E;
+
+typedef enum
+{
+    CAPTURE_IDLE,                       // not recording
+    CAPTURE_ARMED,                      // recording, waiting for the trigger
+    CAPTURE_TRIGGERED,                  // recording the post-trigger part
+    CAPTURE_DONE                        // complete, dumped by capture_poll()
+} CAPTURE_STATE_E;
+
+typedef struct
+{
+    int16_t Pe;
+    int16_t Pm;
+    int16_t Vm;
+    int16_t T;
+} capture_record_t;
+
+void capture_init( void );
+
+// Settings take effect at the next capture_arm(); pre + post is cut to
+// CAPTURE_RECORDS
+void capture_set_pre( uint8_t samples );
+void capture_set_post( uint8_t samples );
+void capture_set_threshold( int counts );
+
+// Empty the ring and record until the trigger
+void capture_arm( CAPTURE_TRIGGER_E trigger );
+
+// Fire on the next control cycle
+void capture_trigger( void );
+
+// Stop recording, the ring keeps what it has
+void capture_stop( void );
+
+CAPTURE_STATE_E capture_get_state( void );
+
+// Control cycle, from calculate()
+void capture_sample( int Pr, int Pe, int Pm, int Vm, int T );
+
+// Send the next few lines of a finished capture, from service_serial()
+void capture_poll( void );
+
+// Menu 'C,<op>,<arg>':
+//      0   report the state; dump the last capture again
+//      1   arm with trigger <arg> (CAPTURE_TRIGGER_E)
+//      2   trigger now
+//      3   pre-trigger samples <arg>
+//      4   post-trigger samples <arg>
+//      5   |Pe| threshold <arg> counts
+//      6   stop
+void capture_command( int op, int arg );
+
+#endif //__CAPTURE_H
@@ -0,0 +1,765 @@
+/* controller.c
+ *
+ * Lab2 PD position controller, see controller.h
+ */
+
+#include <pololu/orangutan.h>
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "autotune.h"
+#include "capture.h"
+#include "controller.h"
+#include "double_buffer.h"
+#include "friction.h"
+#include "latency.h"
+#include "menu.h"
+#include "param_store.h"
+#include "pid.h"
+#include "quadrature.h"
+#include "supervisor.h"
+#include "timer_wheel.h"
+#include "telemetry.h"
+#include "telemetry_pack.h"
+#include "trace.h"
+
+// Bump when controller_params_t changes so old blocks are not loaded
+#define CONTROLLER_PARAMS_VERSION 3
+
+typedef struct
+{
+    float Kp;
+    float Kd;
+    unsigned char logging;
+    float Ki;
+    unsigned char law;
+    friction_params_t friction;
+} controller_params_t;
+
+// What calculate() works from.  The main loop changes its own copy and
+// publishes it whole (double_buffer.h); calculate() takes the latest one at
+// the start of a cycle, so it never sees half of a float written.
+typedef struct
+{
+    float Kp;
+    float Kd;
+    float Pr;                           // reference, degrees
+    uint8_t frames;                     // command frames included so far
+    float Ki;
+    uint8_t law;                        // CONTROLLER_LAW_*
+    pid_gains_t pid;                    // Kp, Kd, Ki for pid_step()
+    friction_params_t friction;
+} control_set_t;
+
+static control_set_t commanded;         // main loop
+static control_set_t active;            // calculate()
+static control_set_t control_blocks[2];
+static double_buffer_t control_buffer;
+
+static int send_outputs;
+static int Pe_int, Pm_int, Pr_int, Vm_int, T_int;
+
+static pid_state_t pid;
+static uint8_t law_running;             // law of the last cycle, CONTROLLER_LAW_NUM for auto-tune
+
+static timer_wheel_timer_t calculate_timer;
+static unsigned int v_iter;
+static unsigned int v_iter_last_pos;
+
+// -1 nothing to do, AUTOTUNE_RULE_E to start, AUTOTUNE_REQUEST_ABORT
+#define AUTOTUNE_REQUEST_ABORT -2
+
+static volatile signed char autotune_request;
+static unsigned char autotune_reported;
+static unsigned char autotune_adopted;
+
+#define FRICTION_REQUEST_START  1
+#define FRICTION_REQUEST_ABORT  2
+
+static volatile uint8_t friction_request;
+static unsigned char friction_reported;
+
+static unsigned char params_saves_reported;
+static unsigned char params_save_rejected;
+
+// Command frame hand over: the main loop publishes a frame's values and
+// sets FRAME_PENDING, calculate() sets FRAME_APPLIED when it takes a set
+// that includes them, the main loop acks it and frees it.  Each side only
+// writes the state byte when it owns it.
+#define FRAME_FREE      0
+#define FRAME_PENDING   1
+#define FRAME_APPLIED   2
+
+static volatile uint16_t cycle;
+static uint16_t frame_seq;
+static uint8_t frame_number;            // commanded.frames with the pending frame
+static volatile uint8_t frame_state;
+static uint16_t frame_cycle;            // cycle the frame took effect on
+static uint8_t frame_acked;             // a frame has been applied and acked
+
+// Replace the power up gains and logging with the saved ones, if any
+static void restore_params( void )
+{
+    controller_params_t params;
+
+    params.Kp = commanded.Kp;
+    params.Kd = commanded.Kd;
+    params.logging = send_outputs;
+    params.Ki = commanded.Ki;
+    params.law = commanded.law;
+    params.friction = commanded.friction;
+
+    param_store_load( CONTROLLER_PARAMS_VERSION, &params, sizeof(params) );
+
+    commanded.Kp = params.Kp;
+    commanded.Kd = params.Kd;
+    send_outputs = params.logging;
+    commanded.Ki = params.Ki;
+    commanded.law = ( params.law < CONTROLLER_LAW_NUM ) ? params.law : CONTROLLER_LAW_PD;
+    commanded.friction = params.friction;
+
+    params_saves_reported = param_store_get_saves();
+    params_save_rejected = 0;
+}
+
+static void calculate_tick( void *context )
+{
+    (void)context;
+
+    calculate();
+}
+
+// Fixed point gains for pid_step(), from the float ones
+static void set_pid_gains( control_set_t *set )
+{
+    pid_gains_from_float( &set->pid, set->Kp, set->Kd, set->Ki, NUM_MS_PER_CALC / 1000.0f, V_WINDOW_CALCS * NUM_MS_PER_CALC / 1000.0f );
+}
+
+void controller_init( void )
+{
+    Pe_int = Pm_int = Pr_int = Vm_int = T_int = 0;
+
+    v_iter = v_iter_last_pos = 0;
+
+    commanded.Pr = 0.0f, commanded.Kp = 4.3f, commanded.Kd = -4.85f; // Dummy values until new ones are set at runtime
+    commanded.frames = 0;
+    commanded.Ki = 0.0f;
+    commanded.law = CONTROLLER_LAW_PD;
+    commanded.friction.enabled = 0;
+    commanded.friction.forward = 0;
+    commanded.friction.reverse = 0;
+    commanded.friction.band = FRICTION_BAND_DEFAULT;
+
+    send_outputs = 1; // Default to send outputs
+
+    autotune_request = -1;
+    friction_request = 0;
+
+    cycle = 0;
+    frame_state = FRAME_FREE;
+    frame_acked = 0;
+
+    capture_init();
+    latency_init();
+
+    restore_params();
+
+    set_pid_gains( &commanded );
+    pid_reset( &pid, 0 );
+    law_running = commanded.law;
+
+    active = commanded;
+    double_buffer_init( &control_buffer, control_blocks, sizeof(control_set_t), &commanded );
+
+    // Runs from the timer ISR
+    timer_wheel_setup( &calculate_timer, calculate_tick, 0, 0 );
+    timer_wheel_arm( &calculate_timer, NUM_MS_PER_CALC, NUM_MS_PER_CALC );
+}
+
+// Hand the main loop's copy of the set to calculate()
+static void publish( void )
+{
+    set_pid_gains( &commanded );
+    latency_published();
+    double_buffer_publish( &control_buffer, &commanded );
+}
+
+void calculate()
+{
+    unsigned int T_speed;
+    unsigned int T_reverse;
+    int32_t Pm_long, Pr_long, Pe_long;
+    uint8_t fresh;
+
+    cycle++;
+
+    // Latest set from the main loop, used for the whole cycle
+    fresh = double_buffer_take( &control_buffer, &active );
+    if ( fresh && ( frame_state == FRAME_PENDING ) && ( active.frames == frame_number ) )
+    {
+        frame_cycle = cycle;
+        frame_state = FRAME_APPLIED;
+    }
+
+    // Calc current position.  The error is worked out on the 32 bit count,
+    // so it stays right once the 16 bit Pm and Pr wrap.
+    Pm_long = quadrature_get_count( QUADRATURE_M2 );
+    Pm_int  = (int)Pm_long;
+    TRACE( TRACE_CONTROL_BEGIN, Pm_int );
+
+    // Calc velocity
+    if ( v_iter++ > V_ITER_THRESH )
+    {
+        v_iter = 0;
+        Vm_int = Pm_int - v_iter_last_pos;
+        v_iter_last_pos = Pm_int;
+    }
+
+    // Calculate the position error
+    Pr_long = (int32_t)(active.Pr  / DEG_PER_COUNT);
+    Pr_int = (int)Pr_long;
+    Pe_long = Pr_long - Pm_long;
+
+    // Clamp maximum error
+    if ( Pe_long > POSITION_ERROR_COUNT_MAX )
+    {
+        Pe_long = POSITION_ERROR_COUNT_MAX;
+    }
+
+    if ( Pe_long < -POSITION_ERROR_COUNT_MAX )
+    {
+        Pe_long = -POSITION_ERROR_COUNT_MAX;
+    }
+    Pe_int = (int)Pe_long;
+
+    // Start auto-tune here so the experiment is centred on a fresh position
+    if ( autotune_request == AUTOTUNE_REQUEST_ABORT )
+    {
+        autotune_abort();
+        autotune_request = -1;
+    }
+    else if ( ( autotune_request >= 0 ) && ( friction_calibrate_state() != FRICTION_CAL_RUNNING ) )
+    {
+        autotune_start( Pm_int, (AUTOTUNE_RULE_E)autotune_request, NUM_MS_PER_CALC / 1000.0f, V_WINDOW_CALCS * NUM_MS_PER_CALC / 1000.0f );
+        autotune_request = -1;
+    }
+
+    if ( friction_request == FRICTION_REQUEST_ABORT )
+    {
+        friction_calibrate_abort();
+        friction_request = 0;
+    }
+    else if ( ( friction_request == FRICTION_REQUEST_START ) && ( autotune_get_state() != AUTOTUNE_RUNNING ) )
+    {
+        friction_calibrate_start( Pm_int );
+        friction_request = 0;
+    }
+
+    if ( friction_calibrate_state() == FRICTION_CAL_RUNNING )
+    {
+        // Duty ramp replaces the law until the motor breaks free both ways
+        T_int = friction_calibrate_step( Pm_int );
+
+        if ( friction_calibrate_state() == FRICTION_CAL_DONE )
+        {
+            friction_calibration_t calibration;
+
+            // The main loop picks these up as well, see adopt_friction()
+            friction_get_calibration( &calibration );
+            active.friction.forward = calibration.forward;
+            active.friction.reverse = calibration.reverse;
+            active.friction.enabled = 1;
+        }
+        law_running = CONTROLLER_LAW_NUM;
+    }
+    else if ( autotune_get_state() == AUTOTUNE_RUNNING )
+    {
+        // Relay replaces the PD law until the limit cycle is measured
+        T_int = autotune_step( Pm_int );
+
+        if ( autotune_get_state() == AUTOTUNE_DONE )
+        {
+            autotune_result_t result;
+
+            autotune_get_result( &result );
+            // The main loop picks these up as well, see adopt_autotune()
+            active.Kp = result.Kp;
+            active.Kd = result.Kd;
+            active.Pr = autotune_get_center() * DEG_PER_COUNT;
+            set_pid_gains( &active );
+        }
+        law_running = CONTROLLER_LAW_NUM;
+    }
+    else if ( active.law == CONTROLLER_LAW_PID )
+    {
+        // Start clean when switched to, or after auto-tune
+        if ( law_running != CONTROLLER_LAW_PID )
+        {
+            pid_reset( &pid, Pm_int );
+        }
+        T_int = pid_step( &pid, &active.pid, Pe_int, Pm_int, MOTOR_SPEED_MAX );
+        law_running = CONTROLLER_LAW_PID;
+    }
+    else
+    {
+        // Torque
+        float t1_f = active.Kp * Pe_int;
+        float t2_f = active.Kd * Vm_int;
+        T_int = (int)(t1_f - t2_f);
+        law_running = CONTROLLER_LAW_PD;
+    }
+
+    if ( law_running != CONTROLLER_LAW_NUM )
+    {
+        T_int = friction_compensate( &active.friction, T_int );
+    }
+
+/*
+    // Clamp minimum speed
+    if ( ( T_int > 0 ) && ( T_int < MOTOR_SPEED_MIN ) )
+    {
+        T_int = MOTOR_SPEED_MIN;
+    }
+    else if ( ( T_int < 0 ) && ( T_int > -MOTOR_SPEED_MIN ) )
+    {
+        T_int = -MOTOR_SPEED_MIN;
+    }
+*/
+    if ( T_int < -MOTOR_SPEED_MAX )
+    {
+        T_int = -MOTOR_SPEED_MAX;
+    }
+
+    if ( T_int > MOTOR_SPEED_MAX )
+    {
+        T_int = MOTOR_SPEED_MAX;
+    }
+
+    // Set new motor commands
+
+/*
+    if ( T_int < 0 )
+    {
+        T_speed = -T_int;
+        T_reverse = 1;
+    }
+    else
+    {
+        T_speed = T_int;
+        T_reverse = 0;
+    }
+
+    OCR2B = T_speed;
+
+    if (T_speed == 0)
+    {
+        // Achieve a 0% duty cycle on the PWM pin by driving it low,
+        // disconnecting it from Timer2
+        TCCR2A &= ~(1<<COM2B1);
+    }
+    else
+    {
+        // Achieve a variable duty cycle on the PWM pin using Timer2.
+        TCCR2A |= 1<<COM2B1;
+
+        if (T_reverse)
+        {
+            set_digital_output(DIRB, HIGH);
+        }
+        else
+        {
+            set_digital_output(DIRB, LOW);
+        }
+    }
+*/
+    // Held at zero once a deadline has been missed, until the watchdog
+    // resets the board
+    if ( supervisor_tripped() )
+    {
+        T_int = 0;
+    }
+
+    set_motors( 0, T_int );
+    TRACE( TRACE_CONTROL_END, T_int );
+
+    // First cycle on a new set: a command followed by latency.h has reached
+    // the motor
+    if ( fresh )
+    {
+        latency_actuated();
+    }
+
+    capture_sample( Pr_int, Pe_int, Pm_int, Vm_int, T_int );
+
+    supervisor_checkin( SUPERVISOR_CONTROL );
+
+}
+
+// Send one "d," line per auto-tune cycle and one for the result
+static void report_autotune( void )
+{
+    static char buffer[BUFFER_SIZE];
+    autotune_result_t result;
+    unsigned char changes;
+
+    changes = autotune_get_result( &result );
+    if ( changes == autotune_reported )
+    {
+        return;
+    }
+    autotune_reported = changes;
+
+    switch ( result.state )
+    {
+        case AUTOTUNE_RUNNING:
+            snprintf( buffer, BUFFER_SIZE, "d,autotune cycle %d a=%d Tu=%dms\r\n", result.cycles, (signed int)result.amplitude_counts, (signed int)(result.Tu_s*1000) );
+            break;
+        case AUTOTUNE_DONE:
+            snprintf( buffer, BUFFER_SIZE, "d,autotune done Ku=%d Tu=%dms Kp=%d Kd=%d\r\n", (signed int)(result.Ku*1000), (signed int)(result.Tu_s*1000), (signed int)(result.Kp*1000), (signed int)(result.Kd*1000) );
+            break;
+        case AUTOTUNE_FAILED:
+            snprintf( buffer, BUFFER_SIZE, "d,autotune failed %d\r\n", result.fail );
+            break;
+        default:
+            return;
+    }
+
+    print_usb( buffer );
+}
+
+// calculate() switched to the auto-tune result on its own; take it into the
+// main loop's set, and publish that so a set published in the meantime
+// with the old gains does not stay in use
+static void adopt_autotune( void )
+{
+    autotune_result_t result;
+    unsigned char changes;
+
+    changes = autotune_get_result( &result );
+    if ( ( changes == autotune_adopted ) || ( result.state != AUTOTUNE_DONE ) )
+    {
+        return;
+    }
+    autotune_adopted = changes;
+
+    commanded.Kp = result.Kp;
+    commanded.Kd = result.Kd;
+    commanded.Pr = autotune_get_center() * DEG_PER_COUNT;
+    publish();
+}
+
+// Same for a friction calibration, with one "d," line for its result
+static void adopt_friction( void )
+{
+    static char buffer[BUFFER_SIZE];
+    friction_calibration_t calibration;
+    unsigned char changes;
+
+    changes = friction_get_calibration( &calibration );
+    if ( changes == friction_reported )
+    {
+        return;
+    }
+    friction_reported = changes;
+
+    if ( calibration.state == FRICTION_CAL_DONE )
+    {
+        commanded.friction.forward = calibration.forward;
+        commanded.friction.reverse = calibration.reverse;
+        commanded.friction.enabled = 1;
+        publish();
+
+        snprintf( buffer, BUFFER_SIZE, "d,friction calibrated fwd %u rev %u\r\n", calibration.forward, calibration.reverse );
+        print_usb( buffer );
+    }
+    else if ( calibration.state == FRICTION_CAL_FAILED )
+    {
+        print_usb( "d,friction calibration failed\r\n" );
+    }
+}
+
+// Send one "d," line per completed (or refused) save
+static void report_params( void )
+{
+    static char buffer[BUFFER_SIZE];
+    unsigned char saves;
+
+    if ( params_save_rejected )
+    {
+        params_save_rejected = 0;
+        print_usb( "d,params save busy\r\n" );
+    }
+
+    saves = param_store_get_saves();
+    if ( saves != params_saves_reported )
+    {
+        params_saves_reported = saves;
+        snprintf( buffer, BUFFER_SIZE, "d,params saved slot %d\r\n", param_store_get_slot() );
+        print_usb( buffer );
+    }
+}
+
+static void send_ack( int seq, int result )
+{
+    char line[BUFFER_SIZE];
+
+    telemetry_write( line, snprintf( line, BUFFER_SIZE, "a,%d,%d\r\n", seq, result ) );
+}
+
+static void send_frame_ack( void )
+{
+    char line[BUFFER_SIZE];
+
+    telemetry_write( line, snprintf( line, BUFFER_SIZE, "a,%u,%u\r\n", frame_seq, frame_cycle ) );
+}
+
+// Acknowledge a frame calculate() has applied
+static void report_frame( void )
+{
+    if ( frame_state == FRAME_APPLIED )
+    {
+        send_frame_ack();
+        frame_acked = 1;
+        frame_state = FRAME_FREE;
+    }
+}
+
+void controller_submit_frame( const controller_frame_t *new_frame )
+{
+    if ( frame_state != FRAME_FREE )
+    {
+        // Resent while still pending: the ack is on its way
+        if ( new_frame->seq != frame_seq )
+        {
+            send_ack( new_frame->seq, CONTROLLER_FRAME_BUSY );
+        }
+        return;
+    }
+
+    if ( frame_acked && ( new_frame->seq == frame_seq ) )
+    {
+        send_frame_ack();
+        return;
+    }
+
+    if ( new_frame->set & CONTROLLER_FRAME_KP )
+    {
+        commanded.Kp = new_frame->Kp;
+    }
+    if ( new_frame->set & CONTROLLER_FRAME_KD )
+    {
+        commanded.Kd = new_frame->Kd;
+    }
+    if ( new_frame->set & CONTROLLER_FRAME_PR )
+    {
+        commanded.Pr += new_frame->Pr_step;
+    }
+
+    // Pending before it is published, so calculate() cannot take the set
+    // without marking the frame applied
+    frame_seq = new_frame->seq;
+    frame_number = ++commanded.frames;
+    frame_state = FRAME_PENDING;
+    publish();
+}
+
+void controller_reject_frame( int seq, int reason )
+{
+    send_ack( seq, reason );
+}
+
+uint16_t controller_get_cycle( void )
+{
+    uint16_t copy;
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+    copy = cycle;
+    SREG = cSREG;
+
+    return copy;
+}
+
+void service_serial()
+{
+    static char buffer[BUFFER_SIZE];
+    char cSREG;
+    int Pe, Pr, Pm, Vm, T;
+    int P_term, I_term, D_term;
+    uint8_t law;
+
+    TRACE( TRACE_SERIAL_BEGIN, 0 );
+
+    supervisor_checkin( SUPERVISOR_LOOP );
+
+    adopt_autotune();
+    adopt_friction();
+
+    // check for new serial input command
+    serial_check();
+    latency_poll();
+    check_for_new_bytes_received();
+
+    // calculate() runs in the timer ISR and can land between these reads
+    cSREG = SREG;
+    cli();
+    Pe = Pe_int;
+    Pr = Pr_int;
+    Pm = Pm_int;
+    Vm = Vm_int;
+    T = T_int;
+    P_term = pid.p;
+    I_term = pid.i;
+    D_term = pid.d;
+    law = law_running;
+    SREG = cSREG;
+
+    if ( send_outputs == 1 )
+    {
+        int length;
+
+        length = snprintf( buffer, BUFFER_SIZE, "v,%d,%d,%d,%d,%d,%d,%d\r\n", Pe, Pr, Pm, Vm, T, (signed int)(commanded.Kp*1000), (signed int)(commanded.Kd*1000) );
+        if ( length >= BUFFER_SIZE )
+        {
+            length = BUFFER_SIZE - 1;
+        }
+        telemetry_write( buffer, length );
+
+        if ( law == CONTROLLER_LAW_PID )
+        {
+            telemetry_write( buffer, snprintf( buffer, BUFFER_SIZE, "p,%d,%d,%d,%d\r\n", P_term, I_term, D_term, (signed int)(commanded.Ki*1000) ) );
+        }
+    }
+    else if ( send_outputs == 2 )
+    {
+        int16_t values[TELEMETRY_PACK_FIELDS];
+        uint8_t packed[TELEMETRY_PACK_MAX_BYTES];
+
+        values[0] = Pe;
+        values[1] = Pr;
+        values[2] = Pm;
+        values[3] = Vm;
+        values[4] = T;
+        values[5] = (signed int)(commanded.Kp*1000);
+        values[6] = (signed int)(commanded.Kd*1000);
+        telemetry_write( (const char *)packed, telemetry_pack_sample( values, packed ) );
+    }
+    report_frame();
+    capture_poll();
+    telemetry_poll();
+
+    report_autotune();
+    report_params();
+
+    TRACE( TRACE_SERIAL_END, 0 );
+}
+
+// 0 off, 1 "v," lines, 2 packed records (telemetry_pack.h)
+void set_logging( int new_value )
+{
+    send_outputs = new_value;
+    telemetry_pack_reset();
+}
+
+void set_Pr( float new_ref )
+{
+    commanded.Pr += new_ref;
+    publish();
+}
+
+void set_Kp( float new_Kp )
+{
+    commanded.Kp = new_Kp;
+    publish();
+}
+
+void set_Kd( float new_Kd )
+{
+    commanded.Kd = new_Kd;
+    publish();
+}
+
+void set_Ki( float new_Ki )
+{
+    commanded.Ki = new_Ki;
+    publish();
+}
+
+void set_law( int new_law )
+{
+    if ( ( new_law >= 0 ) && ( new_law < CONTROLLER_LAW_NUM ) )
+    {
+        commanded.law = new_law;
+        publish();
+    }
+}
+
+void set_friction( int op, int arg )
+{
+    static char buffer[BUFFER_SIZE];
+    uint8_t value = ( arg < 0 ) ? 0 : ( ( arg > MOTOR_SPEED_MAX ) ? MOTOR_SPEED_MAX : arg );
+
+    switch ( op )
+    {
+        case 0:
+        case 1:
+            commanded.friction.enabled = op;
+            break;
+        case 2:
+            friction_request = FRICTION_REQUEST_START;
+            break;
+        case 3:
+            commanded.friction.band = value;
+            break;
+        case 4:
+            commanded.friction.forward = value;
+            break;
+        case 5:
+            commanded.friction.reverse = value;
+            break;
+        case 6:
+            friction_request = FRICTION_REQUEST_ABORT;
+            break;
+        default:
+            print_usb( "d,friction op 0 off 1 on 2 calibrate 3 band 4 fwd 5 rev 6 stop\r\n" );
+            return;
+    }
+    publish();
+
+    snprintf( buffer, BUFFER_SIZE, "d,friction %s fwd %u rev %u band %u\r\n", commanded.friction.enabled ? "on" : "off",
+              commanded.friction.forward, commanded.friction.reverse, commanded.friction.band );
+    print_usb( buffer );
+}
+
+void start_autotune( int rule )
+{
+    if ( ( rule >= 0 ) && ( rule < AUTOTUNE_RULE_NUM ) )
+    {
+        autotune_request = rule;
+    }
+    else
+    {
+        // calculate() may be in the middle of an auto-tune step
+        autotune_request = AUTOTUNE_REQUEST_ABORT;
+    }
+}
+
+void save_params( void )
+{
+    controller_params_t params;
+
+    params.Kp = commanded.Kp;
+    params.Kd = commanded.Kd;
+    params.logging = send_outputs;
+    params.Ki = commanded.Ki;
+    params.law = commanded.law;
+    params.friction = commanded.friction;
+
+    if ( !param_store_save( CONTROLLER_PARAMS_VERSION, &params, sizeof(params) ) )
+    {
+        params_save_rejected = 1;
+    }
+}
@@ -0,0 +1,108 @@
+/* controller.h
+ *
+ * Lab2 PD position controller for motor 2.
+ *
+ * Split out of main.c so the control law, the telemetry line and the
+ * parameter setters can be built on their own (host simulation and replay,
+ * see host/lab2_sim.cpp) without the timer and main loop setup.
+ */
+
+#ifndef __CONTROLLER_H
+#define __CONTROLLER_H
+
+#include <inttypes.h>
+
+#define BUFFER_SIZE 64
+
+// Position
+#define DEG_PER_COUNT (360.0f / 64.0f)
+#define POSITION_ERROR_DEG_MAX 540.0f
+#define POSITION_ERROR_COUNT_MAX (POSITION_ERROR_DEG_MAX / DEG_PER_COUNT)
+#define POSITION_ERROR_COUNT_MIN 1
+
+#define NUM_MS_PER_CALC 200
+
+// Velocity
+#define V_ITER_THRESH (200/NUM_MS_PER_CALC)
+#define V_WINDOW_CALCS (V_ITER_THRESH + 2) // calculate() calls between Vm updates
+
+// Motor
+#define MOTOR_SPEED_MIN                 25
+#define MOTOR_SPEED_MAX                 150
+
+// Set the power up state (gains, reference, logging); gains and logging
+// come from the EEPROM parameter block when one has been saved
+void controller_init( void );
+
+// controller_init() arms a timer_wheel.h timer that runs calculate() every
+// NUM_MS_PER_CALC ticks, so timer_wheel_init() has to come first
+
+// One control cycle: read the encoder, compute the torque and set the motor
+void calculate( void );
+
+// Main loop work: handle serial commands and send the "v," telemetry line
+void service_serial( void );
+
+// Parameter setters used by the menu (main loop only).  The gains and
+// reference reach calculate() as one set at the start of its next cycle,
+// see double_buffer.h; the "v," line shows them straight away.
+void set_logging( int );
+void set_Pr( float );
+void set_Kp( float );
+void set_Kd( float );
+void set_Ki( float );                   // torque per count second, PID law only
+void set_law( int );                    // CONTROLLER_LAW_*
+
+// Control law, 'K,<law>'.  With the PID law a "p,<P>,<I>,<D>,<Ki*1000>" line
+// with the torque of each term follows every "v," line.
+#define CONTROLLER_LAW_PD       0       // float PD, the power up law
+#define CONTROLLER_LAW_PID      1       // fixed point PID, pid.h
+#define CONTROLLER_LAW_NUM      2
+
+// Friction feed-forward (friction.h), 'Z,<op>[,<arg>]': 0 off, 1 on,
+// 2 calibrate (turns it on when done), 3 band, 4 forward and 5 reverse
+// breakaway duty, 6 stop a calibration.  Answers with a "d," line.
+void set_friction( int op, int arg );
+
+// Run a relay auto-tune experiment around the current position with the
+// given AUTOTUNE_RULE_E; anything else aborts a running experiment
+void start_autotune( int rule );
+
+// Command frame: several parameter updates applied together at the start of
+// one calculate() and acknowledged on the telemetry stream, in order with
+// the "v," lines, as
+//
+//      a,<seq>,<cycle>     cycle = controller_get_cycle() it took effect on
+//      a,<seq>,-1          busy, the previous frame has not been applied yet
+//      a,<seq>,-2          malformed (seq -1 when it could not be read)
+//
+// A frame with the seq of the last one applied is acknowledged again
+// without being applied twice, so a host can resend when an ack is lost.
+#define CONTROLLER_FRAME_KP     0x01
+#define CONTROLLER_FRAME_KD     0x02
+#define CONTROLLER_FRAME_PR     0x04
+
+#define CONTROLLER_FRAME_BUSY       -1
+#define CONTROLLER_FRAME_MALFORMED  -2
+
+typedef struct
+{
+    uint16_t seq;
+    uint8_t set;                        // CONTROLLER_FRAME_* of the fields used
+    float Kp;
+    float Kd;
+    float Pr_step;                      // added to the reference, as set_Pr()
+} controller_frame_t;
+
+// Queue a frame for the next control cycle, or acknowledge a rejection
+void controller_submit_frame( const controller_frame_t *frame );
+void controller_reject_frame( int seq, int reason );
+
+// calculate() calls so far, wrapping
+uint16_t controller_get_cycle( void );
+
+// Save the current gains and logging state to EEPROM (param_store.h), the
+// write finishes in the background and is reported on a "d," line
+void save_params( void );
+
+#endif //__CONTROLLER_H
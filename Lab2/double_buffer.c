@@ -0,0 +1,52 @@
+/* double_buffer.c
+ *
+ * Main loop to ISR block hand over, see double_buffer.h
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "double_buffer.h"
+
+void double_buffer_init( double_buffer_t *buffer, void *blocks, uint8_t size, const void *initial )
+{
+    buffer->blocks = (uint8_t *)blocks;
+    buffer->size = size;
+    buffer->published = 0;
+    buffer->taken = 0;
+
+    memcpy( buffer->blocks, initial, size );
+}
+
+void double_buffer_publish( double_buffer_t *buffer, const void *values )
+{
+    uint8_t next = buffer->published + 1;
+
+    // The reader only ever copies block published & 1, never this one
+    memcpy( buffer->blocks + ( next & 1 ) * buffer->size, values, buffer->size );
+
+    // Keep the compiler from moving the copy past the flip
+    asm volatile ( "" ::: "memory" );
+    buffer->published = next;
+}
+
+uint8_t double_buffer_take( double_buffer_t *buffer, void *values )
+{
+    uint8_t published = buffer->published;
+
+    if ( published == buffer->taken )
+    {
+        return 0;
+    }
+
+    do
+    {
+        published = buffer->published;
+        memcpy( values, buffer->blocks + ( published & 1 ) * buffer->size, buffer->size );
+        asm volatile ( "" ::: "memory" );
+    } while ( published != buffer->published );
+
+    buffer->taken = published;
+
+    return 1;
+}
@@ -0,0 +1,46 @@
+/* double_buffer.h
+ *
+ * A block of values written by the main loop and read by an interrupt,
+ * handed over without disabling interrupts.
+ *
+ * There are two copies of the block.  The writer fills the one the reader
+ * is not using and then publishes it by bumping a one byte counter; the
+ * low bit of the counter says which copy is current.  A single byte store
+ * cannot be seen half done, so the reader gets either the whole old block
+ * or the whole new one, never some bytes of each.
+ *
+ *      writer (main loop)      double_buffer_publish( &buffer, &values )
+ *      reader (ISR)            if ( double_buffer_take( &buffer, &copy ) ) ...
+ *
+ * The reader takes its own copy once, at the start of its work, and uses
+ * only that copy until the next take.  A take that sees the counter move
+ * while it copies copies again.
+ *
+ * One writer and one reader only.
+ */
+
+#ifndef __DOUBLE_BUFFER_H
+#define __DOUBLE_BUFFER_H
+
+#include <inttypes.h>
+
+typedef struct
+{
+    uint8_t *blocks;                    // two blocks of 'size' bytes
+    uint8_t size;
+    volatile uint8_t published;         // publish count, block published & 1 is current
+    uint8_t taken;                      // reader: published as of its last take
+} double_buffer_t;
+
+// 'blocks' is room for two blocks of 'size' bytes.  'initial' becomes the
+// current block; the reader is taken to have a copy of it already.
+void double_buffer_init( double_buffer_t *buffer, void *blocks, uint8_t size, const void *initial );
+
+// Writer: copy 'values' into the spare block and make it current
+void double_buffer_publish( double_buffer_t *buffer, const void *values );
+
+// Reader: copy the current block into 'values' if it was published since
+// the last take.  Returns 1 when it did.
+uint8_t double_buffer_take( double_buffer_t *buffer, void *values );
+
+#endif //__DOUBLE_BUFFER_H
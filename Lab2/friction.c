@@ -0,0 +1,127 @@
+/* friction.c
+ *
+ * Deadband and friction feed-forward, see friction.h
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "friction.h"
+
+static friction_calibration_t result;
+static unsigned char result_changes;
+
+static signed char direction;
+static int start_position;
+static uint8_t duty;
+static uint8_t pause;
+
+int friction_compensate( const friction_params_t *params, int torque )
+{
+    int offset;
+
+    if ( !params->enabled || ( torque == 0 ) )
+    {
+        return torque;
+    }
+
+    offset = ( torque > 0 ) ? params->forward : params->reverse;
+
+    if ( ( torque >= params->band ) || ( torque <= -params->band ) )
+    {
+        return ( torque > 0 ) ? torque + offset : torque - offset;
+    }
+
+    // Inside the band the offset ramps in with the command
+    return torque + (int)( (long)torque * offset / params->band );
+}
+
+void friction_calibrate_start( int position )
+{
+    direction = 1;
+    start_position = position;
+    duty = 0;
+    pause = 0;
+
+    result.state = FRICTION_CAL_RUNNING;
+    result.forward = 0;
+    result.reverse = 0;
+    result_changes++;
+}
+
+void friction_calibrate_abort( void )
+{
+    if ( result.state == FRICTION_CAL_RUNNING )
+    {
+        result.state = FRICTION_CAL_FAILED;
+        result_changes++;
+    }
+}
+
+int friction_calibrate_step( int position )
+{
+    if ( result.state != FRICTION_CAL_RUNNING )
+    {
+        return 0;
+    }
+
+    // Motor stopped between the directions, start from where it came to rest
+    if ( pause )
+    {
+        if ( --pause == 0 )
+        {
+            start_position = position;
+        }
+        return 0;
+    }
+
+    // 'duty' was applied for the last cycle
+    if ( ( position - start_position ) * direction >= FRICTION_CAL_MOVE_COUNTS )
+    {
+        if ( direction > 0 )
+        {
+            result.forward = duty;
+            direction = -1;
+            duty = 0;
+            pause = FRICTION_CAL_PAUSE_CALCS;
+        }
+        else
+        {
+            result.reverse = duty;
+            result.state = FRICTION_CAL_DONE;
+        }
+        result_changes++;
+        return 0;
+    }
+
+    duty += FRICTION_CAL_STEP;
+    if ( duty > FRICTION_CAL_MAX_DUTY )
+    {
+        result.state = FRICTION_CAL_FAILED;
+        result_changes++;
+        return 0;
+    }
+
+    return direction * duty;
+}
+
+FRICTION_CAL_STATE_E friction_calibrate_state( void )
+{
+    return result.state;
+}
+
+unsigned char friction_get_calibration( friction_calibration_t *calibration )
+{
+    unsigned char changes;
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    *calibration = result;
+    changes = result_changes;
+
+    SREG = cSREG;
+
+    return changes;
+}
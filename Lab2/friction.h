@@ -0,0 +1,77 @@
+/* friction.h
+ *
+ * Feed-forward between the control law and set_motors() for the motor's
+ * deadband and Coulomb friction.
+ *
+ * Below some duty the motor does not turn at all: the driver's deadband
+ * plus the torque it takes to break the gearbox free, which differs with
+ * direction.  The law on its own has to build up that much error before
+ * anything moves.  friction_compensate() adds the breakaway duty for the
+ * direction of the command instead:
+ *
+ *      T >= band       T + forward
+ *      T <= -band      T - reverse
+ *      in between      T + T * offset / band, offset for T's direction
+ *
+ * so the output is continuous through zero and a command of a count or so
+ * of error does not kick the motor from one side to the other.  band 0
+ * switches straight to the full offset.
+ *
+ * The offsets come from a calibration run in calculate() in place of the
+ * law, like auto-tune: the duty is ramped up by FRICTION_CAL_STEP each
+ * control cycle, forward then reverse, until the encoder has moved
+ * FRICTION_CAL_MOVE_COUNTS; the duty that moved it is the breakaway duty
+ * for that direction.  The motor is stopped for FRICTION_CAL_PAUSE_CALCS
+ * between the directions.
+ */
+
+#ifndef __FRICTION_H
+#define __FRICTION_H
+
+#include <inttypes.h>
+
+#define FRICTION_BAND_DEFAULT       2
+
+#define FRICTION_CAL_STEP           1
+#define FRICTION_CAL_MOVE_COUNTS    2
+#define FRICTION_CAL_PAUSE_CALCS    3
+#define FRICTION_CAL_MAX_DUTY       100         // give up past this
+
+typedef struct
+{
+    uint8_t enabled;
+    uint8_t forward;                // breakaway duty, positive commands
+    uint8_t reverse;                // breakaway duty, negative commands
+    uint8_t band;                   // smooth zero crossing, torque units
+} friction_params_t;
+
+typedef enum
+{
+    FRICTION_CAL_IDLE,
+    FRICTION_CAL_RUNNING,
+    FRICTION_CAL_DONE,
+    FRICTION_CAL_FAILED
+} FRICTION_CAL_STATE_E;
+
+typedef struct
+{
+    FRICTION_CAL_STATE_E state;
+    uint8_t forward;
+    uint8_t reverse;
+} friction_calibration_t;
+
+// Law output 'torque' with the feed-forward added, when enabled
+int friction_compensate( const friction_params_t *params, int torque );
+
+// Calibration, stepped from calculate() with the measured position.  The
+// step returns the duty to apply.
+void friction_calibrate_start( int position );
+void friction_calibrate_abort( void );
+int friction_calibrate_step( int position );
+FRICTION_CAL_STATE_E friction_calibrate_state( void );
+
+// Copy of the calibration result with a change counter, as
+// autotune_get_result().  Returns the counter.
+unsigned char friction_get_calibration( friction_calibration_t *calibration );
+
+#endif //__FRICTION_H
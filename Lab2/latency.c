@@ -0,0 +1,305 @@
+/* latency.c
+ *
+ * Command to actuation latency, see latency.h
+ */
+
+#include <pololu/orangutan.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "latency.h"
+#include "menu.h"
+#include "ring.h"
+#include "timer_wheel.h"
+#include "trace.h"
+
+#define LINE_SIZE 64
+
+// Timer3 wraps every ~210 ms; longer gaps are timed on the ms tick
+#define TICKS_MS_MAX 150
+
+// Where the followed command is.  The main loop moves it up to
+// STATE_PUBLISHED, calculate() from there back to STATE_IDLE, each only
+// while it owns it.
+#define STATE_IDLE      0
+#define STATE_LINE      1
+#define STATE_PARSED    2
+#define STATE_PUBLISHED 3
+
+typedef struct
+{
+    uint32_t ms;
+    uint16_t ticks;
+} stamp_t;
+
+RING_DECLARE( latency_ring, latency_sample_t, LATENCY_RECORDS )
+
+static const char *stage_names[LATENCY_STAGES] = { "parse", "publish", "actuate", "total" };
+
+// Main loop
+static stamp_t poll_at;
+static stamp_t rx_at;
+static stamp_t parsed_at;
+static uint16_t skipped;
+
+// Written by the main loop before STATE_PUBLISHED, read by calculate()
+static stamp_t published_at;
+static char op_followed;
+
+// Shared with calculate()
+static volatile uint8_t state;
+static latency_ring_t ring;
+
+static void stamp( stamp_t *at )
+{
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    at->ms = timer_wheel_now();
+    at->ticks = TRACE_NOW();
+
+    SREG = cSREG;
+}
+
+static uint32_t elapsed_us( const stamp_t *from, const stamp_t *to )
+{
+    uint32_t ms = to->ms - from->ms;
+
+    if ( ms < TICKS_MS_MAX )
+    {
+        return (uint32_t)(uint16_t)( to->ticks - from->ticks ) * TRACE_TICK_NS / 1000;
+    }
+    return ms * 1000;
+}
+
+static uint32_t stage_us( const latency_sample_t *sample, uint8_t stage )
+{
+    if ( stage == LATENCY_TOTAL )
+    {
+        return sample->us[LATENCY_PARSE] + sample->us[LATENCY_PUBLISH] + sample->us[LATENCY_ACTUATE];
+    }
+    return sample->us[stage];
+}
+
+void latency_init( void )
+{
+    state = STATE_IDLE;
+    latency_clear();
+}
+
+void latency_poll( void )
+{
+    stamp( &poll_at );
+}
+
+void latency_line( char op )
+{
+    if ( state == STATE_PUBLISHED )
+    {
+        if ( skipped < 0xFFFF )
+        {
+            skipped++;
+        }
+        return;
+    }
+
+    rx_at = poll_at;
+    op_followed = op;
+    state = STATE_LINE;
+}
+
+void latency_parsed( void )
+{
+    if ( state == STATE_LINE )
+    {
+        stamp( &parsed_at );
+        state = STATE_PARSED;
+    }
+}
+
+void latency_line_done( void )
+{
+    // Nothing published
+    if ( ( state == STATE_LINE ) || ( state == STATE_PARSED ) )
+    {
+        state = STATE_IDLE;
+    }
+}
+
+void latency_published( void )
+{
+    if ( state == STATE_PARSED )
+    {
+        stamp( &published_at );
+        state = STATE_PUBLISHED;
+    }
+}
+
+void latency_actuated( void )
+{
+    latency_sample_t *sample;
+    stamp_t now;
+    char cSREG;
+
+    if ( state != STATE_PUBLISHED )
+    {
+        return;
+    }
+
+    stamp( &now );
+
+    cSREG = SREG;
+    cli();
+
+    sample = latency_ring_overwrite( &ring );
+    sample->op = op_followed;
+    sample->rx_ms = rx_at.ms;
+    sample->us[LATENCY_PARSE] = elapsed_us( &rx_at, &parsed_at );
+    sample->us[LATENCY_PUBLISH] = elapsed_us( &parsed_at, &published_at );
+    sample->us[LATENCY_ACTUATE] = elapsed_us( &published_at, &now );
+
+    SREG = cSREG;
+
+    state = STATE_IDLE;
+}
+
+uint8_t latency_count( void )
+{
+    uint8_t count;
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+    count = latency_ring_count( &ring );
+    SREG = cSREG;
+
+    return count;
+}
+
+void latency_get( uint8_t i, latency_sample_t *sample )
+{
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+    *sample = *latency_ring_peek( &ring, i );
+    SREG = cSREG;
+}
+
+uint16_t latency_skipped( void )
+{
+    return skipped;
+}
+
+void latency_clear( void )
+{
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+    latency_ring_init( &ring );
+    SREG = cSREG;
+
+    skipped = 0;
+}
+
+// The value with 'rank' - 1 values below it (counting equal ones either
+// way), no copy sorted
+static uint32_t ranked( const uint32_t *values, uint8_t count, uint8_t rank )
+{
+    uint8_t i, j, below, at_most;
+
+    for ( i = 0; i < count; i++ )
+    {
+        below = at_most = 0;
+        for ( j = 0; j < count; j++ )
+        {
+            below += ( values[j] < values[i] );
+            at_most += ( values[j] <= values[i] );
+        }
+        if ( ( below < rank ) && ( rank <= at_most ) )
+        {
+            return values[i];
+        }
+    }
+    return 0;
+}
+
+uint8_t latency_summarize( LATENCY_STAGE_E stage, latency_summary_t *summary )
+{
+    uint32_t values[LATENCY_RECORDS];
+    uint8_t count, i;
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+    count = latency_ring_count( &ring );
+    for ( i = 0; i < count; i++ )
+    {
+        values[i] = stage_us( latency_ring_peek( &ring, i ), stage );
+    }
+    SREG = cSREG;
+
+    summary->p50 = summary->p99 = summary->max = 0;
+    if ( !count )
+    {
+        return 0;
+    }
+
+    // Nearest rank, ceil( p * count / 100 )
+    summary->p50 = ranked( values, count, (uint8_t)( ( 50 * (uint16_t)count + 99 ) / 100 ) );
+    summary->p99 = ranked( values, count, (uint8_t)( ( 99 * (uint16_t)count + 99 ) / 100 ) );
+    summary->max = ranked( values, count, count );
+
+    return count;
+}
+
+void latency_command( int op )
+{
+    char reply[LINE_SIZE];
+    latency_summary_t summary;
+    latency_sample_t sample;
+    uint8_t count, i;
+
+    switch ( op )
+    {
+        case 0:
+            break;
+        case 1:
+            latency_clear();
+            break;
+        case 2:
+            count = latency_count();
+            for ( i = 0; i < count; i++ )
+            {
+                latency_get( i, &sample );
+                snprintf( reply, LINE_SIZE, "y,%c,%lu,%lu,%lu,%lu,%lu\r\n", sample.op, (unsigned long)sample.rx_ms,
+                          (unsigned long)sample.us[LATENCY_PARSE], (unsigned long)sample.us[LATENCY_PUBLISH],
+                          (unsigned long)sample.us[LATENCY_ACTUATE], (unsigned long)stage_us( &sample, LATENCY_TOTAL ) );
+                print_usb( reply );
+            }
+            return;
+        default:
+            print_usb( "d,latency op 0 report 1 clear 2 list\r\n" );
+            return;
+    }
+
+    snprintf( reply, LINE_SIZE, "d,latency %u commands, %u skipped\r\n", latency_count(), skipped );
+    print_usb( reply );
+
+    for ( i = 0; i < LATENCY_STAGES; i++ )
+    {
+        if ( latency_summarize( (LATENCY_STAGE_E)i, &summary ) )
+        {
+            snprintf( reply, LINE_SIZE, "d,latency %s p50 %lu p99 %lu max %lu us\r\n", stage_names[i],
+                      (unsigned long)summary.p50, (unsigned long)summary.p99, (unsigned long)summary.max );
+            print_usb( reply );
+        }
+    }
+}
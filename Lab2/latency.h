@@ -0,0 +1,93 @@
+/* latency.h
+ *
+ * Command to actuation latency: how long a parameter command takes from
+ * the wire to set_motors().  Four points are stamped on its way through:
+ *
+ *      rx          the service_serial() poll (serial_check()) that brought
+ *                  in the line's terminator; if it came in while a reply
+ *                  was being sent, the poll before
+ *      parsed      the menu has the command's arguments
+ *      published   the setter hands the new set to calculate() (publish())
+ *      actuated    set_motors() at the end of the first calculate() that
+ *                  took the set
+ *
+ * giving three stages, LATENCY_PARSE (rx to parsed), LATENCY_PUBLISH
+ * (parsed to published) and LATENCY_ACTUATE (published to actuated), and
+ * their sum, LATENCY_TOTAL.  Time from the terminator on the wire to the
+ * poll is not visible from here: up to a main loop pass (LOOP_DELAY_MS, see
+ * main.c).  host/lab2_sim.cpp (latency) adds it on the simulated board.
+ *
+ * One command is followed at a time.  Lines that arrive while one is on
+ * its way are counted as skipped, and lines that publish nothing ('L',
+ * 'T', ...) are not counted at all.  The newest LATENCY_RECORDS samples
+ * are kept; 'Y' reports p50, p99 and max of each stage over them.
+ *
+ * Times are in us: from TRACE_NOW() (Timer3, TRACE_TICK_NS) when the gap
+ * is short enough for its 16 bits, from timer_wheel_now() above that.
+ */
+
+#ifndef __LATENCY_H
+#define __LATENCY_H
+
+#include <inttypes.h>
+
+#define LATENCY_RECORDS         32      // power of two (ring.h)
+
+typedef enum
+{
+    LATENCY_PARSE,
+    LATENCY_PUBLISH,
+    LATENCY_ACTUATE,
+    LATENCY_TOTAL,
+    LATENCY_STAGES
+} LATENCY_STAGE_E;
+
+typedef struct
+{
+    char op;                            // command letter
+    uint32_t rx_ms;                     // timer_wheel_now() at the rx poll
+    uint32_t us[LATENCY_TOTAL];         // LATENCY_PARSE .. LATENCY_ACTUATE
+} latency_sample_t;
+
+typedef struct
+{
+    uint32_t p50;
+    uint32_t p99;
+    uint32_t max;
+} latency_summary_t;
+
+void latency_init( void );
+
+// service_serial(), just after serial_check()
+void latency_poll( void );
+
+// Menu: a line ending in 'op' has been read, its arguments are parsed, it
+// has been carried out
+void latency_line( char op );
+void latency_parsed( void );
+void latency_line_done( void );
+
+// controller.c, just before a set is published
+void latency_published( void );
+
+// calculate(), after set_motors(), when the cycle took a new set
+void latency_actuated( void );
+
+// Samples held, oldest first
+uint8_t latency_count( void );
+void latency_get( uint8_t i, latency_sample_t *sample );
+
+// Lines skipped since the last latency_clear()
+uint16_t latency_skipped( void );
+
+void latency_clear( void );
+
+// Nearest rank p50 / p99 / max of a stage over the samples held; 0 when
+// there are none
+uint8_t latency_summarize( LATENCY_STAGE_E stage, latency_summary_t *summary );
+
+// Menu 'Y,<op>': 0 report, 1 clear, 2 list the samples as
+// "y,<op>,<rx ms>,<parse>,<publish>,<actuate>,<total>" (us)
+void latency_command( int op );
+
+#endif //__LATENCY_H
@@ -14,8 +14,15 @@
 #include <inttypes.h>
 #include <string.h>
 
+#include "controller.h"
 #include "menu.h"
+#include "quadrature.h"
+#include "ram_profile.h"
+#include "supervisor.h"
+#include "telemetry.h"
 #include "timer_1284p.h"
+#include "timer_wheel.h"
+#include "trace.h"
 
 // PWM pins
 #define PWM2B	IO_D6
@@ -30,25 +37,15 @@
 // CPU Definitions
 #define CPU_FREQ 20000000
 
-#define BUFFER_SIZE 64
 #define LOOP_DELAY_MS 9
 #define MAX_INT_OUTPUT 100
-#define USB_BAUD_RATE 256000
-
-// Position
-#define DEG_PER_COUNT (360.0f / 64.0f)
-#define POSITION_ERROR_DEG_MAX 540.0f
-#define POSITION_ERROR_COUNT_MAX (POSITION_ERROR_DEG_MAX / DEG_PER_COUNT)
-#define POSITION_ERROR_COUNT_MIN 1
-
-#define NUM_MS_PER_CALC 200
 
-// Velocity
-#define V_ITER_THRESH (200/NUM_MS_PER_CALC)
-
-// Motor
-#define MOTOR_SPEED_MIN                 25
-#define MOTOR_SPEED_MAX                 150
+// Stack headroom check, a "d,RAM" warning line when below the threshold
+#define RAM_CHECK_MS 1000
+#define RAM_WARN_BYTES 256
+#define USB_BAUD_RATE 256000
+#define ENCODER_DECODES 256
+#define ENCODER_DECODES_MAX 1000
 
 // Encoder pin mapping
 #define PIN_ENCODER_1A                  IO_A2
@@ -56,26 +53,35 @@
 #define PIN_ENCODER_2A                  IO_A0
 #define PIN_ENCODER_2B                  IO_A1
 
-static void calculate();
-static void service_serial();
-
 void set_timer0( void );
 void set_timer2( void );
+void set_timer3( void );
 void init_pwm( void );
 
-static int send_outputs;
-static float Pr_f, Kp_f, Kd_f;
-static int Pe_int, Pm_int, Pr_int, Vm_int, T_int;
+void report_memory( int );
+void report_encoders( int, int );
 
 static int timer2_counter = 100;
 
+static timer_wheel_timer_t ram_timer;
+static int ram_warn_bytes = RAM_WARN_BYTES;
+static uint16_t ram_warned;                 // headroom last warned about
+
+static void ram_check( void * );
+
 int main()
 {
-    Pe_int = Pm_int = Pr_int = Vm_int = T_int = 0;
+    supervisor_boot();
+
+    timer_wheel_init();
+    trace_init();
+    telemetry_init();
 
-    Pr_f = 0.0f, Kp_f = 4.3f, Kd_f = -4.85f; // Dummy values until new ones are set at runtime
+    ram_warned = 0xFFFF;
+    timer_wheel_setup( &ram_timer, ram_check, 0, TIMER_WHEEL_DEFERRED );
+    timer_wheel_arm( &ram_timer, RAM_CHECK_MS, RAM_CHECK_MS );
 
-    send_outputs = 1; // Default to send outputs
+    controller_init();
 
     clear();
 
@@ -87,163 +93,157 @@ int main()
     clear();
 
     // Initialize the encoders and specify the four input pins, first two are for motor 1, second two are for motor 2
-    encoders_init( PIN_ENCODER_1A, PIN_ENCODER_1B, PIN_ENCODER_2A, PIN_ENCODER_2B );
+    quadrature_init( PIN_ENCODER_1A, PIN_ENCODER_1B, PIN_ENCODER_2A, PIN_ENCODER_2B );
 
     set_timer0();
+    set_timer3();
     init_pwm();
 
     // Calculate first values
     calculate();
 
+    // Watchdog on from here, the timer tick kicks it
+    supervisor_init();
+
     // Global interrupt enable
     sei();
 
     while(1)
     {
         service_serial();
+        timer_wheel_run_deferred();
         delay_ms( LOOP_DELAY_MS );
     }
 }
 
-static void calculate()
+// ram_timer, from the main loop: warn once per new low below the threshold
+static void ram_check( void *context )
 {
-    static unsigned int v_iter = 0;
-    static unsigned int v_iter_last_pos = 0;
-
-    unsigned int T_speed;
-    unsigned int T_reverse;
+    char buffer[BUFFER_SIZE];
+    uint16_t headroom;
 
-    // Calc current position
-    Pm_int  = encoders_get_counts_m2();
+    (void)context;
 
-    // Calc velocity
-    if ( v_iter++ > V_ITER_THRESH )
+    if ( ram_warn_bytes <= 0 )
     {
-        v_iter = 0;
-        Vm_int = Pm_int - v_iter_last_pos;
-        v_iter_last_pos = Pm_int;
+        return;
     }
 
-    // Calculate the position error
-    Pr_int = (int)(Pr_f  / DEG_PER_COUNT);
-    Pe_int = Pr_int - Pm_int;
-
-    // Clamp maximum error
-    if ( Pe_int > POSITION_ERROR_COUNT_MAX )
+    headroom = ram_profile_headroom();
+    if ( ( headroom < (uint16_t)ram_warn_bytes ) && ( headroom < ram_warned ) )
     {
-        Pe_int = POSITION_ERROR_COUNT_MAX;
-    }
-
-    if ( Pe_int < -POSITION_ERROR_COUNT_MAX )
-    {
-        Pe_int = -POSITION_ERROR_COUNT_MAX;
+        ram_warned = headroom;
+        snprintf( buffer, BUFFER_SIZE, "d,RAM warning: %u bytes headroom\r\n", headroom );
+        print_usb( buffer );
     }
+}
 
-    // Torque
-    float t1_f = Kp_f * Pe_int;
-    float t2_f = Kd_f * Vm_int;
-    T_int = (int)(t1_f - t2_f);
+// SRAM layout and stack high water mark.  'bytes' > 0 sets the warning
+// threshold, < 0 turns the periodic check off.
+void report_memory( int bytes )
+{
+    char buffer[BUFFER_SIZE];
+    ram_profile_t profile;
 
-/*
-    // Clamp minimum speed
-    if ( ( T_int > 0 ) && ( T_int < MOTOR_SPEED_MIN ) )
+    if ( bytes > 0 )
     {
-        T_int = MOTOR_SPEED_MIN;
+        ram_warn_bytes = bytes;
+        ram_warned = 0xFFFF;
     }
-    else if ( ( T_int < 0 ) && ( T_int > -MOTOR_SPEED_MIN ) )
+    else if ( bytes < 0 )
     {
-        T_int = -MOTOR_SPEED_MIN;
-    }
-*/
-    if ( T_int < -MOTOR_SPEED_MAX )
-    {
-        T_int = -MOTOR_SPEED_MAX;
+        ram_warn_bytes = 0;
     }
 
-    if ( T_int > MOTOR_SPEED_MAX )
-    {
-        T_int = MOTOR_SPEED_MAX;
-    }
+    ram_profile_get( &profile );
 
-    // Set new motor commands
+    snprintf( buffer, BUFFER_SIZE, "d,RAM .data %04x %u .bss %04x %u\r\n",
+              profile.data_start, profile.data_bytes, profile.bss_start, profile.bss_bytes );
+    print_usb( buffer );
 
-/*
-    if ( T_int < 0 )
-    {
-        T_speed = -T_int;
-        T_reverse = 1;
-    }
-    else
-    {
-        T_speed = T_int;
-        T_reverse = 0;
-    }
+    snprintf( buffer, BUFFER_SIZE, "d,RAM heap %04x %u end %04x\r\n",
+              profile.heap_start, profile.heap_bytes, profile.ram_end );
+    print_usb( buffer );
+
+    snprintf( buffer, BUFFER_SIZE, "d,RAM stack max %u now %u headroom %u\r\n",
+              profile.stack_max, profile.stack_now, profile.headroom );
+    print_usb( buffer );
 
-    OCR2B = T_speed;
+    snprintf( buffer, BUFFER_SIZE, "d,RAM warn below %d\r\n", ram_warn_bytes );
+    print_usb( buffer );
+}
 
-    if (T_speed == 0)
+// Encoder counts and illegal transitions ('E,0'), or the decode cost ('E,1')
+// over 'count' edges of motor 2 forward and as many back, so the channel
+// ends where it started
+void report_encoders( int op, int count )
+{
+    static const uint8_t forward[4] = { 0, 1, 3, 2 };
+    char buffer[BUFFER_SIZE];
+    quadrature_snapshot_t snapshot;
+    uint8_t a_mask, b_mask, base, state, at, pins[4];
+    uint16_t start, ticks;
+    unsigned long cycles;
+    int i;
+    char cSREG;
+
+    if ( op != 1 )
     {
-        // Achieve a 0% duty cycle on the PWM pin by driving it low,
-        // disconnecting it from Timer2
-        TCCR2A &= ~(1<<COM2B1);
+        quadrature_get_snapshot( &snapshot );
+        snprintf( buffer, BUFFER_SIZE, "d,encoder m1 %ld err %u m2 %ld err %u\r\n",
+                  (long)snapshot.counts[QUADRATURE_M1], snapshot.errors[QUADRATURE_M1],
+                  (long)snapshot.counts[QUADRATURE_M2], snapshot.errors[QUADRATURE_M2] );
+        print_usb( buffer );
+        return;
     }
-    else
-    {
-        // Achieve a variable duty cycle on the PWM pin using Timer2.
-        TCCR2A |= 1<<COM2B1;
 
-        if (T_reverse)
-        {
-            set_digital_output(DIRB, HIGH);
-        }
-        else
-        {
-            set_digital_output(DIRB, LOW);
-        }
+    if ( ( count <= 0 ) || ( count > ENCODER_DECODES_MAX ) )
+    {
+        count = ENCODER_DECODES;
     }
-*/
-    set_motors( 0, T_int );
 
-}
-
-static void service_serial()
-{
-    static char buffer[BUFFER_SIZE];
+    a_mask = 1 << QUADRATURE_PORTA_BIT( PIN_ENCODER_2A );
+    b_mask = 1 << QUADRATURE_PORTA_BIT( PIN_ENCODER_2B );
 
-    // check for new serial input command
-    serial_check();
-    check_for_new_bytes_received();
+    cSREG = SREG;
+    cli();
 
-    snprintf( buffer, BUFFER_SIZE, "v,%d,%d,%d,%d,%d,%d,%d\r\n", (signed int)Pe_int, (signed int)Pr_int, (signed int)Pm_int, (signed int)Vm_int, (signed int)T_int, (signed int)(Kp_f*1000), (signed int)(Kd_f*1000) );
+    base = PINA;
+    state = ( ( base & a_mask ) ? 1 : 0 ) | ( ( base & b_mask ) ? 2 : 0 );
+    base &= ~( a_mask | b_mask );
 
-    if ( send_outputs == 1 )
+    at = 0;
+    for ( i = 0; i < 4; i++ )
     {
-        print_usb( buffer );
+        pins[i] = base | ( ( forward[i] & 1 ) ? a_mask : 0 ) | ( ( forward[i] & 2 ) ? b_mask : 0 );
+        if ( forward[i] == state )
+        {
+            at = i;
+        }
     }
-}
-
-void set_logging( int new_value )
-{
-    send_outputs = new_value;
-}
 
-void set_Pr( float new_ref )
-{
-    Pr_f += new_ref;
-}
+    start = TRACE_NOW();
+    for ( i = 0; i < count; i++ )
+    {
+        at = ( at + 1 ) & 3;
+        quadrature_decode( pins[at] );
+    }
+    for ( i = 0; i < count; i++ )
+    {
+        at = ( at - 1 ) & 3;
+        quadrature_decode( pins[at] );
+    }
+    ticks = TRACE_NOW() - start;
 
-void set_Kp( float new_Kp )
-{
-    Kp_f = new_Kp;
-}
+    SREG = cSREG;
 
-void set_Kd( float new_Kd )
-{
-    Kd_f = new_Kd;
+    // Includes the loop and the call; the ISR adds its entry and exit
+    cycles = (unsigned long)ticks * TRACE_TICK_CYCLES / ( 2 * count );
+    snprintf( buffer, BUFFER_SIZE, "d,encoder decode %lu cycles/edge, under %lu edges/s\r\n",
+              cycles, cycles ? CPU_FREQ / cycles : 0 );
+    print_usb( buffer );
 }
 
-
-
 void set_timer0( void )
 {
     cli();
@@ -294,16 +294,33 @@ void set_timer2( void )
     //Prescaler of 256
     timer_1284p_set_COM( TIMER_1284P_2, TIMER_1284P_B, TIMER_1284P_COM_CLEAR);
     timer_1284p_set_WGM( TIMER_1284P_2, TIMER_1284P_WGM_FAST_PWM );
-    timer_1284p_set_CS( TIMER_1284P_2, TIMER_1284P_CS_PRESCALE_DIV256_TIMER2);
+    timer_1284p_set_CS( TIMER_1284P_2, TIMER_1284P_CS_PRESCALE_DIV256);
 
     // Timer period (8-bit register)
-    timer_1284p_set_OCR( TIMER_1284P_1, TIMER_1284P_A, timer2_counter);
-    timer_1284p_set_OCR( TIMER_1284P_1, TIMER_1284P_B, 0);
+    timer_1284p_set_OCR( TIMER_1284P_2, TIMER_1284P_A, timer2_counter);
+    timer_1284p_set_OCR( TIMER_1284P_2, TIMER_1284P_B, 0);
+
+    // No interrupts: the PWM on OC2B runs in hardware, and there are no
+    // TIMER2 vectors to take them
+    timer_1284p_clr_IE( TIMER_1284P_2, TIMER_1284P_IE_B );
+    timer_1284p_clr_IE( TIMER_1284P_2, TIMER_1284P_IE_A );
+    timer_1284p_clr_IE( TIMER_1284P_2, TIMER_1284P_IE_OVERFLOW );
+}
 
-    // Enable for 0B, enable for 0A, and disable for 0 overflow
-    timer_1284p_set_IE( TIMER_1284P_1, TIMER_1284P_IE_B );
-    timer_1284p_set_IE( TIMER_1284P_1, TIMER_1284P_IE_A );
-    timer_1284p_clr_IE( TIMER_1284P_1, TIMER_1284P_IE_OVERFLOW );
+// Free running Timer3 at F_CPU/64 for the trace.h timestamps, no interrupts
+void set_timer3( void )
+{
+    cli();
+
+    timer_1284p_clr_counter( TIMER_1284P_3 );
+
+    timer_1284p_set_COM( TIMER_1284P_3, TIMER_1284P_A, TIMER_1284P_COM_NO_COMPARE );
+    timer_1284p_set_WGM( TIMER_1284P_3, TIMER_1284P_WGM_NORMAL );
+    timer_1284p_set_CS( TIMER_1284P_3, TIMER_1284P_CS_PRESCALE_DIV64 );
+
+    timer_1284p_clr_IE( TIMER_1284P_3, TIMER_1284P_IE_A );
+    timer_1284p_clr_IE( TIMER_1284P_3, TIMER_1284P_IE_B );
+    timer_1284p_clr_IE( TIMER_1284P_3, TIMER_1284P_IE_OVERFLOW );
 }
 
 void init_pwm( void )
@@ -320,14 +337,7 @@ ISR(TIMER0_COMPA_vect)
 
     cSREG = SREG;
 
-    static int i = 0;
-
-    i++;
-    if ( i >= NUM_MS_PER_CALC )
-    {
-        i = 0;
-        calculate();
-    }
+    timer_wheel_tick();
 
     SREG = cSREG;
 }
@@ -1,13 +1,20 @@
 #include "menu.h"
 
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <inttypes.h>
 #include <string.h>
 
-void set_logging( int );
-void set_Pr( float );
-void set_Kp( float );
-void set_Kd( float );
+#include "capture.h"
+#include "controller.h"
+#include "latency.h"
+#include "supervisor.h"
+#include "telemetry.h"
+#include "trace.h"
+
+void report_memory( int bytes );
+void report_encoders( int op, int count );
 
 #define ECHO2LCD
 
@@ -15,10 +22,10 @@ void set_Kd( float );
 char receive_buffer[32];
 char menuBuffer[32];
 unsigned char receive_buffer_position;
-char send_buffer[32];
 
-// Used to pass to USB_COMM for serial communication
-char tempBuffer[32];
+// Line being received into menuBuffer, see check_for_new_bytes_received()
+static uint8_t received;
+static uint8_t overflow;
 
 // A generic function for whenever you want to print to your serial comm window.
 // Provide a string and the length of that string. My serial comm likes "\r\n" at 
@@ -26,18 +33,70 @@ char tempBuffer[32];
 void print_usb_char( char buffer ) {
     char local_buf[2];
     local_buf[0] = buffer;
-    local_buf[1] = NULL;
+    local_buf[1] = '\0';
     print_usb( local_buf );
 }
 
 void print_usb( char *buffer )
 {
     int length;
+    char *message;
+
     length = strlen( buffer );
+
+    // Copied into a message block and queued, the caller's buffer is free
+    // again at once and nothing waits for the wire
+    message = ( length <= TELEMETRY_MESSAGE_SIZE ) ? telemetry_message_alloc() : NULL;
+    if ( message != NULL )
+    {
+        memcpy( message, buffer, length );
+        telemetry_message_send( message, length );
+        return;
+    }
+
+    // Too long, or no block free: send from the caller's buffer and wait
+    wait_for_sending_to_finish();
     serial_send( USB_COMM, buffer, length );
     wait_for_sending_to_finish();
 }
 
+// Format a reply straight into a message block, cut to the block rather
+// than overrunning it.  With the pool dry the queue is drained for one;
+// if there is still none the reply is dropped (the 'B' report counts it).
+static void reply( const char *format, ... )
+{
+    va_list args;
+    char *message;
+    int length;
+
+    message = telemetry_message_alloc();
+    if ( message == NULL )
+    {
+        telemetry_drain();
+        message = telemetry_message_alloc();
+        if ( message == NULL )
+        {
+            return;
+        }
+    }
+
+    va_start( args, format );
+    length = vsnprintf( message, TELEMETRY_MESSAGE_SIZE, format, args );
+    va_end( args );
+
+    if ( length < 0 )
+    {
+        telemetry_message_free( message );
+        return;
+    }
+    if ( length >= TELEMETRY_MESSAGE_SIZE )
+    {
+        length = TELEMETRY_MESSAGE_SIZE - 1;
+    }
+
+    telemetry_message_send( message, length );
+}
+
 //------------------------------------------------------------------------------------------
 // Initialize serial communication through USB and print menu options
 // This immediately readies the board for serial comm
@@ -51,7 +110,9 @@ void init_menu() {
 
     memset( menuBuffer, 0, sizeof(menuBuffer) );
     memset( receive_buffer, 0, sizeof(receive_buffer) );
-    memset( tempBuffer, 0, sizeof(tempBuffer) );
+    receive_buffer_position = 0;
+    received = 0;
+    overflow = 0;
 
 	// Start receiving bytes in the ring buffer.
 	serial_receive_ring(USB_COMM, receive_buffer, sizeof(receive_buffer));
@@ -65,6 +126,71 @@ void init_menu() {
 //	print_usb( MENU );
 }
 
+//------------------------------------------------------------------------------------------
+// Command frame "F,<seq>[,P<Kp*1000>][,D<Kd*1000>][,R<deg>]", applied by
+// calculate() all at once and acknowledged with "a," (see controller.h)
+static void parse_frame( const char *buffer )
+{
+    controller_frame_t frame;
+    const char *p = buffer + 2;
+    char *end;
+    long value;
+    char field;
+
+    value = strtol( p, &end, 10 );
+    if ( ( end == p ) || ( value < 0 ) || ( value > 0xFFFF ) )
+    {
+        controller_reject_frame( -1, CONTROLLER_FRAME_MALFORMED );
+        return;
+    }
+
+    frame.seq = (uint16_t)value;
+    frame.set = 0;
+    p = end;
+
+    while ( *p == ',' )
+    {
+        field = p[1];
+        field -= 32*(field>='a' && field<='z');
+
+        value = strtol( p + 2, &end, 10 );
+        if ( end == p + 2 )
+        {
+            field = 0;
+        }
+
+        switch ( field )
+        {
+            case 'P':
+                frame.Kp = value / 1000.0f;
+                frame.set |= CONTROLLER_FRAME_KP;
+                break;
+            case 'D':
+                frame.Kd = value / 1000.0f;
+                frame.set |= CONTROLLER_FRAME_KD;
+                break;
+            case 'R':
+                frame.Pr_step = value * 1.0f;
+                frame.set |= CONTROLLER_FRAME_PR;
+                break;
+            default:
+                controller_reject_frame( frame.seq, CONTROLLER_FRAME_MALFORMED );
+                return;
+        }
+
+        p = end;
+    }
+
+    if ( *p != '\0' )
+    {
+        controller_reject_frame( frame.seq, CONTROLLER_FRAME_MALFORMED );
+        return;
+    }
+
+    latency_parsed();
+    controller_submit_frame( &frame );
+}
+
 //------------------------------------------------------------------------------------------
 // process_received_byte: Parses a menu command (series of keystrokes) that 
 // has been received on USB_COMM and processes it accordingly.
@@ -76,37 +202,32 @@ void process_received_string(const char* buffer)
 	char op_char;
     int parsed;
     int new_int;
+    int new_int2;
     float new_float;
     int buf_size;
     int bad_input;
 
     buf_size = strlen( buffer );
 
-    memset( tempBuffer, 0, sizeof(tempBuffer) );
-
-cli();
-
-    sprintf( tempBuffer, "d,Received:%s\n", buffer );
-    print_usb( tempBuffer );
+    reply( "d,Received:%s\n", buffer );
 
     bad_input = 0;
     if ( buf_size < 3 )
     {
         bad_input = 1;
-        sprintf( tempBuffer, "d,Buffer size less than 3 (%d)\r\n", buf_size );
-        print_usb( tempBuffer);
+        reply( "d,Buffer size less than 3 (%d)\r\n", buf_size );
     }
     else if ( buffer[1] != ',' )
     {
         bad_input = 1;
-        sprintf( tempBuffer, "d,Second character not a comma\r\n" );
-        print_usb( tempBuffer );
+        reply( "d,Second character not a comma\r\n" );
     }
 
     if ( bad_input == 0 )
     {
         op_char = buffer[0];
         op_char -= 32*(op_char>='a' && op_char<='z');
+        TRACE( TRACE_COMMAND, op_char );
 
         switch (op_char)
         {
@@ -119,20 +240,103 @@ cli();
             case 'd':
                 parsed = sscanf( buffer, "%c,%d", &op_char, &new_int );
                 new_float = new_int / 1000.0f;
+                latency_parsed();
                 set_Kd( new_float );
                 break;
             case 'P':
             case 'p':
                 parsed = sscanf( buffer, "%c,%d", &op_char, &new_int );
                 new_float = new_int / 1000.0f;
+                latency_parsed();
                 set_Kp( new_float );
                 break;
+            case 'I':
+            case 'i':
+                parsed = sscanf( buffer, "%c,%d", &op_char, &new_int );
+                new_float = new_int / 1000.0f;
+                latency_parsed();
+                set_Ki( new_float );
+                break;
+            case 'K':
+            case 'k':
+                parsed = sscanf( buffer, "%c,%d", &op_char, &new_int );
+                latency_parsed();
+                set_law( new_int );
+                break;
             case 'R':
             case 'r':
                 parsed = sscanf( buffer, "%c,%d", &op_char, &new_int );
                 new_float = new_int *1.0f;
+                latency_parsed();
                 set_Pr( new_float );
                 break;
+            case 'A':
+            case 'a':
+                parsed = sscanf( buffer, "%c,%d", &op_char, &new_int );
+                start_autotune( new_int );
+                break;
+            case 'S':
+            case 's':
+                save_params();
+                break;
+            case 'M':
+            case 'm':
+                new_int = 0;
+                parsed = sscanf( buffer, "%c,%d", &op_char, &new_int );
+                report_memory( new_int );
+                break;
+            case 'E':
+            case 'e':
+                new_int = 0;
+                new_int2 = 0;
+                parsed = sscanf( buffer, "%c,%d,%d", &op_char, &new_int, &new_int2 );
+                report_encoders( new_int, new_int2 );
+                break;
+            case 'B':
+            case 'b':
+                new_int = -1;
+                parsed = sscanf( buffer, "%c,%d", &op_char, &new_int );
+                telemetry_command( new_int );
+                break;
+            case 'F':
+            case 'f':
+                parse_frame( buffer );
+                break;
+            case 'Z':
+            case 'z':
+                new_int = -1;
+                new_int2 = 0;
+                parsed = sscanf( buffer, "%c,%d,%d", &op_char, &new_int, &new_int2 );
+                latency_parsed();
+                set_friction( new_int, new_int2 );
+                break;
+            case 'C':
+            case 'c':
+                new_int = 0;
+                new_int2 = 0;
+                parsed = sscanf( buffer, "%c,%d,%d", &op_char, &new_int, &new_int2 );
+                capture_command( new_int, new_int2 );
+                break;
+            case 'T':
+            case 't':
+                new_int = -1;
+                new_int2 = 0;
+                parsed = sscanf( buffer, "%c,%d,%d", &op_char, &new_int, &new_int2 );
+                trace_command( new_int, new_int2 );
+                break;
+            case 'W':
+            case 'w':
+                new_int = 0;
+                new_int2 = 0;
+                parsed = sscanf( buffer, "%c,%d,%d", &op_char, &new_int, &new_int2 );
+                supervisor_command( new_int, new_int2 );
+                break;
+            case 'Y':
+            case 'y':
+                new_int = 0;
+                parsed = sscanf( buffer, "%c,%d", &op_char, &new_int );
+                latency_command( new_int );
+                break;
             default :
                 print_usb( "d,Entered default case for op code\n" );
                 break;
@@ -249,7 +453,6 @@ cli();
 			print_usb( "Command does not compute.\r\n" );
 		} // end switch(op_char) 
 */
-    sei();
 
 } //end menu()
 
@@ -265,51 +468,20 @@ void check_for_new_bytes_received()
 	Both of these are incremented % (size-of-buffer) to move through the buffer, and once the end is reached, to start back at the beginning.
 	This process and data structures are from the Pololu library. See examples/serial2/test.c and src/OrangutanSerial/ *
 	
-	A carriage return from your comm window initiates the transfer of your keystrokes.
-	All key strokes prior to the carriage return will be processed with a single call to this function (with multiple passes through this loop).
-	On the next function call, the carriage return is processes with a single pass through the loop.
-	The menuBuffer is used to hold all keystrokes prior to the carriage return. The "received" variable, which indexes menuBuffer, is reset to 0
-	after each carriage return.
+	A carriage return or a line feed ends a command, which is processed as soon as it has been read, so
+	several commands that arrive in one pass are each processed in turn.  The menuBuffer holds the keystrokes
+	of the command being received, across calls, indexed by "received".  A command longer than menuBuffer is
+	dropped whole with a "d,Line too long" reply rather than written past the end, and empty lines (the
+	other half of a "\r\n") are ignored.
 	*/ 
-	static int received = 0;
-    int evaluate = 0;
+	char c;
 
 	// while there are unprocessed keystrokes in the receive_buffer, grab them and buffer
 	// them into the menuBuffer
 	while(serial_get_received_bytes(USB_COMM) != receive_buffer_position)
 	{
-		// place in a buffer for processing
-		menuBuffer[received] = receive_buffer[receive_buffer_position];
-
-#ifdef ECHO_TO_COM
-print_usb_char( menuBuffer[received] );
-#endif
+		c = receive_buffer[receive_buffer_position];
 
-#ifdef ECHO2LCD
-lcd_goto_xy(0,0);
-print("RX:(");
-print_long(menuBuffer[received]);
-print_character(')');
-for (int i=0; i<(received+1); i++)
-{
-    print_character(menuBuffer[i]);
-}
-#endif
-
-        if ( menuBuffer[received] == '\r' )
-        {
-#ifdef ECHO_TO_COM
-            print_usb( "\n" );
-#endif
-            evaluate = 1;
-        }
-        else if (menuBuffer[received] == '\n')
-        {
-            evaluate = 1;
-        }
-
-++received;
-		
 		// Increment receive_buffer_position, but wrap around when it gets to
 		// the end of the buffer. 
 		if ( receive_buffer_position == sizeof(receive_buffer) - 1 )
@@ -320,26 +492,64 @@ for (int i=0; i<(received+1); i++)
 		{
 			receive_buffer_position++;
 		}
-	}
 
-	// If there were keystrokes processed, check if a menu command
-	if ( evaluate ) {
+#ifdef ECHO_TO_COM
+print_usb_char( c );
+#endif
+
+        if ( ( c == '\r' ) || ( c == '\n' ) )
+        {
+#ifdef ECHO_TO_COM
+            if ( c == '\r' )
+            {
+                print_usb( "\n" );
+            }
+#endif
+            if ( overflow )
+            {
+                reply( "d,Line too long, dropped\r\n" );
+            }
+            else if ( received > 0 )
+            {
+                latency_line( menuBuffer[0] );
 #ifdef ECHO2LCD
-		lcd_goto_xy(0,1);
-		print("RX:(");
-		print_long(received);
-		print_character(')');
-		for (int i=0; i<received; i++)
-		{
-			print_character(menuBuffer[i]);
-		}
+                lcd_goto_xy(0,1);
+                print("RX:(");
+                print_long(received);
+                print_character(')');
+                for (int i=0; i<received; i++)
+                {
+                    print_character(menuBuffer[i]);
+                }
 #endif
-		// Process buffer: terminate string, process, reset index to beginning of array to receive another command, removing terminators
-		menuBuffer[received-1] = '\0';
+                // Process buffer: terminate string, process, reset index to beginning of array to receive another command
+                menuBuffer[received] = '\0';
+                process_received_string(menuBuffer);
+                latency_line_done();
+            }
 
-		process_received_string(menuBuffer);
-		received = 0;
-		memset( menuBuffer, 0, sizeof(menuBuffer) );
+            received = 0;
+            overflow = 0;
+            memset( menuBuffer, 0, sizeof(menuBuffer) );
+        }
+        else if ( received < sizeof(menuBuffer) - 1 )
+        {
+            menuBuffer[received++] = c;
+#ifdef ECHO2LCD
+            lcd_goto_xy(0,0);
+            print("RX:(");
+            print_long(c);
+            print_character(')');
+            for (int i=0; i<received; i++)
+            {
+                print_character(menuBuffer[i]);
+            }
+#endif
+        }
+        else
+        {
+            overflow = 1;
+        }
 	}
 }
 
@@ -350,7 +560,7 @@ for (int i=0; i<(received+1); i++)
 // corrupt an existing transmission.
 void wait_for_sending_to_finish()
 {
-	while(!serial_send_buffer_empty(USB_COMM))
-		serial_check();		// USB_COMM port is always in SERIAL_CHECK mode
+    // Queued messages first, they were sent before whatever comes next
+    telemetry_drain();
 }
 
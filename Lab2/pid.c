@@ -0,0 +1,86 @@
+/* pid.c
+ *
+ * Fixed-point PID position law, see pid.h
+ */
+
+#include <inttypes.h>
+
+#include "pid.h"
+
+#define Q16_ONE 65536L
+
+// Round to the nearest step of 1 / 'one' and keep within +-'max'
+static int32_t to_fixed( float value, float one, int32_t max )
+{
+    float scaled = value * one;
+
+    if ( scaled > max )
+    {
+        return max;
+    }
+    if ( scaled < -max )
+    {
+        return -max;
+    }
+
+    return (int32_t)( scaled < 0 ? scaled - 0.5f : scaled + 0.5f );
+}
+
+void pid_gains_from_float( pid_gains_t *gains, float Kp, float Kd, float Ki, float calc_period_s, float velocity_window_s )
+{
+    gains->kp = (int16_t)to_fixed( Kp, 1 << PID_FRAC_BITS, INT16_MAX );
+    gains->kd = (int16_t)to_fixed( Kd * velocity_window_s / calc_period_s, 1 << PID_FRAC_BITS, INT16_MAX );
+    gains->ki = to_fixed( Ki * calc_period_s, Q16_ONE, INT16_MAX * Q16_ONE / 256 );
+}
+
+void pid_reset( pid_state_t *state, int position )
+{
+    state->integral = 0;
+    state->derivative = 0;
+    state->last_position = position;
+    state->p = state->i = state->d = 0;
+}
+
+int pid_step( pid_state_t *state, const pid_gains_t *gains, int error, int position, int limit )
+{
+    int32_t limit_q16 = (int32_t)limit * Q16_ONE;
+    int32_t p, d, output;
+
+    // Filtered change of the measurement, Q8 counts per call
+    state->derivative += ( (int32_t)( position - state->last_position ) * ( 1 << PID_FRAC_BITS ) - state->derivative ) >> PID_D_FILTER_SHIFT;
+    state->last_position = position;
+
+    p = (int32_t)gains->kp * error * ( 1 << ( 16 - PID_FRAC_BITS ) );
+    d = (int32_t)gains->kd * state->derivative;
+
+    // Conditional integration: not while saturated in the error's direction
+    output = p - d + state->integral;
+    if ( !( ( output > limit_q16 ) && ( error > 0 ) ) && !( ( output < -limit_q16 ) && ( error < 0 ) ) )
+    {
+        state->integral += gains->ki * error;
+        if ( state->integral > limit_q16 )
+        {
+            state->integral = limit_q16;
+        }
+        if ( state->integral < -limit_q16 )
+        {
+            state->integral = -limit_q16;
+        }
+    }
+
+    output = p - d + state->integral;
+    if ( output > limit_q16 )
+    {
+        output = limit_q16;
+    }
+    if ( output < -limit_q16 )
+    {
+        output = -limit_q16;
+    }
+
+    state->p = (int16_t)( p >> 16 );
+    state->i = (int16_t)( state->integral >> 16 );
+    state->d = (int16_t)( -d >> 16 );
+
+    return (int)( ( output + Q16_ONE / 2 ) >> 16 );
+}
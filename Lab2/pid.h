@@ -0,0 +1,62 @@
+/* pid.h
+ *
+ * Fixed-point PID position law, selected at runtime in place of the float PD
+ * law in calculate() ('K,1', see controller.h).
+ *
+ *      T = Kp e - Kd d + I
+ *
+ *      e   position error, counts
+ *      d   change of the measured position per calculate() call, through a
+ *          first order low pass (1 / 2^PID_D_FILTER_SHIFT of the new value
+ *          per call).  Taken on the measurement, not the error, so a
+ *          reference step does not kick the output.
+ *      I   running sum of Ki e dt.  It is held while the output is past the
+ *          limit and the error would drive it further (conditional
+ *          integration), and never goes past the limit itself, so it does
+ *          not wind up while the motor is saturated.
+ *
+ * The gains are the float Kp, Kd (per velocity window, as the PD law uses
+ * them) and Ki (per second), turned into per call fixed point values once in
+ * pid_gains_from_float() when they change.  pid_step() itself is integer
+ * only: Q8.8 Kp and Kd, Q16 Ki, and the terms worked in Q16 torque in 32
+ * bits.
+ */
+
+#ifndef __PID_H
+#define __PID_H
+
+#include <inttypes.h>
+
+#define PID_FRAC_BITS           8
+#define PID_D_FILTER_SHIFT      1
+
+typedef struct
+{
+    int16_t kp;                 // Q8.8 torque per count
+    int16_t kd;                 // Q8.8 torque per count per call
+    int32_t ki;                 // Q16 torque per count per call
+} pid_gains_t;
+
+typedef struct
+{
+    int32_t integral;           // Q16 torque
+    int32_t derivative;         // Q8 counts per call, filtered
+    int last_position;
+
+    // Terms of the last step in torque units, for telemetry
+    int16_t p;
+    int16_t i;
+    int16_t d;
+} pid_state_t;
+
+// 'calc_period_s' is the time between pid_step() calls and
+// 'velocity_window_s' the span Kd is given over
+void pid_gains_from_float( pid_gains_t *gains, float Kp, float Kd, float Ki, float calc_period_s, float velocity_window_s );
+
+// Clear the integral and start the derivative from 'position'
+void pid_reset( pid_state_t *state, int position );
+
+// One control cycle.  Returns the torque, within +-limit.
+int pid_step( pid_state_t *state, const pid_gains_t *gains, int error, int position, int limit );
+
+#endif //__PID_H
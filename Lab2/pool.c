@@ -0,0 +1,169 @@
+/* pool.c
+ *
+ * Fixed-block memory pool, see pool.h
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <stddef.h>
+#include <string.h>
+
+#include "pool.h"
+
+// The link to the next free block sits in the first bytes of a free block,
+// which need not be aligned for a pointer
+static uint8_t *get_next( const uint8_t *block )
+{
+    uint8_t *next;
+
+    memcpy( &next, block, sizeof(next) );
+    return next;
+}
+
+static void set_next( uint8_t *block, uint8_t *next )
+{
+    memcpy( block, &next, sizeof(next) );
+}
+
+// Block number of a pointer into the pool
+static uint8_t block_index( const pool_t *pool, const uint8_t *block )
+{
+    return (uint16_t)( block - pool->storage ) / pool->block_size;
+}
+
+void pool_init( pool_t *pool, void *storage, uint8_t block_size, uint8_t blocks )
+{
+    uint8_t i;
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    if ( blocks > POOL_BLOCKS_MAX )
+    {
+        blocks = POOL_BLOCKS_MAX;
+    }
+
+    pool->storage = storage;
+    pool->block_size = block_size;
+    pool->blocks = blocks;
+    pool->in_use = 0;
+    pool->high_water = 0;
+    pool->failures = 0;
+    pool->bad_frees = 0;
+    memset( pool->allocated, 0, sizeof(pool->allocated) );
+
+    pool->free_list = NULL;
+    for ( i = blocks; i > 0; i-- )
+    {
+        uint8_t *block = pool->storage + (uint16_t)( i - 1 ) * block_size;
+
+        set_next( block, pool->free_list );
+        pool->free_list = block;
+    }
+
+    SREG = cSREG;
+}
+
+void *pool_alloc( pool_t *pool )
+{
+    uint8_t *block;
+    uint8_t i;
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    block = pool->free_list;
+    if ( block != NULL )
+    {
+        pool->free_list = get_next( block );
+        i = block_index( pool, block );
+        pool->allocated[i >> 3] |= 1 << ( i & 7 );
+        if ( ++pool->in_use > pool->high_water )
+        {
+            pool->high_water = pool->in_use;
+        }
+    }
+    else
+    {
+        pool->failures++;
+    }
+
+    SREG = cSREG;
+
+    return block;
+}
+
+void pool_free( pool_t *pool, void *block )
+{
+    uint8_t *bytes = block;
+    uint16_t offset;
+    uint8_t i;
+    char cSREG;
+
+    if ( block == NULL )
+    {
+        return;
+    }
+
+    cSREG = SREG;
+    cli();
+
+    // Outside the storage, or inside a block
+    offset = (uint16_t)( bytes - pool->storage );
+    if ( ( bytes < pool->storage ) || ( offset >= (uint16_t)pool->blocks * pool->block_size ) || ( offset % pool->block_size ) )
+    {
+        pool->bad_frees++;
+        SREG = cSREG;
+        return;
+    }
+
+    // Already free
+    i = block_index( pool, bytes );
+    if ( !( pool->allocated[i >> 3] & ( 1 << ( i & 7 ) ) ) )
+    {
+        pool->bad_frees++;
+    }
+    else
+    {
+        pool->allocated[i >> 3] &= ~( 1 << ( i & 7 ) );
+        set_next( bytes, pool->free_list );
+        pool->free_list = bytes;
+        pool->in_use--;
+    }
+
+    SREG = cSREG;
+}
+
+void pool_get_stats( pool_t *pool, pool_stats_t *stats )
+{
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    stats->block_size = pool->block_size;
+    stats->blocks = pool->blocks;
+    stats->in_use = pool->in_use;
+    stats->high_water = pool->high_water;
+    stats->failures = pool->failures;
+    stats->bad_frees = pool->bad_frees;
+
+    SREG = cSREG;
+}
+
+void pool_clr_stats( pool_t *pool )
+{
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    pool->high_water = pool->in_use;
+    pool->failures = 0;
+    pool->bad_frees = 0;
+
+    SREG = cSREG;
+}
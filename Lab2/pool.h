@@ -0,0 +1,72 @@
+/* pool.h
+ *
+ * Fixed-block memory pool.
+ *
+ * A pool hands out blocks of one size from an array the user provides.  The
+ * free blocks are chained through their own first bytes, so alloc and free
+ * are a couple of pointer moves, taken with interrupts off and safe from
+ * ISRs, tasks and the main loop alike:
+ *
+ *      static uint8_t storage[8 * 64];
+ *      static pool_t pool;
+ *
+ *      pool_init( &pool, storage, 64, 8 );
+ *      block = pool_alloc( &pool );        NULL when all are in use
+ *      pool_free( &pool, block );
+ *
+ * An empty pool is not an error the pool can fix: pool_alloc() returns NULL
+ * and counts a failure, and the caller falls back on whatever it did
+ * before.  The most blocks ever in use at once is kept as a high water
+ * mark so the pool can be sized from a running board.
+ *
+ * A bit per block records which are handed out, so pool_free() of a pointer
+ * that is not the start of a block, or of a block already free, is counted
+ * in bad_frees and ignored rather than linked into the free list twice.
+ */
+
+#ifndef __POOL_H
+#define __POOL_H
+
+#include <inttypes.h>
+
+#define POOL_BLOCKS_MAX     64
+
+typedef struct
+{
+    uint8_t *storage;
+    uint8_t *free_list;                 // first free block, NULL when empty
+    uint8_t block_size;
+    uint8_t blocks;
+    uint8_t in_use;
+    uint8_t high_water;                 // most blocks in use at once
+    uint16_t failures;                  // pool_alloc() with none free
+    uint16_t bad_frees;                 // pool_free() of a pointer not from the pool, or freed twice
+    uint8_t allocated[POOL_BLOCKS_MAX / 8];     // bit per block handed out
+} pool_t;
+
+typedef struct
+{
+    uint8_t block_size;
+    uint8_t blocks;
+    uint8_t in_use;
+    uint8_t high_water;
+    uint16_t failures;
+    uint16_t bad_frees;
+} pool_stats_t;
+
+// 'storage' holds 'blocks' blocks of 'block_size' bytes, at least the size
+// of a pointer; at most POOL_BLOCKS_MAX blocks, more are not used
+void pool_init( pool_t *pool, void *storage, uint8_t block_size, uint8_t blocks );
+
+// A free block, or NULL
+void *pool_alloc( pool_t *pool );
+
+// Return a block from pool_alloc().  NULL is ignored.
+void pool_free( pool_t *pool, void *block );
+
+void pool_get_stats( pool_t *pool, pool_stats_t *stats );
+
+// Restart the high water mark and the failure counts from now
+void pool_clr_stats( pool_t *pool );
+
+#endif //__POOL_H
@@ -0,0 +1,157 @@
+/* quadrature.c
+ *
+ * Quadrature encoder driver, see quadrature.h
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "quadrature.h"
+
+#define ILLEGAL     2
+
+typedef struct
+{
+    uint8_t a_mask;                 // PINA bits of the two lines
+    uint8_t b_mask;
+    uint8_t previous;               // last state << 2, the table row
+    uint16_t errors;
+    int32_t count;
+} channel_t;
+
+// [previous << 2 | state], state = B << 1 | A
+static const int8_t transitions[16] =
+{
+    0,       1,       -1,      ILLEGAL,       // from 0
+    -1,      0,       ILLEGAL, 1,             // from 1
+    1,       ILLEGAL, 0,       -1,            // from 2
+    ILLEGAL, -1,      1,       0              // from 3
+};
+
+static volatile channel_t channels[QUADRATURE_CHANNELS];
+
+static inline uint8_t line_state( const volatile channel_t *channel, uint8_t pins )
+{
+    uint8_t state = 0;
+
+    if ( pins & channel->a_mask )
+    {
+        state |= 1;
+    }
+    if ( pins & channel->b_mask )
+    {
+        state |= 2;
+    }
+
+    return state;
+}
+
+static inline void decode_channel( volatile channel_t *channel, uint8_t pins )
+{
+    uint8_t state = line_state( channel, pins );
+    int8_t step = transitions[channel->previous | state];
+
+    channel->previous = state << 2;
+
+    if ( step == ILLEGAL )
+    {
+        channel->errors++;
+    }
+    else if ( step )
+    {
+        channel->count += step;
+    }
+}
+
+static inline void decode( uint8_t pins )
+{
+    decode_channel( &channels[QUADRATURE_M1], pins );
+    decode_channel( &channels[QUADRATURE_M2], pins );
+}
+
+static unsigned char on_porta( unsigned char pin )
+{
+    return ( pin >= QUADRATURE_PORTA_FIRST ) && ( pin <= QUADRATURE_PORTA_LAST );
+}
+
+unsigned char quadrature_init( unsigned char m1a, unsigned char m1b, unsigned char m2a, unsigned char m2b )
+{
+    uint8_t i, mask;
+    char cSREG;
+
+    if ( !on_porta( m1a ) || !on_porta( m1b ) || !on_porta( m2a ) || !on_porta( m2b ) )
+    {
+        return 0;
+    }
+
+    cSREG = SREG;
+    cli();
+
+    channels[QUADRATURE_M1].a_mask = 1 << QUADRATURE_PORTA_BIT( m1a );
+    channels[QUADRATURE_M1].b_mask = 1 << QUADRATURE_PORTA_BIT( m1b );
+    channels[QUADRATURE_M2].a_mask = 1 << QUADRATURE_PORTA_BIT( m2a );
+    channels[QUADRATURE_M2].b_mask = 1 << QUADRATURE_PORTA_BIT( m2b );
+
+    mask = 0;
+    for ( i = 0; i < QUADRATURE_CHANNELS; i++ )
+    {
+        channels[i].previous = line_state( &channels[i], PINA ) << 2;
+        channels[i].errors = 0;
+        channels[i].count = 0;
+        mask |= channels[i].a_mask | channels[i].b_mask;
+    }
+
+    // Inputs with the pull ups off, the encoders drive the lines
+    DDRA &= ~mask;
+    PORTA &= ~mask;
+
+    PCMSK0 |= mask;
+    PCIFR = ( 1 << PCIF0 );
+    PCICR |= ( 1 << PCIE0 );
+
+    SREG = cSREG;
+
+    return 1;
+}
+
+int32_t quadrature_get_count( uint8_t channel )
+{
+    int32_t count;
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    count = channels[channel].count;
+
+    SREG = cSREG;
+
+    return count;
+}
+
+void quadrature_get_snapshot( quadrature_snapshot_t *snapshot )
+{
+    uint8_t i;
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    for ( i = 0; i < QUADRATURE_CHANNELS; i++ )
+    {
+        snapshot->counts[i] = channels[i].count;
+        snapshot->errors[i] = channels[i].errors;
+    }
+
+    SREG = cSREG;
+}
+
+void quadrature_decode( uint8_t pins )
+{
+    decode( pins );
+}
+
+ISR( PCINT0_vect )
+{
+    decode( PINA );
+}
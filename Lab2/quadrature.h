@@ -0,0 +1,61 @@
+/* quadrature.h
+ *
+ * Quadrature encoder driver, in place of the Pololu encoders_*() calls.
+ *
+ * The library keeps 16 bit counts, which wrap after about 500 turns at 64
+ * counts a turn, and a single error bit per motor.  This driver keeps a 32
+ * bit count and a count of illegal transitions (both lines changed between
+ * two interrupts, so an edge was missed) for each of the two channels.
+ *
+ * Both encoders must be on PORTA, which is where the Orangutan SVP labs wire
+ * them, so one pin change interrupt (PCINT0) serves all four lines.  The ISR
+ * reads PINA once and, per channel, looks the previous and the new line
+ * state up in a 16 entry table:
+ *
+ *      state = B << 1 | A
+ *
+ *      forward     0 -> 1 -> 3 -> 2 -> 0
+ *      reverse     0 -> 2 -> 3 -> 1 -> 0
+ *      no change   0
+ *      both lines  illegal, the count is left alone
+ *
+ * which counts in the same direction as the library does.
+ *
+ * In Lab2 'E,1' times the decode on the board (report_encoders() in main.c).
+ */
+
+#ifndef __QUADRATURE_H
+#define __QUADRATURE_H
+
+#include <inttypes.h>
+
+#define QUADRATURE_M1           0
+#define QUADRATURE_M2           1
+#define QUADRATURE_CHANNELS     2
+
+// Pololu numbers PORTA backwards, IO_A0 is 31 down to IO_A7 at 24
+#define QUADRATURE_PORTA_FIRST  24
+#define QUADRATURE_PORTA_LAST   31
+#define QUADRATURE_PORTA_BIT( io_pin )  ( QUADRATURE_PORTA_LAST - (io_pin) )
+
+typedef struct
+{
+    int32_t counts[QUADRATURE_CHANNELS];
+    uint16_t errors[QUADRATURE_CHANNELS];       // illegal transitions, wrapping
+} quadrature_snapshot_t;
+
+// Same arguments as encoders_init(), Pololu IO_A* pin numbers.  Clears the
+// counts and errors and enables the interrupt.  Returns 0 when a pin is not
+// on PORTA.
+unsigned char quadrature_init( unsigned char m1a, unsigned char m1b, unsigned char m2a, unsigned char m2b );
+
+// Count of one channel, read with interrupts off
+int32_t quadrature_get_count( uint8_t channel );
+
+// Both counts and error counters from the same instant
+void quadrature_get_snapshot( quadrature_snapshot_t *snapshot );
+
+// The ISR's decode of a PINA value, callable outside the ISR to time it
+void quadrature_decode( uint8_t pins );
+
+#endif //__QUADRATURE_H
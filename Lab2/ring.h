@@ -0,0 +1,139 @@
+/* ring.h
+ *
+ * Typed ring buffers with the capacity fixed at compile time, in place of
+ * cbuf.h (Lab1), which only holds bytes, keeps the size in the struct and
+ * breaks quietly when it is not a power of two.
+ *
+ *      RING_DECLARE( sample_ring, capture_record_t, 64 )
+ *
+ * declares sample_ring_t and static inline functions for it:
+ *
+ *      sample_ring_init( &r )              empty it
+ *      sample_ring_count( &r )             entries held
+ *      sample_ring_empty( &r ), _full( &r )
+ *      sample_ring_push( &r, &item )       copy in, 0 when full
+ *      sample_ring_pop( &r, &item )        copy out oldest, 0 when empty
+ *      sample_ring_slot( &r )              next entry to fill in place,
+ *      sample_ring_commit( &r )            then add it; slot only when not full
+ *      sample_ring_overwrite( &r )         next entry, dropping the oldest
+ *                                          when full (history rings)
+ *      sample_ring_peek( &r, i )           i-th oldest, i < count
+ *      sample_ring_at( &r, index )         entry at a running index, head
+ *                                          and tail are running indexes
+ *
+ * The capacity must be a plain number (or a macro for one) and a power of
+ * two from 2 to 32768; anything else leaves RING_INDEX_<capacity> undefined
+ * and fails to compile.  The index type follows from it: uint8_t up to 128
+ * entries, uint16_t above.  head and tail run freely and are masked with
+ * the constant capacity - 1 when used, so count is head - tail and the ring
+ * holds all 'capacity' entries.
+ *
+ * Nothing here takes interrupts off; a ring shared with an ISR is locked by
+ * its user the way the rest of the code does (cSREG, cli()).
+ */
+
+#ifndef __RING_H
+#define __RING_H
+
+#include <inttypes.h>
+
+#define RING_INDEX_2        uint8_t
+#define RING_INDEX_4        uint8_t
+#define RING_INDEX_8        uint8_t
+#define RING_INDEX_16       uint8_t
+#define RING_INDEX_32       uint8_t
+#define RING_INDEX_64       uint8_t
+#define RING_INDEX_128      uint8_t
+#define RING_INDEX_256      uint16_t
+#define RING_INDEX_512      uint16_t
+#define RING_INDEX_1024     uint16_t
+#define RING_INDEX_2048     uint16_t
+#define RING_INDEX_4096     uint16_t
+#define RING_INDEX_8192     uint16_t
+#define RING_INDEX_16384    uint16_t
+#define RING_INDEX_32768    uint16_t
+
+// Expand a capacity macro before pasting it
+#define RING_DECLARE( name, type, capacity )    RING_DECLARE_( name, type, capacity )
+
+#define RING_DECLARE_( name, type, capacity )                                       \
+    typedef RING_INDEX_##capacity name##_index_t;                                   \
+                                                                                    \
+    typedef struct                                                                  \
+    {                                                                               \
+        type items[capacity];                                                       \
+        name##_index_t head;                                                        \
+        name##_index_t tail;                                                        \
+    } name##_t;                                                                     \
+                                                                                    \
+    static inline void name##_init( name##_t *ring )                                \
+    {                                                                               \
+        ring->head = 0;                                                             \
+        ring->tail = 0;                                                             \
+    }                                                                               \
+                                                                                    \
+    static inline name##_index_t name##_count( const name##_t *ring )               \
+    {                                                                               \
+        return (name##_index_t)( ring->head - ring->tail );                         \
+    }                                                                               \
+                                                                                    \
+    static inline uint8_t name##_empty( const name##_t *ring )                      \
+    {                                                                               \
+        return ring->head == ring->tail;                                            \
+    }                                                                               \
+                                                                                    \
+    static inline uint8_t name##_full( const name##_t *ring )                       \
+    {                                                                               \
+        return name##_count( ring ) == (capacity);                                  \
+    }                                                                               \
+                                                                                    \
+    static inline type *name##_at( name##_t *ring, name##_index_t index )           \
+    {                                                                               \
+        return &ring->items[index & ( (capacity) - 1 )];                            \
+    }                                                                               \
+                                                                                    \
+    static inline type *name##_peek( name##_t *ring, name##_index_t i )             \
+    {                                                                               \
+        return name##_at( ring, (name##_index_t)( ring->tail + i ) );               \
+    }                                                                               \
+                                                                                    \
+    static inline type *name##_slot( name##_t *ring )                               \
+    {                                                                               \
+        return name##_at( ring, ring->head );                                       \
+    }                                                                               \
+                                                                                    \
+    static inline void name##_commit( name##_t *ring )                              \
+    {                                                                               \
+        ring->head++;                                                               \
+    }                                                                               \
+                                                                                    \
+    static inline type *name##_overwrite( name##_t *ring )                          \
+    {                                                                               \
+        if ( name##_full( ring ) )                                                  \
+        {                                                                           \
+            ring->tail++;                                                           \
+        }                                                                           \
+        return name##_at( ring, ring->head++ );                                     \
+    }                                                                               \
+                                                                                    \
+    static inline uint8_t name##_push( name##_t *ring, const type *item )           \
+    {                                                                               \
+        if ( name##_full( ring ) )                                                  \
+        {                                                                           \
+            return 0;                                                               \
+        }                                                                           \
+        *name##_at( ring, ring->head++ ) = *item;                                   \
+        return 1;                                                                   \
+    }                                                                               \
+                                                                                    \
+    static inline uint8_t name##_pop( name##_t *ring, type *item )                  \
+    {                                                                               \
+        if ( name##_empty( ring ) )                                                 \
+        {                                                                           \
+            return 0;                                                               \
+        }                                                                           \
+        *item = *name##_at( ring, ring->tail++ );                                   \
+        return 1;                                                                   \
+    }
+
+#endif //__RING_H
@@ -0,0 +1,275 @@
+/* supervisor.c
+ *
+ * Watchdog supervisor, see supervisor.h
+ */
+
+#include <pololu/orangutan.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "controller.h"
+#include "menu.h"
+#include "supervisor.h"
+#include "timer_wheel.h"
+
+#define LINE_SIZE 64
+#define RECORD_MAGIC 0x5D0C
+
+#define HANG_NONE 0xFF
+
+// Survives a watchdog reset.  Cleared at power up and brown out, when the
+// RAM holds nothing worth reading.
+typedef struct
+{
+    uint16_t magic;
+    uint16_t resets;
+    uint8_t cause;
+    uint8_t client;
+    uint16_t late_ms;
+    uint16_t deadline_ms;
+    uint32_t at_ms;
+} record_t;
+
+static record_t record __attribute__(( section( ".noinit" ) ));
+
+static const char *cause_names[SUPERVISOR_CAUSE_NUM] = { "none", "deadline", "stall" };
+static const char *client_names[SUPERVISOR_CLIENTS] = { "control", "loop" };
+
+static supervisor_reset_t last_reset;
+
+static timer_wheel_timer_t check_timer;
+
+// Shared with the tick
+static uint16_t deadline[SUPERVISOR_CLIENTS];
+static volatile uint16_t age[SUPERVISOR_CLIENTS];
+static volatile uint16_t worst[SUPERVISOR_CLIENTS];
+static volatile uint8_t tripped;
+static volatile uint8_t hang;
+
+void supervisor_boot( void )
+{
+    uint8_t flags;
+
+    flags = MCUSR;
+    MCUSR = 0;
+    wdt_disable();
+
+    if ( ( record.magic != RECORD_MAGIC ) || ( flags & ( ( 1 << PORF ) | ( 1 << BORF ) ) ) )
+    {
+        memset( &record, 0, sizeof(record) );
+        record.magic = RECORD_MAGIC;
+    }
+
+    last_reset.reset_flags = flags;
+    last_reset.cause = SUPERVISOR_CAUSE_NONE;
+    last_reset.client = 0;
+    last_reset.late_ms = 0;
+    last_reset.deadline_ms = 0;
+    last_reset.at_ms = 0;
+
+    if ( flags & ( 1 << WDRF ) )
+    {
+        record.resets++;
+        last_reset.cause = ( record.cause == SUPERVISOR_CAUSE_DEADLINE ) ? SUPERVISOR_CAUSE_DEADLINE : SUPERVISOR_CAUSE_STALL;
+        if ( last_reset.cause == SUPERVISOR_CAUSE_DEADLINE )
+        {
+            last_reset.client = record.client;
+            last_reset.late_ms = record.late_ms;
+            last_reset.deadline_ms = record.deadline_ms;
+            last_reset.at_ms = record.at_ms;
+        }
+    }
+    last_reset.resets = record.resets;
+
+    // This run has not missed anything yet
+    record.cause = SUPERVISOR_CAUSE_NONE;
+
+    tripped = 0;
+    hang = HANG_NONE;
+}
+
+// The ms tick, in the timer ISR
+static void check( void *context )
+{
+    uint8_t i;
+
+    (void)context;
+
+    if ( tripped )
+    {
+        set_motors( 0, 0 );
+        return;
+    }
+
+    for ( i = 0; i < SUPERVISOR_CLIENTS; i++ )
+    {
+        if ( age[i] < 0xFFFF )
+        {
+            age[i]++;
+        }
+
+        if ( deadline[i] && ( age[i] > deadline[i] ) )
+        {
+            set_motors( 0, 0 );
+            tripped = 1;
+
+            record.cause = SUPERVISOR_CAUSE_DEADLINE;
+            record.client = i;
+            record.late_ms = age[i];
+            record.deadline_ms = deadline[i];
+            record.at_ms = timer_wheel_now();
+
+            // No more kicks, the watchdog takes it from here
+            return;
+        }
+    }
+
+    wdt_reset();
+}
+
+void supervisor_init( void )
+{
+    uint8_t i;
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    deadline[SUPERVISOR_CONTROL] = SUPERVISOR_CONTROL_MS;
+    deadline[SUPERVISOR_LOOP] = SUPERVISOR_LOOP_MS;
+    for ( i = 0; i < SUPERVISOR_CLIENTS; i++ )
+    {
+        age[i] = 0;
+        worst[i] = 0;
+    }
+
+    timer_wheel_setup( &check_timer, check, 0, 0 );
+    timer_wheel_arm( &check_timer, 0, 1 );
+
+    wdt_enable( SUPERVISOR_WDT_TIMEOUT );
+
+    SREG = cSREG;
+}
+
+void supervisor_checkin( uint8_t client )
+{
+    char cSREG;
+
+    // 'W,4,0': stuck in calculate()
+    if ( ( client == SUPERVISOR_CONTROL ) && ( hang == SUPERVISOR_CONTROL ) )
+    {
+        while ( 1 );
+    }
+
+    cSREG = SREG;
+    cli();
+
+    if ( age[client] > worst[client] )
+    {
+        worst[client] = age[client];
+    }
+    age[client] = 0;
+
+    SREG = cSREG;
+}
+
+unsigned char supervisor_tripped( void )
+{
+    return tripped;
+}
+
+void supervisor_set_deadline( uint8_t client, uint16_t ms )
+{
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    deadline[client] = ms;
+    age[client] = 0;
+
+    SREG = cSREG;
+}
+
+void supervisor_get_reset( supervisor_reset_t *reset )
+{
+    *reset = last_reset;
+}
+
+void supervisor_command( int op, int arg )
+{
+    char reply[LINE_SIZE];
+    uint16_t worst_copy[SUPERVISOR_CLIENTS];
+    uint8_t i;
+    char cSREG;
+
+    switch ( op )
+    {
+        case 0:
+            break;
+        case 1:
+            supervisor_set_deadline( SUPERVISOR_CONTROL, arg < 0 ? 0 : arg );
+            break;
+        case 2:
+            supervisor_set_deadline( SUPERVISOR_LOOP, arg < 0 ? 0 : arg );
+            break;
+        case 3:
+            cSREG = SREG;
+            cli();
+            for ( i = 0; i < SUPERVISOR_CLIENTS; i++ )
+            {
+                worst[i] = 0;
+            }
+            SREG = cSREG;
+            break;
+        case 4:
+            if ( arg == SUPERVISOR_CONTROL )
+            {
+                // Caught at calculate()'s next check-in
+                hang = SUPERVISOR_CONTROL;
+                print_usb( "d,supervisor hanging control\r\n" );
+                return;
+            }
+            print_usb( "d,supervisor hanging\r\n" );
+            wait_for_sending_to_finish();
+            if ( arg != SUPERVISOR_LOOP )
+            {
+                cli();
+            }
+            while ( 1 );
+        default:
+            print_usb( "d,supervisor op 0 report 1 control 2 loop ms 3 clear 4 hang\r\n" );
+            return;
+    }
+
+    cSREG = SREG;
+    cli();
+    for ( i = 0; i < SUPERVISOR_CLIENTS; i++ )
+    {
+        worst_copy[i] = worst[i];
+    }
+    SREG = cSREG;
+
+    snprintf( reply, LINE_SIZE, "d,supervisor ms control %u of %u, loop %u of %u\r\n",
+              worst_copy[SUPERVISOR_CONTROL], deadline[SUPERVISOR_CONTROL],
+              worst_copy[SUPERVISOR_LOOP], deadline[SUPERVISOR_LOOP] );
+    print_usb( reply );
+
+    snprintf( reply, LINE_SIZE, "d,last reset %s flags %02x, %u watchdog resets\r\n",
+              cause_names[last_reset.cause], last_reset.reset_flags, last_reset.resets );
+    print_usb( reply );
+
+    if ( last_reset.cause == SUPERVISOR_CAUSE_DEADLINE )
+    {
+        snprintf( reply, LINE_SIZE, "d,last trip %s %u of %u ms at %lu ms\r\n",
+                  client_names[last_reset.client], last_reset.late_ms, last_reset.deadline_ms,
+                  (unsigned long)last_reset.at_ms );
+        print_usb( reply );
+    }
+}
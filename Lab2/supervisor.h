@@ -0,0 +1,99 @@
+/* supervisor.h
+ *
+ * Watchdog supervisor for the control cycle and the main loop.
+ *
+ * calculate() and service_serial() check in every time they run.  A 1 ms
+ * timer_wheel.h timer, i.e. the timer ISR, ages both check-ins and kicks the
+ * hardware watchdog only while each is within its deadline.  When one is
+ * late the tick
+ *
+ *      sets the motors to zero, and keeps them there (calculate() too),
+ *      writes which client was late and by how much to a record in .noinit,
+ *      stops kicking, so the watchdog resets the board SUPERVISOR_WDT_MS on.
+ *
+ * If the tick itself stops (interrupts left off, or calculate() hung in the
+ * timer ISR when it runs there) nothing is written and the watchdog resets
+ * the board SUPERVISOR_WDT_MS after the last kick; the reset puts the motor
+ * pins back to inputs, which stops the motors.  The record then shows a
+ * watchdog reset with no deadline miss, a "stall".
+ *
+ * Worst case from the last check-in of a hung client:
+ *
+ *      motors at zero      deadline + 1 ms
+ *      board reset         deadline + 1 ms + SUPERVISOR_WDT_MS
+ *      tick stopped        SUPERVISOR_WDT_MS (motors stop at the reset)
+ *
+ * The deadlines are set with 'W' and the longest gap between check-ins
+ * seen is kept per client, to size them from a running board.  'W,0' also
+ * reports the record left by the last reset.  host/lab2_sim.cpp (watchdog)
+ * measures the latencies on the simulated board.
+ */
+
+#ifndef __SUPERVISOR_H
+#define __SUPERVISOR_H
+
+#include <inttypes.h>
+
+#include <avr/wdt.h>
+
+#define SUPERVISOR_CONTROL      0       // calculate()
+#define SUPERVISOR_LOOP         1       // service_serial()
+#define SUPERVISOR_CLIENTS      2
+
+// Power up deadlines, ms since the last check-in; 0 leaves a client
+// unsupervised
+#define SUPERVISOR_CONTROL_MS   ( 2 * NUM_MS_PER_CALC )
+#define SUPERVISOR_LOOP_MS      250
+
+// Hardware watchdog period, nominal: the watchdog oscillator is only good
+// to about 10%
+#define SUPERVISOR_WDT_TIMEOUT  WDTO_30MS
+#define SUPERVISOR_WDT_MS       32
+
+typedef enum
+{
+    SUPERVISOR_CAUSE_NONE,              // not a watchdog reset
+    SUPERVISOR_CAUSE_DEADLINE,          // a client missed its deadline
+    SUPERVISOR_CAUSE_STALL,             // watchdog reset, the tick had stopped
+    SUPERVISOR_CAUSE_NUM
+} SUPERVISOR_CAUSE_E;
+
+// Why the board last reset, as supervisor_get_reset() gives it
+typedef struct
+{
+    uint8_t cause;                      // SUPERVISOR_CAUSE_E
+    uint8_t client;                     // SUPERVISOR_CAUSE_DEADLINE: which
+    uint16_t late_ms;                   // its time since checking in
+    uint16_t deadline_ms;
+    uint32_t at_ms;                     // timer_wheel_now() when caught
+    uint8_t reset_flags;                // MCUSR
+    uint16_t resets;                    // watchdog resets since power up
+} supervisor_reset_t;
+
+// First thing in main(): reads and clears the reset flags, turns the
+// watchdog off (it stays on at 15 ms after a watchdog reset) and takes the
+// record the last run left
+void supervisor_boot( void );
+
+// Start supervising: deadlines to the power up ones, the 1 ms check timer
+// armed and the watchdog on.  After timer_wheel_init(), just before the
+// timer interrupt is enabled.
+void supervisor_init( void );
+
+// Called by the client each time it runs
+void supervisor_checkin( uint8_t client );
+
+// 1 once a deadline has been missed, until the reset
+unsigned char supervisor_tripped( void );
+
+// 0 turns the client's supervision off
+void supervisor_set_deadline( uint8_t client, uint16_t ms );
+
+void supervisor_get_reset( supervisor_reset_t *reset );
+
+// 'W,<op>[,<arg>]': 0 report, 1 control and 2 loop deadline (ms), 3 clear
+// the worst gaps, 4 hang on purpose to test it: arg 0 in calculate(), 1 in
+// the main loop, 2 with interrupts off
+void supervisor_command( int op, int arg );
+
+#endif //__SUPERVISOR_H
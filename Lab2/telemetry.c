@@ -0,0 +1,293 @@
+/* telemetry.c
+ *
+ * Batched telemetry sending, see telemetry.h
+ */
+
+#include <pololu/orangutan.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "menu.h"
+#include "pool.h"
+#include "ring.h"
+#include "telemetry.h"
+#include "trace.h"
+
+// Room for the longest 'B' line at full width; the usual ones still fit a
+// TELEMETRY_MESSAGE_SIZE block, a longer one is sent by print_usb() directly
+#define REPLY_SIZE 96
+
+typedef struct
+{
+    char *data;
+    uint8_t length;
+} message_t;
+
+RING_DECLARE( message_queue, message_t, 8 )
+
+static char blocks[2][TELEMETRY_BLOCK_SIZE];
+static uint8_t filling;                 // index of the block being filled
+static uint8_t fill_length;
+static unsigned long fill_start_ms;     // get_ms() of its first line
+
+static uint16_t latency_ms;
+
+static telemetry_stats_t stats;
+
+static uint8_t message_storage[TELEMETRY_MESSAGES * TELEMETRY_MESSAGE_SIZE];
+static pool_t messages;
+static message_queue_t queue;
+static char *on_wire;                   // message block being sent from
+
+// Once the wire is free: the message block on it has gone, so free it, and
+// start the next queued one
+static void pump_messages( void )
+{
+    message_t message;
+
+    if ( !serial_send_buffer_empty( USB_COMM ) )
+    {
+        return;
+    }
+
+    if ( on_wire != NULL )
+    {
+        pool_free( &messages, on_wire );
+        on_wire = NULL;
+    }
+
+    if ( message_queue_pop( &queue, &message ) )
+    {
+        serial_send( USB_COMM, message.data, message.length );
+        on_wire = message.data;
+        stats.messages++;
+    }
+}
+
+// Send the queued messages and wait for the wire, USB_COMM is in
+// SERIAL_CHECK mode.  Returns 0 when there was nothing to wait for.
+static uint8_t drain( void )
+{
+    pump_messages();
+    if ( serial_send_buffer_empty( USB_COMM ) && message_queue_empty( &queue ) )
+    {
+        return 0;
+    }
+
+    while ( !serial_send_buffer_empty( USB_COMM ) || !message_queue_empty( &queue ) )
+    {
+        serial_check();
+        pump_messages();
+    }
+
+    // Free the last one
+    pump_messages();
+
+    return 1;
+}
+
+// Wait for the previous send to drain before sending a block
+static void wait_for_wire( void )
+{
+    uint16_t start = TRACE_NOW();
+
+    if ( drain() )
+    {
+        stats.stalls++;
+        stats.wait_ticks += (uint16_t)( TRACE_NOW() - start );
+    }
+}
+
+static void send_block( void )
+{
+    if ( !fill_length )
+    {
+        return;
+    }
+
+    wait_for_wire();
+    serial_send( USB_COMM, blocks[filling], fill_length );
+
+    stats.blocks++;
+    stats.bytes += fill_length;
+
+    filling ^= 1;
+    fill_length = 0;
+}
+
+void telemetry_init( void )
+{
+    filling = 0;
+    fill_length = 0;
+    latency_ms = TELEMETRY_DEFAULT_LATENCY_MS;
+    pool_init( &messages, message_storage, TELEMETRY_MESSAGE_SIZE, TELEMETRY_MESSAGES );
+    message_queue_init( &queue );
+    on_wire = NULL;
+    telemetry_clr_stats();
+}
+
+void telemetry_set_latency( uint16_t ms )
+{
+    telemetry_flush();
+    latency_ms = ms;
+}
+
+uint16_t telemetry_get_latency( void )
+{
+    return latency_ms;
+}
+
+void telemetry_write( const char *line, uint8_t length )
+{
+    uint16_t start = TRACE_NOW();
+
+    if ( length > TELEMETRY_BLOCK_SIZE )
+    {
+        length = TELEMETRY_BLOCK_SIZE;
+    }
+
+    if ( length > TELEMETRY_BLOCK_SIZE - fill_length )
+    {
+        send_block();
+    }
+
+    if ( !fill_length )
+    {
+        fill_start_ms = get_ms();
+    }
+
+    memcpy( &blocks[filling][fill_length], line, length );
+    fill_length += length;
+    stats.samples++;
+
+    if ( !latency_ms )
+    {
+        // One send per line, waiting for it like print_usb()
+        send_block();
+        wait_for_wire();
+    }
+
+    stats.cost_ticks += (uint16_t)( TRACE_NOW() - start );
+}
+
+void telemetry_poll( void )
+{
+    uint16_t start;
+
+    pump_messages();
+
+    if ( !fill_length || ( get_ms() - fill_start_ms < latency_ms ) )
+    {
+        return;
+    }
+
+    start = TRACE_NOW();
+    send_block();
+    stats.cost_ticks += (uint16_t)( TRACE_NOW() - start );
+}
+
+void telemetry_flush( void )
+{
+    send_block();
+}
+
+char *telemetry_message_alloc( void )
+{
+    // Blocks whose send has finished are only freed by a pump
+    pump_messages();
+
+    return pool_alloc( &messages );
+}
+
+void telemetry_message_send( char *message, uint8_t length )
+{
+    message_t entry;
+
+    if ( length > TELEMETRY_MESSAGE_SIZE )
+    {
+        length = TELEMETRY_MESSAGE_SIZE;
+    }
+
+    entry.data = message;
+    entry.length = length;
+
+    // The queue holds every block of the pool
+    message_queue_push( &queue, &entry );
+    pump_messages();
+}
+
+void telemetry_message_free( char *message )
+{
+    pool_free( &messages, message );
+}
+
+void telemetry_drain( void )
+{
+    drain();
+}
+
+void telemetry_get_message_pool( pool_stats_t *copy )
+{
+    pool_get_stats( &messages, copy );
+}
+
+void telemetry_get_stats( telemetry_stats_t *copy )
+{
+    *copy = stats;
+}
+
+void telemetry_clr_stats( void )
+{
+    memset( &stats, 0, sizeof(stats) );
+    stats.start_ms = get_ms();
+    pool_clr_stats( &messages );
+}
+
+// ticks * TRACE_TICK_CYCLES / count without overflowing on long runs
+static unsigned long ticks_to_cycles( uint32_t ticks, uint32_t count )
+{
+    return ( ticks / count ) * TRACE_TICK_CYCLES + ( ticks % count ) * TRACE_TICK_CYCLES / count;
+}
+
+void telemetry_command( int ms )
+{
+    telemetry_stats_t copy;
+    pool_stats_t pool_stats;
+    char reply[REPLY_SIZE];
+    unsigned long elapsed;
+    unsigned long per_sample = 0;
+    unsigned long wait_per_sample = 0;
+
+    telemetry_flush();
+    telemetry_get_stats( &copy );
+    telemetry_get_message_pool( &pool_stats );
+
+    elapsed = get_ms() - copy.start_ms;
+    if ( !elapsed )
+    {
+        elapsed = 1;
+    }
+    if ( copy.samples )
+    {
+        per_sample = ticks_to_cycles( copy.cost_ticks, copy.samples );
+        wait_per_sample = ticks_to_cycles( copy.wait_ticks, copy.samples );
+    }
+
+    snprintf( reply, REPLY_SIZE, "d,telemetry latency %u ms, %lu samples %lu ms\r\n", latency_ms, (unsigned long)copy.samples, elapsed );
+    print_usb( reply );
+    snprintf( reply, REPLY_SIZE, "d,%lu samples/s %lu sends/s %lu stalls\r\n", (unsigned long)copy.samples * 1000 / elapsed, (unsigned long)copy.blocks * 1000 / elapsed, (unsigned long)copy.stalls );
+    print_usb( reply );
+    snprintf( reply, REPLY_SIZE, "d,%lu cycles/sample, %lu waiting\r\n", per_sample, wait_per_sample );
+    print_usb( reply );
+    snprintf( reply, REPLY_SIZE, "d,%lu messages, pool %u x %u high %u failed %u\r\n", (unsigned long)copy.messages,
+              pool_stats.blocks, pool_stats.block_size, pool_stats.high_water, pool_stats.failures );
+    print_usb( reply );
+
+    if ( ms >= 0 )
+    {
+        telemetry_set_latency( ms );
+        telemetry_clr_stats();
+    }
+}
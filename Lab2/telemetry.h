@@ -0,0 +1,105 @@
+/* telemetry.h
+ *
+ * Batched sending of the Lab2 "v," telemetry lines.
+ *
+ * Lines are copied into one of two TELEMETRY_BLOCK_SIZE blocks.  The Pololu
+ * serial_send() transmits straight out of the caller's buffer, so while one
+ * block is on the wire the other fills, and a block is handed to
+ * serial_send() when
+ *
+ *      the next line would not fit (size), or
+ *      its oldest line has waited the maximum latency (age, checked by
+ *      telemetry_poll() every main loop / serial task pass), or
+ *      telemetry_flush() is called.
+ *
+ * Only when a full block is ready before the previous one has drained does
+ * the sender wait, so the CPU no longer spins for every line.  A latency of
+ * 0 sends every line on its own and waits for it to drain, as print_usb()
+ * does, for comparison.
+ *
+ * print_usb() waits for a block in flight before sending, so "d," lines
+ * are not corrupted, but they can overtake "v," lines still being batched
+ * by up to the latency.
+ *
+ * The time spent in telemetry_write() / telemetry_poll(), waits included,
+ * is counted on the trace.h Timer3 clock for the 'B' report.
+ *
+ * Other messages ("d," replies) go out of TELEMETRY_MESSAGE_SIZE blocks
+ * from a pool.h pool: the sender builds the message in a block from
+ * telemetry_message_alloc() and hands it over with telemetry_message_send().
+ * It is queued, sent straight out of the block when the wire is free, and
+ * the block goes back to the pool once it has gone, so nothing waits for
+ * the wire unless the pool runs dry.  print_usb() copies into a block
+ * this way.  Queued messages go out before the next telemetry block.  The
+ * message functions are for the main loop / serial task only.
+ */
+
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#include <inttypes.h>
+
+#include "pool.h"
+
+#define TELEMETRY_BLOCK_SIZE            250     // serial_send() takes an unsigned char
+#define TELEMETRY_DEFAULT_LATENCY_MS    50
+
+#define TELEMETRY_MESSAGE_SIZE          64
+#define TELEMETRY_MESSAGES              6       // at most 8, the queue length
+
+typedef struct
+{
+    uint32_t samples;
+    uint32_t blocks;                    // serial_send() calls
+    uint32_t bytes;
+    uint32_t stalls;                    // sends that waited for the other block
+    uint32_t cost_ticks;                // TRACE_NOW() counts in the send path
+    uint32_t wait_ticks;                // of which waiting for the wire
+    uint32_t messages;                  // message blocks sent
+    unsigned long start_ms;             // get_ms() at the last clear
+} telemetry_stats_t;
+
+void telemetry_init( void );
+
+// Maximum time a line waits in a block, 0 for a send per line
+void telemetry_set_latency( uint16_t ms );
+uint16_t telemetry_get_latency( void );
+
+// Queue one line
+void telemetry_write( const char *line, uint8_t length );
+
+// Move the message queue along, and send the filling block if it has
+// reached the maximum latency
+void telemetry_poll( void );
+
+// Send the filling block now
+void telemetry_flush( void );
+
+// A TELEMETRY_MESSAGE_SIZE block to build a message in, NULL when every
+// block is queued or on the wire
+char *telemetry_message_alloc( void );
+
+// Queue 'length' bytes of a block from telemetry_message_alloc().  The block
+// belongs to the send path from here on and is freed once sent.
+void telemetry_message_send( char *message, uint8_t length );
+
+// Give back a block that is not going to be sent
+void telemetry_message_free( char *message );
+
+// Send every queued message and wait for the wire to go quiet, for code
+// that calls serial_send() itself
+void telemetry_drain( void );
+
+// Message pool stats (pool.h)
+void telemetry_get_message_pool( pool_stats_t *stats );
+
+void telemetry_get_stats( telemetry_stats_t *stats );
+void telemetry_clr_stats( void );
+
+// 'B' menu command: report the stats since the last clear, ending with the
+// message count and pool usage ("d,<n> messages, pool <blocks> x <size>
+// high <n> failed <n>"), then with <ms> >= 0 set the maximum latency and
+// clear them
+void telemetry_command( int ms );
+
+#endif //__TELEMETRY_H
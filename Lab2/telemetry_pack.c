@@ -0,0 +1,79 @@
+/* telemetry_pack.c
+ *
+ * Packed telemetry records, see telemetry_pack.h
+ */
+
+#include <inttypes.h>
+
+#include "telemetry_pack.h"
+
+static int16_t previous[TELEMETRY_PACK_FIELDS];
+static uint8_t seq;
+static uint8_t since_keyframe;
+
+static uint8_t *put_zigzag( uint8_t *p, int16_t value )
+{
+    uint16_t u = (uint16_t)( (uint16_t)value << 1 ) ^ ( value < 0 ? 0xFFFF : 0 );
+
+    while ( u >= 0x80 )
+    {
+        *p++ = (uint8_t)( u | 0x80 );
+        u >>= 7;
+    }
+    *p++ = (uint8_t)u;
+
+    return p;
+}
+
+void telemetry_pack_reset( void )
+{
+    since_keyframe = 0;
+}
+
+uint8_t telemetry_pack_sample( const int16_t *values, uint8_t *out )
+{
+    uint8_t *p = out + 3;
+    uint8_t *bitmap;
+    uint8_t i;
+
+    out[2] = seq++;
+
+    if ( since_keyframe == 0 )
+    {
+        out[0] = TELEMETRY_PACK_KEYFRAME;
+        for ( i = 0; i < TELEMETRY_PACK_FIELDS; i++ )
+        {
+            p = put_zigzag( p, values[i] );
+        }
+    }
+    else
+    {
+        out[0] = TELEMETRY_PACK_DELTA;
+        bitmap = p++;
+        *bitmap = 0;
+        for ( i = 0; i < TELEMETRY_PACK_FIELDS; i++ )
+        {
+            int16_t change = (int16_t)( (uint16_t)values[i] - (uint16_t)previous[i] );
+
+            if ( change )
+            {
+                *bitmap |= 1 << i;
+                p = put_zigzag( p, change );
+            }
+        }
+    }
+
+    for ( i = 0; i < TELEMETRY_PACK_FIELDS; i++ )
+    {
+        previous[i] = values[i];
+    }
+
+    if ( ++since_keyframe == TELEMETRY_PACK_KEYFRAME_INTERVAL )
+    {
+        since_keyframe = 0;
+    }
+
+    out[1] = (uint8_t)( p - out - 2 );
+
+    return (uint8_t)( p - out );
+}
@@ -0,0 +1,45 @@
+/* telemetry_pack.h
+ *
+ * Packed binary form of the "v," telemetry sample, sent instead of the text
+ * line with logging mode 2 ('L,2').
+ *
+ * Every record starts with a byte no text line starts with, so records and
+ * "d," lines can share the stream:
+ *
+ *      type        TELEMETRY_PACK_KEYFRAME or TELEMETRY_PACK_DELTA
+ *      length      bytes after this one
+ *      seq         counts up by one per record
+ *      keyframe:   the 7 fields as zigzag varints
+ *      delta:      bitmap, bit i set when field i changed, then the change
+ *                  of each of those fields as a zigzag varint
+ *
+ * Fields are in "v," line order (Pe, Pr, Pm, Vm, T, Kp*1000, Kd*1000) and
+ * wrap as 16 bit ints, so a change is never more than 3 varint bytes.  A
+ * zigzag varint is the value mapped to unsigned as 0, -1, 1, -2, ... ->
+ * 0, 1, 2, 3, ..., 7 bits per byte, low first, top bit set on every byte
+ * but the last.
+ *
+ * A keyframe goes out every TELEMETRY_PACK_KEYFRAME_INTERVAL records and
+ * after telemetry_pack_reset(), so a reader that missed bytes (the seq
+ * shows it) picks up again at the next one.  host/packed_frame.h decodes
+ * the stream.
+ */
+
+#ifndef __TELEMETRY_PACK_H
+#define __TELEMETRY_PACK_H
+
+#include <inttypes.h>
+
+#define TELEMETRY_PACK_KEYFRAME             0xF1
+#define TELEMETRY_PACK_DELTA                0xF2
+#define TELEMETRY_PACK_FIELDS               7
+#define TELEMETRY_PACK_MAX_BYTES            ( 4 + 3 * TELEMETRY_PACK_FIELDS )
+#define TELEMETRY_PACK_KEYFRAME_INTERVAL    32
+
+// Next record is a keyframe
+void telemetry_pack_reset( void );
+
+// Pack one sample into 'out' (TELEMETRY_PACK_MAX_BYTES), returns the bytes used
+uint8_t telemetry_pack_sample( const int16_t *values, uint8_t *out );
+
+#endif //__TELEMETRY_PACK_H
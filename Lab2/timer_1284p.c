@@ -4,12 +4,70 @@
  *  Author: Kyle
  */
 
-#ifndef __TIMER_1284P_H
-#define __TIMER_1284P_H
-
 #include "timer_1284p.h"
 #include <pololu/orangutan.h>
 
+#define WGM_UNSUPPORTED 0xFF
+#define CS_UNSUPPORTED  0xFF
+
+// WGMn3:0 for each TIMER_1284P_WGM_E (datasheet tables 14-8, 15-5 and 17-8)
+static const unsigned char wgm_bits_8bit[TIMER_1284P_WGM_NUM] =
+{
+    0,                  // NORMAL
+    2,                  // CTC
+    7,                  // FAST_PWM
+    3,                  // FAST_PWM_8BIT
+    WGM_UNSUPPORTED,    // FAST_PWM_9BIT
+    WGM_UNSUPPORTED,    // FAST_PWM_10BIT
+    5,                  // PHASE_CORRECT
+    1,                  // PHASE_CORRECT_8BIT
+    WGM_UNSUPPORTED,    // PHASE_CORRECT_9BIT
+    WGM_UNSUPPORTED     // PHASE_CORRECT_10BIT
+};
+
+static const unsigned char wgm_bits_16bit[TIMER_1284P_WGM_NUM] =
+{
+    0,                  // NORMAL
+    4,                  // CTC
+    15,                 // FAST_PWM
+    5,                  // FAST_PWM_8BIT
+    6,                  // FAST_PWM_9BIT
+    7,                  // FAST_PWM_10BIT
+    11,                 // PHASE_CORRECT
+    1,                  // PHASE_CORRECT_8BIT
+    2,                  // PHASE_CORRECT_9BIT
+    3                   // PHASE_CORRECT_10BIT
+};
+
+// CSn2:0 for each TIMER_1284P_CS_E (datasheet tables 14-9 and 17-9)
+static const unsigned char cs_bits_timer013[TIMER_1284P_CS_NUM] =
+{
+    0,                  // DISABLE
+    1,                  // DIV1
+    2,                  // DIV8
+    CS_UNSUPPORTED,     // DIV32
+    3,                  // DIV64
+    CS_UNSUPPORTED,     // DIV128
+    4,                  // DIV256
+    5,                  // DIV1024
+    6,                  // EXT_FALL_EDGE
+    7                   // EXT_RISE_EDGE
+};
+
+static const unsigned char cs_bits_timer2[TIMER_1284P_CS_NUM] =
+{
+    0,                  // DISABLE
+    1,                  // DIV1
+    2,                  // DIV8
+    3,                  // DIV32
+    4,                  // DIV64
+    5,                  // DIV128
+    6,                  // DIV256
+    7,                  // DIV1024
+    CS_UNSUPPORTED,     // EXT_FALL_EDGE
+    CS_UNSUPPORTED      // EXT_RISE_EDGE
+};
+
 void timer_1284p_set_COM(TIMER_1284P_E timer, TIMER_1284P_AB_E ab, TIMER_1284P_COM_E com)
 {
     int reg_val;
@@ -62,111 +120,65 @@ void timer_1284p_set_COM(TIMER_1284P_E timer, TIMER_1284P_AB_E ab, TIMER_1284P_C
 
 void timer_1284p_set_WGM(TIMER_1284P_E timer, TIMER_1284P_WGM_E wgm)
 {
+    int bits;
     int reg_val_a, reg_val_b;
     int mask_a;
     int mask_b;
 
+    if ( wgm >= TIMER_1284P_WGM_NUM )
+    {
+        return;
+    }
+
+    // WGMn1:0 are bits 1:0 of TCCRnA on every timer, WGMn2 is bit 3 of TCCRnB
+    // and WGMn3 (16-bit timers only) is bit 4
     switch( timer )
     {
         case TIMER_1284P_0:
-            switch ( wgm )
-            {
-                case TIMER_1284P_WGM_NORMAL:
-                    reg_val_a = (0<<WGM00) | (0<<WGM01);
-                    reg_val_b = (0<<WGM02);
-                    break;
-                case TIMER_1284P_WGM_CTC:
-                    reg_val_a = (0<<WGM00) | (1<<WGM01);
-                    reg_val_b = (0<<WGM02);
-                    break;
-                default:
-                    reg_val_a = 0;
-                    reg_val_b = 0;
-                    break;
-            }
-
+        case TIMER_1284P_2:
+            bits = wgm_bits_8bit[wgm];
             mask_a = (1<<WGM00) | (1<<WGM01);
             mask_b = (1<<WGM02);
+            break;
+        case TIMER_1284P_1:
+        case TIMER_1284P_3:
+            bits = wgm_bits_16bit[wgm];
+            mask_a = (1<<WGM10) | (1<<WGM11);
+            mask_b = (1<<WGM12) | (1<<WGM13);
+            break;
+        default:
+            return;
+    }
+
+    if ( bits == WGM_UNSUPPORTED )
+    {
+        return;
+    }
 
+    reg_val_a = ( bits & 0x3 ) << WGM00;
+    reg_val_b = ( ( bits >> 2 ) & 0x3 ) << WGM12;
+
+    switch( timer )
+    {
+        case TIMER_1284P_0:
             TCCR0A &= ~mask_a;
             TCCR0A |= reg_val_a;
             TCCR0B &= ~mask_b;
             TCCR0B |= reg_val_b;
             break;
         case TIMER_1284P_1:
-            switch ( wgm )
-            {
-                case TIMER_1284P_WGM_NORMAL:
-                    reg_val_a = (0<<WGM13) | (0<<WGM11);
-                    reg_val_b = (0<<WGM12) | (0<<WGM13);
-                    break;
-                case TIMER_1284P_WGM_CTC:
-                    reg_val_a = (0<<WGM10) | (0<<WGM11);
-                    reg_val_b = (1<<WGM12) | (0<<WGM13);
-                    break;
-                default:
-                    reg_val_a = 0;
-                    reg_val_b = 0;
-                    break;
-            }
-
-            mask_a = (1<<WGM10) | (1<<WGM11);
-            mask_b = (1<<WGM12) | (1<<WGM13);
-
             TCCR1A &= ~mask_a;
             TCCR1A |= reg_val_a;
             TCCR1B &= ~mask_b;
             TCCR1B |= reg_val_b;
             break;
         case TIMER_1284P_2:
-            switch ( wgm )
-            {
-                case TIMER_1284P_WGM_NORMAL:
-                    reg_val_a = (0<<WGM20) | (0<<WGM21);
-                    reg_val_b = (0<<WGM22);
-                    break;
-                case TIMER_1284P_WGM_CTC:
-                    reg_val_a = (0<<WGM20) | (1<<WGM21);
-                    reg_val_b = (0<<WGM22);
-                    break;
-                case TIMER_1284P_WGM_FAST_PWM:
-                    reg_val_a = (1<<WGM20) | (1<<WGM21);
-                    reg_val_b = (1<<WGM22);
-                    break;
-                default:
-                    reg_val_a = 0;
-                    reg_val_b = 0;
-                    break;
-            }
-
-            mask_a = (1<<WGM20) | (1<<WGM21);
-            mask_b = (1<<WGM22);
-
             TCCR2A &= ~mask_a;
             TCCR2A |= reg_val_a;
             TCCR2B &= ~mask_b;
             TCCR2B |= reg_val_b;
             break;
         case TIMER_1284P_3:
-            switch ( wgm )
-            {
-                case TIMER_1284P_WGM_NORMAL:
-                    reg_val_a = (0<<WGM33) | (0<<WGM31);
-                    reg_val_b = (0<<WGM32) | (0<<WGM33);
-                    break;
-                case TIMER_1284P_WGM_CTC:
-                    reg_val_a = (0<<WGM30) | (0<<WGM31);
-                    reg_val_b = (1<<WGM32) | (0<<WGM33);
-                    break;
-                default:
-                    reg_val_a = 0;
-                    reg_val_b = 0;
-                    break;
-            }
-
-            mask_a = (1<<WGM30) | (1<<WGM31);
-            mask_b = (1<<WGM32) | (1<<WGM33);
-
             TCCR3A &= ~mask_a;
             TCCR3A |= reg_val_a;
             TCCR3B &= ~mask_b;
@@ -179,10 +191,22 @@ void timer_1284p_set_WGM(TIMER_1284P_E timer, TIMER_1284P_WGM_E wgm)
 
 void timer_1284p_set_CS(TIMER_1284P_E timer, TIMER_1284P_CS_E cs)
 {
+    int bits;
     int reg_val;
     int mask;
 
-    reg_val = ( cs & 0x7 ) << CS00;
+    if ( cs >= TIMER_1284P_CS_NUM )
+    {
+        return;
+    }
+
+    bits = ( timer == TIMER_1284P_2 ) ? cs_bits_timer2[cs] : cs_bits_timer013[cs];
+    if ( bits == CS_UNSUPPORTED )
+    {
+        return;
+    }
+
+    reg_val = bits << CS00;
     mask = (1<<CS00) | (1<<CS01) | (1<<CS02);
 
     switch( timer )
@@ -196,6 +220,8 @@ void timer_1284p_set_CS(TIMER_1284P_E timer, TIMER_1284P_CS_E cs)
             TCCR1B |= reg_val;
             break;
         case TIMER_1284P_2:
+            TCCR2B &= ~mask;
+            TCCR2B |= reg_val;
             break;
         case TIMER_1284P_3:
             TCCR3B &= ~mask;
@@ -248,6 +274,7 @@ void timer_1284p_set_OCR(TIMER_1284P_E timer, TIMER_1284P_AB_E ab, int duration_
                 default:
                     break;
             }
+            break;
         case TIMER_1284P_3:
             switch ( ab )
             {
@@ -266,7 +293,8 @@ void timer_1284p_set_OCR(TIMER_1284P_E timer, TIMER_1284P_AB_E ab, int duration_
     }
 }
 
-void timer_1284p_set_IE(TIMER_1284P_E timer, TIMER_1284P_INT_E interrupt)
+// OCIEnA, OCIEnB and TOIEn sit at the same bit positions in every TIMSKn
+static int timer_1284p_IE_bit(TIMER_1284P_INT_E interrupt)
 {
     int reg_value;
 
@@ -286,6 +314,15 @@ void timer_1284p_set_IE(TIMER_1284P_E timer, TIMER_1284P_INT_E interrupt)
             break;
     }
 
+    return reg_value;
+}
+
+void timer_1284p_set_IE(TIMER_1284P_E timer, TIMER_1284P_INT_E interrupt)
+{
+    int reg_value;
+
+    reg_value = timer_1284p_IE_bit( interrupt );
+
     switch( timer )
     {
         case TIMER_1284P_0:
@@ -295,6 +332,7 @@ void timer_1284p_set_IE(TIMER_1284P_E timer, TIMER_1284P_INT_E interrupt)
             TIMSK1 |= reg_value;
             break;
         case TIMER_1284P_2:
+            TIMSK2 |= reg_value;
             break;
         case TIMER_1284P_3:
             TIMSK3 |= reg_value;
@@ -306,57 +344,51 @@ void timer_1284p_set_IE(TIMER_1284P_E timer, TIMER_1284P_INT_E interrupt)
 
 void timer_1284p_clr_counter(TIMER_1284P_E timer)
 {
+    timer_1284p_set_counter( timer, 0 );
+}
+
+void timer_1284p_clr_IE(TIMER_1284P_E timer, TIMER_1284P_INT_E interrupt)
+{
+    int reg_value;
+
+    reg_value = timer_1284p_IE_bit( interrupt );
+
     switch( timer )
     {
         case TIMER_1284P_0:
-            TCNT0 = 0;
+            TIMSK0 &= ~reg_value;
             break;
         case TIMER_1284P_1:
-            TCNT1 = 0;
+            TIMSK1 &= ~reg_value;
             break;
         case TIMER_1284P_2:
+            TIMSK2 &= ~reg_value;
             break;
         case TIMER_1284P_3:
-            TCNT3 = 0;
+            TIMSK3 &= ~reg_value;
             break;
         default:
             break;
     }
 }
 
-void timer_1284p_clr_IE(TIMER_1284P_E timer, TIMER_1284P_INT_E interrupt)
+void timer_1284p_set_counter(TIMER_1284P_E timer, int value)
 {
-    int reg_value;
-
-    switch ( interrupt )
-    {
-        case TIMER_1284P_IE_B:
-            reg_value = (1<<OCIE0B);
-            break;
-        case TIMER_1284P_IE_A:
-            reg_value = (1<<OCIE0A);
-            break;
-        case TIMER_1284P_IE_OVERFLOW:
-            reg_value = (1<<TOIE0);
-            break;
-        default:
-            reg_value = 0;
-            break;
-    }
-
     switch( timer )
     {
         case TIMER_1284P_0:
-            TIMSK0 &= ~reg_value;
+            TCNT0 = value;
             break;
         case TIMER_1284P_1:
-            TIMSK1 &= ~reg_value;
+            TCNT1 = value;
             break;
         case TIMER_1284P_2:
+            TCNT2 = value;
             break;
         case TIMER_1284P_3:
-            TIMSK3 &= ~reg_value;
-            default:
+            TCNT3 = value;
+            break;
+        default:
             break;
     }
 }
@@ -376,6 +408,7 @@ int timer_1284p_get_counter(TIMER_1284P_E timer)
         ret_value = TCNT1;
         break;
     case TIMER_1284P_2:
+        ret_value = TCNT2;
         break;
     case TIMER_1284P_3:
         ret_value = TCNT3;
@@ -387,4 +420,58 @@ int timer_1284p_get_counter(TIMER_1284P_E timer)
     return ret_value;
 }
 
-#endif
+void timer_1284p_set_async(TIMER_1284P_ASYNC_E clock)
+{
+    unsigned char timsk;
+    unsigned char assr;
+
+    switch ( clock )
+    {
+        case TIMER_1284P_ASYNC_CRYSTAL:
+            assr = (1<<AS2);
+            break;
+        case TIMER_1284P_ASYNC_EXT_CLOCK:
+            // EXCLK has to be set before AS2
+            ASSR = (1<<EXCLK);
+            assr = (1<<EXCLK) | (1<<AS2);
+            break;
+        case TIMER_1284P_ASYNC_OFF:
+        default:
+            assr = 0;
+            break;
+    }
+
+    // 1. Mask the Timer 2 interrupts while the clock changes
+    timsk = TIMSK2;
+    TIMSK2 = 0;
+
+    // 2. Select the clock
+    ASSR = assr;
+
+    // 3. Rewrite TCNT2, OCR2x and TCCR2x, their contents may be corrupted by
+    //    the switch; the timer is left stopped
+    TCNT2 = 0;
+    OCR2A = 0;
+    OCR2B = 0;
+    TCCR2A = 0;
+    TCCR2B = 0;
+
+    // 4. Wait for the writes to reach the asynchronous domain
+    timer_1284p_wait_async_update();
+
+    // 5. Clear any flags the switch raised, then put the masks back
+    TIFR2 = (1<<OCF2B) | (1<<OCF2A) | (1<<TOV2);
+    TIMSK2 = timsk;
+}
+
+void timer_1284p_wait_async_update(void)
+{
+    if ( ( ASSR & (1<<AS2) ) == 0 )
+    {
+        return;
+    }
+
+    while ( ASSR & ( (1<<TCN2UB) | (1<<OCR2AUB) | (1<<OCR2BUB) | (1<<TCR2AUB) | (1<<TCR2BUB) ) )
+    {
+    }
+}
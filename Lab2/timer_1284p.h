@@ -4,7 +4,21 @@
  *  Author: Kyle
  */
 
-typedef enum 
+#ifndef __TIMER_1284P_H
+#define __TIMER_1284P_H
+
+/*
+** Thin wrappers over the ATmega1284P timer registers (doc8272):
+**   - Timers 0 and 2 are 8-bit, Timers 1 and 3 are 16-bit
+**   - Timer 2 has its own prescaler encoding (adds /32 and /128, no external
+**     clock pin) and can run asynchronously from TOSC1 (32.768 kHz crystal
+**     or an external clock), see timer_1284p_set_async()
+**
+** The Pololu library uses Timer 2 for the SVP motor PWM and Timer 1 for the
+** buzzer, so only take them when those features are not in use.
+*/
+
+typedef enum
 {
     TIMER_1284P_0,
     TIMER_1284P_1,
@@ -17,15 +31,26 @@ typedef enum
 {
     TIMER_1284P_COM_NO_COMPARE = 0,
     TIMER_1284P_COM_TOGGLE = 1,
-    TIMER_1284P_COM_CLEAR = 2,
-    TIMER_1284P_COM_SET = 3
+    TIMER_1284P_COM_CLEAR = 2,      // PWM modes: non-inverting
+    TIMER_1284P_COM_SET = 3         // PWM modes: inverting
 } TIMER_1284P_COM_E;
 
+// TOP for each mode.  Modes without a 9 or 10 bit TOP only exist on the
+// 16-bit timers; timer_1284p_set_WGM() leaves an 8-bit timer unchanged for
+// them.
 typedef enum
 {
-    TIMER_1284P_WGM_NORMAL,
-    TIMER_1284P_WGM_CTC,
-    TIMER_1284P_WGM_FAST_PWM
+    TIMER_1284P_WGM_NORMAL,                 // 0xFF / 0xFFFF
+    TIMER_1284P_WGM_CTC,                    // OCRnA
+    TIMER_1284P_WGM_FAST_PWM,               // OCRnA
+    TIMER_1284P_WGM_FAST_PWM_8BIT,          // 0xFF
+    TIMER_1284P_WGM_FAST_PWM_9BIT,          // 0x1FF, Timers 1 and 3
+    TIMER_1284P_WGM_FAST_PWM_10BIT,         // 0x3FF, Timers 1 and 3
+    TIMER_1284P_WGM_PHASE_CORRECT,          // OCRnA
+    TIMER_1284P_WGM_PHASE_CORRECT_8BIT,     // 0xFF
+    TIMER_1284P_WGM_PHASE_CORRECT_9BIT,     // 0x1FF, Timers 1 and 3
+    TIMER_1284P_WGM_PHASE_CORRECT_10BIT,    // 0x3FF, Timers 1 and 3
+    TIMER_1284P_WGM_NUM
 } TIMER_1284P_WGM_E;
 
 typedef enum
@@ -34,17 +59,21 @@ typedef enum
     TIMER_1284P_FOC_ACTIVE,
 } TIMER_1284P_FOC_E;
 
+// Clock selects.  Not every timer has every divider, timer_1284p_set_CS()
+// leaves the timer unchanged for one it does not have.
 typedef enum
 {
-    TIMER_1284P_CS_DISABLE = 0,
-    TIMER_1284P_CS_PRESCALE_DIV1 = 1,
-    TIMER_1284P_CS_PRESCALE_DIV8 = 2,
-    TIMER_1284P_CS_PRESCALE_DIV64 = 3,
-    TIMER_1284P_CS_PRESCALE_DIV256 = 4,
-    TIMER_1284P_CS_PRESCALE_DIV1024 = 5,
-    TIMER_1284P_CS_EXT_FALL_EDGE = 6,
-    TIMER_1284P_CS_EXT_RISE_EDGE = 7,
-    TIMER_1284P_CS_PRESCALE_DIV256_TIMER2 = 6
+    TIMER_1284P_CS_DISABLE,
+    TIMER_1284P_CS_PRESCALE_DIV1,
+    TIMER_1284P_CS_PRESCALE_DIV8,
+    TIMER_1284P_CS_PRESCALE_DIV32,      // Timer 2 only
+    TIMER_1284P_CS_PRESCALE_DIV64,
+    TIMER_1284P_CS_PRESCALE_DIV128,     // Timer 2 only
+    TIMER_1284P_CS_PRESCALE_DIV256,
+    TIMER_1284P_CS_PRESCALE_DIV1024,
+    TIMER_1284P_CS_EXT_FALL_EDGE,       // Tn pin, not Timer 2
+    TIMER_1284P_CS_EXT_RISE_EDGE,       // Tn pin, not Timer 2
+    TIMER_1284P_CS_NUM
 } TIMER_1284P_CS_E;
 
 typedef enum
@@ -60,6 +89,14 @@ typedef enum
     TIMER_1284P_IE_OVERFLOW,
 } TIMER_1284P_INT_E;
 
+// Timer 2 clock source
+typedef enum
+{
+    TIMER_1284P_ASYNC_OFF,              // I/O clock
+    TIMER_1284P_ASYNC_CRYSTAL,          // crystal on TOSC1/TOSC2
+    TIMER_1284P_ASYNC_EXT_CLOCK         // external clock on TOSC1
+} TIMER_1284P_ASYNC_E;
+
 void timer_1284p_set_COM(TIMER_1284P_E, TIMER_1284P_AB_E, TIMER_1284P_COM_E);
 void timer_1284p_set_WGM(TIMER_1284P_E, TIMER_1284P_WGM_E);
 void timer_1284p_set_CS(TIMER_1284P_E, TIMER_1284P_CS_E);
@@ -69,4 +106,18 @@ void timer_1284p_set_IE(TIMER_1284P_E, TIMER_1284P_INT_E);
 void timer_1284p_clr_counter(TIMER_1284P_E);
 void timer_1284p_clr_IE(TIMER_1284P_E, TIMER_1284P_INT_E);
 
+void timer_1284p_set_counter(TIMER_1284P_E, int);
 int timer_1284p_get_counter(TIMER_1284P_E);
+
+// Switch Timer 2 between the I/O clock and TOSC1, following the datasheet
+// sequence (Timer 2 interrupts masked, registers rewritten, wait for the
+// update, stale flags cleared).  Timer 2 is stopped afterwards; set the mode,
+// OCR and clock select again, then re-enable its interrupts.
+void timer_1284p_set_async(TIMER_1284P_ASYNC_E);
+
+// In asynchronous mode writes to TCNT2, OCR2x and TCCR2x take a couple of
+// TOSC1 cycles to land.  Wait for them before writing the same register
+// again or before going to power save.
+void timer_1284p_wait_async_update(void);
+
+#endif //__TIMER_1284P_H
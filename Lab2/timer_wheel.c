@@ -0,0 +1,290 @@
+/* timer_wheel.c
+ *
+ * Hierarchical timer wheel on the 1 ms tick, see timer_wheel.h
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "timer_wheel.h"
+
+#define SLOT_MASK ( TIMER_WHEEL_SLOTS - 1 )
+
+static timer_wheel_timer_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+// Timers due on the tick being run, so a callback can cancel one of them
+static timer_wheel_timer_t *expiring;
+
+// Deferred expiries, oldest first
+static timer_wheel_timer_t *deferred;
+static timer_wheel_timer_t **deferred_tail;
+
+// Next tick to run; timer_wheel_now() is the one before
+static uint32_t base;
+
+static timer_wheel_stats_t stats;
+static uint16_t tick_work;
+
+static void push( timer_wheel_timer_t **head, timer_wheel_timer_t *timer )
+{
+    timer->next = *head;
+    if ( timer->next )
+    {
+        timer->next->pprev = &timer->next;
+    }
+    *head = timer;
+    timer->pprev = head;
+}
+
+static void unlink_timer( timer_wheel_timer_t *timer )
+{
+    if ( !timer->pprev )
+    {
+        return;
+    }
+
+    if ( timer->next )
+    {
+        timer->next->pprev = timer->pprev;
+    }
+    else if ( deferred_tail == &timer->next )
+    {
+        deferred_tail = timer->pprev;
+    }
+
+    *timer->pprev = timer->next;
+    timer->next = 0;
+    timer->pprev = 0;
+    timer->queued = 0;
+}
+
+// Put the timer in the slot its expiry falls in, counting from 'base'
+static void insert( timer_wheel_timer_t *timer )
+{
+    uint32_t ticks = timer->expires - base;
+    uint8_t level;
+
+    if ( (int32_t)ticks < 0 )
+    {
+        // Already due, run it on the next tick
+        timer->expires = base;
+        ticks = 0;
+    }
+    else if ( ticks > TIMER_WHEEL_MAX_DELAY )
+    {
+        timer->expires = base + TIMER_WHEEL_MAX_DELAY;
+        ticks = TIMER_WHEEL_MAX_DELAY;
+    }
+
+    for ( level = 0; level < TIMER_WHEEL_LEVELS - 1; level++ )
+    {
+        if ( ticks < ( 1UL << ( TIMER_WHEEL_SLOT_BITS * ( level + 1 ) ) ) )
+        {
+            break;
+        }
+    }
+
+    push( &slots[level][( timer->expires >> ( TIMER_WHEEL_SLOT_BITS * level ) ) & SLOT_MASK], timer );
+}
+
+// Spread one slot of 'level' over the levels below.  Returns the slot index
+// so the caller knows whether the next level up wrapped too.
+static uint8_t cascade( uint8_t level )
+{
+    uint8_t index = ( base >> ( TIMER_WHEEL_SLOT_BITS * level ) ) & SLOT_MASK;
+    timer_wheel_timer_t *timer, *next;
+
+    timer = slots[level][index];
+    slots[level][index] = 0;
+
+    while ( timer )
+    {
+        next = timer->next;
+        insert( timer );
+        timer = next;
+        tick_work++;
+    }
+
+    return index;
+}
+
+void timer_wheel_init( void )
+{
+    memset( slots, 0, sizeof(slots) );
+    expiring = 0;
+    deferred = 0;
+    deferred_tail = &deferred;
+    base = 1;
+    memset( &stats, 0, sizeof(stats) );
+}
+
+void timer_wheel_setup( timer_wheel_timer_t *timer, timer_wheel_callback_t callback, void *context, uint8_t flags )
+{
+    memset( timer, 0, sizeof(*timer) );
+    timer->callback = callback;
+    timer->context = context;
+    timer->flags = flags;
+}
+
+void timer_wheel_arm( timer_wheel_timer_t *timer, uint32_t delay, uint32_t period )
+{
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    unlink_timer( timer );
+
+    timer->expires = base - 1 + ( delay ? delay : 1 );
+    timer->period = period;
+    insert( timer );
+
+    SREG = cSREG;
+}
+
+void timer_wheel_cancel( timer_wheel_timer_t *timer )
+{
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+
+    unlink_timer( timer );
+
+    SREG = cSREG;
+}
+
+unsigned char timer_wheel_armed( const timer_wheel_timer_t *timer )
+{
+    return ( timer->pprev != 0 );
+}
+
+uint32_t timer_wheel_now( void )
+{
+    char cSREG;
+    uint32_t now;
+
+    cSREG = SREG;
+    cli();
+    now = base - 1;
+    SREG = cSREG;
+
+    return now;
+}
+
+void timer_wheel_tick( void )
+{
+    timer_wheel_timer_t *timer;
+    uint8_t index = base & SLOT_MASK;
+    uint8_t level;
+
+    tick_work = 0;
+
+    // Level 0 wrapped: bring down the next slot of level 1, and so on up
+    if ( index == 0 )
+    {
+        for ( level = 1; ( level < TIMER_WHEEL_LEVELS ) && ( cascade( level ) == 0 ); level++ );
+        stats.cascaded += tick_work;
+    }
+
+    expiring = slots[0][index];
+    slots[0][index] = 0;
+    if ( expiring )
+    {
+        expiring->pprev = &expiring;
+    }
+
+    // From here on re-armed timers count from the next tick
+    base++;
+
+    while ( ( timer = expiring ) != 0 )
+    {
+        unlink_timer( timer );
+        stats.expired++;
+        tick_work++;
+
+        if ( timer->flags & TIMER_WHEEL_DEFERRED )
+        {
+            // Re-armed by timer_wheel_run_deferred()
+            timer->pprev = deferred_tail;
+            *deferred_tail = timer;
+            deferred_tail = &timer->next;
+            timer->queued = 1;
+            continue;
+        }
+
+        if ( timer->period )
+        {
+            timer->expires += timer->period;
+            insert( timer );
+        }
+
+        timer->callback( timer->context );
+    }
+
+    stats.ticks++;
+    if ( tick_work > stats.most_per_tick )
+    {
+        stats.most_per_tick = tick_work;
+    }
+}
+
+void timer_wheel_get_stats( timer_wheel_stats_t *copy )
+{
+    char cSREG;
+
+    cSREG = SREG;
+    cli();
+    *copy = stats;
+    SREG = cSREG;
+}
+
+unsigned char timer_wheel_run_deferred( void )
+{
+    char cSREG;
+    timer_wheel_timer_t *timer;
+    timer_wheel_callback_t callback;
+    void *context;
+    unsigned char ran = 0;
+
+    while ( 1 )
+    {
+        cSREG = SREG;
+        cli();
+
+        timer = deferred;
+        if ( !timer )
+        {
+            SREG = cSREG;
+            break;
+        }
+
+        unlink_timer( timer );
+
+        if ( timer->period )
+        {
+            // Same cadence as if it had run in the tick, dropping whole
+            // periods it has fallen behind by
+            timer->expires += timer->period;
+            while ( (int32_t)( timer->expires - base ) < 0 )
+            {
+                timer->expires += timer->period;
+                timer->overruns++;
+            }
+            insert( timer );
+        }
+
+        callback = timer->callback;
+        context = timer->context;
+
+        SREG = cSREG;
+
+        callback( context );
+        ran++;
+    }
+
+    return ran;
+}
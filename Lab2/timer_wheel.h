@@ -0,0 +1,99 @@
+/* timer_wheel.h
+ *
+ * Software timers on the 1 ms Timer0 tick.
+ *
+ * Timers are kept in a hierarchical wheel: TIMER_WHEEL_LEVELS levels of
+ * TIMER_WHEEL_SLOTS slots, level n slots being TIMER_WHEEL_SLOTS^n ticks
+ * wide.  A timer goes straight into the slot its expiry tick falls in, and
+ * the level 0 slot for the current tick holds exactly the timers due now.
+ * When level 0 wraps, the next level 1 slot is spread out over level 0 (and
+ * likewise up the levels), so each timer is moved at most once per level.
+ *
+ *      arm, cancel     O(1), unlink from a doubly linked slot list
+ *      tick            O(1) plus the timers that expire or cascade
+ *
+ * so the cost of a tick does not depend on how many timers are armed.
+ *
+ * Timers are owned by the caller (usually a static), the wheel only links
+ * them.  Callbacks run either
+ *
+ *      in the tick, i.e. in the timer ISR (keep them short), or
+ *      TIMER_WHEEL_DEFERRED: queued by the tick and run, in expiry order, by
+ *      timer_wheel_run_deferred() from the main loop
+ *
+ * A periodic timer keeps its cadence from the expiry tick, not from when
+ * the callback ran.  A deferred periodic timer that falls a whole period
+ * behind skips the missed expiries and counts them in 'overruns'.
+ *
+ * Everything except timer_wheel_tick() may be called from the main loop or
+ * from a callback.
+ */
+
+#ifndef __TIMER_WHEEL_H
+#define __TIMER_WHEEL_H
+
+#include <inttypes.h>
+
+#define TIMER_WHEEL_SLOT_BITS   5
+#define TIMER_WHEEL_SLOTS       ( 1 << TIMER_WHEEL_SLOT_BITS )
+#define TIMER_WHEEL_LEVELS      4
+
+// Longest delay, ~17 minutes at 1 ms; longer ones are cut to this
+#define TIMER_WHEEL_MAX_DELAY   ( ( 1UL << ( TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS ) ) - 1 )
+
+// timer_wheel_timer_t flags
+#define TIMER_WHEEL_DEFERRED    0x01
+
+typedef void (*timer_wheel_callback_t)( void *context );
+
+typedef struct
+{
+    uint32_t ticks;
+    uint32_t expired;
+    uint32_t cascaded;              // timers moved down a level
+    uint16_t most_per_tick;         // expired + cascaded in the busiest tick
+} timer_wheel_stats_t;
+
+typedef struct timer_wheel_timer
+{
+    // Slot or deferred queue links, pprev is 0 when on neither
+    struct timer_wheel_timer *next;
+    struct timer_wheel_timer **pprev;
+
+    uint32_t expires;               // tick
+    uint32_t period;                // 0 for one-shot
+    timer_wheel_callback_t callback;
+    void *context;
+    uint8_t flags;
+    uint8_t queued;                 // on the deferred queue
+    uint16_t overruns;
+} timer_wheel_timer_t;
+
+// Empty wheel at tick 0
+void timer_wheel_init( void );
+
+// Set up a timer, not armed
+void timer_wheel_setup( timer_wheel_timer_t *timer, timer_wheel_callback_t callback, void *context, uint8_t flags );
+
+// Expire 'delay' ticks from now (0 expires on the next tick), then every
+// 'period' ticks if that is not 0.  Re-arming an armed timer moves it.
+void timer_wheel_arm( timer_wheel_timer_t *timer, uint32_t delay, uint32_t period );
+
+// Disarm, including a deferred expiry that has not run yet
+void timer_wheel_cancel( timer_wheel_timer_t *timer );
+
+// 1 while armed or waiting on the deferred queue
+unsigned char timer_wheel_armed( const timer_wheel_timer_t *timer );
+
+// Ticks so far
+uint32_t timer_wheel_now( void );
+
+// Timer0 compare ISR
+void timer_wheel_tick( void );
+
+// Main loop: run the deferred callbacks queued so far.  Returns how many ran.
+unsigned char timer_wheel_run_deferred( void );
+
+void timer_wheel_get_stats( timer_wheel_stats_t *stats );
+
+#endif //__TIMER_WHEEL_H
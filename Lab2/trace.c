@@ -0,0 +1,213 @@
+/* trace.c
+ *
+ * Binary event trace, see trace.h
+ */
+
+#include <pololu/orangutan.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "menu.h"
+#include "trace.h"
+
+#define DUMP_CHUNK 32
+#define REPLY_SIZE 48
+#define DEFAULT_PROBES 256
+
+// Probes timed per interrupts off stretch, about 2 us each: well inside
+// the 1 ms tick, so no tick is lost however many are asked for
+#define PROBE_BATCH 32
+
+trace_record_t trace_ring[TRACE_RECORDS];
+volatile uint8_t trace_head;
+volatile uint8_t trace_wrapped;
+volatile uint8_t trace_state;
+uint8_t trace_trigger;
+uint8_t trace_post;
+
+// trace_dump() output, sent in DUMP_CHUNK pieces
+static char chunk[DUMP_CHUNK];
+static uint8_t chunk_length;
+static uint16_t sum;
+
+static void flush( void )
+{
+    if ( chunk_length )
+    {
+        wait_for_sending_to_finish();
+        serial_send( USB_COMM, chunk, chunk_length );
+        wait_for_sending_to_finish();
+        chunk_length = 0;
+    }
+}
+
+static void put( uint8_t byte )
+{
+    chunk[chunk_length++] = byte;
+    sum += byte;
+
+    if ( chunk_length == DUMP_CHUNK )
+    {
+        flush();
+    }
+}
+
+static void put16( uint16_t value )
+{
+    put( value & 0xFF );
+    put( value >> 8 );
+}
+
+void trace_init( void )
+{
+    trace_restart( TRACE_TRIGGER_OFF, 0 );
+}
+
+void trace_restart( uint8_t trigger, uint8_t post )
+{
+    char cSREG;
+
+    if ( post > TRACE_RECORDS - 1 )
+    {
+        post = TRACE_RECORDS - 1;
+    }
+
+    cSREG = SREG;
+    cli();
+
+    trace_head = 0;
+    trace_wrapped = 0;
+    trace_trigger = trigger;
+    trace_post = post;
+    trace_state = TRACE_RUNNING;
+
+    SREG = cSREG;
+}
+
+void trace_freeze( void )
+{
+    trace_state = TRACE_FROZEN;
+}
+
+TRACE_STATE_E trace_get_state( void )
+{
+    return (TRACE_STATE_E)trace_state;
+}
+
+uint8_t trace_count( void )
+{
+    return trace_wrapped ? TRACE_RECORDS : trace_head;
+}
+
+void trace_dump( void )
+{
+    const trace_record_t *record;
+    uint8_t count, index;
+
+    trace_freeze();
+
+    count = trace_count();
+    index = trace_wrapped ? trace_head : 0;
+
+    chunk_length = 0;
+    sum = 0;
+
+    put( 'T' );
+    put( 'R' );
+    put( 'C' );
+    put( '1' );
+    put16( count );
+    put16( TRACE_TICK_NS );
+
+    while ( count-- )
+    {
+        record = &trace_ring[index];
+        put16( record->time );
+        put( record->id );
+        put16( record->payload );
+
+        index = ( index + 1 ) & ( TRACE_RECORDS - 1 );
+    }
+
+    put16( sum );
+    flush();
+
+    print_usb( "\r\n" );
+}
+
+uint16_t trace_measure_probe( uint16_t count )
+{
+    char cSREG;
+    uint32_t ticks;
+    uint16_t start, batch, i, j;
+
+    if ( !count )
+    {
+        return 0;
+    }
+
+    trace_restart( TRACE_TRIGGER_OFF, 0 );
+
+    ticks = 0;
+    for ( i = 0; i < count; i += batch )
+    {
+        batch = ( count - i < PROBE_BATCH ) ? count - i : PROBE_BATCH;
+
+        cSREG = SREG;
+        cli();
+
+        start = TRACE_NOW();
+        for ( j = 0; j < batch; j++ )
+        {
+            TRACE( TRACE_MARK, i + j );
+        }
+        ticks += (uint16_t)( TRACE_NOW() - start );
+
+        SREG = cSREG;
+    }
+
+    trace_restart( TRACE_TRIGGER_OFF, 0 );
+
+    return (uint16_t)( ticks * TRACE_TICK_CYCLES / count );
+}
+
+void trace_command( int op, int arg )
+{
+    static const char * const state_names[] = { "running", "triggered", "frozen" };
+    char reply[REPLY_SIZE];
+
+    switch ( op )
+    {
+        case 0:
+            trace_dump();
+            return;
+        case 1:
+            trace_restart( TRACE_TRIGGER_OFF, 0 );
+            break;
+        case 2:
+            trace_restart( (uint8_t)arg, TRACE_RECORDS / 2 );
+            break;
+        case 3:
+            trace_freeze();
+            break;
+        case 4:
+            if ( arg <= 0 )
+            {
+                arg = DEFAULT_PROBES;
+            }
+            snprintf( reply, REPLY_SIZE, "d,trace probe %u cycles\r\n", trace_measure_probe( arg ) );
+            print_usb( reply );
+            break;
+        default:
+            print_usb( "d,trace op 0 dump 1 run 2 trigger 3 freeze 4 cost\r\n" );
+            return;
+    }
+
+    snprintf( reply, REPLY_SIZE, "d,trace %s %u records\r\n", state_names[trace_get_state()], trace_count() );
+    print_usb( reply );
+}
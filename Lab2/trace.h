@@ -0,0 +1,158 @@
+/* trace.h
+ *
+ * Binary event trace for Lab2.
+ *
+ * TRACE( id, payload ) appends a 5 byte record to a RAM ring:
+ *
+ *      time        16 bits, TCNT3 (Timer3 free running at F_CPU/64, so
+ *                  TRACE_TICK_NS per count, wrapping every ~210 ms)
+ *      id          8 bits, TRACE_EVENT_E
+ *      payload     16 bits, meaning depends on the event
+ *
+ * The probe is inline, takes interrupts off for the record and may be used
+ * from ISRs, tasks and the main loop alike.  It costs about 40 cycles (the
+ * 'T,4' command measures it on the board); with the ring frozen about 10.
+ *
+ * The ring keeps the newest TRACE_RECORDS records until it is frozen, on
+ * demand (trace_freeze()) or by a trigger: trace_restart( id, post ) freezes
+ * it 'post' records after the first record with event 'id', so the ring
+ * holds what led up to the event as well as what followed.
+ *
+ * trace_dump() sends the frozen ring over USB_COMM as one binary frame,
+ * little endian:
+ *
+ *      "TRC1"
+ *      uint16  record count
+ *      uint16  TRACE_TICK_NS
+ *      count x { uint16 time, uint8 id, uint16 payload }, oldest first
+ *      uint16  sum of every byte above
+ *      "\r\n"
+ *
+ * host/trace_decode.cpp turns it into a Chrome trace (Perfetto) JSON or a
+ * VCD.  Times only carry 16 bits, the decoder counts a wrap whenever a
+ * record's time is below the previous one, so there must be a record at
+ * least every ~210 ms; service_serial() traces every loop pass.
+ */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <inttypes.h>
+
+#define TRACE_RECORDS       128         // power of two, at most 128
+#define TRACE_RECORD_BYTES  5
+#define TRACE_TICK_NS       3200        // Timer3 at 20 MHz / 64
+#define TRACE_TICK_CYCLES   64          // CPU cycles per TRACE_NOW() count
+
+#define TRACE_NOW()         TCNT3
+
+// Keep in step with host/trace_frame.h
+typedef enum
+{
+    TRACE_NONE,
+    TRACE_CONTROL_BEGIN,                // calculate(), payload Pm
+    TRACE_CONTROL_END,                  // payload T (motor command)
+    TRACE_SERIAL_BEGIN,                 // service_serial()
+    TRACE_SERIAL_END,
+    TRACE_COMMAND,                      // menu command, payload op char
+    TRACE_MARK,                         // payload free, 'T,4' uses it
+    TRACE_EVENT_NUM
+} TRACE_EVENT_E;
+
+typedef enum
+{
+    TRACE_RUNNING,                      // no trigger, or not seen yet
+    TRACE_TRIGGERED,                    // recording the records after it
+    TRACE_FROZEN
+} TRACE_STATE_E;
+
+// No trigger for trace_restart()
+#define TRACE_TRIGGER_OFF   0xFF
+
+typedef struct
+{
+    uint16_t time;
+    uint8_t id;
+    uint16_t payload;
+} trace_record_t;
+
+// Used by the inline probe, use the functions below instead
+extern trace_record_t trace_ring[TRACE_RECORDS];
+extern volatile uint8_t trace_head;
+extern volatile uint8_t trace_wrapped;
+extern volatile uint8_t trace_state;
+extern uint8_t trace_trigger;
+extern uint8_t trace_post;
+
+static inline void trace_record( uint8_t id, uint16_t payload )
+{
+    char cSREG;
+    trace_record_t *record;
+
+    cSREG = SREG;
+    cli();
+
+    if ( trace_state != TRACE_FROZEN )
+    {
+        record = &trace_ring[trace_head];
+        record->time = TRACE_NOW();
+        record->id = id;
+        record->payload = payload;
+
+        trace_head = ( trace_head + 1 ) & ( TRACE_RECORDS - 1 );
+        if ( !trace_head )
+        {
+            trace_wrapped = 1;
+        }
+
+        if ( trace_state == TRACE_TRIGGERED )
+        {
+            if ( --trace_post == 0 )
+            {
+                trace_state = TRACE_FROZEN;
+            }
+        }
+        else if ( id == trace_trigger )
+        {
+            trace_state = trace_post ? TRACE_TRIGGERED : TRACE_FROZEN;
+        }
+    }
+
+    SREG = cSREG;
+}
+
+#define TRACE( id, payload ) trace_record( (id), (uint16_t)(payload) )
+
+// Empty ring, running, no trigger.  Timer3 is set up by the application.
+void trace_init( void );
+
+// Empty the ring and record again; freeze 'post' records after event
+// 'trigger' (TRACE_TRIGGER_OFF for none, 'post' is cut to TRACE_RECORDS - 1)
+void trace_restart( uint8_t trigger, uint8_t post );
+
+void trace_freeze( void );
+TRACE_STATE_E trace_get_state( void );
+
+// Records held, up to TRACE_RECORDS
+uint8_t trace_count( void );
+
+// Freeze and send the ring as a binary frame (see above)
+void trace_dump( void );
+
+// Menu 'T,<op>,<arg>':
+//      0   freeze and dump
+//      1   restart, no trigger
+//      2   restart, freeze TRACE_RECORDS / 2 records after event <arg>
+//      3   freeze
+//      4   probe cost over <arg> probes (default 256)
+void trace_command( int op, int arg );
+
+// CPU cycles per TRACE() into a running ring, timed on Timer3 over 'count'
+// probes.  Interrupts are off only for each batch of a few probes, so a
+// large count delays the main loop but drops no ticks.  Leaves the ring
+// empty and running.
+uint16_t trace_measure_probe( uint16_t count );
+
+#endif //__TRACE_H
@@ -0,0 +1,144 @@
+/* append_file.cpp
+ *
+ * See append_file.h
+ */
+
+#include "append_file.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+AppendFile::AppendFile() : fd_( -1 ), base_( NULL ), mapped_size_( 0 ), header_( NULL )
+{
+}
+
+AppendFile::~AppendFile()
+{
+    close();
+}
+
+bool AppendFile::create( const char *path, const char magic[8], uint32_t version, uint32_t record_size, uint64_t initial_capacity )
+{
+    close();
+
+    fd_ = ::open( path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( fd_ < 0 )
+    {
+        return false;
+    }
+
+    mapped_size_ = APPEND_FILE_HEADER_SIZE + (size_t)record_size * initial_capacity;
+    if ( ftruncate( fd_, mapped_size_ ) != 0 )
+    {
+        close();
+        return false;
+    }
+
+    base_ = (uint8_t *)mmap( NULL, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0 );
+    if ( base_ == MAP_FAILED )
+    {
+        base_ = NULL;
+        close();
+        return false;
+    }
+
+    header_ = (AppendFileHeader *)base_;
+    memcpy( header_->magic, magic, sizeof(header_->magic) );
+    header_->version = version;
+    header_->record_size = record_size;
+    header_->count = 0;
+    header_->capacity = initial_capacity;
+
+    return true;
+}
+
+void AppendFile::close()
+{
+    if ( base_ != NULL )
+    {
+        munmap( base_, mapped_size_ );
+        base_ = NULL;
+        header_ = NULL;
+    }
+
+    if ( fd_ >= 0 )
+    {
+        ::close( fd_ );
+        fd_ = -1;
+    }
+
+    mapped_size_ = 0;
+}
+
+bool AppendFile::grow( uint64_t new_capacity )
+{
+    size_t new_size;
+    void *new_base;
+
+    new_size = APPEND_FILE_HEADER_SIZE + (size_t)header_->record_size * new_capacity;
+    if ( ftruncate( fd_, new_size ) != 0 )
+    {
+        return false;
+    }
+
+    new_base = mremap( base_, mapped_size_, new_size, MREMAP_MAYMOVE );
+    if ( new_base == MAP_FAILED )
+    {
+        return false;
+    }
+
+    base_ = (uint8_t *)new_base;
+    header_ = (AppendFileHeader *)base_;
+    mapped_size_ = new_size;
+    header_->capacity = new_capacity;
+
+    return true;
+}
+
+uint8_t *AppendFile::next()
+{
+    if ( header_ == NULL )
+    {
+        return NULL;
+    }
+
+    if ( header_->count >= header_->capacity )
+    {
+        if ( !grow( header_->capacity * 2 ) )
+        {
+            return NULL;
+        }
+    }
+
+    return record( header_->count );
+}
+
+uint8_t *AppendFile::record( uint64_t index )
+{
+    return base_ + APPEND_FILE_HEADER_SIZE + (size_t)header_->record_size * index;
+}
+
+void AppendFile::commit()
+{
+    __atomic_store_n( &header_->count, header_->count + 1, __ATOMIC_RELEASE );
+}
+
+uint64_t AppendFile::count() const
+{
+    return ( header_ != NULL ) ? header_->count : 0;
+}
+
+uint8_t *AppendFile::user()
+{
+    return header_->user;
+}
+
+void AppendFile::sync()
+{
+    if ( base_ != NULL )
+    {
+        msync( base_, mapped_size_, MS_ASYNC );
+    }
+}
@@ -0,0 +1,70 @@
+/* append_file.h
+ *
+ * Memory mapped, growable file of fixed size records.
+ *
+ * Layout:
+ *   [ header page ]  AppendFileHeader followed by a small user area
+ *   [ record 0 ][ record 1 ] ... [ record capacity-1 ]
+ *
+ * The file is grown by doubling capacity (ftruncate + mremap), so appends
+ * are amortized O(1) and never copy records.  The record count in the header
+ * is only advanced after a record is fully written (release store), so a
+ * viewer that maps the same file read only can poll 'count' and never sees a
+ * half written record.
+ */
+
+#ifndef __APPEND_FILE_H
+#define __APPEND_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define APPEND_FILE_HEADER_SIZE 4096
+#define APPEND_FILE_USER_SIZE   1024
+
+struct AppendFileHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;         // committed records
+    uint64_t capacity;      // records the file currently has room for
+    uint8_t  user[APPEND_FILE_USER_SIZE];
+};
+
+class AppendFile
+{
+public:
+    AppendFile();
+    ~AppendFile();
+
+    // Create (truncate) 'path' for records of 'record_size' bytes.
+    bool create( const char *path, const char magic[8], uint32_t version, uint32_t record_size, uint64_t initial_capacity );
+    void close();
+
+    // Pointer to the next uncommitted record, growing the file if needed.
+    // Returns NULL if the file could not be grown.
+    uint8_t *next();
+
+    // Pointer to an already reserved record (committed or the one returned by next()).
+    uint8_t *record( uint64_t index );
+
+    // Publish the record returned by next().
+    void commit();
+
+    uint64_t count() const;
+    uint8_t *user();
+
+    // Flush dirty pages to disk (msync).  Not needed for live viewers.
+    void sync();
+
+private:
+    bool grow( uint64_t new_capacity );
+
+    int fd_;
+    uint8_t *base_;
+    size_t mapped_size_;
+    AppendFileHeader *header_;
+};
+
+#endif //__APPEND_FILE_H
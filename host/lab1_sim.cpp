@@ -0,0 +1,430 @@
+/* lab1_sim.cpp
+ *
+ * Lab1 menu.c built for the host against the simulated Orangutan (host/sim),
+ * to measure and fuzz the command path.  The LED, PWM and memory calls the
+ * menu makes into main.c are stubs that only remember their arguments.
+ *
+ * Usage:
+ *   lab1_sim bench [--mix valid|mixed|hostile] [--rate n] [--seconds s]
+ *                  [--baud n] [--poll-ms n] [--seed n]
+ *
+ *     Streams generated command lines (menu_bench.h) onto the USB_COMM
+ *     receive ring at 'rate' lines/s over a 'baud' wire, polling the menu
+ *     every 'poll-ms' like the Lab1 main loop, and with the replies going
+ *     out over the same wire.  Without --rate, a sweep of rates.  Reports
+ *     the lines answered, dropped and misparsed (the "Op:" echo of what the
+ *     menu parsed against what was sent), the lines/s answered, the share
+ *     of the time spent waiting on the wire and the host time per line.
+ *
+ *   lab1_sim fuzz [--bytes n] [--seed n]
+ *
+ *     Random bytes in random sized bursts, some bigger than the ring, with
+ *     long runs and no terminators.  Build with -fsanitize=address to have
+ *     any overrun of the menu's buffers stop the run with a report.
+ *
+ * Build (from host/):
+ *   gcc -O2 -c -Isim/include -Isim ../Lab1/menu.c sim/orangutan_sim.c sim/motor_plant.c
+ *   g++ -O2 -Isim -Isim/include -I../Lab1 -o lab1_sim lab1_sim.cpp menu.o orangutan_sim.o motor_plant.o
+ *
+ * For the fuzz, add -g -fsanitize=address to both lines.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <deque>
+#include <string>
+
+#include "menu_bench.h"
+
+extern "C"
+{
+#include "menu.h"
+#include "sim.h"
+
+extern char receive_buffer[32];
+extern unsigned char receive_buffer_position;
+
+// main.c, called by the menu
+static int periods[3];
+static int toggles[3];
+static int yellow_level;
+
+void clr_red_toggle_counter( void ) { toggles[0] = 0; }
+void clr_green_toggle_counter( void ) { toggles[1] = 0; }
+void clr_yellow_toggle_counter( void ) { toggles[2] = 0; }
+int get_red_toggle_counter( void ) { return toggles[0]; }
+int get_green_toggle_counter( void ) { return toggles[1]; }
+int get_yellow_toggle_counter( void ) { return toggles[2]; }
+void set_red_period( int new_period ) { periods[0] = new_period; }
+int set_green_period( int new_period ) { periods[1] = new_period; return new_period; }
+void set_yellow_period( int new_period ) { periods[2] = new_period; }
+unsigned char save_led_periods( void ) { return 1; }
+void set_yellow_level( int percent ) { yellow_level = percent; }
+void set_soft_pwm_bench( int count ) { (void)count; }
+void report_soft_pwm( void ) {}
+void report_memory( int bytes ) { (void)bytes; }
+
+// host/sim drives the Lab2 encoder lines through this, Lab1 has none
+void PCINT0_vect( void ) {}
+}
+
+using menu_bench::Line;
+using menu_bench::LINE_VALID;
+using menu_bench::LINE_MALFORMED;
+using menu_bench::LINE_OVERSIZED;
+
+#define LAB1_BAUD       9600            // init_menu()
+#define LINE_MAX        31              // menuBuffer less the terminator
+
+static double wall_seconds( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Everything the menu sends, split into lines at '\r' and '\n'
+struct TxLines
+{
+    std::string partial;
+    std::deque<std::string> lines;
+
+    static void handler( const char *data, size_t length, void *context )
+    {
+        TxLines *self = (TxLines *)context;
+
+        for ( size_t i = 0; i < length; i++ )
+        {
+            if ( ( data[i] == '\r' ) || ( data[i] == '\n' ) )
+            {
+                if ( !self->partial.empty() )
+                {
+                    self->lines.push_back( self->partial );
+                    self->partial.clear();
+                }
+            }
+            else
+            {
+                self->partial += data[i];
+            }
+        }
+    }
+};
+
+// The menu's answer to a line, or "" for the echo and the menu prompt
+static std::string reply_key( const std::string &line )
+{
+    if ( ( line.compare( 0, 3, "Op:" ) == 0 ) || ( line.compare( 0, 13, "Line too long" ) == 0 ) )
+    {
+        return line;
+    }
+    return std::string();
+}
+
+// "<op> <color> <value>", which the menu echoes as "Op:<op> C:<color> V:<value>"
+static Line make_line( menu_bench::Random &random, menu_bench::LINE_KIND_E kind )
+{
+    static const char ops[] = "TtPpZz";
+    static const char colors[] = "RGYArgya";
+    char text[96], reply[48];
+    Line line;
+    char op, color;
+    int value;
+
+    line.kind = kind;
+
+    switch ( kind )
+    {
+        case LINE_VALID:
+            if ( random.below( 4 ) == 0 )
+            {
+                op = 'D';
+                color = 'Y';
+                value = random.between( 0, 100 );
+            }
+            else
+            {
+                op = ops[random.below( sizeof(ops) - 1 )];
+                color = colors[random.below( sizeof(colors) - 1 )];
+                value = random.between( 0, 2000 );
+            }
+            break;
+
+        case LINE_MALFORMED:
+            // Parses, but names no command or no LED
+            if ( random.below( 2 ) )
+            {
+                op = "QXJ"[random.below( 3 )];
+                color = 'R';
+            }
+            else
+            {
+                op = 'T';
+                color = "QX7"[random.below( 3 )];
+            }
+            value = random.between( -500, 500 );
+            break;
+
+        default:
+            snprintf( text, sizeof(text), "T R %0*d", random.between( LINE_MAX, 80 ), random.between( 0, 9 ) );
+            line.text = text;
+            line.reply = "Line too long";
+            return line;
+    }
+
+    snprintf( text, sizeof(text), "%c %c %d", op, color, value );
+    snprintf( reply, sizeof(reply), "Op:%c C:%c V:%d", op, color, value );
+    line.text = text;
+    line.reply = reply;
+
+    return line;
+}
+
+struct BenchResult
+{
+    menu_bench::Tally tally;
+    double seconds;             // simulated, until the last reply
+    double wait_share;          // of that spent polling a busy wire
+    double host_ns;             // host time in the menu per line answered
+};
+
+// 'wire' 0 sends the replies instantly, leaving only the menu's own time
+static BenchResult run_bench( const menu_bench::Mix &mix, double rate, double seconds, unsigned long baud,
+                              unsigned long wire, int poll_ms, uint32_t seed )
+{
+    menu_bench::Random random( seed );
+    menu_bench::Feed feed( baud, rate, "\r" );
+    TxLines tx;
+    BenchResult result;
+    double now_us = 0.0, end_us = seconds * 1e6, last_us = 0.0, stop_us = -1.0, host = 0.0, start;
+
+    // A fresh board; the menu's line state is only reset by a terminator
+    sim_reset();
+    sim_set_tx_handler( TxLines::handler, &tx );
+    receive_buffer_position = 0;
+    init_menu();
+    sim_serial_inject( "\r", 1 );
+    check_for_new_bytes_received();
+    sim_serial_wire( wire );
+    tx.lines.clear();
+
+    // On past the end of the stream, long enough for the last replies
+    while ( ( stop_us < 0.0 ) || ( now_us < stop_us ) )
+    {
+        while ( ( feed.next_start_us() <= now_us ) && ( feed.next_start_us() < end_us ) )
+        {
+            Line line = make_line( random, menu_bench::pick_kind( random, mix ) );
+
+            feed.send( line );
+            result.tally.expect( line );
+        }
+        feed.deliver( now_us );
+
+        start = wall_seconds();
+        serial_check();
+        check_for_new_bytes_received();
+        host += wall_seconds() - start;
+
+        while ( !tx.lines.empty() )
+        {
+            std::string key = reply_key( tx.lines.front() );
+
+            if ( !key.empty() )
+            {
+                result.tally.reply( key );
+                last_us = now_us;
+            }
+            tx.lines.pop_front();
+        }
+
+        // The menu may have spent longer than a poll waiting on the wire
+        now_us += poll_ms * 1000.0;
+        if ( now_us < (double)sim_cpu_us() )
+        {
+            now_us = (double)sim_cpu_us();
+        }
+        sim.ms = (unsigned long)( now_us / 1000.0 );
+
+        if ( ( stop_us < 0.0 ) && feed.idle() && ( now_us >= end_us ) )
+        {
+            stop_us = now_us + 2e6;
+        }
+    }
+
+    result.tally.finish();
+    result.seconds = ( last_us > end_us ? last_us : end_us ) / 1e6;
+    result.wait_share = sim.tx_wait_us / ( now_us ? now_us : 1.0 );
+    result.host_ns = result.tally.answered ? host * 1e9 / result.tally.answered : 0.0;
+
+    return result;
+}
+
+static int bench_mode( int argc, char **argv )
+{
+    static const double rates[] = { 1, 2, 5, 10, 20, 50 };
+    const menu_bench::Mix *mix = menu_bench::find_mix( "mixed" );
+    double rate = 0.0, seconds = 20.0;
+    unsigned long baud = LAB1_BAUD;
+    int poll_ms = 1;
+    uint32_t seed = 1;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--mix" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            mix = menu_bench::find_mix( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--rate" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            rate = atof( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--seconds" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            seconds = atof( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--baud" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            baud = strtoul( argv[++i], NULL, 10 );
+        }
+        else if ( ( strcmp( argv[i], "--poll-ms" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            poll_ms = atoi( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--seed" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            seed = strtoul( argv[++i], NULL, 10 );
+        }
+        else
+        {
+            fprintf( stderr, "bench: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( ( mix == NULL ) || ( rate < 0.0 ) || ( seconds <= 0.0 ) || !baud || ( poll_ms <= 0 ) )
+    {
+        fprintf( stderr, "bench: bad --mix, --rate, --seconds, --baud or --poll-ms\n" );
+        return 1;
+    }
+
+    printf( "Lab1 menu, %s lines, %lu baud, polled every %d ms, %.0f s per rate\n", mix->name, baud, poll_ms, seconds );
+    printf( "%8s %7s %9s %8s %10s %11s %9s\n",
+            "lines/s", "sent", "answered", "dropped", "misparsed", "answered/s", "wire wait" );
+
+    for ( size_t r = 0; r < ( rate > 0.0 ? 1 : sizeof(rates) / sizeof(rates[0]) ); r++ )
+    {
+        double offered = ( rate > 0.0 ) ? rate : rates[r];
+        BenchResult result = run_bench( *mix, offered, seconds, baud, baud, poll_ms, seed );
+        const menu_bench::Tally &tally = result.tally;
+
+        printf( "%8.0f %7llu %9llu %8llu %10llu %11.1f %8.0f%%\n",
+                offered, (unsigned long long)tally.total_sent(), (unsigned long long)tally.answered,
+                (unsigned long long)tally.dropped, (unsigned long long)tally.misparsed,
+                tally.answered / result.seconds, 100.0 * result.wait_share );
+    }
+
+    // The busy wire dominates the host time above
+    {
+        BenchResult result = run_bench( *mix, 10.0, seconds, baud, 0, poll_ms, seed );
+
+        printf( "menu alone, replies sent instantly: %.0f host ns/line over %llu lines\n",
+                result.host_ns, (unsigned long long)result.tally.answered );
+    }
+
+    return 0;
+}
+
+static int fuzz_mode( int argc, char **argv )
+{
+    unsigned long bytes = 1000000, fed = 0, replies = 0, too_long = 0;
+    uint32_t seed = 1;
+    TxLines tx;
+    bool ok = true;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--bytes" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            bytes = strtoul( argv[++i], NULL, 10 );
+        }
+        else if ( ( strcmp( argv[i], "--seed" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            seed = strtoul( argv[++i], NULL, 10 );
+        }
+        else
+        {
+            fprintf( stderr, "fuzz: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    menu_bench::FuzzSource source( seed );
+
+    sim_reset();
+    sim_set_tx_handler( TxLines::handler, &tx );
+    receive_buffer_position = 0;
+    init_menu();
+
+    while ( fed < bytes )
+    {
+        char burst[48];
+        size_t length = 1 + source.random.below( sizeof(burst) );
+
+        for ( size_t i = 0; i < length; i++ )
+        {
+            burst[i] = source.next();
+        }
+        sim_serial_inject( burst, length );
+        fed += length;
+
+        serial_check();
+        check_for_new_bytes_received();
+
+        ok &= ( receive_buffer_position < sizeof(receive_buffer) );
+
+        while ( !tx.lines.empty() )
+        {
+            replies += ( tx.lines.front().compare( 0, 3, "Op:" ) == 0 );
+            too_long += ( tx.lines.front().compare( 0, 13, "Line too long" ) == 0 );
+            tx.lines.pop_front();
+        }
+    }
+
+    printf( "Lab1 menu fuzz: %lu bytes, %lu lines parsed, %lu too long, AddressSanitizer %s  %s\n",
+            fed, replies, too_long, menu_bench::asan_on() ? "on" : "off (no overrun checks)", ok ? "ok" : "FAIL" );
+
+    return ok ? 0 : 2;
+}
+
+static void usage( const char *name )
+{
+    fprintf( stderr, "usage: %s bench [--mix valid|mixed|hostile] [--rate n] [--seconds s] [--baud n] [--poll-ms n] [--seed n]\n"
+                     "       %s fuzz [--bytes n] [--seed n]\n",
+             name, name );
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc < 2 )
+    {
+        usage( argv[0] );
+        return 1;
+    }
+
+    if ( strcmp( argv[1], "bench" ) == 0 )
+    {
+        return bench_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "fuzz" ) == 0 )
+    {
+        return fuzz_mode( argc - 2, argv + 2 );
+    }
+
+    usage( argv[0] );
+    return 1;
+}
@@ -0,0 +1,4277 @@
+/* lab2_sim.cpp
+ *
+ * Host build of the Lab2 firmware (controller.c + menu.c, compiled unchanged
+ * against the stand-in Pololu headers in sim/include) driven by a virtual
+ * clock.  Nothing waits on real time, so the firmware runs as fast as the
+ * host CPU allows.
+ *
+ * Modes:
+ *
+ *   lab2_sim replay <session> [--phase ms] [--show n] [--no-seed]
+ *
+ *     Feeds the commands of a session recorded with telemetry_ingest --record
+ *     into the firmware at their recorded times and diffs every line the
+ *     firmware sends against the recorded board output.  The encoder is
+ *     driven from the recorded Pm values, so everything downstream of the
+ *     encoder (Pe, Pr, Vm, T, gains, menu replies) is checked.
+ *
+ *     --phase   offset (ms) of the board's calculate() ticks from the start
+ *               of the recording; estimated from the recording if omitted
+ *     --show    print the first n mismatching lines (default 10)
+ *     --no-seed start from the power up gains and reference instead of the
+ *               values in the first recorded "v," line
+ *
+ *   lab2_sim autotune [--rule n] [--step deg] [--plant-us us]
+ *
+ *     Closed loop against the motor model (sim/motor_plant.h): sends
+ *     "A,<rule>", prints the firmware's auto-tune reports, then applies a
+ *     reference step with the new gains and reports the response.
+ *
+ *   lab2_sim sweep [--kp from:to:n] [--kd from:to:n] [--step deg]
+ *                  [--seconds s] [--plant-us us] [--log]
+ *
+ *     Step response for every Kp/Kd pair from power up: overshoot, settling
+ *     time and final error, plus how much motion was simulated per wall
+ *     clock millisecond.  Logging is off unless --log is given.
+ *
+ *     --plant-us  motor model step (default 250), independent of the 1 ms
+ *                 timer ISR
+ *
+ *   lab2_sim params [--saves n]
+ *
+ *     Exercises the EEPROM parameter block (param_store.h): save and restore
+ *     across a reset, n further saves to show the slot rotation and bytes
+ *     written per save, a reset in the middle of a save and a corrupted
+ *     newest slot.
+ *
+ *   lab2_sim wheel [--ticks n]
+ *
+ *     Timer wheel (timer_wheel.h) cost per 1 ms tick with 4 to 256 timers
+ *     armed (periodic, 10 ms to 5 s, a quarter of them deferred): host time
+ *     per tick, timers expired and cascaded per tick and in the busiest
+ *     tick, next to one tick counter per timer as Lab1 did it.  Also checks
+ *     every expiry lands on its tick.
+ *
+ *   lab2_sim trace [--out dump.bin]
+ *
+ *     Event trace (trace.h): dumps the ring with 'T,0' after a reference
+ *     step and checks the binary frame decodes (host/trace_frame.h), then
+ *     arms a trigger on the next menu command and checks the ring froze
+ *     half a ring after it.  --out saves the first dump for trace_decode.
+ *
+ *   lab2_sim telemetry [--seconds s] [--baud n]
+ *
+ *     Batched telemetry (telemetry.h) against one send per line, with the
+ *     USB wire modelled at 256000 baud (sim_serial_wire()) and the main loop
+ *     delay of main.c (9 ms) cut down to 4 and 1 ms: samples/s delivered,
+ *     serial_send() calls/s, time spent polling a busy wire per sample and
+ *     as a share of the CPU.  Fails if any send cut off another.
+ *
+ *   lab2_sim capture
+ *
+ *     Triggered capture (capture.h): arms each trigger in turn (reference
+ *     step, |Pe| over the level, manual), checks the dump has the pre and
+ *     post-trigger lengths asked for, that the trigger sample is where the
+ *     trigger fired and that every captured sample matches a "v," line
+ *     streamed alongside it, and compares the bytes sent.
+ *
+ *   lab2_sim pack [<session>] [--iterations n] [--seed n]
+ *
+ *     Packed telemetry (Lab2/telemetry_pack.h, host/packed_frame.h): bytes
+ *     per sample against the "v," lines for the samples of a recorded
+ *     session and for a simulated step response sent with 'L,1' and 'L,2',
+ *     then round trip fuzzing of the firmware encoder against the host
+ *     decoder: random sample sequences fed to LineParser in random chunks
+ *     between "d," lines must come back exactly, and after a corrupted,
+ *     cut or dropped record or random bytes in the stream the decoder must
+ *     be back in step by the second keyframe after it.
+ *
+ *   lab2_sim frame [--trials n]
+ *
+ *     Command frames ('F', controller.h): a gain change plus reference step
+ *     sent as one frame n times at different phases of the control period
+ *     must show up in the same control cycle, the one the ack names, while
+ *     the same changes as separate 'P', 'D' and 'R' lines are counted when
+ *     they land in different cycles.  Also the virtual time from sending a
+ *     frame to its ack, resending an acked frame, a busy and malformed
+ *     frames.
+ *
+ *   lab2_sim tear [--seconds s] [--interval-us us]
+ *
+ *     Torn parameter reads: a writer stores Kp, Kd and Pr a byte at a time,
+ *     as the AVR does, while SIGALRM stands in for the timer interrupt and
+ *     reads them.  In place, as set_Kp() and friends used to write them,
+ *     the reads catch floats half written; through the double buffer
+ *     (Lab2/double_buffer.h) that controller.c now uses they must not.
+ *
+ *   lab2_sim pid [--kp x] [--kd x] [--ki x] [--seconds s]
+ *
+ *     Control laws ('K', controller.h) against the motor model's friction
+ *     and deadband: the float PD law, the fixed point PID (Lab2/pid.h) with
+ *     no integral and with Ki, over a series of reference steps.  Overshoot,
+ *     settling time and final error per step, and the largest integral term
+ *     on the "p," lines.  With the integral every step must settle and the
+ *     integral must stay inside the torque limit.
+ *
+ *   lab2_sim friction [--kp x] [--kd x] [--ki x] [--seconds s]
+ *
+ *     Friction feed-forward ('Z', Lab2/friction.h): the same steps with the
+ *     PD and PID laws, each without and with the compensation after a
+ *     breakaway calibration.  The calibrated duties are checked against the
+ *     model's deadband and Coulomb friction, and with the same gains the PD
+ *     law plus feed-forward must end every step inside the settle band.
+ *
+ *   lab2_sim quadrature [--revs n] [--edges n]
+ *
+ *     Encoder driver (Lab2/quadrature.h) fed edge by edge through PINA and
+ *     its PCINT0 ISR: runs of n turns each way past the 16 bit range, then
+ *     random edges on both channels with states skipped, counted against
+ *     the injected illegal transitions and the library's decode.
+ *
+ *   lab2_sim ring [--bursts n]
+ *
+ *     Typed ring buffers (Lab2/ring.h): fill, overwrite and drain at the
+ *     capacity, the index width each capacity gets, then the same bursts
+ *     of pushes and pops through Lab1's cbuf.h and rings of bytes, capture
+ *     records and trace records, timed per operation.
+ *
+ *   lab2_sim pool [--commands n] [--baud n]
+ *
+ *     Message pool (Lab2/pool.h): the allocator at its limits, then replies
+ *     over a modelled wire going out of pool blocks, against the same with
+ *     every block held so print_usb() sends and waits as it used to.  No
+ *     line may be lost or cut, and no send may start over another.
+ *
+ *   lab2_sim watchdog [--trials n]
+ *
+ *     Watchdog supervisor (Lab2/supervisor.h): no trip over 10 s of normal
+ *     running, then the main loop hanging, the control cycle overrunning
+ *     its deadline and the timer tick stopping, each at spread out phases.
+ *     The time from the late client's last check-in to the motor at zero
+ *     and to the watchdog reset must stay within the bounds supervisor.h
+ *     gives, and the record read back after the reset must name the fault.
+ *
+ *   lab2_sim menu [--mix valid|mixed|hostile] [--rate n] [--seconds s]
+ *                 [--baud n] [--seed n]
+ *
+ *     Command lines (menu_bench.h) streamed onto the USB_COMM receive ring
+ *     at 'rate' lines/s, or a sweep of rates, with the main loop reading it
+ *     every 10 ms.  Lines answered ("d,Received:"), dropped and misparsed,
+ *     lines/s answered and host time per line.  lab1_sim does the same for
+ *     Lab1.
+ *
+ *   lab2_sim fuzz [--bytes n] [--seed n]
+ *
+ *     Random bytes through the menu with the controller running.  Build
+ *     with -fsanitize=address to have any overrun stop the run.
+ *
+ *   lab2_sim latency [--commands n] [--seed n] [--no-log]
+ *
+ *     R, P and D commands one at a time, each terminator landing at a random
+ *     us over two control periods.  p50, p99 and max of each latency.h
+ *     stage, of the wire to the rx poll as the harness sees it and of the
+ *     whole way from the wire to set_motors(); the 'Y,0' report must agree.
+ *
+ * Build (from host/):
+ *   gcc -O2 -c -Isim/include -I../Lab2 ../Lab2/controller.c ../Lab2/menu.c ../Lab2/autotune.c ../Lab2/param_store.c ../Lab2/timer_wheel.c ../Lab2/trace.c ../Lab2/telemetry.c ../Lab2/capture.c ../Lab2/telemetry_pack.c ../Lab2/double_buffer.c ../Lab2/pid.c ../Lab2/friction.c ../Lab2/quadrature.c ../Lab2/pool.c ../Lab2/supervisor.c ../Lab2/latency.c sim/orangutan_sim.c sim/motor_plant.c
+ *   g++ -O2 -Isim -Isim/include -I../Lab2 -o lab2_sim lab2_sim.cpp session_file.cpp controller.o menu.o autotune.o param_store.o timer_wheel.o trace.o telemetry.o capture.o telemetry_pack.o double_buffer.o pid.o friction.o quadrature.o pool.o supervisor.o latency.o orangutan_sim.o motor_plant.o
+ */
+
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/time.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "../Lab1/cbuf.h"
+#include "menu_bench.h"
+#include "session_file.h"
+#include "telemetry_parser.h"
+#include "trace_frame.h"
+
+extern "C"
+{
+#include "autotune.h"
+#include "capture.h"
+#include "controller.h"
+#include "double_buffer.h"
+#include "latency.h"
+#include "menu.h"
+#include "param_store.h"
+#include "pool.h"
+#include "quadrature.h"
+#include "ring.h"
+#include "sim.h"
+#include "supervisor.h"
+#include "telemetry.h"
+#include "telemetry_pack.h"
+#include "timer_wheel.h"
+#include "trace.h"
+
+// menu.c's receive ring and line buffer
+extern char receive_buffer[32];
+extern char menuBuffer[32];
+extern unsigned char receive_buffer_position;
+}
+
+using telemetry::FIELD_E;
+using telemetry::FIELD_KD;
+using telemetry::FIELD_KP;
+using telemetry::FIELD_NAMES;
+using telemetry::FIELD_NUM;
+using telemetry::FIELD_PE;
+using telemetry::FIELD_PM;
+using telemetry::FIELD_PR;
+using telemetry::FIELD_T;
+using telemetry::FIELD_VM;
+using telemetry::Sample;
+
+//------------------------------------------------------------------------------------------
+// Firmware harness
+
+// No linker layout or painted stack on the host
+extern "C" void report_memory( int bytes )
+{
+    (void)bytes;
+    print_usb( (char *)"d,no RAM profile\r\n" );
+}
+
+// Counts as main.c reports them; the decode timing needs Timer3 on the board
+extern "C" void report_encoders( int op, int count )
+{
+    char buffer[BUFFER_SIZE];
+    quadrature_snapshot_t snapshot;
+
+    (void)count;
+    if ( op == 1 )
+    {
+        print_usb( (char *)"d,no decode timing on the host\r\n" );
+        return;
+    }
+
+    quadrature_get_snapshot( &snapshot );
+    snprintf( buffer, BUFFER_SIZE, "d,encoder m1 %ld err %u m2 %ld err %u\r\n",
+              (long)snapshot.counts[QUADRATURE_M1], snapshot.errors[QUADRATURE_M1],
+              (long)snapshot.counts[QUADRATURE_M2], snapshot.errors[QUADRATURE_M2] );
+    print_usb( buffer );
+}
+
+// Collects everything the firmware sends and splits it into lines, and
+// keeps the raw bytes too while keep_raw is set
+struct TxLines
+{
+    std::string partial;
+    std::deque<std::string> lines;
+    bool keep_raw;
+    std::string raw;
+
+    TxLines() : keep_raw( false ) {}
+
+    static void handler( const char *data, size_t length, void *context )
+    {
+        TxLines *self = (TxLines *)context;
+
+        if ( self->keep_raw )
+        {
+            self->raw.append( data, length );
+        }
+
+        for ( size_t i = 0; i < length; i++ )
+        {
+            if ( ( data[i] == '\r' ) || ( data[i] == '\n' ) )
+            {
+                if ( !self->partial.empty() )
+                {
+                    self->lines.push_back( self->partial );
+                    self->partial.clear();
+                }
+            }
+            else
+            {
+                self->partial += data[i];
+            }
+        }
+    }
+};
+
+// Virtual 1 ms timer: calls the Timer0 compare ISR body for every tick up to
+// and including 'time_us'
+struct VirtualClock
+{
+    int64_t next_tick_ms;
+
+    template <typename BeforeTick>
+    void advance_to( int64_t time_us, BeforeTick before_tick )
+    {
+        while ( next_tick_ms * 1000 <= time_us )
+        {
+            before_tick( next_tick_ms );
+            sim_encoders_sync();
+            sim.ms = (unsigned long)next_tick_ms;
+            TCNT3 = (uint16_t)( next_tick_ms * 1000000 / TRACE_TICK_NS );
+            timer_wheel_tick();
+            if ( sim_eeprom_tick_ms() )
+            {
+                EE_READY_vect();
+            }
+            next_tick_ms++;
+        }
+    }
+};
+
+// Reset keeping the EEPROM and run the firmware init, in main.c's order.
+// 'reset_flags' is what MCUSR shows the firmware.
+static void firmware_boot( TxLines &tx, uint8_t reset_flags = ( 1 << PORF ) )
+{
+    sim_power_cycle();
+    MCUSR = reset_flags;
+    supervisor_boot();
+    sim_set_tx_handler( TxLines::handler, &tx );
+    timer_wheel_init();
+    trace_init();
+    telemetry_init();
+    controller_init();
+    init_menu();
+    quadrature_init( IO_A2, IO_A3, IO_A0, IO_A1 );
+    supervisor_init();
+}
+
+// Fresh board, EEPROM erased
+static void firmware_power_up( TxLines &tx )
+{
+    sim_reset();
+    firmware_boot( tx );
+}
+
+// Run the timer ISR 'count' times with the clock stopped, so calculate()
+// lands on a chosen phase of the 200 ms period
+static void firmware_preroll_ticks( int count )
+{
+    for ( int i = 0; i < count; i++ )
+    {
+        timer_wheel_tick();
+    }
+}
+
+// One pass of the firmware main loop
+static void firmware_loop_pass( void )
+{
+    service_serial();
+    timer_wheel_run_deferred();
+}
+
+static double wall_seconds( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool line_to_sample( const std::string &line, Sample &sample )
+{
+    return ( line.size() > 2 ) && ( line[0] == 'v' ) && ( line[1] == ',' ) &&
+           telemetry::parse_values( line.data() + 2, line.data() + line.size(), sample );
+}
+
+//------------------------------------------------------------------------------------------
+// replay
+
+struct RecordedValue
+{
+    int64_t time_us;
+    Sample sample;
+};
+
+// calculate() is the only place Pe/Pr/Pm/Vm/T change, so every recorded line
+// where one of them changed tells us a calculate() happened since the
+// previous line.  Vote for every ms phase in that window and take the middle
+// of the best run of phases.
+static int estimate_calc_phase( const std::vector<RecordedValue> &values )
+{
+    static const FIELD_E calc_fields[] = { FIELD_PE, FIELD_PR, FIELD_PM, FIELD_VM, FIELD_T };
+    std::vector<int> votes( NUM_MS_PER_CALC, 0 );
+    int best = 0, best_start = 0, best_length = 0;
+
+    for ( size_t i = 1; i < values.size(); i++ )
+    {
+        bool changed = false;
+        int64_t from_ms, to_ms;
+
+        for ( size_t f = 0; f < sizeof(calc_fields) / sizeof(calc_fields[0]); f++ )
+        {
+            changed |= ( values[i].sample.field[calc_fields[f]] != values[i - 1].sample.field[calc_fields[f]] );
+        }
+
+        from_ms = values[i - 1].time_us / 1000 + 1;
+        to_ms = values[i].time_us / 1000;
+
+        if ( !changed || ( to_ms - from_ms >= NUM_MS_PER_CALC ) )
+        {
+            continue;
+        }
+
+        for ( int64_t t = from_ms; t <= to_ms; t++ )
+        {
+            votes[t % NUM_MS_PER_CALC]++;
+        }
+    }
+
+    for ( int p = 0; p < NUM_MS_PER_CALC; p++ )
+    {
+        if ( votes[p] > best )
+        {
+            best = votes[p];
+        }
+    }
+
+    // Longest run of max votes (wrapping), take its middle
+    for ( int p = 0; p < NUM_MS_PER_CALC; p++ )
+    {
+        int length = 0;
+
+        while ( ( length < NUM_MS_PER_CALC ) && ( votes[( p + length ) % NUM_MS_PER_CALC] == best ) )
+        {
+            length++;
+        }
+
+        if ( length > best_length )
+        {
+            best_length = length;
+            best_start = p;
+        }
+    }
+
+    return ( best_start + best_length / 2 ) % NUM_MS_PER_CALC;
+}
+
+struct ReplayStats
+{
+    uint64_t commands;
+    uint64_t lines_recorded;
+    uint64_t values_compared;
+    uint64_t values_mismatched;
+    uint64_t field_mismatches[FIELD_NUM];
+    uint64_t text_compared;
+    uint64_t text_mismatched;
+    uint64_t missing;           // recorded, firmware did not send
+    uint64_t extra;             // firmware sent, not in the recording
+};
+
+static int replay( int argc, char **argv )
+{
+    const char *path = NULL;
+    int phase = -1;
+    int show = 10;
+    bool seed = true;
+    SessionReader session;
+    std::vector<RecordedValue> values;
+    size_t value_index = 0;
+    TxLines tx;
+    VirtualClock clock;
+    ReplayStats stats;
+    double wall_start, wall_time, session_seconds;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--phase" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            phase = atoi( argv[++i] ) % NUM_MS_PER_CALC;
+        }
+        else if ( ( strcmp( argv[i], "--show" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            show = atoi( argv[++i] );
+        }
+        else if ( strcmp( argv[i], "--no-seed" ) == 0 )
+        {
+            seed = false;
+        }
+        else if ( path == NULL )
+        {
+            path = argv[i];
+        }
+        else
+        {
+            fprintf( stderr, "replay: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( ( path == NULL ) || !session.load( path ) )
+    {
+        fprintf( stderr, "replay: could not load session %s\n", path ? path : "" );
+        return 1;
+    }
+
+    const std::vector<SessionRecord> &records = session.records();
+
+    for ( size_t i = 0; i < records.size(); i++ )
+    {
+        RecordedValue value;
+
+        if ( ( records[i].dir == SESSION_RX ) &&
+             line_to_sample( std::string( records[i].data, records[i].length ), value.sample ) )
+        {
+            value.time_us = records[i].time_us;
+            values.push_back( value );
+        }
+    }
+
+    if ( phase < 0 )
+    {
+        phase = estimate_calc_phase( values );
+    }
+
+    memset( &stats, 0, sizeof(stats) );
+    wall_start = wall_seconds();
+
+    firmware_power_up( tx );
+    // The recording has one send per line, in order with the replies
+    telemetry_set_latency( 0 );
+    firmware_preroll_ticks( ( 2 * NUM_MS_PER_CALC - 1 - phase ) % NUM_MS_PER_CALC );
+
+    if ( seed && !values.empty() )
+    {
+        const Sample &first = values[0].sample;
+
+        set_Kp( first.field[FIELD_KP] / 1000.0f );
+        set_Kd( first.field[FIELD_KD] / 1000.0f );
+        set_Pr( first.field[FIELD_PR] * DEG_PER_COUNT );
+        sim.encoder_m2 = first.field[FIELD_PM];
+    }
+
+    clock.next_tick_ms = 0;
+
+    for ( size_t i = 0; i < records.size(); i++ )
+    {
+        const SessionRecord &record = records[i];
+
+        // The encoder reads whatever position the next recorded line reports
+        clock.advance_to( record.time_us, [&]( int64_t tick_ms )
+        {
+            while ( ( value_index < values.size() ) && ( values[value_index].time_us < tick_ms * 1000 ) )
+            {
+                value_index++;
+            }
+            if ( value_index < values.size() )
+            {
+                sim.encoder_m2 = values[value_index].sample.field[FIELD_PM];
+            }
+        } );
+
+        if ( record.dir == SESSION_TX )
+        {
+            stats.commands++;
+            sim_serial_inject( record.data, record.length );
+            sim_serial_inject( "\n", 1 );
+            continue;
+        }
+
+        std::string recorded( record.data, record.length );
+        Sample recorded_sample, produced_sample;
+        bool recorded_is_value = line_to_sample( recorded, recorded_sample );
+
+        stats.lines_recorded++;
+
+        // The board only talks from its main loop, so one recorded line
+        // means at least one main loop pass happened
+        if ( tx.lines.empty() )
+        {
+            firmware_loop_pass();
+        }
+
+        // Skip firmware lines of the wrong kind so one missing "d," line
+        // does not shift every comparison after it
+        while ( recorded_is_value && !tx.lines.empty() && ( tx.lines.front()[0] != 'v' ) )
+        {
+            stats.extra++;
+            tx.lines.pop_front();
+            if ( tx.lines.empty() )
+            {
+                firmware_loop_pass();
+            }
+        }
+
+        if ( tx.lines.empty() || ( ( tx.lines.front()[0] == 'v' ) != recorded_is_value ) )
+        {
+            stats.missing++;
+            if ( show > 0 )
+            {
+                show--;
+                printf( "%10.3fs missing: %s\n", record.time_us / 1e6, recorded.c_str() );
+            }
+            continue;
+        }
+
+        std::string produced = tx.lines.front();
+        tx.lines.pop_front();
+
+        if ( recorded_is_value && line_to_sample( produced, produced_sample ) )
+        {
+            bool mismatch = false;
+
+            stats.values_compared++;
+            for ( int f = 0; f < FIELD_NUM; f++ )
+            {
+                if ( recorded_sample.field[f] != produced_sample.field[f] )
+                {
+                    stats.field_mismatches[f]++;
+                    mismatch = true;
+                }
+            }
+
+            if ( mismatch )
+            {
+                stats.values_mismatched++;
+            }
+
+            if ( mismatch && ( show > 0 ) )
+            {
+                show--;
+                printf( "%10.3fs recorded: %s\n            replayed: %s\n", record.time_us / 1e6, recorded.c_str(), produced.c_str() );
+            }
+        }
+        else
+        {
+            stats.text_compared++;
+            if ( recorded != produced )
+            {
+                stats.text_mismatched++;
+                if ( show > 0 )
+                {
+                    show--;
+                    printf( "%10.3fs recorded: %s\n            replayed: %s\n", record.time_us / 1e6, recorded.c_str(), produced.c_str() );
+                }
+            }
+        }
+    }
+
+    wall_time = wall_seconds() - wall_start;
+    session_seconds = records.empty() ? 0.0 : records.back().time_us / 1e6;
+
+    printf( "session: %.1fs, %zu records, %llu commands, %llu lines (calc phase %d ms)\n",
+            session_seconds, records.size(), (unsigned long long)stats.commands,
+            (unsigned long long)stats.lines_recorded, phase );
+    printf( "values:  %llu compared, %llu mismatched",
+            (unsigned long long)stats.values_compared, (unsigned long long)stats.values_mismatched );
+    for ( int f = 0; f < FIELD_NUM; f++ )
+    {
+        if ( stats.field_mismatches[f] )
+        {
+            printf( " %s:%llu", FIELD_NAMES[f], (unsigned long long)stats.field_mismatches[f] );
+        }
+    }
+    printf( "\n" );
+    printf( "text:    %llu compared, %llu mismatched\n",
+            (unsigned long long)stats.text_compared, (unsigned long long)stats.text_mismatched );
+    printf( "lines:   %llu missing, %llu extra\n",
+            (unsigned long long)stats.missing, (unsigned long long)stats.extra );
+    printf( "replayed in %.3fs wall (%.0fx real time)\n",
+            wall_time, wall_time > 0 ? session_seconds / wall_time : 0.0 );
+
+    return ( stats.values_mismatched || stats.text_mismatched || stats.missing ) ? 2 : 0;
+}
+
+//------------------------------------------------------------------------------------------
+// Closed loop
+
+// Firmware + motor model (sim/motor_plant.h), the main loop runs every
+// LOOP_MS like main.c (LOOP_DELAY_MS plus the time to send a line)
+struct ClosedLoop
+{
+    static const int LOOP_MS = 10;
+
+    TxLines tx;
+    VirtualClock clock;
+    motor_params_t params;
+    unsigned int plant_step_us;
+    motor_plant_t plant;
+
+    ClosedLoop() : plant_step_us( 250 )
+    {
+        motor_plant_default_params( &params );
+    }
+
+    void power_up()
+    {
+        firmware_power_up( tx );
+        clock.next_tick_ms = 0;
+        motor_plant_init( &plant, &params, plant_step_us );
+        sim_attach_motor_m2( &plant );
+    }
+
+    // Board reset: EEPROM kept, motor back at rest at zero
+    void reboot( uint8_t reset_flags = ( 1 << PORF ) )
+    {
+        firmware_boot( tx, reset_flags );
+        tx.lines.clear();
+        clock.next_tick_ms = 0;
+        motor_plant_init( &plant, &params, plant_step_us );
+        sim_attach_motor_m2( &plant );
+    }
+
+    void command( const char *text )
+    {
+        sim_serial_inject( text, strlen( text ) );
+        sim_serial_inject( "\n", 1 );
+    }
+
+    // Run for 'ms', hand every line the firmware sends to on_line and call
+    // on_tick after every timer tick
+    template <typename OnLine, typename OnTick>
+    void run( int64_t ms, OnLine on_line, OnTick on_tick )
+    {
+        int64_t end_ms = clock.next_tick_ms + ms;
+
+        while ( clock.next_tick_ms < end_ms )
+        {
+            int64_t now_ms = clock.next_tick_ms;
+
+            clock.advance_to( now_ms * 1000, []( int64_t )
+            {
+                sim_advance_motors_us( 1000 );
+            } );
+
+            on_tick();
+
+            if ( now_ms % LOOP_MS == 0 )
+            {
+                firmware_loop_pass();
+                while ( !tx.lines.empty() )
+                {
+                    on_line( tx.lines.front() );
+                    tx.lines.pop_front();
+                }
+            }
+        }
+    }
+
+    template <typename OnLine>
+    void run( int64_t ms, OnLine on_line )
+    {
+        run( ms, on_line, []() {} );
+    }
+};
+
+static void ignore_line( const std::string & )
+{
+}
+
+// Output shaft response to a reference step, in encoder counts
+struct StepResponse
+{
+    int target;
+    int start;
+    int peak;                   // furthest travel in the step direction
+    int final_error;
+    int64_t settle_ms;          // last time the error was outside SETTLE_BAND
+    double overshoot_percent;
+
+    static const int SETTLE_BAND = 2;
+};
+
+// Send "R,<deg>" with the reference at 'from_deg' and follow the encoder for
+// 'ms', handing every line the firmware sends to on_line
+template <typename OnLine>
+static StepResponse run_step( ClosedLoop &loop, int from_deg, int target_deg, int64_t ms, OnLine on_line )
+{
+    StepResponse response;
+    char command[32];
+    int64_t start_ms = loop.clock.next_tick_ms;
+    int direction;
+
+    response.start = motor_plant_counts( &loop.plant );
+    response.target = (int)( ( from_deg + target_deg ) / DEG_PER_COUNT );
+    response.peak = response.start;
+    response.settle_ms = 0;
+    direction = ( response.target >= response.start ) ? 1 : -1;
+
+    snprintf( command, sizeof(command), "R,%d", target_deg );
+    loop.command( command );
+
+    loop.run( ms, on_line, [&]()
+    {
+        int counts = motor_plant_counts( &loop.plant );
+
+        if ( ( counts - response.peak ) * direction > 0 )
+        {
+            response.peak = counts;
+        }
+
+        if ( abs( response.target - counts ) > StepResponse::SETTLE_BAND )
+        {
+            response.settle_ms = loop.clock.next_tick_ms - start_ms;
+        }
+    } );
+
+    response.final_error = response.target - motor_plant_counts( &loop.plant );
+    response.overshoot_percent = 0.0;
+    if ( response.target != response.start )
+    {
+        response.overshoot_percent = 100.0 * ( response.peak - response.target ) / ( response.target - response.start );
+    }
+
+    return response;
+}
+
+static StepResponse run_step( ClosedLoop &loop, int target_deg, int64_t ms )
+{
+    return run_step( loop, 0, target_deg, ms, ignore_line );
+}
+
+static void print_step( const StepResponse &response )
+{
+    printf( "overshoot %6.1f%%  settle %6.2fs  final error %3d counts",
+            response.overshoot_percent, response.settle_ms / 1000.0, response.final_error );
+}
+
+static int autotune( int argc, char **argv )
+{
+    int rule = 0;
+    int step_deg = 90;
+    char command[32];
+    ClosedLoop loop;
+    bool finished = false;
+    autotune_result_t result;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--rule" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            rule = atoi( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--step" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            step_deg = atoi( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--plant-us" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            loop.plant_step_us = atoi( argv[++i] );
+        }
+        else
+        {
+            fprintf( stderr, "autotune: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    loop.power_up();
+    loop.run( 1000, ignore_line );
+
+    snprintf( command, sizeof(command), "A,%d", rule );
+    loop.command( command );
+
+    // AUTOTUNE_TIMEOUT_CALCS bounds the experiment, allow a little more
+    for ( int second = 0; ( second < 120 ) && !finished; second++ )
+    {
+        loop.run( 1000, [&]( const std::string &line )
+        {
+            if ( line.compare( 0, 10, "d,autotune" ) == 0 )
+            {
+                printf( "%8.1fs %s\n", sim.ms / 1000.0, line.c_str() );
+                finished |= ( line.compare( 0, 15, "d,autotune done" ) == 0 ) ||
+                            ( line.compare( 0, 17, "d,autotune failed" ) == 0 );
+            }
+        } );
+    }
+
+    if ( !finished || ( autotune_get_state() != AUTOTUNE_DONE ) )
+    {
+        printf( "auto-tune did not complete\n" );
+        return 2;
+    }
+
+    autotune_get_result( &result );
+    printf( "step %d deg with Kp=%.3f Kd=%.3f: ", step_deg, result.Kp, result.Kd );
+    print_step( run_step( loop, step_deg, 10000 ) );
+    printf( "\n" );
+
+    return 0;
+}
+
+// "from:to:count" into a list of values
+static bool parse_range( const char *text, std::vector<double> &values )
+{
+    double from, to;
+    int count;
+
+    values.clear();
+
+    if ( sscanf( text, "%lf:%lf:%d", &from, &to, &count ) == 3 )
+    {
+        for ( int i = 0; i < count; i++ )
+        {
+            values.push_back( ( count > 1 ) ? from + ( to - from ) * i / ( count - 1 ) : from );
+        }
+    }
+    else if ( sscanf( text, "%lf", &from ) == 1 )
+    {
+        values.push_back( from );
+    }
+
+    return !values.empty();
+}
+
+static int sweep( int argc, char **argv )
+{
+    std::vector<double> kp_values, kd_values;
+    int step_deg = 90;
+    int seconds = 10;
+    bool logging = false;
+    ClosedLoop loop;
+    double start_wall, wall_time;
+    int64_t simulated_ms = 0;
+
+    parse_range( "1:20:5", kp_values );
+    parse_range( "0:10:5", kd_values );
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--kp" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            if ( !parse_range( argv[++i], kp_values ) )
+            {
+                fprintf( stderr, "sweep: bad range %s\n", argv[i] );
+                return 1;
+            }
+        }
+        else if ( ( strcmp( argv[i], "--kd" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            if ( !parse_range( argv[++i], kd_values ) )
+            {
+                fprintf( stderr, "sweep: bad range %s\n", argv[i] );
+                return 1;
+            }
+        }
+        else if ( ( strcmp( argv[i], "--step" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            step_deg = atoi( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--seconds" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            seconds = atoi( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--plant-us" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            loop.plant_step_us = atoi( argv[++i] );
+        }
+        else if ( strcmp( argv[i], "--log" ) == 0 )
+        {
+            logging = true;
+        }
+        else
+        {
+            fprintf( stderr, "sweep: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    start_wall = wall_seconds();
+
+    for ( size_t p = 0; p < kp_values.size(); p++ )
+    {
+        for ( size_t d = 0; d < kd_values.size(); d++ )
+        {
+            StepResponse response;
+
+            loop.power_up();
+            set_logging( logging );
+            set_Kp( (float)kp_values[p] );
+            set_Kd( (float)kd_values[d] );
+
+            response = run_step( loop, step_deg, (int64_t)seconds * 1000 );
+            simulated_ms += (int64_t)seconds * 1000;
+
+            printf( "Kp %8.3f  Kd %8.3f  ", kp_values[p], kd_values[d] );
+            print_step( response );
+            printf( "\n" );
+        }
+    }
+
+    wall_time = wall_seconds() - start_wall;
+
+    printf( "%zu runs, %.0fs simulated in %.3fs wall (%.1f simulated s per wall ms, plant step %uus)\n",
+            kp_values.size() * kd_values.size(), simulated_ms / 1000.0, wall_time,
+            wall_time > 0 ? simulated_ms / 1000.0 / ( wall_time * 1000.0 ) : 0.0, loop.plant_step_us );
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------------------
+// EEPROM parameter block
+
+// Gains from the last "v," line sent in 'ms'
+static bool run_read_gains( ClosedLoop &loop, int64_t ms, Sample &last )
+{
+    bool seen = false;
+
+    loop.run( ms, [&]( const std::string &line )
+    {
+        Sample sample;
+
+        if ( line_to_sample( line, sample ) )
+        {
+            last = sample;
+            seen = true;
+        }
+    } );
+
+    return seen;
+}
+
+// The menu handles one command per main loop pass, so give each its own
+static void send_command( ClosedLoop &loop, const char *text )
+{
+    loop.command( text );
+    loop.run( ClosedLoop::LOOP_MS, ignore_line );
+}
+
+// Send "S,1" and run until the firmware reports the save.  Returns the time
+// it took (ms), or -1 if it never finished.
+static int64_t run_save( ClosedLoop &loop )
+{
+    int64_t start_ms = loop.clock.next_tick_ms;
+    bool saved = false;
+
+    loop.command( "S,1" );
+
+    for ( int i = 0; ( i < 100 ) && !saved; i++ )
+    {
+        loop.run( 10, [&]( const std::string &line )
+        {
+            saved |= ( line.compare( 0, 14, "d,params saved" ) == 0 );
+        } );
+    }
+
+    return saved ? loop.clock.next_tick_ms - start_ms : -1;
+}
+
+static bool check_gains( const char *label, ClosedLoop &loop, int kp_milli, int kd_milli )
+{
+    Sample last;
+    bool ok;
+
+    memset( &last, 0, sizeof(last) );
+    ok = run_read_gains( loop, 500, last ) &&
+         ( last.field[FIELD_KP] == kp_milli ) && ( last.field[FIELD_KD] == kd_milli );
+
+    printf( "%-34s Kp=%6d Kd=%6d (expected %6d %6d) %s\n", label,
+            last.field[FIELD_KP], last.field[FIELD_KD], kp_milli, kd_milli, ok ? "ok" : "FAIL" );
+
+    return ok;
+}
+
+static int params( int argc, char **argv )
+{
+    int saves = 40;
+    ClosedLoop loop;
+    char command[32];
+    int slot_counts[PARAM_STORE_SLOTS] = { 0 };
+    uint64_t writes_before;
+    int64_t ms, max_ms = 0;
+    bool ok = true;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--saves" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            saves = atoi( argv[++i] );
+        }
+        else
+        {
+            fprintf( stderr, "params: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    loop.power_up();
+    ok &= check_gains( "erased EEPROM, power up defaults", loop, 4300, -4850 );
+
+    send_command( loop, "P,7500" );
+    send_command( loop, "D,1250" );
+    writes_before = sim.eeprom_writes;
+    ms = run_save( loop );
+    printf( "save: %lldms, %llu bytes written\n", (long long)ms, (unsigned long long)( sim.eeprom_writes - writes_before ) );
+    ok &= ( ms >= 0 );
+
+    loop.reboot();
+    ok &= check_gains( "after reset", loop, 7500, 1250 );
+
+    // Every save goes to the next slot; only bytes that differ are written
+    writes_before = sim.eeprom_writes;
+    for ( int i = 0; i < saves; i++ )
+    {
+        snprintf( command, sizeof(command), "P,%d", 1000 + i );
+        send_command( loop, command );
+        ms = run_save( loop );
+        if ( ms < 0 )
+        {
+            ok = false;
+            break;
+        }
+        max_ms = ( ms > max_ms ) ? ms : max_ms;
+        slot_counts[param_store_get_slot()]++;
+    }
+
+    printf( "%d saves: %.1f bytes written per save, longest %lldms, saves per slot:", saves,
+            saves ? (double)( sim.eeprom_writes - writes_before ) / saves : 0.0, (long long)max_ms );
+    for ( int i = 0; i < PARAM_STORE_SLOTS; i++ )
+    {
+        printf( " %d", slot_counts[i] );
+    }
+    printf( "\n" );
+
+    loop.reboot();
+    ok &= check_gains( "after reset", loop, 1000 + saves - 1, 1250 );
+
+    // Reset part way through a save: the previous block must come back
+    send_command( loop, "P,9999" );
+    loop.command( "S,1" );
+    loop.run( ClosedLoop::LOOP_MS + 3 * SIM_EEPROM_WRITE_MS, ignore_line );
+    printf( "reset during save (%s)\n", param_store_busy() ? "save in progress" : "save already finished" );
+    loop.reboot();
+    ok &= check_gains( "after reset during save", loop, 1000 + saves - 1, 1250 );
+
+    // A corrupted newest slot falls back to the one before it
+    sim_eeprom[PARAM_STORE_BASE_ADDRESS + param_store_get_slot() * PARAM_STORE_SLOT_SIZE + PARAM_STORE_HEADER_SIZE] ^= 0x01;
+    loop.reboot();
+    ok &= check_gains( "after corrupting the newest slot", loop, 1000 + saves - 2, 1250 );
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// Timer wheel cost
+
+struct WheelTimer
+{
+    timer_wheel_timer_t timer;
+    uint32_t due;
+    uint32_t period;
+};
+
+struct WheelBench
+{
+    uint32_t now;
+    uint64_t expiries;
+    uint64_t late;
+
+    static void expired( void *context );
+};
+
+static WheelBench wheel_bench;
+
+void WheelBench::expired( void *context )
+{
+    WheelTimer *timer = (WheelTimer *)context;
+
+    // Deferred ones run after the tick, within the same loop pass here
+    if ( timer->due != wheel_bench.now )
+    {
+        wheel_bench.late++;
+    }
+
+    timer->due += timer->period;
+    wheel_bench.expiries++;
+}
+
+struct WheelResult
+{
+    double ns_per_tick;
+    timer_wheel_stats_t stats;
+    uint64_t late;
+};
+
+// 'count' periodic timers for 'ticks' ticks, main loop pass every tick
+static WheelResult run_wheel( int count, uint32_t ticks )
+{
+    std::vector<WheelTimer> timers( count );
+    WheelResult result;
+    double start;
+
+    srand( 1 );
+    timer_wheel_init();
+    memset( &wheel_bench, 0, sizeof(wheel_bench) );
+
+    for ( int i = 0; i < count; i++ )
+    {
+        WheelTimer &t = timers[i];
+
+        t.period = 10 + rand() % 4991;
+        t.due = 1 + rand() % t.period;
+        timer_wheel_setup( &t.timer, WheelBench::expired, &t, ( i % 4 == 3 ) ? TIMER_WHEEL_DEFERRED : 0 );
+        timer_wheel_arm( &t.timer, t.due, t.period );
+    }
+
+    start = wall_seconds();
+
+    for ( uint32_t tick = 0; tick < ticks; tick++ )
+    {
+        wheel_bench.now++;
+        timer_wheel_tick();
+        timer_wheel_run_deferred();
+    }
+
+    result.ns_per_tick = ( wall_seconds() - start ) * 1e9 / ticks;
+    timer_wheel_get_stats( &result.stats );
+    result.late = wheel_bench.late;
+
+    return result;
+}
+
+// The Lab1 way: a counter per timer, all of them looked at every tick
+static double run_tick_counters( int count, uint32_t ticks )
+{
+    std::vector<uint32_t> counter( count, 0 ), threshold( count );
+    volatile uint64_t expiries = 0;
+    double start;
+
+    srand( 1 );
+    for ( int i = 0; i < count; i++ )
+    {
+        threshold[i] = 10 + rand() % 4991;
+    }
+
+    start = wall_seconds();
+
+    for ( uint32_t tick = 0; tick < ticks; tick++ )
+    {
+        for ( int i = 0; i < count; i++ )
+        {
+            if ( ++counter[i] >= threshold[i] )
+            {
+                counter[i] = 0;
+                expiries = expiries + 1;
+            }
+        }
+    }
+
+    return ( wall_seconds() - start ) * 1e9 / ticks;
+}
+
+static int wheel( int argc, char **argv )
+{
+    uint32_t ticks = 2000000;
+    bool ok = true;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--ticks" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            ticks = (uint32_t)atol( argv[++i] );
+        }
+        else
+        {
+            fprintf( stderr, "wheel: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( ticks == 0 )
+    {
+        return 1;
+    }
+
+    printf( "%u ticks (%.0f s of 1 ms ticks), host ns\n", ticks, ticks / 1000.0 );
+    printf( "timers  wheel ns/tick  expired/tick  cascaded/tick  busiest tick  late  counters ns/tick\n" );
+
+    for ( int count = 4; count <= 256; count *= 2 )
+    {
+        WheelResult result = run_wheel( count, ticks );
+        double counters = run_tick_counters( count, ticks );
+
+        printf( "%6d  %13.1f  %12.3f  %13.3f  %12u  %4llu  %16.1f\n", count, result.ns_per_tick,
+                (double)result.stats.expired / result.stats.ticks, (double)result.stats.cascaded / result.stats.ticks,
+                result.stats.most_per_tick, (unsigned long long)result.late, counters );
+
+        ok &= ( result.late == 0 );
+    }
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// Event trace
+
+// Send 'T,...' and return the raw bytes the firmware answers with
+static std::string run_trace_command( ClosedLoop &loop, const char *text )
+{
+    std::string raw;
+
+    loop.tx.raw.clear();
+    loop.tx.keep_raw = true;
+    send_command( loop, text );
+    loop.tx.keep_raw = false;
+    raw.swap( loop.tx.raw );
+
+    return raw;
+}
+
+static bool decode_dump( const std::string &raw, trace::Frame &frame )
+{
+    size_t used;
+
+    return trace::parse_frame( (const uint8_t *)raw.data(), raw.size(), frame, used ) == trace::FRAME_OK;
+}
+
+static int count_events( const trace::Frame &frame, uint8_t id )
+{
+    int count = 0;
+
+    for ( const trace::Record &record : frame.records )
+    {
+        count += ( record.id == id );
+    }
+
+    return count;
+}
+
+static int trace_mode( int argc, char **argv )
+{
+    const char *out = NULL;
+    ClosedLoop loop;
+    trace::Frame frame;
+    std::string raw;
+    char command[32];
+    size_t trigger_at;
+    bool ok = true;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--out" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            out = argv[++i];
+        }
+        else
+        {
+            fprintf( stderr, "trace: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    // Free running: a step, then dump the newest TRACE_RECORDS records
+    loop.power_up();
+    loop.run( 500, ignore_line );
+    send_command( loop, "R,90" );
+    loop.run( 1500, ignore_line );
+
+    raw = run_trace_command( loop, "T,0" );
+    if ( !decode_dump( raw, frame ) )
+    {
+        printf( "free running dump: no valid frame in %zu bytes  FAIL\n", raw.size() );
+        return 2;
+    }
+
+    ok &= ( frame.records.size() == TRACE_RECORDS );
+    printf( "free running dump: %zu bytes, %zu records over %.1f ms, %d calculate(), %d service_serial()  %s\n",
+            raw.size(), frame.records.size(), frame.records.back().time_ns / 1e6,
+            count_events( frame, trace::EVENT_CONTROL_BEGIN ), count_events( frame, trace::EVENT_SERIAL_BEGIN ),
+            ok ? "ok" : "FAIL" );
+
+    if ( out )
+    {
+        FILE *file = fopen( out, "wb" );
+
+        if ( !file )
+        {
+            perror( out );
+            return 1;
+        }
+        fwrite( raw.data(), 1, raw.size(), file );
+        fclose( file );
+        printf( "dump written to %s (host/trace_decode %s --json ... --vcd ...)\n", out, out );
+    }
+
+    // Triggered: freeze half a ring after the next menu command
+    snprintf( command, sizeof(command), "T,2,%d", trace::EVENT_COMMAND );
+    run_trace_command( loop, command );
+    loop.run( 1000, ignore_line );
+    send_command( loop, "R,-90" );
+    loop.run( 3000, ignore_line );
+
+    raw = run_trace_command( loop, "T,0" );
+    if ( !decode_dump( raw, frame ) )
+    {
+        printf( "triggered dump: no valid frame  FAIL\n" );
+        return 2;
+    }
+
+    // The 'T,0' itself is not in the ring, it was frozen long before
+    for ( trigger_at = 0; trigger_at < frame.records.size(); trigger_at++ )
+    {
+        if ( frame.records[trigger_at].id == trace::EVENT_COMMAND )
+        {
+            break;
+        }
+    }
+
+    ok &= ( frame.records.size() == TRACE_RECORDS ) &&
+          ( trigger_at + 1 + TRACE_RECORDS / 2 == TRACE_RECORDS ) &&
+          ( frame.records[trigger_at].payload == 'R' );
+    printf( "triggered dump: %zu records, command '%c' at record %zu, %zu after it  %s\n",
+            frame.records.size(), trigger_at < frame.records.size() ? frame.records[trigger_at].payload : '?',
+            trigger_at, frame.records.size() - trigger_at - 1, ok ? "ok" : "FAIL" );
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// Telemetry batching
+
+struct TelemetryRun
+{
+    double samples_per_s;
+    double sends_per_s;
+    double wait_us_per_sample;
+    double wait_percent;
+    uint64_t clobbered;
+    size_t report_lines;        // 'B' reply
+};
+
+// Logging on, a reference step, the main loop pass followed by 'delay_ms'
+// as main.c does with LOOP_DELAY_MS.  Passes start on a 1 ms tick.
+static TelemetryRun run_telemetry( int delay_ms, int latency_ms, unsigned long baud, int seconds )
+{
+    ClosedLoop loop;
+    TelemetryRun run;
+    uint64_t samples = 0;
+    uint64_t sends, wait_us;
+    int64_t next_pass_us = 0;
+    int64_t end_ms;
+
+    loop.power_up();
+    set_logging( 1 );
+    telemetry_set_latency( latency_ms );
+    sim_serial_wire( baud );
+    loop.command( "R,90" );
+
+    auto count = [&]()
+    {
+        while ( !loop.tx.lines.empty() )
+        {
+            samples += ( loop.tx.lines.front().compare( 0, 2, "v," ) == 0 );
+            loop.tx.lines.pop_front();
+        }
+    };
+
+    end_ms = loop.clock.next_tick_ms + seconds * 1000;
+    while ( loop.clock.next_tick_ms < end_ms )
+    {
+        int64_t now_ms = loop.clock.next_tick_ms;
+
+        loop.clock.advance_to( now_ms * 1000, []( int64_t )
+        {
+            sim_advance_motors_us( 1000 );
+        } );
+
+        if ( now_ms * 1000 >= next_pass_us )
+        {
+            firmware_loop_pass();
+            next_pass_us = (int64_t)sim_cpu_us() + delay_ms * 1000;
+            count();
+        }
+    }
+
+    sends = sim.tx_calls;
+    wait_us = sim.tx_wait_us;
+
+    run.samples_per_s = (double)samples / seconds;
+    run.sends_per_s = (double)sends / seconds;
+    run.wait_us_per_sample = samples ? (double)wait_us / samples : 0.0;
+    run.wait_percent = 100.0 * wait_us / ( seconds * 1e6 );
+
+    // The firmware's own report goes through print_usb() behind the batch
+    run.report_lines = 0;
+    loop.command( "B,-1" );
+    loop.run( 100, [&]( const std::string &line )
+    {
+        run.report_lines += ( line.compare( 0, 12, "d,telemetry " ) == 0 ) ||
+                            ( line.find( "samples/s" ) != std::string::npos ) ||
+                            ( line.find( "cycles/sample" ) != std::string::npos );
+    } );
+    run.clobbered = sim.tx_clobbered;
+
+    return run;
+}
+
+static int telemetry_mode( int argc, char **argv )
+{
+    static const int DELAYS_MS[] = { 9, 4, 1 };
+    static const int LATENCIES_MS[] = { 0, 10, 50 };
+    int seconds = 10;
+    unsigned long baud = 256000;
+    bool ok = true;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--seconds" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            seconds = atoi( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--baud" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            baud = strtoul( argv[++i], NULL, 10 );
+        }
+        else
+        {
+            fprintf( stderr, "telemetry: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( ( seconds <= 0 ) || !baud )
+    {
+        fprintf( stderr, "telemetry: --seconds and --baud must be positive\n" );
+        return 1;
+    }
+
+    printf( "%lu baud, %d s per run, latency 0 = one serial_send() per line\n", baud, seconds );
+    printf( "loop delay  latency  samples/s   sends/s  wait us/sample  CPU waiting\n" );
+
+    for ( int delay_ms : DELAYS_MS )
+    {
+        for ( int latency_ms : LATENCIES_MS )
+        {
+            TelemetryRun run = run_telemetry( delay_ms, latency_ms, baud, seconds );
+            bool run_ok = ( run.clobbered == 0 ) && ( run.report_lines == 3 );
+
+            ok &= run_ok;
+            printf( "%7d ms %5d ms %10.1f %9.1f %15.1f %11.1f%%  %s\n",
+                    delay_ms, latency_ms, run.samples_per_s, run.sends_per_s,
+                    run.wait_us_per_sample, run.wait_percent, run_ok ? "ok" : "FAIL" );
+        }
+    }
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// Triggered capture
+
+struct CaptureDump
+{
+    std::string header;
+    std::vector<int> index;
+    std::vector<Sample> samples;        // Pe, Pm, Vm, T filled in
+    bool ended;
+    size_t bytes;
+
+    CaptureDump() : ended( false ), bytes( 0 ) {}
+};
+
+// Run until the firmware has sent "d,capture end" or 'ms' have passed.
+// "v," lines go to 'streamed' along with their byte count.
+static void run_capture( ClosedLoop &loop, int64_t ms, CaptureDump &dump,
+                         std::vector<Sample> &streamed, size_t &streamed_bytes )
+{
+    for ( int64_t t = 0; ( t < ms ) && !dump.ended; t += ClosedLoop::LOOP_MS )
+    {
+        loop.run( ClosedLoop::LOOP_MS, [&]( const std::string &line )
+        {
+            Sample sample;
+            int index, Pe, Pm, Vm, T;
+
+            if ( line_to_sample( line, sample ) )
+            {
+                streamed.push_back( sample );
+                streamed_bytes += line.size() + 2;
+            }
+            else if ( sscanf( line.c_str(), "c,%d,%d,%d,%d,%d", &index, &Pe, &Pm, &Vm, &T ) == 5 )
+            {
+                memset( &sample, 0, sizeof(sample) );
+                sample.field[FIELD_PE] = Pe;
+                sample.field[FIELD_PM] = Pm;
+                sample.field[FIELD_VM] = Vm;
+                sample.field[FIELD_T] = T;
+                dump.index.push_back( index );
+                dump.samples.push_back( sample );
+                dump.bytes += line.size() + 2;
+            }
+            else if ( line.compare( 0, 10, "d,capture " ) == 0 )
+            {
+                if ( line == "d,capture end" )
+                {
+                    dump.ended = true;
+                }
+                else if ( line.find( " every " ) != std::string::npos )
+                {
+                    dump.header = line;
+                }
+                dump.bytes += line.size() + 2;
+            }
+        } );
+    }
+}
+
+static bool same_signals( const Sample &a, const Sample &b )
+{
+    return ( a.field[FIELD_PE] == b.field[FIELD_PE] ) && ( a.field[FIELD_PM] == b.field[FIELD_PM] ) &&
+           ( a.field[FIELD_VM] == b.field[FIELD_VM] ) && ( a.field[FIELD_T] == b.field[FIELD_T] );
+}
+
+// Every captured sample is one of the streamed ones, in order
+static bool dump_matches_stream( const CaptureDump &dump, const std::vector<Sample> &streamed )
+{
+    size_t next = 0;
+
+    for ( const Sample &sample : dump.samples )
+    {
+        while ( ( next < streamed.size() ) && !same_signals( streamed[next], sample ) )
+        {
+            next++;
+        }
+        if ( next == streamed.size() )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool check_capture( const char *label, const CaptureDump &dump, int pre, int post,
+                           const std::vector<Sample> &streamed, size_t streamed_bytes,
+                           bool ( *at_trigger )( const CaptureDump &dump, size_t trigger ) )
+{
+    size_t trigger = 0;
+    bool ok;
+
+    while ( ( trigger < dump.index.size() ) && ( dump.index[trigger] != 0 ) )
+    {
+        trigger++;
+    }
+
+    ok = dump.ended && ( (int)dump.samples.size() == pre + post ) &&
+         ( dump.index.front() == -pre ) && ( dump.index.back() == post - 1 ) &&
+         ( (int)trigger == pre ) && at_trigger( dump, trigger ) &&
+         dump_matches_stream( dump, streamed );
+
+    printf( "%-10s %-50s %3zu samples, %5zu bytes dumped, %6zu bytes of \"v,\" lines  %s\n",
+            label, dump.header.c_str(), dump.samples.size(), dump.bytes, streamed_bytes, ok ? "ok" : "FAIL" );
+
+    return ok;
+}
+
+static bool reference_trigger( const CaptureDump &dump, size_t trigger )
+{
+    // Error jumps by the 90 degree step at the trigger
+    return ( trigger > 0 ) && ( abs( dump.samples[trigger - 1].field[FIELD_PE] ) <= 1 ) &&
+           ( dump.samples[trigger].field[FIELD_PE] >= 90 / DEG_PER_COUNT - 1 );
+}
+
+static int capture_level;
+
+static bool error_trigger( const CaptureDump &dump, size_t trigger )
+{
+    return ( abs( dump.samples[trigger].field[FIELD_PE] ) > capture_level ) &&
+           ( ( trigger == 0 ) || ( abs( dump.samples[trigger - 1].field[FIELD_PE] ) <= capture_level ) );
+}
+
+static bool any_trigger( const CaptureDump &, size_t )
+{
+    return true;
+}
+
+static int capture_mode( int argc, char **argv )
+{
+    ClosedLoop loop;
+    char command[32];
+    bool ok = true;
+
+    if ( argc )
+    {
+        fprintf( stderr, "capture: unexpected argument %s\n", argv[0] );
+        return 1;
+    }
+
+    // Gains from 'lab2_sim autotune', the power up ones do not settle
+    loop.power_up();
+    set_Kp( 5.579f );
+    set_Kd( 0.930f );
+    loop.run( 1000, ignore_line );
+
+    // Reference step, 8 before and 40 after
+    {
+        CaptureDump dump;
+        std::vector<Sample> streamed;
+        size_t streamed_bytes = 0;
+
+        send_command( loop, "C,3,8" );
+        send_command( loop, "C,4,40" );
+        send_command( loop, "C,1,1" );
+        run_capture( loop, 3000, dump, streamed, streamed_bytes );
+        send_command( loop, "R,90" );
+        run_capture( loop, 20000, dump, streamed, streamed_bytes );
+        ok &= check_capture( "reference", dump, 8, 40, streamed, streamed_bytes, reference_trigger );
+    }
+
+    // |Pe| over the level on the way back, logging off
+    {
+        CaptureDump dump;
+        std::vector<Sample> streamed;
+        size_t streamed_bytes = 0;
+
+        capture_level = 5;
+        snprintf( command, sizeof(command), "C,5,%d", capture_level );
+        send_command( loop, "L,0" );
+        send_command( loop, command );
+        send_command( loop, "C,3,16" );
+        send_command( loop, "C,4,16" );
+        send_command( loop, "C,1,2" );
+        run_capture( loop, 4000, dump, streamed, streamed_bytes );
+        send_command( loop, "R,-90" );
+        run_capture( loop, 20000, dump, streamed, streamed_bytes );
+        // Logging is off, so nothing streamed to compare with
+        ok &= check_capture( "error", dump, 16, 16, dump.samples, streamed_bytes, error_trigger );
+    }
+
+    // Manual, before the pre-trigger part has filled
+    {
+        CaptureDump dump;
+        std::vector<Sample> streamed;
+        size_t streamed_bytes = 0;
+
+        send_command( loop, "C,3,100" );
+        send_command( loop, "C,4,10" );
+        send_command( loop, "C,1,0" );
+        run_capture( loop, 2000, dump, streamed, streamed_bytes );
+        send_command( loop, "C,2" );
+        run_capture( loop, 20000, dump, streamed, streamed_bytes );
+        ok &= check_capture( "manual", dump, (int)( dump.samples.size() - 10 ), 10, dump.samples, streamed_bytes, any_trigger );
+        ok &= ( dump.samples.size() > 10 ) && ( dump.samples.size() < 10 + 100 );
+    }
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// Packed telemetry
+
+struct CollectSink
+{
+    std::vector<Sample> samples;
+
+    void on_line( const char *, size_t ) {}
+    void on_values( const Sample &sample ) { samples.push_back( sample ); }
+    void on_debug( const char *, size_t ) {}
+    void on_other( const char *, size_t ) {}
+};
+
+typedef telemetry::LineParser<CollectSink> CollectParser;
+
+// Fields as the firmware sends them, 16 bit
+static Sample wrap_sample( const Sample &sample )
+{
+    Sample wrapped;
+
+    for ( int i = 0; i < FIELD_NUM; i++ )
+    {
+        wrapped.field[i] = (int16_t)sample.field[i];
+    }
+
+    return wrapped;
+}
+
+static bool same_sample( const Sample &a, const Sample &b )
+{
+    return memcmp( a.field, b.field, sizeof(a.field) ) == 0;
+}
+
+// Run the firmware encoder over 'samples', one record each
+static std::vector<std::string> pack_records( const std::vector<Sample> &samples )
+{
+    std::vector<std::string> records;
+
+    telemetry_pack_reset();
+
+    for ( const Sample &sample : samples )
+    {
+        int16_t values[TELEMETRY_PACK_FIELDS];
+        uint8_t packed[TELEMETRY_PACK_MAX_BYTES];
+        uint8_t length;
+
+        for ( int i = 0; i < TELEMETRY_PACK_FIELDS; i++ )
+        {
+            values[i] = (int16_t)sample.field[i];
+        }
+        length = telemetry_pack_sample( values, packed );
+        records.push_back( std::string( (const char *)packed, length ) );
+    }
+
+    return records;
+}
+
+static int random_range( int from, int to )
+{
+    return from + rand() % ( to - from + 1 );
+}
+
+// A sample sequence in one of a few shapes: slow drift with steps (like
+// the controller), every field random, or long runs of repeats
+static std::vector<Sample> random_samples( size_t count )
+{
+    std::vector<Sample> samples( count );
+    int shape = rand() % 3;
+    Sample current;
+
+    for ( int i = 0; i < FIELD_NUM; i++ )
+    {
+        current.field[i] = random_range( -32768, 32767 );
+    }
+
+    for ( size_t n = 0; n < count; n++ )
+    {
+        for ( int i = 0; i < FIELD_NUM; i++ )
+        {
+            switch ( shape )
+            {
+                case 0:
+                    if ( rand() % 4 == 0 )
+                    {
+                        current.field[i] += ( rand() % 50 == 0 ) ? random_range( -2000, 2000 ) : random_range( -3, 3 );
+                    }
+                    break;
+                case 1:
+                    current.field[i] = random_range( -32768, 32767 );
+                    break;
+                default:
+                    if ( rand() % 40 == 0 )
+                    {
+                        current.field[i] = random_range( -32768, 32767 );
+                    }
+                    break;
+            }
+        }
+        samples[n] = wrap_sample( current );
+    }
+
+    return samples;
+}
+
+// Every sample back, exactly, with any chunking and "d," lines between records
+static bool fuzz_round_trip( const std::vector<Sample> &samples )
+{
+    std::vector<std::string> records = pack_records( samples );
+    std::string stream;
+    CollectSink sink;
+    CollectParser parser( sink );
+    size_t offset = 0;
+
+    for ( const std::string &record : records )
+    {
+        if ( rand() % 10 == 0 )
+        {
+            stream += "d,params saved slot 3\r\n";
+        }
+        stream += record;
+    }
+
+    while ( offset < stream.size() )
+    {
+        size_t chunk = std::min( stream.size() - offset, (size_t)random_range( 1, 300 ) );
+
+        parser.feed( stream.data() + offset, chunk );
+        offset += chunk;
+    }
+
+    if ( sink.samples.size() != samples.size() )
+    {
+        return false;
+    }
+    for ( size_t i = 0; i < samples.size(); i++ )
+    {
+        if ( !same_sample( sink.samples[i], samples[i] ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+struct CorruptResult
+{
+    bool resynced;
+    int silent;                 // wrong samples decoded without complaint
+};
+
+// Damage one record, decode record by record and check everything from the
+// second keyframe after the damage on
+static CorruptResult fuzz_corrupt_record( const std::vector<Sample> &samples )
+{
+    std::vector<std::string> records = pack_records( samples );
+    telemetry::PackDecoder decoder;
+    size_t damaged = rand() % records.size();
+    size_t keyframes = 0;
+    CorruptResult result = { true, 0 };
+
+    switch ( rand() % 3 )
+    {
+        case 0:
+            records[damaged][rand() % records[damaged].size()] ^= (char)( 1 << ( rand() % 8 ) );
+            break;
+        case 1:
+            records[damaged].resize( rand() % records[damaged].size() );
+            break;
+        default:
+            records[damaged].clear();
+            break;
+    }
+
+    for ( size_t i = 0; i < records.size(); i++ )
+    {
+        Sample sample;
+        bool decoded;
+
+        if ( records[i].empty() )
+        {
+            continue;
+        }
+
+        decoded = decoder.decode( (const uint8_t *)records[i].data(), records[i].size(), sample.field );
+
+        if ( ( i > damaged ) && ( (uint8_t)records[i][0] == telemetry::PACK_KEYFRAME ) )
+        {
+            keyframes++;
+        }
+
+        if ( keyframes >= 2 )
+        {
+            result.resynced &= decoded && same_sample( sample, samples[i] );
+        }
+        else if ( decoded && ( i >= damaged ) && !same_sample( sample, samples[i] ) )
+        {
+            result.silent++;
+        }
+    }
+
+    return result;
+}
+
+// Random bytes spliced into the stream: the parser survives and the last
+// two keyframe intervals, untouched, come out right
+static bool fuzz_garbage( const std::vector<Sample> &samples )
+{
+    std::vector<std::string> records = pack_records( samples );
+    size_t clean_from = records.size() - 2 * TELEMETRY_PACK_KEYFRAME_INTERVAL;
+    std::string stream;
+    CollectSink sink;
+    CollectParser parser( sink );
+    size_t tail;
+
+    for ( size_t i = 0; i < records.size(); i++ )
+    {
+        if ( ( i < clean_from ) && ( rand() % 20 == 0 ) )
+        {
+            int length = random_range( 1, 40 );
+
+            for ( int n = 0; n < length; n++ )
+            {
+                stream += (char)( rand() & 0xFF );
+            }
+        }
+        stream += records[i];
+    }
+
+    parser.feed( stream.data(), stream.size() );
+
+    // Decoded samples line up with the originals from the end back
+    tail = TELEMETRY_PACK_KEYFRAME_INTERVAL;
+    if ( sink.samples.size() < tail )
+    {
+        return false;
+    }
+    for ( size_t i = 1; i <= tail; i++ )
+    {
+        if ( !same_sample( sink.samples[sink.samples.size() - i], samples[samples.size() - i] ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Samples and bytes on the link for a step response with logging mode 'mode'
+static void run_logged_steps( int mode, std::vector<Sample> &samples, size_t &bytes )
+{
+    ClosedLoop loop;
+    CollectSink sink;
+    CollectParser parser( sink );
+    char command[8];
+
+    loop.power_up();
+    set_Kp( 5.579f );
+    set_Kd( 0.930f );
+    snprintf( command, sizeof(command), "L,%d", mode );
+    send_command( loop, command );
+
+    loop.tx.raw.clear();
+    loop.tx.keep_raw = true;
+    for ( int step = 0; step < 4; step++ )
+    {
+        send_command( loop, ( step & 1 ) ? "R,-90" : "R,90" );
+        loop.run( 3000, ignore_line );
+    }
+    loop.tx.keep_raw = false;
+
+    parser.feed( loop.tx.raw.data(), loop.tx.raw.size() );
+    samples = sink.samples;
+    bytes = loop.tx.raw.size();
+}
+
+static int pack_mode( int argc, char **argv )
+{
+    const char *path = NULL;
+    int iterations = 500;
+    unsigned int seed = 1;
+    bool ok = true;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--iterations" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            iterations = atoi( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--seed" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            seed = strtoul( argv[++i], NULL, 10 );
+        }
+        else if ( path == NULL )
+        {
+            path = argv[i];
+        }
+        else
+        {
+            fprintf( stderr, "pack: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( path )
+    {
+        SessionReader session;
+        std::vector<Sample> samples;
+        std::vector<std::string> records;
+        std::string stream;
+        CollectSink sink;
+        CollectParser parser( sink );
+        size_t text = 0;
+        bool same;
+
+        if ( !session.load( path ) )
+        {
+            fprintf( stderr, "pack: could not load session %s\n", path );
+            return 1;
+        }
+
+        for ( const SessionRecord &record : session.records() )
+        {
+            Sample sample;
+
+            if ( ( record.dir == SESSION_RX ) && line_to_sample( std::string( record.data, record.length ), sample ) )
+            {
+                samples.push_back( wrap_sample( sample ) );
+                text += record.length + 2;
+            }
+        }
+
+        if ( samples.empty() )
+        {
+            fprintf( stderr, "pack: no \"v,\" lines in %s\n", path );
+            return 1;
+        }
+
+        records = pack_records( samples );
+        for ( const std::string &record : records )
+        {
+            stream += record;
+        }
+        parser.feed( stream.data(), stream.size() );
+
+        same = ( sink.samples.size() == samples.size() );
+        for ( size_t i = 0; same && ( i < samples.size() ); i++ )
+        {
+            same = same_sample( sink.samples[i], samples[i] );
+        }
+        ok &= same;
+
+        printf( "session %s: %zu samples, text %.2f bytes/sample, packed %.2f bytes/sample (%.1fx)  %s\n",
+                path, samples.size(), (double)text / samples.size(), (double)stream.size() / samples.size(),
+                (double)text / stream.size(), same ? "ok" : "FAIL" );
+    }
+
+    // The same simulated step responses over the link in both modes
+    {
+        std::vector<Sample> text_samples, packed_samples;
+        size_t text_link, packed_link;
+        bool same;
+
+        run_logged_steps( 1, text_samples, text_link );
+        run_logged_steps( 2, packed_samples, packed_link );
+
+        same = !text_samples.empty() && ( text_samples.size() == packed_samples.size() );
+        for ( size_t i = 0; same && ( i < text_samples.size() ); i++ )
+        {
+            same = same_sample( text_samples[i], packed_samples[i] );
+        }
+        ok &= same;
+
+        printf( "simulated steps: %zu samples, 'L,1' %.2f bytes/sample, 'L,2' %.2f bytes/sample (%.1fx)  %s\n",
+                text_samples.size(), (double)text_link / text_samples.size(),
+                (double)packed_link / packed_samples.size(), (double)text_link / packed_link, same ? "ok" : "FAIL" );
+    }
+
+    // Fuzzing
+    {
+        int round_trips = 0, resynced = 0, garbage = 0, silent = 0;
+
+        srand( seed );
+
+        for ( int n = 0; n < iterations; n++ )
+        {
+            std::vector<Sample> samples = random_samples( random_range( 1, 600 ) );
+            std::vector<Sample> longer = random_samples( random_range( 3 * TELEMETRY_PACK_KEYFRAME_INTERVAL, 800 ) );
+            CorruptResult result;
+
+            round_trips += fuzz_round_trip( samples );
+
+            result = fuzz_corrupt_record( longer );
+            resynced += result.resynced;
+            silent += result.silent;
+
+            garbage += fuzz_garbage( longer );
+        }
+
+        ok &= ( round_trips == iterations ) && ( resynced == iterations ) && ( garbage == iterations );
+
+        printf( "fuzz (seed %u): round trip %d/%d, back in step after a damaged record %d/%d "
+                "(%d wrong samples before that), after random bytes %d/%d  %s\n",
+                seed, round_trips, iterations, resynced, iterations, silent, garbage, iterations,
+                ok ? "ok" : "FAIL" );
+    }
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// Command frames
+
+struct FrameAck
+{
+    int seq;
+    int result;
+    int64_t ms;                 // virtual time it arrived
+};
+
+// Run until an ack arrives or 'ms' pass; every "v," line goes to 'lines'
+// with the control cycle count when it was sent
+struct FrameWatch
+{
+    std::vector<Sample> lines;
+    std::vector<uint16_t> line_cycles;
+    std::vector<FrameAck> acks;
+
+    void run( ClosedLoop &loop, int64_t ms, bool until_ack )
+    {
+        size_t acks_before = acks.size();
+
+        for ( int64_t t = 0; ( t < ms ) && !( until_ack && ( acks.size() > acks_before ) ); t += ClosedLoop::LOOP_MS )
+        {
+            loop.run( ClosedLoop::LOOP_MS, [&]( const std::string &line )
+            {
+                Sample sample;
+                FrameAck ack;
+
+                if ( line_to_sample( line, sample ) )
+                {
+                    lines.push_back( sample );
+                    line_cycles.push_back( controller_get_cycle() );
+                }
+                else if ( sscanf( line.c_str(), "a,%d,%d", &ack.seq, &ack.result ) == 2 )
+                {
+                    ack.ms = loop.clock.next_tick_ms;
+                    acks.push_back( ack );
+                }
+            } );
+        }
+    }
+};
+
+// Torque calculate() gets from the line's Pe and Vm with these gains
+static int frame_torque( int kp_milli, int kd_milli, const Sample &line )
+{
+    float t1_f = ( kp_milli / 1000.0f ) * (int)line.field[FIELD_PE];
+    float t2_f = ( kd_milli / 1000.0f ) * (int)line.field[FIELD_VM];
+    int T = (int)( t1_f - t2_f );
+
+    return std::max( -MOTOR_SPEED_MAX, std::min( MOTOR_SPEED_MAX, T ) );
+}
+
+static int frame_mode( int argc, char **argv )
+{
+    ClosedLoop loop;
+    FrameWatch watch;
+    int trials = 20;
+    int atomic = 0, straddled = 0;
+    int64_t rtt_sum = 0, rtt_max = 0, rtt_min = 1 << 30;
+    char command[48];
+    bool ok = true;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--trials" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            trials = atoi( argv[++i] );
+        }
+        else
+        {
+            fprintf( stderr, "frame: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( trials <= 0 )
+    {
+        fprintf( stderr, "frame: --trials must be positive\n" );
+        return 1;
+    }
+
+    loop.power_up();
+    set_Kp( 5.579f );
+    set_Kd( 0.930f );
+    loop.run( 1000, ignore_line );
+
+    for ( int trial = 0; trial < trials; trial++ )
+    {
+        int kp = 5000 + 100 * trial;
+        int kd = 900 + 10 * trial;
+        int step = ( trial & 1 ) ? -45 : 45;
+        size_t first = watch.lines.size();
+        int64_t sent_ms;
+        bool applied = false;
+        bool trial_ok;
+
+        // Spread the trials over the 200 ms control period
+        loop.run( 10 + ( trial * 70 ) % NUM_MS_PER_CALC, ignore_line );
+
+        snprintf( command, sizeof(command), "F,%d,P%d,D%d,R%d", trial + 1, kp, kd, step );
+        sent_ms = loop.clock.next_tick_ms;
+        loop.command( command );
+        watch.run( loop, 1000, true );
+        watch.run( loop, 2 * NUM_MS_PER_CALC, false );
+
+        trial_ok = !watch.acks.empty() && ( watch.acks.back().seq == trial + 1 ) && ( watch.acks.back().result >= 0 );
+        if ( trial_ok )
+        {
+            const FrameAck &ack = watch.acks.back();
+            Sample before = watch.lines[first];
+
+            rtt_sum += ack.ms - sent_ms;
+            rtt_min = std::min( rtt_min, ack.ms - sent_ms );
+            rtt_max = std::max( rtt_max, ack.ms - sent_ms );
+
+            // The "v," gains are the commanded ones, so tell which gains a
+            // cycle used from its torque.  Every line shows either the old
+            // reference and gains or the new ones, and the first with the
+            // new ones is from the acked cycle.
+            for ( size_t i = first; i < watch.lines.size(); i++ )
+            {
+                const Sample &line = watch.lines[i];
+                bool pr_new = ( line.field[FIELD_PR] != before.field[FIELD_PR] );
+                int T_old = frame_torque( before.field[FIELD_KP], before.field[FIELD_KD], line );
+                int T_new = frame_torque( kp, kd, line );
+
+                if ( ( T_old != T_new ) && ( line.field[FIELD_T] != ( pr_new ? T_new : T_old ) ) )
+                {
+                    trial_ok = false;
+                }
+                if ( pr_new && !applied )
+                {
+                    applied = true;
+                    trial_ok &= ( watch.line_cycles[i] == (uint16_t)ack.result );
+                }
+            }
+            trial_ok &= applied;
+        }
+        atomic += trial_ok;
+
+        // The same as three lines, one per main loop pass as the GUI sends them
+        uint16_t cycle_p, cycle_r;
+
+        loop.run( 10 + ( trial * 70 ) % NUM_MS_PER_CALC, ignore_line );
+        snprintf( command, sizeof(command), "P,%d", kp + 50 );
+        send_command( loop, command );
+        cycle_p = controller_get_cycle();
+        snprintf( command, sizeof(command), "D,%d", kd + 5 );
+        send_command( loop, command );
+        snprintf( command, sizeof(command), "R,%d", -step );
+        send_command( loop, command );
+        cycle_r = controller_get_cycle();
+        straddled += ( cycle_p != cycle_r );
+
+        watch.run( loop, 2 * NUM_MS_PER_CALC, false );
+    }
+
+    ok &= ( atomic == trials );
+    printf( "frames: %d/%d applied in one control cycle, the acked one  %s\n", atomic, trials, atomic == trials ? "ok" : "FAIL" );
+    printf( "separate P/D/R lines: %d/%d landed in different control cycles\n", straddled, trials );
+    printf( "command to ack: min %lld ms, mean %.1f ms, max %lld ms (control period %d ms, main loop %d ms)\n",
+            (long long)rtt_min, atomic ? (double)rtt_sum / atomic : 0.0, (long long)rtt_max, NUM_MS_PER_CALC, ClosedLoop::LOOP_MS );
+
+    // Resend of the last frame: acked again on the same cycle, not applied twice
+    {
+        FrameAck last = watch.acks.empty() ? FrameAck() : watch.acks.back();
+        size_t first = watch.lines.size();
+        bool resend_ok;
+
+        for ( const FrameAck &ack : watch.acks )
+        {
+            if ( ack.seq == trials )
+            {
+                last = ack;
+            }
+        }
+
+        snprintf( command, sizeof(command), "F,%d,R90", trials );
+        loop.command( command );
+        watch.run( loop, 1000, true );
+        watch.run( loop, 2 * NUM_MS_PER_CALC, false );
+
+        resend_ok = ( watch.acks.back().seq == trials ) && ( watch.acks.back().result == last.result ) &&
+                    ( watch.lines.back().field[FIELD_PR] == watch.lines[first].field[FIELD_PR] );
+        ok &= resend_ok;
+        printf( "resent frame %d: acked on cycle %d again, not applied  %s\n", trials, watch.acks.back().result, resend_ok ? "ok" : "FAIL" );
+    }
+
+    // Two frames in a row: the second arrives before the first is applied
+    {
+        bool busy_ok;
+
+        uint16_t cycle = controller_get_cycle();
+
+        // Just after a control cycle, one main loop pass apart
+        while ( controller_get_cycle() == cycle )
+        {
+            loop.run( 1, ignore_line );
+        }
+        snprintf( command, sizeof(command), "F,%d,R10", trials + 1 );
+        send_command( loop, command );
+        snprintf( command, sizeof(command), "F,%d,R10", trials + 2 );
+        loop.command( command );
+        watch.run( loop, 1000, false );
+
+        busy_ok = ( watch.acks.size() >= 2 ) &&
+                  ( watch.acks[watch.acks.size() - 2].seq == trials + 2 ) && ( watch.acks[watch.acks.size() - 2].result == -1 ) &&
+                  ( watch.acks.back().seq == trials + 1 ) && ( watch.acks.back().result >= 0 );
+        ok &= busy_ok;
+        printf( "frame sent while one is pending: rejected busy  %s\n", busy_ok ? "ok" : "FAIL" );
+    }
+
+    // Malformed
+    {
+        static const struct
+        {
+            const char *text;
+            int seq;
+        } bad[] = { { "F,x", -1 }, { "F,70000", -1 }, { "F,7,X5", 7 }, { "F,8,P", 8 }, { "F,9,P1;", 9 } };
+        int rejected = 0;
+
+        for ( size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++ )
+        {
+            loop.command( bad[i].text );
+            watch.run( loop, 100, true );
+            rejected += ( watch.acks.back().seq == bad[i].seq ) && ( watch.acks.back().result == -2 );
+        }
+        ok &= ( rejected == (int)( sizeof(bad) / sizeof(bad[0]) ) );
+        printf( "malformed frames: %d/%zu rejected  %s\n", rejected, sizeof(bad) / sizeof(bad[0]),
+                rejected == (int)( sizeof(bad) / sizeof(bad[0]) ) ? "ok" : "FAIL" );
+    }
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// Torn parameter reads
+
+// Kp, Kd and Pr as calculate() reads them.  Set n has every byte of every
+// field equal to n, so a read shows a float written half way (bytes of a
+// field differ) and a read between fields (whole fields of different sets).
+struct TearSet
+{
+    float Kp;
+    float Kd;
+    float Pr;
+};
+
+struct TearCount
+{
+    uint64_t reads;
+    uint64_t torn_floats;
+    uint64_t mixed_sets;
+};
+
+static volatile TearSet tear_direct;    // written in place, as set_Kp() did
+static TearSet tear_blocks[2];
+static double_buffer_t tear_buffer;
+static TearSet tear_active;             // the "ISR"'s copy
+static volatile int tear_use_buffer;
+static TearCount tear_count;
+
+static void tear_check( const uint8_t *bytes )
+{
+    bool torn = false;
+
+    for ( size_t field = 0; field < sizeof(TearSet) / sizeof(float); field++ )
+    {
+        for ( size_t i = 1; i < sizeof(float); i++ )
+        {
+            if ( bytes[field * sizeof(float) + i] != bytes[field * sizeof(float)] )
+            {
+                tear_count.torn_floats++;
+                torn = true;
+                break;
+            }
+        }
+    }
+
+    if ( !torn && ( ( bytes[0] != bytes[sizeof(float)] ) || ( bytes[0] != bytes[2 * sizeof(float)] ) ) )
+    {
+        tear_count.mixed_sets++;
+    }
+
+    tear_count.reads++;
+}
+
+// SIGALRM preempts the writer the way the Timer0 interrupt preempts the
+// main loop: at any instruction, and it runs to the end before the writer
+// carries on
+static void tear_interrupt( int )
+{
+    if ( tear_use_buffer )
+    {
+        double_buffer_take( &tear_buffer, &tear_active );
+        tear_check( (const uint8_t *)&tear_active );
+    }
+    else
+    {
+        TearSet copy;
+
+        memcpy( &copy, (const void *)&tear_direct, sizeof(copy) );
+        tear_check( (const uint8_t *)&copy );
+    }
+}
+
+// The AVR stores a float one byte at a time, low byte first
+static void tear_store( volatile uint8_t *destination, uint8_t value, size_t length )
+{
+    for ( size_t i = 0; i < length; i++ )
+    {
+        destination[i] = value;
+    }
+}
+
+static TearCount run_tear( bool use_buffer, double seconds, long interval_us )
+{
+    struct itimerval timer;
+    struct sigaction action;
+    TearSet commanded;
+    double end;
+    uint8_t n = 0;
+
+    memset( &commanded, 0, sizeof(commanded) );
+    memset( (void *)&tear_direct, 0, sizeof(tear_direct) );
+    tear_active = commanded;
+    double_buffer_init( &tear_buffer, tear_blocks, sizeof(TearSet), &commanded );
+    tear_use_buffer = use_buffer;
+    tear_count = TearCount();
+
+    memset( &action, 0, sizeof(action) );
+    action.sa_handler = tear_interrupt;
+    sigemptyset( &action.sa_mask );
+    sigaction( SIGALRM, &action, NULL );
+
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = interval_us;
+    timer.it_value = timer.it_interval;
+    setitimer( ITIMER_REAL, &timer, NULL );
+
+    end = wall_seconds() + seconds;
+    while ( wall_seconds() < end )
+    {
+        for ( int i = 0; i < 1000; i++ )
+        {
+            n++;
+            if ( use_buffer )
+            {
+                // The main loop's own copy, then one publish
+                tear_store( (volatile uint8_t *)&commanded, n, sizeof(commanded) );
+                double_buffer_publish( &tear_buffer, &commanded );
+            }
+            else
+            {
+                tear_store( (volatile uint8_t *)&tear_direct, n, sizeof(tear_direct) );
+            }
+        }
+    }
+
+    memset( &timer, 0, sizeof(timer) );
+    setitimer( ITIMER_REAL, &timer, NULL );
+    signal( SIGALRM, SIG_DFL );
+
+    return tear_count;
+}
+
+static int tear_mode( int argc, char **argv )
+{
+    double seconds = 2.0;
+    long interval_us = 50;
+    TearCount direct, buffered;
+    bool ok;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--seconds" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            seconds = atof( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--interval-us" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            interval_us = atol( argv[++i] );
+        }
+        else
+        {
+            fprintf( stderr, "tear: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( ( seconds <= 0 ) || ( interval_us <= 0 ) || ( interval_us >= 1000000 ) )
+    {
+        fprintf( stderr, "tear: --seconds and --interval-us must be positive, the interval under 1 s\n" );
+        return 1;
+    }
+
+    direct = run_tear( false, seconds, interval_us );
+    buffered = run_tear( true, seconds, interval_us );
+
+    printf( "writer storing Kp, Kd, Pr a byte at a time for %.1f s each, interrupted every %ld us\n", seconds, interval_us );
+    printf( "                      reads   torn floats   mixed Kp/Kd/Pr\n" );
+    printf( "written in place  %9llu     %9llu        %9llu\n",
+            (unsigned long long)direct.reads, (unsigned long long)direct.torn_floats, (unsigned long long)direct.mixed_sets );
+    ok = ( buffered.torn_floats == 0 ) && ( buffered.mixed_sets == 0 ) && ( buffered.reads > 0 );
+    printf( "double buffer     %9llu     %9llu        %9llu  %s\n",
+            (unsigned long long)buffered.reads, (unsigned long long)buffered.torn_floats, (unsigned long long)buffered.mixed_sets,
+            ok ? "ok" : "FAIL" );
+    if ( direct.torn_floats == 0 )
+    {
+        printf( "no torn reads in place either: too few interrupts to tell, try a longer run\n" );
+    }
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// PID law
+
+struct LawRun
+{
+    const char *label;
+    int law;
+    double ki;
+    bool friction;              // calibrate and use the friction feed-forward
+    std::vector<StepResponse> steps;
+    int max_integral;           // largest |I| on the "p," lines
+    int p_lines;
+    int forward;                // calibrated breakaway duty, -1 if it failed
+    int reverse;
+};
+
+static void run_law( LawRun &run, double kp, double kd, const std::vector<int> &steps_deg, int64_t step_ms )
+{
+    ClosedLoop loop;
+    char command[32];
+    int reference_deg = 0;
+
+    loop.power_up();
+    set_Kp( (float)kp );
+    set_Kd( (float)kd );
+    snprintf( command, sizeof(command), "I,%d", (int)lround( run.ki * 1000 ) );
+    send_command( loop, command );
+    snprintf( command, sizeof(command), "K,%d", run.law );
+    send_command( loop, command );
+    loop.run( 1000, ignore_line );
+
+    run.forward = run.reverse = -1;
+    if ( run.friction )
+    {
+        bool finished = false;
+
+        loop.command( "Z,2" );
+        for ( int second = 0; ( second < 120 ) && !finished; second++ )
+        {
+            loop.run( 1000, [&]( const std::string &line )
+            {
+                finished |= ( sscanf( line.c_str(), "d,friction calibrated fwd %d rev %d", &run.forward, &run.reverse ) == 2 ) ||
+                            ( line == "d,friction calibration failed" );
+            } );
+        }
+        loop.run( 1000, ignore_line );
+        reference_deg = 0;
+    }
+
+    run.max_integral = 0;
+    run.p_lines = 0;
+    for ( int step : steps_deg )
+    {
+        run.steps.push_back( run_step( loop, reference_deg, step, step_ms, [&]( const std::string &line )
+        {
+            int P, I, D, ki;
+
+            if ( sscanf( line.c_str(), "p,%d,%d,%d,%d", &P, &I, &D, &ki ) == 4 )
+            {
+                run.max_integral = std::max( run.max_integral, abs( I ) );
+                run.p_lines++;
+            }
+        } ) );
+        reference_deg += step;
+    }
+}
+
+// Every step, then the means; a step that did not settle counts as the
+// whole step time
+static void print_law_run( const LawRun &run, const std::vector<int> &steps_deg, int seconds )
+{
+    double settle_sum = 0.0;
+    int error_sum = 0, settled = 0;
+
+    for ( size_t i = 0; i < run.steps.size(); i++ )
+    {
+        const StepResponse &step = run.steps[i];
+        bool step_settled = ( abs( step.final_error ) <= StepResponse::SETTLE_BAND );
+
+        printf( "%s Ki %5.3f  %5d deg  ", run.label, run.ki, steps_deg[i] );
+        print_step( step );
+        printf( "%s\n", step_settled ? "" : "  (not settled)" );
+
+        error_sum += abs( step.final_error );
+        settled += step_settled;
+        settle_sum += step_settled ? step.settle_ms / 1000.0 : seconds;
+    }
+
+    printf( "%s Ki %5.3f  mean |final error| %.2f counts, settled %d/%zu, mean settle %.2fs, largest |I| %d\n\n",
+            run.label, run.ki, (double)error_sum / run.steps.size(), settled, run.steps.size(),
+            settle_sum / run.steps.size(), run.max_integral );
+}
+
+static int pid_mode( int argc, char **argv )
+{
+    double kp = 1.4, kd = 0.37, ki = 2.0;
+    int seconds = 5;
+    std::vector<int> steps_deg = { 45, -90, 180, -45, 360, -450 };
+    bool ok = true;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--kp" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            kp = atof( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--kd" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            kd = atof( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--ki" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            ki = atof( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--seconds" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            seconds = atoi( argv[++i] );
+        }
+        else
+        {
+            fprintf( stderr, "pid: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( seconds <= 0 )
+    {
+        fprintf( stderr, "pid: --seconds must be positive\n" );
+        return 1;
+    }
+
+    LawRun runs[] = {
+        { "float PD   (K,0)", CONTROLLER_LAW_PD, 0.0, false, {}, 0, 0, 0, 0 },
+        { "fixed PD   (K,1)", CONTROLLER_LAW_PID, 0.0, false, {}, 0, 0, 0, 0 },
+        { "fixed PID  (K,1)", CONTROLLER_LAW_PID, ki, false, {}, 0, 0, 0, 0 },
+    };
+
+    printf( "Kp %.3f Kd %.3f, steps of", kp, kd );
+    for ( int step : steps_deg )
+    {
+        printf( " %d", step );
+        (void)step;
+    }
+    printf( " deg, %d s each\n", seconds );
+
+    for ( LawRun &run : runs )
+    {
+        run_law( run, kp, kd, steps_deg, seconds * 1000 );
+        print_law_run( run, steps_deg, seconds );
+
+        // The "p," line goes out with the PID law only
+        ok &= ( run.law == CONTROLLER_LAW_PID ) == ( run.p_lines > 0 );
+    }
+
+    // With an integral every step has to end inside the settle band, and
+    // the integral never past the torque limit
+    for ( const StepResponse &step : runs[2].steps )
+    {
+        ok &= ( ki <= 0.0 ) || ( abs( step.final_error ) <= StepResponse::SETTLE_BAND );
+    }
+    ok &= ( runs[2].max_integral <= MOTOR_SPEED_MAX );
+    printf( "%s\n", ok ? "ok" : "FAIL" );
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// Friction feed-forward
+
+// Smallest duty that turns the model's motor: past the deadband, and enough
+// current at stall to beat the Coulomb friction
+static int plant_breakaway( const motor_params_t &params )
+{
+    for ( int pwm = 1; pwm <= 255; pwm++ )
+    {
+        double volts = params.supply_v * pwm / 255.0;
+
+        if ( ( pwm > params.deadband_pwm ) && ( params.kt * volts / params.resistance_ohm > params.coulomb ) )
+        {
+            return pwm;
+        }
+    }
+
+    return -1;
+}
+
+static int friction_mode( int argc, char **argv )
+{
+    double kp = 1.4, kd = 0.37, ki = 2.0;
+    int seconds = 5;
+    std::vector<int> steps_deg = { 45, -90, 180, -45, 360, -450 };
+    motor_params_t params;
+    int expected;
+    bool ok = true;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--kp" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            kp = atof( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--kd" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            kd = atof( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--ki" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            ki = atof( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--seconds" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            seconds = atoi( argv[++i] );
+        }
+        else
+        {
+            fprintf( stderr, "friction: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( seconds <= 0 )
+    {
+        fprintf( stderr, "friction: --seconds must be positive\n" );
+        return 1;
+    }
+
+    LawRun runs[] = {
+        { "PD             ", CONTROLLER_LAW_PD, 0.0, false, {}, 0, 0, 0, 0 },
+        { "PD  + friction ", CONTROLLER_LAW_PD, 0.0, true, {}, 0, 0, 0, 0 },
+        { "PID            ", CONTROLLER_LAW_PID, ki, false, {}, 0, 0, 0, 0 },
+        { "PID + friction ", CONTROLLER_LAW_PID, ki, true, {}, 0, 0, 0, 0 },
+    };
+
+    motor_plant_default_params( &params );
+    expected = plant_breakaway( params );
+
+    printf( "Kp %.3f Kd %.3f, steps of", kp, kd );
+    for ( int step : steps_deg )
+    {
+        printf( " %d", step );
+    }
+    printf( " deg, %d s each\n", seconds );
+
+    for ( LawRun &run : runs )
+    {
+        run_law( run, kp, kd, steps_deg, seconds * 1000 );
+        if ( run.friction )
+        {
+            // The ramp moves a duty step per control cycle, so it may read
+            // a step or two high
+            bool calibrated = ( run.forward >= expected ) && ( run.forward <= expected + 2 ) &&
+                              ( run.reverse >= expected ) && ( run.reverse <= expected + 2 );
+
+            printf( "%s calibrated breakaway fwd %d rev %d, model %d  %s\n", run.label, run.forward, run.reverse, expected,
+                    calibrated ? "ok" : "FAIL" );
+            ok &= calibrated;
+        }
+        print_law_run( run, steps_deg, seconds );
+    }
+
+    // Same gains: with the feed-forward the PD law has to end every step
+    // inside the settle band
+    for ( const StepResponse &step : runs[1].steps )
+    {
+        ok &= ( abs( step.final_error ) <= StepResponse::SETTLE_BAND );
+    }
+    printf( "%s\n", ok ? "ok" : "FAIL" );
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// Quadrature decoder
+
+// The library's decode (PololuWheelEncoders): a step up when the new A
+// differs from the old B, down when the new B differs from the old A, an
+// error when both lines changed.  16 bit count, as encoders_get_counts_*().
+struct LibraryDecoder
+{
+    int16_t count;
+    uint16_t errors;
+    uint8_t a, b;
+
+    void edge( uint8_t new_a, uint8_t new_b )
+    {
+        count = (int16_t)( count + ( new_a ^ b ) - ( new_b ^ a ) );
+        errors += ( new_a != a ) && ( new_b != b );
+        a = new_a;
+        b = new_b;
+    }
+};
+
+// Lab2 wiring in sim.h: motor 2 on PA0 (A) / PA1 (B), motor 1 on PA2 / PA3
+static const int quadrature_shift[QUADRATURE_CHANNELS] = { 2, 0 };
+
+static void quadrature_set_lines( int channel, uint8_t state )
+{
+    int shift = quadrature_shift[channel];
+
+    PINA = (uint8_t)( ( PINA & ~( 3 << shift ) ) | ( state << shift ) );
+    PCINT0_vect();
+}
+
+static int quadrature_mode( int argc, char **argv )
+{
+    static const uint8_t forward[4] = { 0, 1, 3, 2 };
+    long revs = 2000, edges = 1000000;
+    quadrature_snapshot_t snapshot;
+    LibraryDecoder library[QUADRATURE_CHANNELS];
+    int64_t expected[QUADRATURE_CHANNELS];
+    int at[QUADRATURE_CHANNELS];
+    uint16_t illegal[QUADRATURE_CHANNELS];
+    bool ok = true, agree = true;
+    double start, seconds;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--revs" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            revs = atol( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--edges" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            edges = atol( argv[++i] );
+        }
+        else
+        {
+            fprintf( stderr, "quadrature: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( ( revs <= 0 ) || ( edges <= 0 ) )
+    {
+        fprintf( stderr, "quadrature: --revs and --edges must be positive\n" );
+        return 1;
+    }
+
+    // Long runs both ways, one edge at a time through the ISR
+    sim_reset();
+    quadrature_init( IO_A2, IO_A3, IO_A0, IO_A1 );
+
+    for ( int sign = 1; sign >= -1; sign -= 2 )
+    {
+        int32_t target = (int32_t)( sign * revs * 64 );
+        bool right;
+
+        sim.encoder_m2 = target;
+        sim.encoder_m1 = -target / 2;
+        sim_encoders_sync();
+        quadrature_get_snapshot( &snapshot );
+
+        right = ( snapshot.counts[QUADRATURE_M2] == target ) && ( snapshot.counts[QUADRATURE_M1] == -target / 2 ) &&
+                ( snapshot.errors[QUADRATURE_M1] == 0 ) && ( snapshot.errors[QUADRATURE_M2] == 0 );
+        printf( "%+ld turns: m2 %ld counts (16 bit: %d), m1 %ld, errors %u/%u  %s\n", sign * revs,
+                (long)snapshot.counts[QUADRATURE_M2], (int16_t)snapshot.counts[QUADRATURE_M2],
+                (long)snapshot.counts[QUADRATURE_M1], snapshot.errors[QUADRATURE_M1], snapshot.errors[QUADRATURE_M2],
+                right ? "ok" : "FAIL" );
+        ok &= right;
+    }
+
+    // Random edges on both channels, some of them skipping a state, against
+    // the library's decode
+    sim_reset();
+    quadrature_init( IO_A2, IO_A3, IO_A0, IO_A1 );
+    srand( 45 );
+
+    for ( int channel = 0; channel < QUADRATURE_CHANNELS; channel++ )
+    {
+        library[channel] = LibraryDecoder();
+        expected[channel] = 0;
+        at[channel] = 0;
+        illegal[channel] = 0;
+    }
+
+    start = wall_seconds();
+    for ( long i = 0; i < edges; i++ )
+    {
+        int channel = rand() % QUADRATURE_CHANNELS;
+        int r = rand() % 100;
+        int step;
+        uint8_t state;
+
+        if ( r < 2 )
+        {
+            step = 2;
+            illegal[channel]++;
+        }
+        else
+        {
+            step = ( r < 55 ) ? 1 : -1;
+            expected[channel] += step;
+        }
+
+        at[channel] = ( at[channel] + step + 4 ) & 3;
+        state = forward[at[channel]];
+        quadrature_set_lines( channel, state );
+        library[channel].edge( state & 1, ( state >> 1 ) & 1 );
+    }
+    seconds = wall_seconds() - start;
+
+    quadrature_get_snapshot( &snapshot );
+    for ( int channel = 0; channel < QUADRATURE_CHANNELS; channel++ )
+    {
+        // Both leave the count alone on an illegal transition, so the counts
+        // still agree in the low 16 bits
+        bool right = ( snapshot.errors[channel] == illegal[channel] ) && ( library[channel].errors == illegal[channel] );
+
+        printf( "m%d: %ld counts, %u illegal transitions of %u injected, library %d counts %u errors  %s\n",
+                channel + 1, (long)snapshot.counts[channel], snapshot.errors[channel], illegal[channel],
+                library[channel].count, library[channel].errors, right ? "ok" : "FAIL" );
+        ok &= right;
+        agree &= ( (int16_t)snapshot.counts[channel] == library[channel].count );
+    }
+    printf( "counts %s the library's (low 16 bits)  %s\n", agree ? "match" : "differ from", agree ? "ok" : "FAIL" );
+    printf( "%ld edges in %.3fs, %.1f ns per ISR call on this host\n", edges, seconds, seconds * 1e9 / edges );
+    ok &= agree;
+
+    // Expected counts only hold with no illegal transitions; check a clean run
+    sim_reset();
+    quadrature_init( IO_A2, IO_A3, IO_A0, IO_A1 );
+    for ( int channel = 0; channel < QUADRATURE_CHANNELS; channel++ )
+    {
+        expected[channel] = 0;
+        at[channel] = 0;
+    }
+    for ( long i = 0; i < edges; i++ )
+    {
+        int channel = rand() % QUADRATURE_CHANNELS;
+        int step = ( rand() % 100 < 55 ) ? 1 : -1;
+
+        expected[channel] += step;
+        at[channel] = ( at[channel] + step + 4 ) & 3;
+        quadrature_set_lines( channel, forward[at[channel]] );
+    }
+    quadrature_get_snapshot( &snapshot );
+    {
+        bool right = ( snapshot.counts[QUADRATURE_M1] == expected[QUADRATURE_M1] ) &&
+                     ( snapshot.counts[QUADRATURE_M2] == expected[QUADRATURE_M2] ) &&
+                     ( snapshot.errors[QUADRATURE_M1] == 0 ) && ( snapshot.errors[QUADRATURE_M2] == 0 );
+
+        printf( "clean walk: m1 %ld of %lld, m2 %ld of %lld  %s\n", (long)snapshot.counts[QUADRATURE_M1],
+                (long long)expected[QUADRATURE_M1], (long)snapshot.counts[QUADRATURE_M2],
+                (long long)expected[QUADRATURE_M2], right ? "ok" : "FAIL" );
+        ok &= right;
+    }
+
+    printf( "%s\n", ok ? "ok" : "FAIL" );
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// Ring buffers
+
+RING_DECLARE( byte_ring, uint8_t, 64 )
+RING_DECLARE( big_ring, uint8_t, 256 )
+RING_DECLARE( capture_records, capture_record_t, CAPTURE_RECORDS )
+RING_DECLARE( trace_records, trace_record_t, TRACE_RECORDS )
+
+// Bursts of 1..32 pushes then as many pops, the same for every ring
+static std::vector<uint8_t> ring_bursts( size_t count )
+{
+    std::vector<uint8_t> bursts( count );
+
+    srand( 46 );
+    for ( uint8_t &burst : bursts )
+    {
+        burst = (uint8_t)( 1 + rand() % 32 );
+    }
+
+    return bursts;
+}
+
+static double cbuf_ns_per_op( const std::vector<uint8_t> &bursts, uint32_t *sum )
+{
+    static uint8_t storage[64];
+    cbuf_t ring;
+    uint32_t total = 0;
+    uint64_t ops = 0;
+    double start;
+
+    CBUF_INIT( &ring, storage, sizeof(storage) );
+
+    start = wall_seconds();
+    for ( uint8_t burst : bursts )
+    {
+        for ( uint8_t i = 0; i < burst; i++ )
+        {
+            if ( !CBUF_FULL( &ring ) )
+            {
+                CBUF_PUSH( &ring, (uint8_t)( total + i ) );
+            }
+        }
+        for ( uint8_t i = 0; i < burst; i++ )
+        {
+            if ( !CBUF_EMPTY( &ring ) )
+            {
+                total += CBUF_POP( &ring );
+            }
+        }
+        ops += 2 * burst;
+    }
+
+    *sum = total;
+    return ( wall_seconds() - start ) * 1e9 / ops;
+}
+
+template <typename Ring, typename Push, typename Pop>
+static double ring_ns_per_op( const std::vector<uint8_t> &bursts, Ring &ring, Push push, Pop pop, uint32_t *sum )
+{
+    uint32_t total = 0;
+    uint64_t ops = 0;
+    double start;
+
+    start = wall_seconds();
+    for ( uint8_t burst : bursts )
+    {
+        for ( uint8_t i = 0; i < burst; i++ )
+        {
+            push( ring, (uint8_t)( total + i ) );
+        }
+        for ( uint8_t i = 0; i < burst; i++ )
+        {
+            total += pop( ring );
+        }
+        ops += 2 * burst;
+    }
+
+    *sum = total;
+    return ( wall_seconds() - start ) * 1e9 / ops;
+}
+
+static int ring_mode( int argc, char **argv )
+{
+    long bursts_count = 2000000;
+    std::vector<uint8_t> bursts;
+    uint32_t cbuf_sum, byte_sum, big_sum, capture_sum, trace_sum;
+    double cbuf_ns, byte_ns, big_ns, capture_ns, trace_ns;
+    bool ok = true, right;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--bursts" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            bursts_count = atol( argv[++i] );
+        }
+        else
+        {
+            fprintf( stderr, "ring: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( bursts_count <= 0 )
+    {
+        fprintf( stderr, "ring: --bursts must be positive\n" );
+        return 1;
+    }
+
+    // Behaviour at the edges
+    {
+        static capture_records_t records;
+        static big_ring_t big;
+        capture_record_t record = { 1, 2, 3, 4 };
+        int pushed = 0, dropped_right = 1;
+
+        capture_records_init( &records );
+        while ( capture_records_push( &records, &record ) )
+        {
+            record.Pe++;
+            pushed++;
+        }
+        right = ( pushed == CAPTURE_RECORDS ) && capture_records_full( &records ) &&
+                ( capture_records_count( &records ) == CAPTURE_RECORDS ) && ( capture_records_peek( &records, 0 )->Pe == 1 );
+
+        // Overwrite drops the oldest
+        for ( int i = 0; i < 3; i++ )
+        {
+            capture_records_overwrite( &records )->Pe = (int16_t)( 1000 + i );
+        }
+        dropped_right = ( capture_records_count( &records ) == CAPTURE_RECORDS ) &&
+                        ( capture_records_peek( &records, 0 )->Pe == 4 ) &&
+                        ( capture_records_peek( &records, CAPTURE_RECORDS - 1 )->Pe == 1002 );
+        right &= dropped_right;
+
+        while ( capture_records_pop( &records, &record ) )
+        {
+        }
+        right &= capture_records_empty( &records ) && !capture_records_pop( &records, &record );
+
+        big_ring_init( &big );
+        for ( int i = 0; i < 256; i++ )
+        {
+            uint8_t value = (uint8_t)i;
+            right &= big_ring_push( &big, &value );
+        }
+        right &= big_ring_full( &big ) && ( big_ring_count( &big ) == 256 );
+
+        printf( "index bytes: 64 x uint8_t %zu, 128 x capture record %zu, 256 x uint8_t %zu\n",
+                sizeof(byte_ring_index_t), sizeof(capture_records_index_t), sizeof(big_ring_index_t) );
+        printf( "fill to capacity, overwrite oldest, drain, 256 entries  %s\n", right ? "ok" : "FAIL" );
+        ok &= right && ( sizeof(byte_ring_index_t) == 1 ) && ( sizeof(capture_records_index_t) == 1 ) &&
+              ( sizeof(big_ring_index_t) == 2 );
+    }
+
+    // Same bursts through cbuf.h and the typed rings
+    bursts = ring_bursts( (size_t)bursts_count );
+
+    cbuf_ns = cbuf_ns_per_op( bursts, &cbuf_sum );
+
+    {
+        static byte_ring_t bytes;
+        byte_ring_init( &bytes );
+        byte_ns = ring_ns_per_op( bursts, bytes,
+                                  []( byte_ring_t &r, uint8_t v ) { byte_ring_push( &r, &v ); },
+                                  []( byte_ring_t &r ) { uint8_t v = 0; byte_ring_pop( &r, &v ); return (uint32_t)v; },
+                                  &byte_sum );
+    }
+    {
+        static big_ring_t big;
+        big_ring_init( &big );
+        big_ns = ring_ns_per_op( bursts, big,
+                                 []( big_ring_t &r, uint8_t v ) { big_ring_push( &r, &v ); },
+                                 []( big_ring_t &r ) { uint8_t v = 0; big_ring_pop( &r, &v ); return (uint32_t)v; },
+                                 &big_sum );
+    }
+    {
+        static capture_records_t records;
+        capture_records_init( &records );
+        capture_ns = ring_ns_per_op( bursts, records,
+                                     []( capture_records_t &r, uint8_t v )
+                                     {
+                                         capture_record_t *record;
+
+                                         if ( !capture_records_full( &r ) )
+                                         {
+                                             record = capture_records_slot( &r );
+                                             record->Pe = v;
+                                             record->Pm = v;
+                                             record->Vm = 0;
+                                             record->T = 0;
+                                             capture_records_commit( &r );
+                                         }
+                                     },
+                                     []( capture_records_t &r )
+                                     {
+                                         capture_record_t record = { 0, 0, 0, 0 };
+                                         capture_records_pop( &r, &record );
+                                         return (uint32_t)(uint8_t)record.Pe;
+                                     },
+                                     &capture_sum );
+    }
+    {
+        static trace_records_t records;
+        trace_records_init( &records );
+        trace_ns = ring_ns_per_op( bursts, records,
+                                   []( trace_records_t &r, uint8_t v )
+                                   {
+                                       trace_record_t record = { 0, TRACE_MARK, v };
+                                       trace_records_push( &r, &record );
+                                   },
+                                   []( trace_records_t &r )
+                                   {
+                                       trace_record_t record = { 0, 0, 0 };
+                                       trace_records_pop( &r, &record );
+                                       return (uint32_t)(uint8_t)record.payload;
+                                   },
+                                   &trace_sum );
+    }
+
+    // Bursts are under every capacity, so each ring passes the same bytes
+    right = ( byte_sum == cbuf_sum ) && ( big_sum == cbuf_sum ) && ( capture_sum == cbuf_sum ) && ( trace_sum == cbuf_sum );
+    printf( "%ld bursts of 1..32 pushes and as many pops, ns per push or pop on this host:\n", bursts_count );
+    printf( "  cbuf.h        64 x uint8_t           %6.2f\n", cbuf_ns );
+    printf( "  ring.h        64 x uint8_t           %6.2f\n", byte_ns );
+    printf( "  ring.h       256 x uint8_t           %6.2f\n", big_ns );
+    printf( "  ring.h       128 x capture_record_t  %6.2f  (%zu bytes)\n", capture_ns, sizeof(capture_record_t) );
+    printf( "  ring.h       128 x trace_record_t    %6.2f  (%zu bytes)\n", trace_ns, sizeof(trace_record_t) );
+    printf( "same data out of every ring  %s\n", right ? "ok" : "FAIL" );
+    ok &= right;
+
+    printf( "%s\n", ok ? "ok" : "FAIL" );
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// Message pool
+
+struct PoolRun
+{
+    int lines;
+    int bad_lines;
+    double wait_us_per_command;
+    pool_stats_t stats;
+    uint64_t clobbered;
+};
+
+// 'commands' x "B,-1" (five reply lines) one per 50 ms over a wire at
+// 'baud'.  With 'dry' the harness holds every message block, so print_usb()
+// falls back on sending from the caller's buffer and waiting, as it did
+// before the pool.
+static PoolRun run_pool( int commands, unsigned long baud, bool dry )
+{
+    ClosedLoop loop;
+    PoolRun run = PoolRun();
+    std::vector<char *> held;
+    uint64_t wait_start;
+
+    loop.power_up();
+    set_logging( 0 );
+    sim_serial_wire( baud );
+
+    if ( dry )
+    {
+        for ( char *block; ( block = telemetry_message_alloc() ) != NULL; )
+        {
+            held.push_back( block );
+        }
+    }
+
+    wait_start = sim.tx_wait_us;
+    for ( int i = 0; i < commands; i++ )
+    {
+        loop.command( "B,-1" );
+        loop.run( 50, [&]( const std::string &line )
+        {
+            run.lines++;
+            run.bad_lines += ( line.compare( 0, 2, "d," ) != 0 );
+        }, []() {} );
+    }
+    run.wait_us_per_command = (double)( sim.tx_wait_us - wait_start ) / commands;
+
+    for ( char *block : held )
+    {
+        telemetry_message_free( block );
+    }
+
+    telemetry_get_message_pool( &run.stats );
+    run.clobbered = sim.tx_clobbered;
+
+    return run;
+}
+
+static int pool_mode( int argc, char **argv )
+{
+    int commands = 50;
+    unsigned long baud = 256000;
+    bool ok = true, right;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--commands" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            commands = atoi( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--baud" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            baud = strtoul( argv[++i], NULL, 10 );
+        }
+        else
+        {
+            fprintf( stderr, "pool: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( ( commands <= 0 ) || !baud )
+    {
+        fprintf( stderr, "pool: --commands and --baud must be positive\n" );
+        return 1;
+    }
+
+    // The allocator on its own
+    {
+        static uint8_t storage[4 * 16];
+        uint8_t outside[16];
+        pool_t pool;
+        pool_stats_t stats;
+        void *blocks[4];
+        bool distinct = true;
+
+        pool_init( &pool, storage, 16, 4 );
+        for ( int i = 0; i < 4; i++ )
+        {
+            blocks[i] = pool_alloc( &pool );
+            distinct &= ( blocks[i] != NULL );
+            for ( int j = 0; j < i; j++ )
+            {
+                distinct &= ( blocks[i] != blocks[j] );
+            }
+        }
+        right = distinct && ( pool_alloc( &pool ) == NULL );
+
+        pool_free( &pool, outside );
+        pool_free( &pool, blocks[2] );
+        right &= ( pool_alloc( &pool ) == blocks[2] );
+
+        // Inside a block, and a double free with others still in use
+        pool_free( &pool, (uint8_t *)blocks[1] + 1 );
+        pool_free( &pool, blocks[3] );
+        pool_free( &pool, blocks[3] );
+        pool_get_stats( &pool, &stats );
+        right &= ( stats.in_use == 3 ) && ( stats.bad_frees == 3 );
+
+        for ( int i = 0; i < 3; i++ )
+        {
+            pool_free( &pool, blocks[i] );
+        }
+        pool_free( &pool, blocks[0] );
+
+        // Each block once on the free list
+        for ( int i = 0; i < 4; i++ )
+        {
+            blocks[i] = pool_alloc( &pool );
+            for ( int j = 0; j < i; j++ )
+            {
+                right &= ( blocks[i] != blocks[j] );
+            }
+        }
+        right &= ( blocks[3] != NULL ) && ( pool_alloc( &pool ) == NULL );
+        for ( int i = 0; i < 4; i++ )
+        {
+            pool_free( &pool, blocks[i] );
+        }
+
+        pool_get_stats( &pool, &stats );
+        right &= ( stats.in_use == 0 ) && ( stats.high_water == 4 ) && ( stats.failures == 2 ) && ( stats.bad_frees == 4 );
+        printf( "pool 4 x 16: exhaustion, reuse, foreign, misaligned and double frees (high %u failed %u bad frees %u)  %s\n",
+                stats.high_water, stats.failures, stats.bad_frees, right ? "ok" : "FAIL" );
+        ok &= right;
+    }
+
+    printf( "%d x \"B,-1\" at %lu baud, one per 50 ms\n", commands, baud );
+    for ( int dry = 0; dry < 2; dry++ )
+    {
+        PoolRun run = run_pool( commands, baud, dry );
+
+        // Dry, the "d,Received" echo finds no block and is dropped
+        right = ( run.bad_lines == 0 ) && ( run.clobbered == 0 ) && ( run.lines == commands * ( dry ? 4 : 5 ) ) &&
+                ( dry || ( run.stats.failures == 0 ) );
+        printf( "%s  %5d lines  CPU waiting %7.1f us/command  pool high %u failed %u  %s\n",
+                dry ? "pool held, print_usb() waits" : "pool                       ",
+                run.lines, run.wait_us_per_command, run.stats.high_water, run.stats.failures, right ? "ok" : "FAIL" );
+        ok &= right;
+    }
+
+    printf( "%s\n", ok ? "ok" : "FAIL" );
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// Watchdog supervisor
+
+enum WatchdogFault
+{
+    FAULT_LOOP,                 // the main loop stops, the tick runs on
+    FAULT_CONTROL,              // calculate() runs slower than its deadline
+    FAULT_STALL,                // the timer tick stops (interrupts off)
+    FAULT_NUM
+};
+
+static const char *fault_names[FAULT_NUM] = { "main loop hangs", "control overruns", "tick stops" };
+
+struct WatchdogTrial
+{
+    int64_t checkin_ms;         // the late client's last check-in (last kick for a stall)
+    int64_t stop_ms;            // motor 2 first at zero, -1 if never
+    int64_t reset_ms;           // the watchdog ran out, -1 if never
+    bool record_ok;             // 'W,0' after the reset names the fault
+};
+
+// Drive the motor toward a far reference, set the client's deadline, inject
+// the fault 'phase_ms' later and run until the watchdog runs out, then
+// reset with WDRF and read the record back
+static WatchdogTrial run_watchdog_trial( WatchdogFault fault, int deadline_ms, int phase_ms )
+{
+    ClosedLoop loop;
+    WatchdogTrial trial = { -1, -1, -1, false };
+    int64_t fault_ms, last_pass_ms, last_cycle_ms = -1;
+    uint16_t cycle;
+    char text[32];
+    bool tick, pass;
+
+    loop.power_up();
+    set_logging( 0 );
+    snprintf( text, sizeof(text), "W,%d,%d", ( fault == FAULT_CONTROL ) ? 1 : 2, deadline_ms );
+    // One command per loop pass
+    loop.command( "R,3600" );
+    loop.run( 100, ignore_line );
+    if ( fault == FAULT_LOOP )
+    {
+        loop.command( text );
+    }
+    loop.run( 400 + phase_ms, ignore_line );
+
+    fault_ms = loop.clock.next_tick_ms;
+    last_pass_ms = ( fault_ms - 1 ) - ( fault_ms - 1 ) % ClosedLoop::LOOP_MS;
+    if ( fault == FAULT_CONTROL )
+    {
+        // Takes effect on the next loop pass, which restarts the age
+        loop.command( text );
+    }
+    cycle = controller_get_cycle();
+
+    tick = ( fault != FAULT_STALL );
+    pass = ( fault != FAULT_LOOP );
+    for ( int64_t now_ms = fault_ms; now_ms < fault_ms + 5000; now_ms++ )
+    {
+        if ( tick )
+        {
+            loop.clock.advance_to( now_ms * 1000, []( int64_t )
+            {
+                sim_advance_motors_us( 1000 );
+            } );
+        }
+        else
+        {
+            sim_advance_motors_us( 1000 );
+            sim.ms = (unsigned long)now_ms;
+            loop.clock.next_tick_ms = now_ms + 1;
+        }
+
+        if ( pass && ( now_ms % ClosedLoop::LOOP_MS == 0 ) )
+        {
+            firmware_loop_pass();
+            loop.tx.lines.clear();
+            last_pass_ms = now_ms;
+        }
+
+        if ( controller_get_cycle() != cycle )
+        {
+            cycle = controller_get_cycle();
+            last_cycle_ms = now_ms;
+        }
+
+        if ( ( trial.stop_ms < 0 ) && ( sim.motor_m2 == 0 ) )
+        {
+            trial.stop_ms = now_ms;
+        }
+
+        if ( sim_watchdog_expired() )
+        {
+            trial.reset_ms = now_ms;
+            break;
+        }
+    }
+
+    switch ( fault )
+    {
+        case FAULT_LOOP:
+            trial.checkin_ms = last_pass_ms;
+            break;
+        case FAULT_CONTROL:
+            trial.checkin_ms = std::max( last_cycle_ms, fault_ms + ( ClosedLoop::LOOP_MS - fault_ms % ClosedLoop::LOOP_MS ) % ClosedLoop::LOOP_MS );
+            break;
+        default:
+            trial.checkin_ms = (int64_t)sim.wdt_kicked_ms;
+            break;
+    }
+
+    if ( trial.reset_ms < 0 )
+    {
+        return trial;
+    }
+
+    // The board comes back up; the motor pins went to inputs at the reset
+    if ( trial.stop_ms < 0 )
+    {
+        trial.stop_ms = trial.reset_ms;
+    }
+
+    loop.reboot( 1 << WDRF );
+    set_logging( 0 );
+    loop.command( "W,0" );
+
+    std::string expect = ( fault == FAULT_STALL ) ? "d,last reset stall" : "d,last reset deadline";
+    const char *client = ( fault == FAULT_LOOP ) ? "d,last trip loop" : ( fault == FAULT_CONTROL ) ? "d,last trip control" : NULL;
+    bool cause = false, which = ( client == NULL );
+
+    loop.run( 50, [&]( const std::string &line )
+    {
+        cause |= ( line.compare( 0, expect.size(), expect ) == 0 );
+        if ( client )
+        {
+            which |= ( line.compare( 0, strlen( client ), client ) == 0 );
+        }
+    } );
+    trial.record_ok = cause && which;
+
+    return trial;
+}
+
+static int watchdog_mode( int argc, char **argv )
+{
+    static const int loop_deadlines[] = { 50, 250 };
+    static const int control_deadlines[] = { 100, 150 };
+    int trials = 20;
+    bool ok = true, right;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--trials" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            trials = atoi( argv[++i] );
+        }
+        else
+        {
+            fprintf( stderr, "watchdog: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( trials <= 0 )
+    {
+        fprintf( stderr, "watchdog: --trials must be positive\n" );
+        return 1;
+    }
+
+    // No trips in normal running, and the gaps 'W,0' reports
+    {
+        ClosedLoop loop;
+        int tripped = 0;
+        unsigned control_worst = 0, control_deadline = 0, loop_worst = 0, loop_deadline = 0;
+
+        loop.power_up();
+        for ( int i = 0; i < 10; i++ )
+        {
+            loop.command( ( i & 1 ) ? "R,0" : "R,720" );
+            loop.run( 1000, ignore_line, [&]()
+            {
+                tripped |= supervisor_tripped() || sim_watchdog_expired();
+            } );
+        }
+        set_logging( 0 );
+        loop.command( "W,0" );
+        loop.run( 50, [&]( const std::string &line )
+        {
+            sscanf( line.c_str(), "d,supervisor ms control %u of %u, loop %u of %u",
+                    &control_worst, &control_deadline, &loop_worst, &loop_deadline );
+        } );
+
+        right = !tripped && control_deadline && ( control_worst <= control_deadline ) && ( loop_worst <= loop_deadline );
+        printf( "10 s of steps, logging on: %s, worst gap control %u of %u ms, loop %u of %u ms, watchdog %d ms  %s\n",
+                tripped ? "TRIPPED" : "no trip", control_worst, control_deadline, loop_worst, loop_deadline,
+                SUPERVISOR_WDT_MS, right ? "ok" : "FAIL" );
+        ok &= right;
+    }
+
+    printf( "%-17s %8s %6s  %-24s %-24s %s\n", "fault", "deadline", "trials", "motor 0 after check-in", "reset after check-in", "record" );
+
+    for ( int f = 0; f < FAULT_NUM; f++ )
+    {
+        WatchdogFault fault = (WatchdogFault)f;
+        const int *deadlines = ( fault == FAULT_CONTROL ) ? control_deadlines : loop_deadlines;
+        int runs = ( fault == FAULT_STALL ) ? 1 : 2;
+
+        for ( int d = 0; d < runs; d++ )
+        {
+            int deadline_ms = deadlines[d];
+            int64_t stop_max = 0, reset_max = 0, stop_bound, reset_bound;
+            int records = 0, missed = 0;
+            char deadline_text[16];
+
+            for ( int t = 0; t < trials; t++ )
+            {
+                // Spread the faults over the loop and control periods
+                WatchdogTrial trial = run_watchdog_trial( fault, deadline_ms, ( t * 37 ) % NUM_MS_PER_CALC );
+
+                if ( trial.reset_ms < 0 )
+                {
+                    missed++;
+                    continue;
+                }
+                stop_max = std::max( stop_max, trial.stop_ms - trial.checkin_ms );
+                reset_max = std::max( reset_max, trial.reset_ms - trial.checkin_ms );
+                records += trial.record_ok;
+            }
+
+            if ( fault == FAULT_STALL )
+            {
+                stop_bound = reset_bound = SUPERVISOR_WDT_MS;
+                snprintf( deadline_text, sizeof(deadline_text), "-" );
+            }
+            else
+            {
+                stop_bound = deadline_ms + 1;
+                reset_bound = stop_bound + SUPERVISOR_WDT_MS;
+                snprintf( deadline_text, sizeof(deadline_text), "%d ms", deadline_ms );
+            }
+
+            right = !missed && ( records == trials ) && ( stop_max <= stop_bound ) && ( reset_max <= reset_bound );
+            printf( "%-17s %8s %6d  max %4lld ms (bound %4lld)  max %4lld ms (bound %4lld)  %d/%d  %s\n",
+                    fault_names[fault], deadline_text, trials,
+                    (long long)stop_max, (long long)stop_bound, (long long)reset_max, (long long)reset_bound,
+                    records, trials, right ? "ok" : "FAIL" );
+            ok &= right;
+        }
+    }
+
+    printf( "%s\n", ok ? "ok" : "FAIL" );
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// Menu command path
+
+// "<op>,<value>", answered with "d,Received:<line>" whatever the line holds
+static menu_bench::Line make_menu_line( menu_bench::Random &random, menu_bench::LINE_KIND_E kind )
+{
+    static const char ops[] = "PDRIKpdrik";
+    char text[96];
+    menu_bench::Line line;
+    char op;
+    int value;
+
+    line.kind = kind;
+
+    switch ( kind )
+    {
+        case menu_bench::LINE_VALID:
+            op = ops[random.below( sizeof(ops) - 1 )];
+            switch ( op )
+            {
+                case 'K':
+                case 'k':
+                    value = random.between( 0, CONTROLLER_LAW_NUM - 1 );
+                    break;
+                case 'R':
+                case 'r':
+                    value = random.between( -720, 720 );
+                    break;
+                case 'D':
+                case 'd':
+                    value = random.between( -9999, 0 );
+                    break;
+                default:
+                    value = random.between( 0, 9999 );
+                    break;
+            }
+            snprintf( text, sizeof(text), "%c,%d", op, value );
+            break;
+
+        case menu_bench::LINE_MALFORMED:
+            // No comma, too short, or no such command
+            switch ( random.below( 3 ) )
+            {
+                case 0:
+                    snprintf( text, sizeof(text), "P%d", random.between( 0, 9999 ) );
+                    break;
+                case 1:
+                    snprintf( text, sizeof(text), "%c,", ops[random.below( sizeof(ops) - 1 )] );
+                    break;
+                default:
+                    snprintf( text, sizeof(text), "Q,%d", random.between( -99, 99 ) );
+                    break;
+            }
+            break;
+
+        default:
+            snprintf( text, sizeof(text), "R,%0*d", random.between( (int)sizeof(menuBuffer), 80 ), random.between( 0, 9 ) );
+            line.text = text;
+            line.reply = "d,Line too long, dropped";
+            return line;
+    }
+
+    line.text = text;
+    line.reply = std::string( "d,Received:" ) + text;
+
+    return line;
+}
+
+struct MenuRun
+{
+    menu_bench::Tally tally;
+    double seconds;             // simulated, to the end of the stream or the last reply
+    double host_ns;             // host time in the loop passes per line answered
+};
+
+// The main loop reads the ring every ClosedLoop::LOOP_MS with logging off,
+// replies going out over a 'baud' wire
+static MenuRun run_menu( const menu_bench::Mix &mix, double rate, double seconds, unsigned long baud, uint32_t seed )
+{
+    menu_bench::Random random( seed );
+    menu_bench::Feed feed( baud, rate, "\n" );
+    ClosedLoop loop;
+    MenuRun run;
+    double end_us = seconds * 1e6, last_us = 0.0, host = 0.0, start;
+    int64_t stop_ms = -1;
+
+    loop.power_up();
+    set_logging( 0 );
+    sim_serial_wire( baud );
+
+    for ( int64_t now_ms = 0; ( stop_ms < 0 ) || ( now_ms < stop_ms ); now_ms++ )
+    {
+        double now_us = now_ms * 1000.0;
+
+        loop.clock.advance_to( now_ms * 1000, []( int64_t )
+        {
+            sim_advance_motors_us( 1000 );
+        } );
+
+        if ( now_ms % ClosedLoop::LOOP_MS != 0 )
+        {
+            continue;
+        }
+
+        while ( ( feed.next_start_us() <= now_us ) && ( feed.next_start_us() < end_us ) )
+        {
+            menu_bench::Line line = make_menu_line( random, menu_bench::pick_kind( random, mix ) );
+
+            feed.send( line );
+            run.tally.expect( line );
+        }
+        feed.deliver( std::max( now_us, (double)sim_cpu_us() ) );
+
+        start = wall_seconds();
+        firmware_loop_pass();
+        host += wall_seconds() - start;
+
+        while ( !loop.tx.lines.empty() )
+        {
+            const std::string &text = loop.tx.lines.front();
+
+            if ( ( text.compare( 0, 11, "d,Received:" ) == 0 ) || ( text.compare( 0, 15, "d,Line too long" ) == 0 ) )
+            {
+                run.tally.reply( text );
+                last_us = now_us;
+            }
+            loop.tx.lines.pop_front();
+        }
+
+        if ( ( stop_ms < 0 ) && feed.idle() && ( now_us >= end_us ) )
+        {
+            stop_ms = now_ms + 1000;
+        }
+    }
+
+    run.tally.finish();
+    run.seconds = std::max( last_us, end_us ) / 1e6;
+    run.host_ns = run.tally.answered ? host * 1e9 / run.tally.answered : 0.0;
+
+    return run;
+}
+
+static int menu_mode( int argc, char **argv )
+{
+    static const double rates[] = { 10, 50, 100, 200, 400, 800, 1600 };
+    const menu_bench::Mix *mix = menu_bench::find_mix( "mixed" );
+    double rate = 0.0, seconds = 10.0;
+    unsigned long baud = 256000;
+    uint32_t seed = 1;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--mix" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            mix = menu_bench::find_mix( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--rate" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            rate = atof( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--seconds" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            seconds = atof( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--baud" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            baud = strtoul( argv[++i], NULL, 10 );
+        }
+        else if ( ( strcmp( argv[i], "--seed" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            seed = strtoul( argv[++i], NULL, 10 );
+        }
+        else
+        {
+            fprintf( stderr, "menu: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( ( mix == NULL ) || ( rate < 0.0 ) || ( seconds <= 0.0 ) || !baud )
+    {
+        fprintf( stderr, "menu: bad --mix, --rate, --seconds or --baud\n" );
+        return 1;
+    }
+
+    printf( "Lab2 menu, %s lines, %lu baud, main loop every %d ms, logging off, %.0f s per rate\n",
+            mix->name, baud, ClosedLoop::LOOP_MS, seconds );
+    printf( "%8s %7s %9s %8s %10s %11s %13s\n",
+            "lines/s", "sent", "answered", "dropped", "misparsed", "answered/s", "host ns/line" );
+
+    for ( size_t r = 0; r < ( rate > 0.0 ? 1 : sizeof(rates) / sizeof(rates[0]) ); r++ )
+    {
+        double offered = ( rate > 0.0 ) ? rate : rates[r];
+        MenuRun run = run_menu( *mix, offered, seconds, baud, seed );
+        const menu_bench::Tally &tally = run.tally;
+
+        printf( "%8.0f %7llu %9llu %8llu %10llu %11.1f %13.0f\n",
+                offered, (unsigned long long)tally.total_sent(), (unsigned long long)tally.answered,
+                (unsigned long long)tally.dropped, (unsigned long long)tally.misparsed,
+                tally.answered / run.seconds, run.host_ns );
+    }
+
+    if ( mix->oversized )
+    {
+        printf( "Oversized lines longer than the %u byte ring lap it within a pass; what is left can\n"
+                "read as a shorter valid line, counted misparsed\n", (unsigned)sizeof(receive_buffer) );
+    }
+
+    return 0;
+}
+
+// Random bytes through the whole command path, with the controller running.
+// 'W' becomes '?', as 'W,4' hangs the firmware on purpose.
+static int fuzz_mode( int argc, char **argv )
+{
+    unsigned long bytes = 1000000, fed = 0, received = 0, too_long = 0;
+    uint32_t seed = 1;
+    ClosedLoop loop;
+    bool ok = true;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--bytes" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            bytes = strtoul( argv[++i], NULL, 10 );
+        }
+        else if ( ( strcmp( argv[i], "--seed" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            seed = strtoul( argv[++i], NULL, 10 );
+        }
+        else
+        {
+            fprintf( stderr, "fuzz: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    menu_bench::FuzzSource source( seed );
+
+    loop.power_up();
+
+    while ( fed < bytes )
+    {
+        char burst[64];
+        size_t length = 1 + source.random.below( sizeof(burst) );
+
+        for ( size_t i = 0; i < length; i++ )
+        {
+            burst[i] = source.next();
+            if ( ( burst[i] == 'W' ) || ( burst[i] == 'w' ) )
+            {
+                burst[i] = '?';
+            }
+        }
+        sim_serial_inject( burst, length );
+        fed += length;
+
+        loop.run( ClosedLoop::LOOP_MS, [&]( const std::string &line )
+        {
+            received += ( line.compare( 0, 11, "d,Received:" ) == 0 );
+            too_long += ( line.compare( 0, 15, "d,Line too long" ) == 0 );
+        } );
+
+        ok &= ( receive_buffer_position < sizeof(receive_buffer) );
+    }
+
+    printf( "Lab2 menu fuzz: %lu bytes, %lu lines received, %lu too long, AddressSanitizer %s  %s\n",
+            fed, received, too_long, menu_bench::asan_on() ? "on" : "off (no overrun checks)", ok ? "ok" : "FAIL" );
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+// Command to actuation latency
+
+// Nearest rank, 'p' percent
+static double nearest_rank( std::vector<double> values, double p )
+{
+    size_t rank;
+
+    if ( values.empty() )
+    {
+        return 0.0;
+    }
+    std::sort( values.begin(), values.end() );
+    rank = (size_t)ceil( p / 100.0 * values.size() );
+    return values[rank ? rank - 1 : 0];
+}
+
+typedef enum
+{
+    LATENCY_COLUMN_WIRE,                // terminator on the wire to the rx poll, harness
+    LATENCY_COLUMN_PARSE,
+    LATENCY_COLUMN_PUBLISH,
+    LATENCY_COLUMN_ACTUATE,
+    LATENCY_COLUMN_BOARD,               // rx poll to set_motors(), latency.h's total
+    LATENCY_COLUMN_END,                 // wire to set_motors()
+    LATENCY_COLUMNS
+} LatencyColumn;
+
+static const char *LATENCY_COLUMN_NAMES[LATENCY_COLUMNS] =
+{
+    "wire to poll", "parse", "publish", "actuate", "poll to motor", "wire to motor"
+};
+
+// Parameter commands whose terminator lands at a random us over two control
+// periods, one at a time, timed by latency.h and by the harness
+static int latency_mode( int argc, char **argv )
+{
+    int commands = 200, lost = 0;
+    uint32_t seed = 1;
+    bool logging = true, ok = true, right;
+    std::vector<double> columns[LATENCY_COLUMNS];
+    uint32_t last_rx_ms = 0xFFFFFFFF;
+    int64_t wheel_ahead_ms;
+    ClosedLoop loop;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--commands" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            commands = atoi( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--seed" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            seed = strtoul( argv[++i], NULL, 10 );
+        }
+        else if ( strcmp( argv[i], "--no-log" ) == 0 )
+        {
+            logging = false;
+        }
+        else
+        {
+            fprintf( stderr, "latency: unexpected argument %s\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( commands <= 0 )
+    {
+        fprintf( stderr, "latency: --commands must be positive\n" );
+        return 1;
+    }
+
+    menu_bench::Random random( seed );
+
+    loop.power_up();
+    set_logging( logging ? 1 : 0 );
+    sim_serial_wire( 256000 );
+    loop.run( 1000, ignore_line );
+
+    // timer_wheel_now() counts the tick at sim.ms 0 as 1
+    wheel_ahead_ms = (int64_t)timer_wheel_now() - (int64_t)sim.ms;
+
+    for ( int k = 0; k < commands; k++ )
+    {
+        double arrival_us = ( loop.clock.next_tick_ms + random.between( 0, 2 * NUM_MS_PER_CALC - 1 ) ) * 1000.0 + random.below( 1000 );
+        uint32_t roll = random.below( 100 );
+        char text[16];
+        latency_sample_t sample;
+        bool got = false;
+
+        if ( roll < 70 )
+        {
+            snprintf( text, sizeof(text), "R,%d", ( k & 1 ) ? -10 : 10 );
+        }
+        else if ( roll < 85 )
+        {
+            snprintf( text, sizeof(text), "P,4300" );
+        }
+        else
+        {
+            snprintf( text, sizeof(text), "D,-4850" );
+        }
+
+        // The bytes are on the ring from the tick after they arrive
+        while ( loop.clock.next_tick_ms * 1000.0 < arrival_us )
+        {
+            loop.run( 1, ignore_line );
+        }
+        loop.command( text );
+
+        for ( int ms = 0; ( ms < 1000 ) && !got; ms++ )
+        {
+            loop.run( 1, ignore_line );
+            if ( latency_count() )
+            {
+                latency_get( latency_count() - 1, &sample );
+                got = ( sample.rx_ms != last_rx_ms );
+            }
+        }
+        if ( !got )
+        {
+            lost++;
+            continue;
+        }
+        last_rx_ms = sample.rx_ms;
+
+        columns[LATENCY_COLUMN_WIRE].push_back( ( sample.rx_ms - wheel_ahead_ms ) * 1000.0 - arrival_us );
+        columns[LATENCY_COLUMN_PARSE].push_back( sample.us[LATENCY_PARSE] );
+        columns[LATENCY_COLUMN_PUBLISH].push_back( sample.us[LATENCY_PUBLISH] );
+        columns[LATENCY_COLUMN_ACTUATE].push_back( sample.us[LATENCY_ACTUATE] );
+        columns[LATENCY_COLUMN_BOARD].push_back( (double)sample.us[LATENCY_PARSE] + sample.us[LATENCY_PUBLISH] + sample.us[LATENCY_ACTUATE] );
+        columns[LATENCY_COLUMN_END].push_back( columns[LATENCY_COLUMN_WIRE].back() + columns[LATENCY_COLUMN_BOARD].back() );
+    }
+
+    printf( "%d commands (R, P, D) one at a time, terminator at a random us, logging %s, 256000 baud,\n"
+            "main loop every %d ms, calculate() every %d ms\n",
+            commands, logging ? "on" : "off", ClosedLoop::LOOP_MS, NUM_MS_PER_CALC );
+    printf( "%-14s %10s %10s %10s\n", "us", "p50", "p99", "max" );
+    for ( int c = 0; c < LATENCY_COLUMNS; c++ )
+    {
+        printf( "%-14s %10.0f %10.0f %10.0f\n", LATENCY_COLUMN_NAMES[c],
+                nearest_rank( columns[c], 50 ), nearest_rank( columns[c], 99 ), nearest_rank( columns[c], 100 ) );
+    }
+    printf( "parse and publish take no virtual time here, 'Y,0' on the board times them\n" );
+
+    // The rx poll is the first pass after the terminator, the first
+    // calculate() after the publish takes the set
+    right = !lost && !latency_skipped() &&
+            ( nearest_rank( columns[LATENCY_COLUMN_WIRE], 100 ) <= ClosedLoop::LOOP_MS * 1000.0 ) &&
+            ( nearest_rank( columns[LATENCY_COLUMN_ACTUATE], 100 ) <= NUM_MS_PER_CALC * 1000.0 );
+    printf( "lost %d, skipped %u, wire to poll within %d ms, actuate within %d ms  %s\n",
+            lost, latency_skipped(), ClosedLoop::LOOP_MS, NUM_MS_PER_CALC, right ? "ok" : "FAIL" );
+    ok &= right;
+
+    // 'Y,0' over the samples the board holds against the same samples here
+    {
+        std::vector<double> held( columns[LATENCY_COLUMN_BOARD].end() - std::min( columns[LATENCY_COLUMN_BOARD].size(), (size_t)LATENCY_RECORDS ),
+                                  columns[LATENCY_COLUMN_BOARD].end() );
+        unsigned long p50 = 0, p99 = 0, max = 0;
+        unsigned held_count = 0, skipped = 0;
+
+        // The report lines queue behind each other on the wire
+        loop.command( "Y,0" );
+        loop.run( 200, [&]( const std::string &line )
+        {
+            sscanf( line.c_str(), "d,latency %u commands, %u skipped", &held_count, &skipped );
+            sscanf( line.c_str(), "d,latency total p50 %lu p99 %lu max %lu us", &p50, &p99, &max );
+        } );
+
+        right = ( held_count == held.size() ) && ( p50 == nearest_rank( held, 50 ) ) &&
+                ( p99 == nearest_rank( held, 99 ) ) && ( max == nearest_rank( held, 100 ) );
+        printf( "'Y,0' poll to motor over the last %u: p50 %lu p99 %lu max %lu us, as here  %s\n",
+                held_count, p50, p99, max, right ? "ok" : "FAIL" );
+        ok &= right;
+    }
+
+    return ok ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------------------
+
+static void usage( const char *name )
+{
+    fprintf( stderr, "usage: %s replay <session> [--phase ms] [--show n] [--no-seed]\n"
+                     "       %s autotune [--rule n] [--step deg] [--plant-us us]\n"
+                     "       %s sweep [--kp from:to:n] [--kd from:to:n] [--step deg] [--seconds s] [--plant-us us] [--log]\n"
+                     "       %s params [--saves n]\n"
+                     "       %s wheel [--ticks n]\n"
+                     "       %s trace [--out dump.bin]\n"
+                     "       %s telemetry [--seconds s] [--baud n]\n"
+                     "       %s capture\n"
+                     "       %s pack [<session>] [--iterations n] [--seed n]\n"
+                     "       %s frame [--trials n]\n"
+                     "       %s tear [--seconds s] [--interval-us us]\n"
+                     "       %s pid [--kp x] [--kd x] [--ki x] [--seconds s]\n"
+                     "       %s friction [--kp x] [--kd x] [--ki x] [--seconds s]\n"
+                     "       %s quadrature [--revs n] [--edges n]\n"
+                     "       %s ring [--bursts n]\n"
+                     "       %s pool [--commands n] [--baud n]\n"
+                     "       %s watchdog [--trials n]\n"
+                     "       %s menu [--mix valid|mixed|hostile] [--rate n] [--seconds s] [--baud n] [--seed n]\n"
+                     "       %s fuzz [--bytes n] [--seed n]\n"
+                     "       %s latency [--commands n] [--seed n] [--no-log]\n",
+             name, name, name, name, name, name, name, name, name, name, name, name, name, name, name, name, name, name, name, name );
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc < 2 )
+    {
+        usage( argv[0] );
+        return 1;
+    }
+
+    if ( strcmp( argv[1], "replay" ) == 0 )
+    {
+        return replay( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "autotune" ) == 0 )
+    {
+        return autotune( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "sweep" ) == 0 )
+    {
+        return sweep( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "params" ) == 0 )
+    {
+        return params( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "wheel" ) == 0 )
+    {
+        return wheel( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "trace" ) == 0 )
+    {
+        return trace_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "telemetry" ) == 0 )
+    {
+        return telemetry_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "capture" ) == 0 )
+    {
+        return capture_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "pack" ) == 0 )
+    {
+        return pack_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "frame" ) == 0 )
+    {
+        return frame_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "tear" ) == 0 )
+    {
+        return tear_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "pid" ) == 0 )
+    {
+        return pid_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "friction" ) == 0 )
+    {
+        return friction_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "quadrature" ) == 0 )
+    {
+        return quadrature_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "ring" ) == 0 )
+    {
+        return ring_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "pool" ) == 0 )
+    {
+        return pool_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "watchdog" ) == 0 )
+    {
+        return watchdog_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "menu" ) == 0 )
+    {
+        return menu_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "fuzz" ) == 0 )
+    {
+        return fuzz_mode( argc - 2, argv + 2 );
+    }
+
+    if ( strcmp( argv[1], "latency" ) == 0 )
+    {
+        return latency_mode( argc - 2, argv + 2 );
+    }
+
+    usage( argv[0] );
+    return 1;
+}
@@ -0,0 +1,200 @@
+/* line_generator.cpp
+ *
+ * Pretends to be Lab2 on a pseudo terminal so telemetry_ingest can be run
+ * without a board.  Lines have the same shape as service_serial() output,
+ * with Pm counting up by one per line so the reader can prove nothing was
+ * dropped (telemetry_ingest --check-ramp).  A "d," line is mixed in every
+ * DEBUG_LINE_INTERVAL lines.
+ *
+ * Output is paced to the byte rate of a real 8N1 link at --baud, or sent as
+ * fast as the pty accepts with --flat-out.
+ *
+ * Usage:
+ *   line_generator [--baud n] [--seconds s] [--flat-out] [--wait ms]
+ *
+ *   $ ./line_generator --seconds 60 &
+ *   pty: /dev/pts/7
+ *   $ ./telemetry_ingest /dev/pts/7 capture.l2s --check-ramp --baud 0
+ *
+ * Build (from host/):
+ *   g++ -O2 -o line_generator line_generator.cpp
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_BAUD        256000
+#define BITS_PER_BYTE       10          // start + 8 data + stop
+#define DEBUG_LINE_INTERVAL 500
+#define PACE_INTERVAL_US    1000
+
+static int64_t monotonic_us( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int write_all( int fd, const char *data, size_t length )
+{
+    while ( length > 0 )
+    {
+        ssize_t sent = write( fd, data, length );
+        if ( sent <= 0 )
+        {
+            return -1;
+        }
+        data += sent;
+        length -= sent;
+    }
+
+    return 0;
+}
+
+// Same format string as service_serial() in Lab2/main.c
+static int format_line( char *buffer, size_t size, uint32_t seq, uint32_t pm )
+{
+    int Pr = ( pm / 2000 ) % 2 ? 720 : -720;
+    int Pm = (int)pm;
+    int Pe = Pr - ( Pm % 1440 );
+    int Vm = ( seq % 7 ) - 3;
+    int T = Pe > 150 ? 150 : ( Pe < -150 ? -150 : Pe );
+
+    if ( ( seq % DEBUG_LINE_INTERVAL ) == DEBUG_LINE_INTERVAL - 1 )
+    {
+        return snprintf( buffer, size, "d,Received:R,%d\n", Pr );
+    }
+
+    return snprintf( buffer, size, "v,%d,%d,%d,%d,%d,%d,%d\r\n", Pe, Pr, Pm, Vm, T, 4300, -4850 );
+}
+
+int main( int argc, char **argv )
+{
+    int baud = DEFAULT_BAUD;
+    double seconds = 10.0;
+    int flat_out = 0;
+    int wait_ms = 1000;
+    int master;
+    int64_t start_us, end_us;
+    uint64_t bytes_sent = 0;
+    uint32_t seq = 0;
+    uint32_t values_sent = 0;
+    char line[80];
+    int line_length = 0;
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--baud" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            baud = atoi( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--seconds" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            seconds = atof( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--wait" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            wait_ms = atoi( argv[++i] );
+        }
+        else if ( strcmp( argv[i], "--flat-out" ) == 0 )
+        {
+            flat_out = 1;
+        }
+        else
+        {
+            fprintf( stderr, "usage: %s [--baud n] [--seconds s] [--flat-out] [--wait ms]\n", argv[0] );
+            return 1;
+        }
+    }
+
+    master = posix_openpt( O_RDWR | O_NOCTTY );
+    if ( ( master < 0 ) || ( grantpt( master ) != 0 ) || ( unlockpt( master ) != 0 ) )
+    {
+        perror( "posix_openpt" );
+        return 1;
+    }
+
+    printf( "pty: %s\n", ptsname( master ) );
+    fflush( stdout );
+
+    // Give the reader time to open the slave side
+    usleep( wait_ms * 1000 );
+
+    start_us = monotonic_us();
+    end_us = start_us + (int64_t)( seconds * 1e6 );
+
+    while ( 1 )
+    {
+        int64_t now_us = monotonic_us();
+        uint64_t budget;
+
+        if ( now_us >= end_us )
+        {
+            break;
+        }
+
+        if ( flat_out )
+        {
+            budget = UINT64_MAX;
+        }
+        else
+        {
+            budget = (uint64_t)( ( now_us - start_us ) * ( baud / BITS_PER_BYTE ) / 1000000 );
+        }
+
+        // Send every whole line the link would have carried by now
+        while ( 1 )
+        {
+            if ( line_length == 0 )
+            {
+                line_length = format_line( line, sizeof(line), seq, values_sent );
+            }
+
+            if ( bytes_sent + line_length > budget )
+            {
+                break;
+            }
+
+            if ( write_all( master, line, line_length ) != 0 )
+            {
+                perror( "write" );
+                return 1;
+            }
+
+            if ( line[0] == 'v' )
+            {
+                values_sent++;
+            }
+
+            bytes_sent += line_length;
+            line_length = 0;
+            seq++;
+
+            if ( flat_out && ( ( seq & 0xFF ) == 0 ) )
+            {
+                break;
+            }
+        }
+
+        if ( !flat_out )
+        {
+            usleep( PACE_INTERVAL_US );
+        }
+    }
+
+    fprintf( stderr, "sent %u v lines, %llu bytes in %.1fs (%.0f B/s)\n",
+             values_sent, (unsigned long long)bytes_sent, seconds,
+             bytes_sent / seconds );
+
+    // Let the reader drain before hanging up
+    usleep( 500000 );
+    close( master );
+
+    return 0;
+}
@@ -0,0 +1,321 @@
+/* menu_bench.h
+ *
+ * Command streams for benchmarking and fuzzing the Lab1 and Lab2 menus on
+ * the host (lab1_sim, lab2_sim menu).
+ *
+ * The harness makes the lines, in its lab's syntax, as one of
+ *
+ *      LINE_VALID      a command the menu should carry out
+ *      LINE_MALFORMED  one it should answer with an error
+ *      LINE_OVERSIZED  longer than the menu's line buffer, to be dropped whole
+ *
+ * with the reply each should get.  A Feed paces them onto the simulated
+ * USB_COMM receive ring (sim_serial_inject()) at a command rate and a baud
+ * rate, the way a terminal sends them: a line may arrive over several polls
+ * of the menu, or several lines in one.  Bytes the menu has not read before
+ * the ring comes round again are lost, as on the board.  A Tally matches
+ * the replies against the lines in order and counts
+ *
+ *      answered    the reply the line should get
+ *      dropped     no reply: a later line's reply came first, or none at all
+ *      misparsed   a reply that matches no line waiting for one
+ *
+ * Random numbers are seeded, so a run repeats exactly.
+ */
+
+#ifndef __MENU_BENCH_H
+#define __MENU_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <deque>
+#include <string>
+
+extern "C"
+{
+#include "sim.h"
+}
+
+namespace menu_bench
+{
+
+typedef enum
+{
+    LINE_VALID,
+    LINE_MALFORMED,
+    LINE_OVERSIZED,
+    LINE_KINDS
+} LINE_KIND_E;
+
+struct Line
+{
+    LINE_KIND_E kind;
+    std::string text;           // without the terminator
+    std::string reply;          // what the menu should answer, as the harness keys it
+};
+
+// xorshift32, never seeded with 0
+class Random
+{
+public:
+    explicit Random( uint32_t seed ) : state( seed ? seed : 1 ) {}
+
+    uint32_t next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // 0 .. n - 1
+    uint32_t below( uint32_t n )
+    {
+        return n ? next() % n : 0;
+    }
+
+    // lo .. hi
+    int between( int lo, int hi )
+    {
+        return lo + (int)below( (uint32_t)( hi - lo + 1 ) );
+    }
+
+private:
+    uint32_t state;
+};
+
+// Percentages of each kind in a stream, valid being the rest
+struct Mix
+{
+    const char *name;
+    int malformed;
+    int oversized;
+};
+
+static const Mix MIXES[] =
+{
+    { "valid",   0,  0 },
+    { "mixed",   15, 5 },
+    { "hostile", 40, 30 },
+};
+
+static const size_t MIX_NUM = sizeof(MIXES) / sizeof(MIXES[0]);
+
+static inline const Mix *find_mix( const char *name )
+{
+    for ( size_t i = 0; i < MIX_NUM; i++ )
+    {
+        if ( strcmp( MIXES[i].name, name ) == 0 )
+        {
+            return &MIXES[i];
+        }
+    }
+    return NULL;
+}
+
+static inline LINE_KIND_E pick_kind( Random &random, const Mix &mix )
+{
+    int roll = (int)random.below( 100 );
+
+    if ( roll < mix.oversized )
+    {
+        return LINE_OVERSIZED;
+    }
+    if ( roll < mix.oversized + mix.malformed )
+    {
+        return LINE_MALFORMED;
+    }
+    return LINE_VALID;
+}
+
+// Lines start 1 / rate apart, or when the last one has finished if the
+// wire is slower than that; bytes follow each other at the baud rate
+class Feed
+{
+public:
+    Feed( unsigned long baud, double lines_per_s, const char *terminator )
+        : byte_us( 10.0e6 / baud ), line_us( 1.0e6 / lines_per_s ), end( terminator ),
+          next_line_us( 0.0 ), next_byte_us( 0.0 )
+    {
+    }
+
+    // Queue a line to go out at its turn
+    void send( const Line &line )
+    {
+        double start = ( next_byte_us > next_line_us ) ? next_byte_us : next_line_us;
+
+        for ( size_t i = 0; i < line.text.size() + end.size(); i++ )
+        {
+            pending.push_back( Byte( start + i * byte_us, ( i < line.text.size() ) ? line.text[i] : end[i - line.text.size()] ) );
+        }
+        next_byte_us = start + ( line.text.size() + end.size() ) * byte_us;
+        next_line_us += line_us;
+    }
+
+    // When the next line would start
+    double next_start_us() const
+    {
+        return ( next_byte_us > next_line_us ) ? next_byte_us : next_line_us;
+    }
+
+    // Put every byte due by 'time_us' on the ring
+    void deliver( double time_us )
+    {
+        std::string chunk;
+
+        while ( !pending.empty() && ( pending.front().at_us <= time_us ) )
+        {
+            chunk += pending.front().value;
+            pending.pop_front();
+        }
+        if ( !chunk.empty() )
+        {
+            sim_serial_inject( chunk.data(), chunk.size() );
+        }
+    }
+
+    bool idle() const
+    {
+        return pending.empty();
+    }
+
+private:
+    struct Byte
+    {
+        Byte( double at, char c ) : at_us( at ), value( c ) {}
+        double at_us;
+        char value;
+    };
+
+    double byte_us;
+    double line_us;
+    std::string end;
+    double next_line_us;
+    double next_byte_us;
+    std::deque<Byte> pending;
+};
+
+class Tally
+{
+public:
+    Tally() : answered( 0 ), dropped( 0 ), misparsed( 0 )
+    {
+        for ( int i = 0; i < LINE_KINDS; i++ )
+        {
+            sent[i] = 0;
+        }
+    }
+
+    void expect( const Line &line )
+    {
+        sent[line.kind]++;
+        waiting.push_back( line.reply );
+    }
+
+    // A reply the menu sent; lines passed over on the way to its match
+    // were dropped
+    void reply( const std::string &text )
+    {
+        for ( size_t i = 0; i < waiting.size(); i++ )
+        {
+            if ( waiting[i] == text )
+            {
+                dropped += i;
+                waiting.erase( waiting.begin(), waiting.begin() + i + 1 );
+                answered++;
+                return;
+            }
+        }
+
+        // Not any line's, so the front one was read wrong
+        misparsed++;
+        if ( !waiting.empty() )
+        {
+            waiting.pop_front();
+        }
+    }
+
+    // End of the run: whatever is still waiting never got an answer
+    void finish()
+    {
+        dropped += waiting.size();
+        waiting.clear();
+    }
+
+    uint64_t total_sent() const
+    {
+        return sent[LINE_VALID] + sent[LINE_MALFORMED] + sent[LINE_OVERSIZED];
+    }
+
+    uint64_t sent[LINE_KINDS];
+    uint64_t answered;
+    uint64_t dropped;
+    uint64_t misparsed;
+
+private:
+    std::deque<std::string> waiting;
+};
+
+// Fuzz bytes: mostly printable, with terminators, commas, digits and signs
+// the parsers look for, the odd control or high byte, and now and then a
+// long run with no terminator to overflow a line buffer
+class FuzzSource
+{
+public:
+    explicit FuzzSource( uint32_t seed ) : random( seed ), run_left( 0 ) {}
+
+    char next()
+    {
+        static const char interesting[] = "\r\n,-+0123456789 ";
+
+        if ( run_left )
+        {
+            run_left--;
+            return (char)( '0' + random.below( 10 ) );
+        }
+
+        uint32_t roll = random.below( 1000 );
+
+        if ( roll < 5 )
+        {
+            run_left = 20 + random.below( 200 );
+            return ',';
+        }
+        if ( roll < 300 )
+        {
+            return interesting[random.below( sizeof(interesting) - 1 )];
+        }
+        if ( roll < 320 )
+        {
+            return (char)random.below( 256 );
+        }
+        return (char)( 'A' + random.below( 58 ) );
+    }
+
+    Random random;
+
+private:
+    uint32_t run_left;
+};
+
+// Built with -fsanitize=address
+static inline bool asan_on( void )
+{
+#if defined(__SANITIZE_ADDRESS__)
+    return true;
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+    return true;
+#else
+    return false;
+#endif
+#else
+    return false;
+#endif
+}
+
+} // namespace menu_bench
+
+#endif //__MENU_BENCH_H
@@ -0,0 +1,206 @@
+/* packed_frame.h
+ *
+ * Decoder for the packed telemetry records Lab2 sends with logging mode 2
+ * ('L,2'), see Lab2/telemetry_pack.h for the format:
+ *
+ *   type (0xF1 keyframe / 0xF2 delta), length, seq,
+ *   keyframe: 7 zigzag varints / delta: change bitmap + zigzag varints
+ *
+ * PackDecoder keeps the previous sample.  After a gap in the sequence
+ * numbers (bytes lost on the host side) or a bad record, deltas are thrown
+ * away until the next keyframe; the firmware sends one every
+ * PACK_KEYFRAME_INTERVAL records.
+ *
+ * LineParser (telemetry_parser.h) picks these records out of the stream
+ * between text lines and hands them to on_values() like a "v," line.
+ * Sessions for lab2_sim replay must be recorded with text lines ('L,1'):
+ * records are not passed to on_line().
+ */
+
+#ifndef __PACKED_FRAME_H
+#define __PACKED_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace telemetry
+{
+
+// Keep in step with Lab2/telemetry_pack.h
+enum
+{
+    PACK_KEYFRAME = 0xF1,
+    PACK_DELTA = 0xF2,
+    PACK_FIELDS = 7,            // FIELD_NUM, in the same order (telemetry_parser.h)
+    PACK_MAX_RECORD = 4 + 3 * PACK_FIELDS,
+    PACK_KEYFRAME_INTERVAL = 32
+};
+
+static inline bool is_pack_type( uint8_t byte )
+{
+    return ( byte == PACK_KEYFRAME ) || ( byte == PACK_DELTA );
+}
+
+struct PackStats
+{
+    uint64_t keyframes;
+    uint64_t deltas;
+    uint64_t gaps;              // seq jumps
+    uint64_t unsynced;          // deltas dropped waiting for a keyframe
+    uint64_t malformed;
+};
+
+// Read one zigzag varint of at most 3 bytes (16 bits)
+static inline bool get_zigzag( const uint8_t *&p, const uint8_t *end, int16_t &value )
+{
+    uint32_t u = 0;
+
+    for ( int shift = 0; shift < 21; shift += 7 )
+    {
+        if ( p >= end )
+        {
+            return false;
+        }
+
+        uint8_t byte = *p++;
+
+        u |= (uint32_t)( byte & 0x7F ) << shift;
+        if ( !( byte & 0x80 ) )
+        {
+            if ( u > 0xFFFF )
+            {
+                return false;
+            }
+            value = (int16_t)( ( u >> 1 ) ^ ( 0 - ( u & 1 ) ) );
+            return true;
+        }
+    }
+
+    return false;
+}
+
+class PackDecoder
+{
+public:
+    PackDecoder()
+    {
+        reset();
+        stats_ = PackStats();
+    }
+
+    // Forget the previous sample, wait for a keyframe
+    void reset()
+    {
+        synced_ = false;
+        expected_seq_ = 0;
+        for ( int i = 0; i < PACK_FIELDS; i++ )
+        {
+            previous_[i] = 0;
+        }
+    }
+
+    // 'record' is a whole record, type byte first.  Returns true with the
+    // sample's fields in 'out' when it could be decoded.
+    bool decode( const uint8_t *record, size_t length, int32_t *out )
+    {
+        const uint8_t *p = record + 3;
+        const uint8_t *end = record + length;
+        int16_t values[PACK_FIELDS];
+        uint8_t seq;
+
+        if ( ( length < 3 ) || !is_pack_type( record[0] ) || ( record[1] != length - 2 ) )
+        {
+            stats_.malformed++;
+            synced_ = false;
+            return false;
+        }
+
+        seq = record[2];
+        if ( synced_ && ( seq != expected_seq_ ) )
+        {
+            stats_.gaps++;
+            synced_ = false;
+        }
+        expected_seq_ = (uint8_t)( seq + 1 );
+
+        if ( record[0] == PACK_KEYFRAME )
+        {
+            for ( int i = 0; i < PACK_FIELDS; i++ )
+            {
+                if ( !get_zigzag( p, end, values[i] ) )
+                {
+                    return bad_record();
+                }
+            }
+            stats_.keyframes++;
+        }
+        else
+        {
+            uint8_t bitmap;
+
+            if ( !synced_ )
+            {
+                stats_.unsynced++;
+                return false;
+            }
+            if ( p >= end )
+            {
+                return bad_record();
+            }
+
+            bitmap = *p++;
+            if ( bitmap >> PACK_FIELDS )
+            {
+                return bad_record();
+            }
+
+            for ( int i = 0; i < PACK_FIELDS; i++ )
+            {
+                int16_t change = 0;
+
+                if ( ( bitmap & ( 1 << i ) ) && !get_zigzag( p, end, change ) )
+                {
+                    return bad_record();
+                }
+                values[i] = (int16_t)( (uint16_t)previous_[i] + (uint16_t)change );
+            }
+            stats_.deltas++;
+        }
+
+        if ( p != end )
+        {
+            return bad_record();
+        }
+
+        for ( int i = 0; i < PACK_FIELDS; i++ )
+        {
+            previous_[i] = values[i];
+            out[i] = values[i];
+        }
+        synced_ = true;
+
+        return true;
+    }
+
+    const PackStats &stats() const
+    {
+        return stats_;
+    }
+
+private:
+    bool bad_record()
+    {
+        stats_.malformed++;
+        synced_ = false;
+        return false;
+    }
+
+    int16_t previous_[PACK_FIELDS];
+    bool synced_;
+    uint8_t expected_seq_;
+    PackStats stats_;
+};
+
+} // namespace telemetry
+
+#endif //__PACKED_FRAME_H
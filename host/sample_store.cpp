@@ -0,0 +1,182 @@
+/* sample_store.cpp
+ *
+ * See sample_store.h
+ */
+
+#include "sample_store.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using telemetry::FIELD_NUM;
+using telemetry::Sample;
+
+static const char SAMPLE_MAGIC[8]  = { 'L', '2', 'S', 'A', 'M', 'P', 'L', 0 };
+static const char SUMMARY_MAGIC[8] = { 'L', '2', 'S', 'U', 'M', 'R', 'Y', 0 };
+
+// Initial file sizes, both double as needed
+#define SAMPLE_STORE_INITIAL_CHUNKS    4
+#define SAMPLE_STORE_INITIAL_SUMMARIES 1024
+
+static uint64_t summary_span( int level )
+{
+    uint64_t span = SAMPLE_STORE_SUMMARY_BASE;
+
+    for ( int i = 0; i < level; i++ )
+    {
+        span *= SAMPLE_STORE_SUMMARY_FACTOR;
+    }
+
+    return span;
+}
+
+SampleStore::SampleStore() : chunk_( NULL ), info_( NULL )
+{
+    memset( pending_, 0, sizeof(pending_) );
+}
+
+bool SampleStore::create( const char *path )
+{
+    char summary_path[1024];
+
+    if ( !samples_.create( path, SAMPLE_MAGIC, SAMPLE_STORE_VERSION, sizeof(SampleChunk), SAMPLE_STORE_INITIAL_CHUNKS ) )
+    {
+        return false;
+    }
+
+    info_ = (SampleStoreInfo *)samples_.user();
+    info_->num_fields = FIELD_NUM;
+    info_->chunk_samples = SAMPLE_STORE_CHUNK;
+    info_->sample_count = 0;
+
+    for ( int level = 0; level < SAMPLE_STORE_SUMMARY_LEVELS; level++ )
+    {
+        snprintf( summary_path, sizeof(summary_path), "%s.sum%d", path, level );
+        if ( !summary_[level].create( summary_path, SUMMARY_MAGIC, SAMPLE_STORE_VERSION, sizeof(SummaryRecord), SAMPLE_STORE_INITIAL_SUMMARIES ) )
+        {
+            return false;
+        }
+        *(uint64_t *)summary_[level].user() = summary_span( level );
+    }
+
+    return true;
+}
+
+void SampleStore::close()
+{
+    samples_.close();
+
+    for ( int level = 0; level < SAMPLE_STORE_SUMMARY_LEVELS; level++ )
+    {
+        summary_[level].close();
+    }
+
+    chunk_ = NULL;
+    info_ = NULL;
+}
+
+bool SampleStore::append( int64_t time_us, const Sample &sample )
+{
+    uint64_t index;
+    uint32_t slot;
+    SummaryRecord single;
+
+    index = info_->sample_count;
+    slot = index % SAMPLE_STORE_CHUNK;
+
+    if ( slot == 0 )
+    {
+        // Previous chunk (if any) is full, publish it and start the next one.
+        // The user area can move when the file grows, so refresh info_.
+        if ( index != 0 )
+        {
+            samples_.commit();
+        }
+
+        chunk_ = (SampleChunk *)samples_.next();
+        info_ = (SampleStoreInfo *)samples_.user();
+        if ( chunk_ == NULL )
+        {
+            return false;
+        }
+    }
+
+    chunk_->time_us[slot] = time_us;
+    for ( int f = 0; f < FIELD_NUM; f++ )
+    {
+        chunk_->field[f][slot] = sample.field[f];
+    }
+
+    __atomic_store_n( &info_->sample_count, index + 1, __ATOMIC_RELEASE );
+
+    single.time_first_us = time_us;
+    single.time_last_us = time_us;
+    single.first_sample = index;
+    single.samples = 1;
+    memcpy( single.min, sample.field, sizeof(single.min) );
+    memcpy( single.max, sample.field, sizeof(single.max) );
+    summarize( 0, single );
+
+    return true;
+}
+
+void SampleStore::summarize( int level, const SummaryRecord &in )
+{
+    SummaryRecord &acc = pending_[level];
+    SummaryRecord *out;
+
+    if ( acc.samples == 0 )
+    {
+        acc = in;
+    }
+    else
+    {
+        acc.time_last_us = in.time_last_us;
+        acc.samples += in.samples;
+        for ( int f = 0; f < FIELD_NUM; f++ )
+        {
+            if ( in.min[f] < acc.min[f] )
+            {
+                acc.min[f] = in.min[f];
+            }
+            if ( in.max[f] > acc.max[f] )
+            {
+                acc.max[f] = in.max[f];
+            }
+        }
+    }
+
+    if ( acc.samples < summary_span( level ) )
+    {
+        return;
+    }
+
+    out = (SummaryRecord *)summary_[level].next();
+    if ( out != NULL )
+    {
+        *out = acc;
+        summary_[level].commit();
+    }
+
+    if ( level + 1 < SAMPLE_STORE_SUMMARY_LEVELS )
+    {
+        summarize( level + 1, acc );
+    }
+
+    acc.samples = 0;
+}
+
+uint64_t SampleStore::sample_count() const
+{
+    return ( info_ != NULL ) ? info_->sample_count : 0;
+}
+
+void SampleStore::sync()
+{
+    samples_.sync();
+
+    for ( int level = 0; level < SAMPLE_STORE_SUMMARY_LEVELS; level++ )
+    {
+        summary_[level].sync();
+    }
+}
@@ -0,0 +1,81 @@
+/* sample_store.h
+ *
+ * Columnar on-disk store for Lab2 telemetry samples plus min/max summaries.
+ *
+ * <path>       Samples, stored in chunks of SAMPLE_STORE_CHUNK samples.  Each
+ *              chunk holds the host timestamps followed by one column per
+ *              field, so a viewer can mmap the file and walk a single field
+ *              without touching the others.
+ *
+ *                  int64_t time_us[CHUNK]
+ *                  int32_t field[FIELD_NUM][CHUNK]
+ *
+ *              The live sample count is in SampleStoreInfo (header user area).
+ *
+ * <path>.sumN  Min/max decimation pyramid, level N covers
+ *              SAMPLE_STORE_SUMMARY_BASE * SAMPLE_STORE_SUMMARY_FACTOR^N
+ *              samples per record.  A viewer zoomed out draws from the
+ *              coarsest level that still gives it one record per pixel
+ *              instead of redrawing every sample.
+ */
+
+#ifndef __SAMPLE_STORE_H
+#define __SAMPLE_STORE_H
+
+#include "append_file.h"
+#include "telemetry_parser.h"
+
+#define SAMPLE_STORE_VERSION        1
+#define SAMPLE_STORE_CHUNK          4096
+#define SAMPLE_STORE_SUMMARY_LEVELS 3
+#define SAMPLE_STORE_SUMMARY_BASE   64
+#define SAMPLE_STORE_SUMMARY_FACTOR 16
+
+struct SampleStoreInfo
+{
+    uint32_t num_fields;
+    uint32_t chunk_samples;
+    uint64_t sample_count;
+};
+
+struct SampleChunk
+{
+    int64_t time_us[SAMPLE_STORE_CHUNK];
+    int32_t field[telemetry::FIELD_NUM][SAMPLE_STORE_CHUNK];
+};
+
+struct SummaryRecord
+{
+    int64_t  time_first_us;
+    int64_t  time_last_us;
+    uint64_t first_sample;
+    uint32_t samples;
+    int32_t  min[telemetry::FIELD_NUM];
+    int32_t  max[telemetry::FIELD_NUM];
+};
+
+class SampleStore
+{
+public:
+    SampleStore();
+
+    bool create( const char *path );
+    void close();
+
+    // Append one sample.  Returns false if the file could not be grown.
+    bool append( int64_t time_us, const telemetry::Sample &sample );
+
+    uint64_t sample_count() const;
+    void sync();
+
+private:
+    void summarize( int level, const SummaryRecord &in );
+
+    AppendFile samples_;
+    AppendFile summary_[SAMPLE_STORE_SUMMARY_LEVELS];
+    SummaryRecord pending_[SAMPLE_STORE_SUMMARY_LEVELS];
+    SampleChunk *chunk_;
+    SampleStoreInfo *info_;
+};
+
+#endif //__SAMPLE_STORE_H
@@ -0,0 +1,57 @@
+/* serial_port.cpp
+ *
+ * See serial_port.h
+ *
+ * <asm/termbits.h> cannot be mixed with <termios.h>, so this file only uses
+ * the kernel termios2 interface.
+ */
+
+#include "serial_port.h"
+
+#include <asm/termbits.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+int serial_port_open( const char *path, int baud )
+{
+    struct termios2 tio;
+    int fd;
+
+    fd = open( path, O_RDWR | O_NOCTTY );
+    if ( fd < 0 )
+    {
+        return -1;
+    }
+
+    if ( ioctl( fd, TCGETS2, &tio ) != 0 )
+    {
+        close( fd );
+        return -1;
+    }
+
+    // Raw 8N1, no flow control, no echo, no line editing
+    tio.c_iflag &= ~( IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF );
+    tio.c_oflag &= ~OPOST;
+    tio.c_lflag &= ~( ECHO | ECHONL | ICANON | ISIG | IEXTEN );
+    tio.c_cflag &= ~( CSIZE | PARENB | CSTOPB | CRTSCTS );
+    tio.c_cflag |= CS8 | CREAD | CLOCAL;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+
+    if ( baud > 0 )
+    {
+        tio.c_cflag &= ~CBAUD;
+        tio.c_cflag |= BOTHER;
+        tio.c_ispeed = baud;
+        tio.c_ospeed = baud;
+    }
+
+    if ( ioctl( fd, TCSETS2, &tio ) != 0 )
+    {
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
@@ -0,0 +1,17 @@
+/* serial_port.h
+ *
+ * Open the Orangutan USB_COMM virtual COM port (or a pty) in raw mode.
+ */
+
+#ifndef __SERIAL_PORT_H
+#define __SERIAL_PORT_H
+
+// Lab2 USB_BAUD_RATE
+#define SERIAL_PORT_DEFAULT_BAUD 256000
+
+// Returns an open file descriptor or -1.  256000 is not one of the POSIX
+// Bxxx rates, so the speed is set through termios2/BOTHER.  A baud of 0
+// leaves the speed alone (useful for ptys).
+int serial_port_open( const char *path, int baud );
+
+#endif //__SERIAL_PORT_H
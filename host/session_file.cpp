@@ -0,0 +1,180 @@
+/* session_file.cpp
+ *
+ * See session_file.h
+ */
+
+#include "session_file.h"
+
+#include <string.h>
+
+static const char SESSION_MAGIC[8] = { 'L', '2', 'S', 'E', 'S', 'S', 0, 0 };
+
+SessionWriter::SessionWriter() : file_( NULL ), last_us_( 0 )
+{
+}
+
+SessionWriter::~SessionWriter()
+{
+    close();
+}
+
+bool SessionWriter::create( const char *path, int64_t start_unix_us )
+{
+    uint32_t version = SESSION_FILE_VERSION;
+
+    file_ = fopen( path, "wb" );
+    if ( file_ == NULL )
+    {
+        return false;
+    }
+
+    fwrite( SESSION_MAGIC, 1, sizeof(SESSION_MAGIC), file_ );
+    fwrite( &version, sizeof(version), 1, file_ );
+    fwrite( &start_unix_us, sizeof(start_unix_us), 1, file_ );
+    last_us_ = 0;
+
+    return true;
+}
+
+void SessionWriter::put_varint( uint64_t value )
+{
+    while ( value >= 0x80 )
+    {
+        fputc( (int)( ( value & 0x7F ) | 0x80 ), file_ );
+        value >>= 7;
+    }
+    fputc( (int)value, file_ );
+}
+
+void SessionWriter::write( int64_t time_us, SESSION_DIR_E dir, const char *data, size_t length )
+{
+    if ( time_us < last_us_ )
+    {
+        time_us = last_us_;
+    }
+
+    put_varint( time_us - last_us_ );
+    fputc( dir, file_ );
+    put_varint( length );
+    fwrite( data, 1, length, file_ );
+
+    last_us_ = time_us;
+}
+
+void SessionWriter::flush()
+{
+    if ( file_ != NULL )
+    {
+        fflush( file_ );
+    }
+}
+
+void SessionWriter::close()
+{
+    if ( file_ != NULL )
+    {
+        fclose( file_ );
+        file_ = NULL;
+    }
+}
+
+static bool get_varint( const char *&p, const char *end, uint64_t &value )
+{
+    int shift = 0;
+
+    value = 0;
+    while ( p < end )
+    {
+        uint8_t byte = (uint8_t)*p++;
+
+        value |= (uint64_t)( byte & 0x7F ) << shift;
+        if ( ( byte & 0x80 ) == 0 )
+        {
+            return true;
+        }
+
+        shift += 7;
+        if ( shift > 63 )
+        {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+bool SessionReader::load( const char *path )
+{
+    FILE *file;
+    long size;
+    const char *p, *end;
+    uint32_t version;
+    int64_t time_us = 0;
+
+    records_.clear();
+
+    file = fopen( path, "rb" );
+    if ( file == NULL )
+    {
+        return false;
+    }
+
+    fseek( file, 0, SEEK_END );
+    size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+
+    buffer_.resize( size > 0 ? size : 0 );
+    if ( ( size > 0 ) && ( fread( &buffer_[0], 1, size, file ) != (size_t)size ) )
+    {
+        fclose( file );
+        return false;
+    }
+    fclose( file );
+
+    if ( ( size < (long)( sizeof(SESSION_MAGIC) + sizeof(version) + sizeof(start_unix_us_) ) ) ||
+         ( memcmp( &buffer_[0], SESSION_MAGIC, sizeof(SESSION_MAGIC) ) != 0 ) )
+    {
+        return false;
+    }
+
+    p = &buffer_[0] + sizeof(SESSION_MAGIC);
+    end = &buffer_[0] + size;
+
+    memcpy( &version, p, sizeof(version) );
+    p += sizeof(version);
+    memcpy( &start_unix_us_, p, sizeof(start_unix_us_) );
+    p += sizeof(start_unix_us_);
+
+    if ( version != SESSION_FILE_VERSION )
+    {
+        return false;
+    }
+
+    while ( p < end )
+    {
+        SessionRecord record;
+        uint64_t delta, length;
+
+        if ( !get_varint( p, end, delta ) || ( p >= end ) )
+        {
+            break;
+        }
+
+        record.dir = (SESSION_DIR_E)(uint8_t)*p++;
+
+        if ( !get_varint( p, end, length ) || ( length > (uint64_t)( end - p ) ) )
+        {
+            break;
+        }
+
+        time_us += delta;
+        record.time_us = time_us;
+        record.data = p;
+        record.length = length;
+        records_.push_back( record );
+
+        p += length;
+    }
+
+    return true;
+}
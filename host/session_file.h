@@ -0,0 +1,73 @@
+/* session_file.h
+ *
+ * Compact recording of a serial session with the board.
+ *
+ *   header:  "L2SESS\0\0"  uint32 version  int64 start time (unix us)
+ *   record:  varint  microseconds since the previous record
+ *            uint8   direction (SESSION_TX = host to board, SESSION_RX = board to host)
+ *            varint  length
+ *            bytes   one command as sent / one line as received (no terminator)
+ *
+ * Varints are LEB128 (7 bits per byte, low bits first), so a "v," line at
+ * the Lab2 rate costs 3 bytes of framing.
+ */
+
+#ifndef __SESSION_FILE_H
+#define __SESSION_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#define SESSION_FILE_VERSION 1
+
+typedef enum
+{
+    SESSION_TX = 0,
+    SESSION_RX = 1
+} SESSION_DIR_E;
+
+struct SessionRecord
+{
+    int64_t time_us;            // since start of session
+    SESSION_DIR_E dir;
+    const char *data;           // points into SessionReader's buffer
+    size_t length;
+};
+
+class SessionWriter
+{
+public:
+    SessionWriter();
+    ~SessionWriter();
+
+    bool create( const char *path, int64_t start_unix_us );
+    void write( int64_t time_us, SESSION_DIR_E dir, const char *data, size_t length );
+    void flush();
+    void close();
+
+private:
+    void put_varint( uint64_t value );
+
+    FILE *file_;
+    int64_t last_us_;
+};
+
+class SessionReader
+{
+public:
+    // Loads and indexes the whole file.  Returns false on a bad header;
+    // a truncated last record (recorder killed) is silently dropped.
+    bool load( const char *path );
+
+    int64_t start_unix_us() const { return start_unix_us_; }
+    const std::vector<SessionRecord> &records() const { return records_; }
+
+private:
+    std::vector<char> buffer_;
+    std::vector<SessionRecord> records_;
+    int64_t start_unix_us_;
+};
+
+#endif //__SESSION_FILE_H
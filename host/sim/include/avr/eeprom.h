@@ -0,0 +1,24 @@
+/* avr/eeprom.h - host simulation stand-in
+ *
+ * Reads come straight from the simulated EEPROM array in orangutan_sim.c.
+ * Addresses are EEPROM offsets cast to pointers, as on the AVR.
+ */
+
+#ifndef __SIM_AVR_EEPROM_H
+#define __SIM_AVR_EEPROM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint8_t eeprom_read_byte( const uint8_t *address );
+void eeprom_read_block( void *destination, const void *source, size_t size );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__SIM_AVR_EEPROM_H
@@ -0,0 +1,19 @@
+/* avr/interrupt.h - host simulation stand-in
+ *
+ * There is only one thread on the host, the simulation calls "ISRs" itself
+ * between main loop steps, so cli()/sei() only track the I flag.
+ */
+
+#ifndef __SIM_AVR_INTERRUPT_H
+#define __SIM_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define SREG_I 0x80
+
+#define cli() ( SREG &= (uint8_t)~SREG_I )
+#define sei() ( SREG |= SREG_I )
+
+#define ISR(vector) void vector( void )
+
+#endif //__SIM_AVR_INTERRUPT_H
@@ -0,0 +1,60 @@
+/* avr/io.h - host simulation stand-in
+ *
+ * Only the registers the Lab sources touch on the host build are provided,
+ * as plain variables.
+ */
+
+#ifndef __SIM_AVR_IO_H
+#define __SIM_AVR_IO_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern volatile uint8_t SREG;
+
+// EEPROM control, a write started with EEPE is completed by
+// sim_eeprom_tick_ms()
+extern volatile uint16_t EEAR;
+extern volatile uint8_t EEDR;
+extern volatile uint8_t EECR;
+
+#define EERE    0
+#define EEPE    1
+#define EEMPE   2
+#define EERIE   3
+
+#define E2END   0x0FFF
+
+// Timer3 count, set from the virtual clock by the harness
+extern volatile uint16_t TCNT3;
+
+// Encoder lines, driven by sim_encoders_sync(), and the pin change
+// interrupt setup quadrature.c writes
+extern volatile uint8_t PINA;
+extern volatile uint8_t DDRA;
+extern volatile uint8_t PORTA;
+extern volatile uint8_t PCMSK0;
+extern volatile uint8_t PCICR;
+extern volatile uint8_t PCIFR;
+
+#define PCIE0   0
+#define PCIF0   0
+
+// Reset flags: sim_power_cycle() leaves PORF, a harness resetting the board
+// for sim_watchdog_expired() sets WDRF instead
+extern volatile uint8_t MCUSR;
+
+#define PORF    0
+#define EXTRF   1
+#define BORF    2
+#define WDRF    3
+#define JTRF    4
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__SIM_AVR_IO_H
@@ -0,0 +1,9 @@
+/* avr/pgmspace.h - host simulation stand-in */
+
+#ifndef __SIM_AVR_PGMSPACE_H
+#define __SIM_AVR_PGMSPACE_H
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+#endif //__SIM_AVR_PGMSPACE_H
@@ -0,0 +1,34 @@
+/* avr/wdt.h - host simulation stand-in
+ *
+ * The watchdog counts sim.ms from the last wdt_enable() or wdt_reset();
+ * sim_watchdog_expired() tells the harness when it would reset the board.
+ * The periods are the nominal ones, 16 ms << WDTO_*.
+ */
+
+#ifndef __SIM_AVR_WDT_H
+#define __SIM_AVR_WDT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WDTO_15MS   0
+#define WDTO_30MS   1
+#define WDTO_60MS   2
+#define WDTO_120MS  3
+#define WDTO_250MS  4
+#define WDTO_500MS  5
+#define WDTO_1S     6
+#define WDTO_2S     7
+#define WDTO_4S     8
+#define WDTO_8S     9
+
+void wdt_enable( unsigned char timeout );
+void wdt_disable( void );
+void wdt_reset( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__SIM_AVR_WDT_H
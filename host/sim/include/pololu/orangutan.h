@@ -0,0 +1,76 @@
+/* pololu/orangutan.h - host simulation stand-in
+ *
+ * Declares the subset of the Pololu AVR library the Lab sources use, with
+ * the same signatures.  The implementations in orangutan_sim.c route serial
+ * traffic, encoder counts and motor commands to the simulation (sim.h).
+ */
+
+#ifndef __SIM_POLOLU_ORANGUTAN_H
+#define __SIM_POLOLU_ORANGUTAN_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USB_COMM 2
+
+#define LOW  0
+#define HIGH 1
+
+// Pin identifiers, only used as opaque arguments on the host
+#define IO_D5 29
+#define IO_D6 30
+#define IO_C6 22
+#define IO_A0 31
+#define IO_A1 30
+#define IO_A2 29
+#define IO_A3 28
+
+#define TOP_BUTTON    (1 << 5)
+#define MIDDLE_BUTTON (1 << 3)
+#define BOTTOM_BUTTON (1 << 2)
+#define ALL_BUTTONS   ( TOP_BUTTON | MIDDLE_BUTTON | BOTTOM_BUTTON )
+
+// OrangutanSerial
+void serial_set_baud_rate( unsigned char port, unsigned long baud );
+void serial_receive_ring( unsigned char port, char *buffer, unsigned char size );
+unsigned char serial_get_received_bytes( unsigned char port );
+void serial_send( unsigned char port, char *buffer, unsigned char size );
+char serial_send_buffer_empty( unsigned char port );
+void serial_check( void );
+
+// PololuWheelEncoders
+void encoders_init( unsigned char m1a, unsigned char m1b, unsigned char m2a, unsigned char m2b );
+int encoders_get_counts_m1( void );
+int encoders_get_counts_m2( void );
+unsigned char encoders_check_error_m1( void );
+unsigned char encoders_check_error_m2( void );
+
+// OrangutanMotors
+void set_motors( int m1, int m2 );
+
+// OrangutanTime
+void delay_ms( unsigned int milliseconds );
+unsigned long get_ms( void );
+
+// OrangutanLCD / OrangutanLEDs / OrangutanDigital / OrangutanBuzzer
+void clear( void );
+void lcd_init_printf( void );
+void lcd_goto_xy( int col, int row );
+void print( const char *str );
+void print_long( long value );
+void print_character( char c );
+void red_led( unsigned char on );
+void green_led( unsigned char on );
+void set_digital_output( unsigned char pin, unsigned char value );
+void play_from_program_space( const char *notes );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__SIM_POLOLU_ORANGUTAN_H
@@ -0,0 +1,32 @@
+/* util/crc16.h - host simulation stand-in
+ *
+ * Same result as the avr-libc inline assembly version (CRC-16, polynomial
+ * 0xA001, reflected).
+ */
+
+#ifndef __SIM_UTIL_CRC16_H
+#define __SIM_UTIL_CRC16_H
+
+#include <stdint.h>
+
+static inline uint16_t _crc16_update( uint16_t crc, uint8_t data )
+{
+    int i;
+
+    crc ^= data;
+    for ( i = 0; i < 8; ++i )
+    {
+        if ( crc & 1 )
+        {
+            crc = ( crc >> 1 ) ^ 0xA001;
+        }
+        else
+        {
+            crc = ( crc >> 1 );
+        }
+    }
+
+    return crc;
+}
+
+#endif //__SIM_UTIL_CRC16_H
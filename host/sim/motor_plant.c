@@ -0,0 +1,134 @@
+/* motor_plant.c
+ *
+ * DC gear motor + encoder model, see motor_plant.h
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "motor_plant.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define PWM_FULL_SCALE 255
+
+void motor_plant_default_params( motor_params_t *params )
+{
+    // Free running at 12 V: ~380 rpm at the output, stall ~5 A
+    params->supply_v = 12.0;
+    params->resistance_ohm = 2.4;
+    params->inductance_h = 1.5e-3;
+    params->kt = 0.0095;
+    params->ke = 0.0095;
+    params->inertia = 3.2e-6;
+    params->viscous = 1.0e-6;
+    params->coulomb = 1.5e-3;
+    params->gear_ratio = 30.0;
+    params->counts_per_rev = 64;
+    params->deadband_pwm = 10;
+}
+
+void motor_plant_init( motor_plant_t *plant, const motor_params_t *params, unsigned int step_us )
+{
+    memset( plant, 0, sizeof(*plant) );
+
+    plant->params = *params;
+    plant->step_us = ( step_us > 0 ) ? step_us : 1;
+    plant->dt = plant->step_us * 1e-6;
+    plant->current_decay = exp( -plant->dt * params->resistance_ohm / params->inductance_h );
+    plant->counts_per_rad = params->counts_per_rev / ( 2.0 * M_PI * params->gear_ratio );
+}
+
+static double pwm_to_volts( const motor_params_t *params, int pwm )
+{
+    if ( ( pwm <= params->deadband_pwm ) && ( pwm >= -params->deadband_pwm ) )
+    {
+        return 0.0;
+    }
+
+    if ( pwm > PWM_FULL_SCALE )
+    {
+        pwm = PWM_FULL_SCALE;
+    }
+    else if ( pwm < -PWM_FULL_SCALE )
+    {
+        pwm = -PWM_FULL_SCALE;
+    }
+
+    return params->supply_v * pwm / PWM_FULL_SCALE;
+}
+
+static void motor_plant_step( motor_plant_t *plant, double volts )
+{
+    const motor_params_t *p = &plant->params;
+    double steady_current, motor_torque, omega;
+
+    // Exact over the step with the back EMF held at its start value
+    steady_current = ( volts - p->ke * plant->omega ) / p->resistance_ohm;
+    plant->current = steady_current + ( plant->current - steady_current ) * plant->current_decay;
+
+    motor_torque = p->kt * plant->current;
+
+    if ( plant->omega == 0.0 )
+    {
+        // Stuck until the motor torque beats Coulomb friction
+        if ( motor_torque > p->coulomb )
+        {
+            plant->omega = ( motor_torque - p->coulomb ) * plant->dt / p->inertia;
+        }
+        else if ( motor_torque < -p->coulomb )
+        {
+            plant->omega = ( motor_torque + p->coulomb ) * plant->dt / p->inertia;
+        }
+    }
+    else
+    {
+        double friction = ( plant->omega > 0.0 ) ? p->coulomb : -p->coulomb;
+
+        omega = plant->omega + ( motor_torque - p->viscous * plant->omega - friction ) * plant->dt / p->inertia;
+
+        // Friction can stop the shaft but not reverse it
+        if ( ( omega > 0.0 ) != ( plant->omega > 0.0 ) )
+        {
+            omega = 0.0;
+        }
+
+        plant->omega = omega;
+    }
+
+    plant->theta += plant->omega * plant->dt;
+    plant->steps++;
+}
+
+void motor_plant_advance_us( motor_plant_t *plant, int pwm, unsigned long us )
+{
+    double volts = pwm_to_volts( &plant->params, pwm );
+
+    us += plant->residual_us;
+
+    while ( us >= plant->step_us )
+    {
+        motor_plant_step( plant, volts );
+        us -= plant->step_us;
+    }
+
+    plant->residual_us = us;
+    plant->counts = (int)floor( plant->theta * plant->counts_per_rad );
+}
+
+int motor_plant_counts( const motor_plant_t *plant )
+{
+    return plant->counts;
+}
+
+double motor_plant_output_deg( const motor_plant_t *plant )
+{
+    return plant->theta * 180.0 / M_PI / plant->params.gear_ratio;
+}
+
+double motor_plant_output_rpm( const motor_plant_t *plant )
+{
+    return plant->omega * 60.0 / ( 2.0 * M_PI ) / plant->params.gear_ratio;
+}
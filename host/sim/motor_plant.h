@@ -0,0 +1,82 @@
+/* motor_plant.h
+ *
+ * DC gear motor + quadrature encoder model for closed loop simulation.
+ *
+ * Motor side:
+ *
+ *      L di/dt = V - R i - Ke w
+ *      J dw/dt = Kt i - b w - Tc sign(w)           (sticks at w = 0 while
+ *                                                    |Kt i| <= Tc)
+ *
+ * V comes from the set_motors() value: |pwm| at or below the deadband gives
+ * 0 V, otherwise pwm / 255 of the supply.  The output shaft turns at w / gear
+ * ratio and the encoder reports floor() of its angle in counts, so the
+ * firmware sees the same quantization as DEG_PER_COUNT on the board.
+ *
+ * The model is stepped at a fixed step (step_us) independent of the 1 ms
+ * timer ISR; motor_plant_advance_us() runs as many steps as fit in the time
+ * given and carries the remainder.  The current is integrated exactly over a
+ * step (the electrical time constant is well under 1 ms), so any step up to
+ * about a tenth of the mechanical time constant is stable.
+ */
+
+#ifndef __MOTOR_PLANT_H
+#define __MOTOR_PLANT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+    double supply_v;
+    double resistance_ohm;
+    double inductance_h;
+    double kt;                  // N m / A
+    double ke;                  // V s / rad
+    double inertia;             // kg m^2 at the motor shaft, load included
+    double viscous;             // N m s / rad at the motor shaft
+    double coulomb;             // N m at the motor shaft
+    double gear_ratio;          // motor turns per output turn
+    int counts_per_rev;         // encoder counts per output turn
+    int deadband_pwm;           // |pwm| at or below this gives no drive
+} motor_params_t;
+
+typedef struct
+{
+    motor_params_t params;
+    unsigned int step_us;
+    unsigned long residual_us;
+
+    // Per step constants
+    double dt;
+    double current_decay;       // exp( -dt R / L )
+    double counts_per_rad;      // at the motor shaft
+
+    // State
+    double current;
+    double omega;               // rad / s, motor shaft
+    double theta;               // rad, motor shaft
+    int counts;
+    unsigned long steps;
+} motor_plant_t;
+
+// 12 V 30:1 metal gearmotor with the Lab2 disk, 64 counts per output turn
+void motor_plant_default_params( motor_params_t *params );
+
+// At rest at position 0
+void motor_plant_init( motor_plant_t *plant, const motor_params_t *params, unsigned int step_us );
+
+// Run the plant for 'us' with the motor driven at 'pwm' (set_motors() units)
+void motor_plant_advance_us( motor_plant_t *plant, int pwm, unsigned long us );
+
+// Output shaft
+int motor_plant_counts( const motor_plant_t *plant );
+double motor_plant_output_deg( const motor_plant_t *plant );
+double motor_plant_output_rpm( const motor_plant_t *plant );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__MOTOR_PLANT_H
@@ -0,0 +1,373 @@
+/* orangutan_sim.c
+ *
+ * Host implementations of the Pololu library calls, see sim.h
+ */
+
+#include <pololu/orangutan.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+
+#include <string.h>
+
+#include "sim.h"
+
+volatile uint8_t SREG;
+volatile uint16_t EEAR;
+volatile uint8_t EEDR;
+volatile uint8_t EECR;
+volatile uint16_t TCNT3;
+volatile uint8_t PINA;
+volatile uint8_t DDRA;
+volatile uint8_t PORTA;
+volatile uint8_t PCMSK0;
+volatile uint8_t PCICR;
+volatile uint8_t PCIFR;
+volatile uint8_t MCUSR;
+
+sim_state_t sim;
+uint8_t sim_eeprom[SIM_EEPROM_SIZE];
+
+static int eeprom_write_elapsed_ms;
+
+static sim_tx_handler_t tx_handler;
+static void *tx_context;
+
+static char *rx_ring;
+static unsigned char rx_ring_size;
+static unsigned char rx_ring_head;
+
+static motor_plant_t *motor_m2;
+
+// Counts PINA last showed, stepped toward sim.encoder_m1 / m2
+static int synced_m1;
+static int synced_m2;
+
+// Serial wire model, off (instant sends) while wire_baud is 0
+static unsigned long wire_baud;
+static uint64_t cpu_us;
+static uint64_t wire_busy_until_us;
+
+void sim_reset( void )
+{
+    sim_power_cycle();
+    memset( sim_eeprom, 0xFF, sizeof(sim_eeprom) );
+}
+
+void sim_power_cycle( void )
+{
+    memset( &sim, 0, sizeof(sim) );
+    SREG = 0;
+    EEAR = 0;
+    EEDR = 0;
+    EECR = 0;
+    TCNT3 = 0;
+    PINA = 0;
+    DDRA = 0;
+    PORTA = 0;
+    PCMSK0 = 0;
+    PCICR = 0;
+    PCIFR = 0;
+    MCUSR = ( 1 << PORF );
+    synced_m1 = 0;
+    synced_m2 = 0;
+    eeprom_write_elapsed_ms = 0;
+    rx_ring = NULL;
+    rx_ring_size = 0;
+    rx_ring_head = 0;
+    motor_m2 = NULL;
+    wire_baud = 0;
+    cpu_us = 0;
+    wire_busy_until_us = 0;
+}
+
+void sim_set_tx_handler( sim_tx_handler_t handler, void *context )
+{
+    tx_handler = handler;
+    tx_context = context;
+}
+
+size_t sim_serial_inject( const char *data, size_t length )
+{
+    size_t i;
+
+    if ( rx_ring == NULL )
+    {
+        return 0;
+    }
+
+    for ( i = 0; i < length; i++ )
+    {
+        rx_ring[rx_ring_head] = data[i];
+        rx_ring_head = ( rx_ring_head + 1 ) % rx_ring_size;
+    }
+
+    sim.rx_bytes += length;
+
+    return length;
+}
+
+void sim_attach_motor_m2( motor_plant_t *plant )
+{
+    motor_m2 = plant;
+}
+
+void sim_advance_motors_us( unsigned long us )
+{
+    if ( motor_m2 != NULL )
+    {
+        motor_plant_advance_us( motor_m2, sim.motor_m2, us );
+        sim.encoder_m2 = motor_plant_counts( motor_m2 );
+    }
+}
+
+// Line state (B << 1 | A) for a count: 0, 1, 3, 2 going forward
+static uint8_t gray_state( int counts )
+{
+    static const uint8_t states[4] = { 0, 1, 3, 2 };
+
+    return states[counts & 3];
+}
+
+// One edge at a time so the ISR sees every transition
+static void sync_channel( int *synced, int target, int shift )
+{
+    while ( *synced != target )
+    {
+        *synced += ( target > *synced ) ? 1 : -1;
+        PINA = (uint8_t)( ( PINA & ~( 3 << shift ) ) | ( gray_state( *synced ) << shift ) );
+
+        if ( ( PCICR & ( 1 << PCIE0 ) ) && ( PCMSK0 & ( 3 << shift ) ) )
+        {
+            PCINT0_vect();
+        }
+    }
+}
+
+void sim_encoders_sync( void )
+{
+    sync_channel( &synced_m2, sim.encoder_m2, 0 );
+    sync_channel( &synced_m1, sim.encoder_m1, 2 );
+}
+
+int sim_eeprom_tick_ms( void )
+{
+    if ( EECR & ( 1 << EEPE ) )
+    {
+        // EEPE without EEMPE just before it is ignored by the part
+        if ( ( EECR & ( 1 << EEMPE ) ) == 0 )
+        {
+            EECR &= (uint8_t)~( 1 << EEPE );
+        }
+        else if ( ++eeprom_write_elapsed_ms >= SIM_EEPROM_WRITE_MS )
+        {
+            sim_eeprom[EEAR % SIM_EEPROM_SIZE] = EEDR;
+            sim.eeprom_writes++;
+            eeprom_write_elapsed_ms = 0;
+            EECR &= (uint8_t)~( ( 1 << EEPE ) | ( 1 << EEMPE ) );
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    return ( EECR & ( 1 << EERIE ) ) != 0;
+}
+
+unsigned char sim_serial_ring_size( void )
+{
+    return rx_ring_size;
+}
+
+void sim_serial_wire( unsigned long baud )
+{
+    wire_baud = baud;
+    wire_busy_until_us = 0;
+}
+
+uint64_t sim_cpu_us( void )
+{
+    if ( cpu_us < (uint64_t)sim.ms * 1000 )
+    {
+        cpu_us = (uint64_t)sim.ms * 1000;
+    }
+
+    return cpu_us;
+}
+
+int sim_watchdog_expired( void )
+{
+    return sim.wdt_period_ms && ( sim.ms - sim.wdt_kicked_ms >= sim.wdt_period_ms );
+}
+
+void wdt_enable( unsigned char timeout )
+{
+    sim.wdt_period_ms = 16U << timeout;
+    sim.wdt_kicked_ms = sim.ms;
+}
+
+void wdt_disable( void )
+{
+    sim.wdt_period_ms = 0;
+}
+
+void wdt_reset( void )
+{
+    sim.wdt_kicked_ms = sim.ms;
+    sim.wdt_kicks++;
+}
+
+static int wire_busy( void )
+{
+    return wire_baud && ( sim_cpu_us() < wire_busy_until_us );
+}
+
+//------------------------------------------------------------------------------------------
+// OrangutanSerial
+
+void serial_set_baud_rate( unsigned char port, unsigned long baud )
+{
+    (void)port;
+    (void)baud;
+}
+
+void serial_receive_ring( unsigned char port, char *buffer, unsigned char size )
+{
+    (void)port;
+    rx_ring = buffer;
+    rx_ring_size = size;
+    rx_ring_head = 0;
+}
+
+unsigned char serial_get_received_bytes( unsigned char port )
+{
+    (void)port;
+    return rx_ring_head;
+}
+
+void serial_send( unsigned char port, char *buffer, unsigned char size )
+{
+    (void)port;
+
+    sim.tx_bytes += size;
+    sim.tx_calls++;
+
+    if ( wire_baud )
+    {
+        // The real library restarts on the new buffer, cutting off the old
+        if ( wire_busy() )
+        {
+            sim.tx_clobbered++;
+        }
+        wire_busy_until_us = sim_cpu_us() + (uint64_t)size * 10 * 1000000 / wire_baud;
+    }
+
+    if ( tx_handler != NULL )
+    {
+        tx_handler( buffer, size, tx_context );
+    }
+}
+
+char serial_send_buffer_empty( unsigned char port )
+{
+    (void)port;
+    return !wire_busy();
+}
+
+// Polling a busy wire costs the caller time
+void serial_check( void )
+{
+    if ( wire_busy() )
+    {
+        cpu_us++;
+        sim.tx_wait_us++;
+    }
+}
+
+//------------------------------------------------------------------------------------------
+// PololuWheelEncoders
+
+void encoders_init( unsigned char m1a, unsigned char m1b, unsigned char m2a, unsigned char m2b )
+{
+    (void)m1a;
+    (void)m1b;
+    (void)m2a;
+    (void)m2b;
+}
+
+int encoders_get_counts_m1( void )
+{
+    return sim.encoder_m1;
+}
+
+int encoders_get_counts_m2( void )
+{
+    return sim.encoder_m2;
+}
+
+unsigned char encoders_check_error_m1( void )
+{
+    return 0;
+}
+
+unsigned char encoders_check_error_m2( void )
+{
+    unsigned char error = sim.encoder_error_m2;
+
+    sim.encoder_error_m2 = 0;
+    return error;
+}
+
+//------------------------------------------------------------------------------------------
+// OrangutanMotors
+
+void set_motors( int m1, int m2 )
+{
+    sim.motor_m1 = m1;
+    sim.motor_m2 = m2;
+}
+
+//------------------------------------------------------------------------------------------
+// avr/eeprom.h
+
+uint8_t eeprom_read_byte( const uint8_t *address )
+{
+    return sim_eeprom[(uintptr_t)address % SIM_EEPROM_SIZE];
+}
+
+void eeprom_read_block( void *destination, const void *source, size_t size )
+{
+    size_t i;
+
+    for ( i = 0; i < size; i++ )
+    {
+        ( (uint8_t *)destination )[i] = eeprom_read_byte( (const uint8_t *)source + i );
+    }
+}
+
+//------------------------------------------------------------------------------------------
+// OrangutanTime
+
+void delay_ms( unsigned int milliseconds )
+{
+    sim.ms += milliseconds;
+}
+
+unsigned long get_ms( void )
+{
+    return sim.ms;
+}
+
+//------------------------------------------------------------------------------------------
+// Display, LEDs, buzzer: nothing to simulate
+
+void clear( void ) {}
+void lcd_init_printf( void ) {}
+void lcd_goto_xy( int col, int row ) { (void)col; (void)row; }
+void print( const char *str ) { (void)str; }
+void print_long( long value ) { (void)value; }
+void print_character( char c ) { (void)c; }
+void red_led( unsigned char on ) { (void)on; }
+void green_led( unsigned char on ) { (void)on; }
+void set_digital_output( unsigned char pin, unsigned char value ) { (void)pin; (void)value; }
+void play_from_program_space( const char *notes ) { (void)notes; }
@@ -0,0 +1,125 @@
+/* sim.h
+ *
+ * Host simulation of the Orangutan SVP pieces the Lab sources use.
+ *
+ * The firmware is compiled unchanged against the stand-in headers in
+ * sim/include.  A harness then drives it:
+ *
+ *   sim_reset();                       power up state
+ *   init_menu(); controller_init();    firmware init
+ *   sim_serial_inject( "R,90\n", 5 );  bytes arriving on USB_COMM
+ *   sim_advance_ms( 1 ) + ISR calls    virtual time
+ *   service_serial();                  main loop body
+ *
+ * The encoder counts are either set by the harness (replay) or come from a
+ * motor model attached with sim_attach_motor_m2() and stepped with
+ * sim_advance_motors_us() alongside the timer ISR.  sim_encoders_sync()
+ * then walks the PINA lines to them one quadrature edge at a time through
+ * the firmware's PCINT0 ISR, wired as Lab2 wires them: motor 2 A/B on PA0
+ * and PA1, motor 1 on PA2 and PA3.
+ *
+ * The watchdog (avr/wdt.h) only reports that it has run out, through
+ * sim_watchdog_expired(); the harness decides what a reset means.
+ *
+ * The EEPROM survives sim_power_cycle() but not sim_reset().  A write the
+ * firmware starts through EECR completes SIM_EEPROM_WRITE_MS later, and the
+ * harness runs the firmware's EE_READY ISR whenever sim_eeprom_tick_ms()
+ * says it is pending.
+ *
+ * Everything the firmware sends with serial_send() is handed to the TX
+ * callback immediately.  By default the send buffer is always "empty";
+ * sim_serial_wire() makes a send occupy the wire for its bytes at a baud
+ * rate, and serial_check() polls while it is busy cost the firmware 1 us
+ * each on a CPU clock (sim_cpu_us()) that runs ahead of sim.ms.
+ */
+
+#ifndef __SIM_H
+#define __SIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <avr/io.h>
+
+#include "motor_plant.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_EEPROM_SIZE     ( E2END + 1 )
+#define SIM_EEPROM_WRITE_MS 4           // 3.4 ms on the part
+
+typedef void (*sim_tx_handler_t)( const char *data, size_t length, void *context );
+
+typedef struct
+{
+    unsigned long ms;           // get_ms()
+    int encoder_m1;             // encoders_get_counts_m1()
+    int encoder_m2;             // encoders_get_counts_m2()
+    unsigned char encoder_error_m2;
+    int motor_m1;               // last set_motors()
+    int motor_m2;
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint64_t tx_calls;
+    uint64_t tx_wait_us;        // serial_check() polls on a busy wire
+    uint64_t tx_clobbered;      // serial_send() while the wire was busy
+    uint64_t eeprom_writes;
+    unsigned int wdt_period_ms;         // 0 while the watchdog is off
+    unsigned long wdt_kicked_ms;        // last wdt_enable() / wdt_reset()
+    uint64_t wdt_kicks;
+} sim_state_t;
+
+extern sim_state_t sim;
+
+extern uint8_t sim_eeprom[SIM_EEPROM_SIZE];
+
+// Fresh board: everything cleared and the EEPROM erased (0xFF)
+void sim_reset( void );
+
+// Reset keeping the EEPROM contents
+void sim_power_cycle( void );
+
+// One ms of EEPROM time.  Returns 1 when the EEPROM ready interrupt is
+// enabled and the EEPROM is idle, i.e. EE_READY_vect() should run.
+int sim_eeprom_tick_ms( void );
+
+// ISR bodies the harness calls (defined by the firmware with ISR())
+void EE_READY_vect( void );
+void PCINT0_vect( void );
+void sim_set_tx_handler( sim_tx_handler_t handler, void *context );
+
+// Put bytes into the USB_COMM receive ring, as the USB driver would
+size_t sim_serial_inject( const char *data, size_t length );
+
+// Drive motor 2 and its encoder from 'plant' (NULL detaches; sim_reset()
+// detaches too)
+void sim_attach_motor_m2( motor_plant_t *plant );
+
+// Run the attached motor models for 'us' at the last set_motors() values
+void sim_advance_motors_us( unsigned long us );
+
+// Step PINA to sim.encoder_m1 / sim.encoder_m2, calling PCINT0_vect() for
+// every edge while the firmware has the interrupt enabled
+void sim_encoders_sync( void );
+
+// Size of the ring the firmware registered with serial_receive_ring()
+unsigned char sim_serial_ring_size( void );
+
+// Model the USB_COMM wire at 'baud' (8N1), 0 for instant sends.  Cleared by
+// sim_power_cycle().
+void sim_serial_wire( unsigned long baud );
+
+// CPU time: sim.ms plus whatever the firmware spent polling a busy wire
+uint64_t sim_cpu_us( void );
+
+// 1 when the watchdog is on and has not been kicked for its period at
+// sim.ms, i.e. the board resets now
+int sim_watchdog_expired( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__SIM_H
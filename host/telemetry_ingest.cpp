@@ -0,0 +1,498 @@
+/* telemetry_ingest.cpp
+ *
+ * Command line replacement for the capture half of real_time_data_plot.m.
+ *
+ * Reads the Lab2 "v," / "d," stream (or packed samples, 'L,2') from the
+ * serial device (or a pty), parses it without allocating, and appends every
+ * sample to a SampleStore capture (see sample_store.h).  There is no sample
+ * limit; the capture file grows as needed and can be memory mapped by a
+ * viewer while it is being written.
+ *
+ * Usage:
+ *   telemetry_ingest <device> <capture file> [options]
+ *     --baud <n>        serial speed (default 256000, 0 = leave as is)
+ *     --stats <ms>      print throughput every <ms> (default 1000, 0 = off)
+ *     --check-ramp      expect Pm to count up by one per line and report gaps
+ *                       (the pattern line_generator sends)
+ *     --quiet           do not echo "d," lines
+ *     --record <file>   record the session (see session_file.h) for
+ *                       lab2_sim replay
+ *     --ping <n>        send n empty command frames ("F,<seq>"), each once
+ *                       the previous one is acknowledged (or after 1 s), and
+ *                       report the round trip times
+ *
+ * Lines typed on stdin (e.g. "R,90") are sent to the board with a '\n'
+ * terminator, the same way real_time_data_plot.m sends its commands, and are
+ * recorded along with every line received.
+ *
+ * Command frames ("F,<seq>,...", see Lab2/controller.h) typed or pinged are
+ * timed until their "a,<seq>,<cycle>" acknowledgement arrives; every ack is
+ * echoed with its round trip time unless --quiet, and the totals are
+ * printed at the end.
+ *
+ * Build (from host/):
+ *   g++ -O2 -o telemetry_ingest telemetry_ingest.cpp sample_store.cpp append_file.cpp serial_port.cpp session_file.cpp
+ */
+
+#include "sample_store.h"
+#include "serial_port.h"
+#include "session_file.h"
+#include "telemetry_parser.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+using telemetry::FIELD_PM;
+using telemetry::LineParser;
+using telemetry::Sample;
+
+#define READ_CHUNK_SIZE 65536
+#define COMMAND_MAX     256
+#define FRAME_SLOTS     64              // frames in flight that can be timed
+#define PING_TIMEOUT_US 1000000
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_signal( int )
+{
+    stop_requested = 1;
+}
+
+static int64_t monotonic_us( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t unix_us( void )
+{
+    struct timeval tv;
+
+    gettimeofday( &tv, NULL );
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+struct IngestSink
+{
+    SampleStore *store;
+    SessionWriter *recorder;
+    int64_t start_us;
+    int64_t now_us;
+    bool quiet;
+    bool check_ramp;
+    bool have_last;
+    int32_t last_pm;
+    uint64_t ramp_gaps;
+    uint64_t ramp_lost;
+    uint64_t store_errors;
+
+    // Command frames by seq % FRAME_SLOTS
+    int frame_seq[FRAME_SLOTS];
+    int64_t frame_sent_us[FRAME_SLOTS];
+    uint64_t acks;
+    uint64_t rejects;
+    uint64_t unmatched_acks;
+    int64_t rtt_sum_us;
+    int64_t rtt_min_us;
+    int64_t rtt_max_us;
+    int ping_outstanding;               // seq, -1 for none
+
+    void frame_sent( int seq )
+    {
+        frame_seq[seq % FRAME_SLOTS] = seq;
+        frame_sent_us[seq % FRAME_SLOTS] = now_us;
+    }
+
+    void on_ack( int seq, int result )
+    {
+        int slot = ( seq >= 0 ) ? seq % FRAME_SLOTS : 0;
+        int64_t rtt_us;
+
+        if ( seq == ping_outstanding )
+        {
+            ping_outstanding = -1;
+        }
+
+        if ( result < 0 )
+        {
+            rejects++;
+            if ( !quiet )
+            {
+                printf( "a,%d rejected (%s)\n", seq, result == -1 ? "busy" : "malformed" );
+            }
+            return;
+        }
+
+        if ( ( seq < 0 ) || ( frame_seq[slot] != seq ) || ( frame_sent_us[slot] == 0 ) )
+        {
+            unmatched_acks++;
+            return;
+        }
+
+        rtt_us = now_us - frame_sent_us[slot];
+        frame_sent_us[slot] = 0;
+
+        acks++;
+        rtt_sum_us += rtt_us;
+        if ( ( acks == 1 ) || ( rtt_us < rtt_min_us ) )
+        {
+            rtt_min_us = rtt_us;
+        }
+        if ( rtt_us > rtt_max_us )
+        {
+            rtt_max_us = rtt_us;
+        }
+
+        if ( !quiet )
+        {
+            printf( "a,%d cycle %d rtt %.1f ms\n", seq, result, rtt_us / 1000.0 );
+        }
+    }
+
+    void on_line( const char *line, size_t length )
+    {
+        if ( recorder != NULL )
+        {
+            recorder->write( now_us - start_us, SESSION_RX, line, length );
+        }
+    }
+
+    void on_values( const Sample &sample )
+    {
+        if ( check_ramp )
+        {
+            if ( have_last && ( sample.field[FIELD_PM] != last_pm + 1 ) )
+            {
+                ramp_gaps++;
+                if ( sample.field[FIELD_PM] > last_pm )
+                {
+                    ramp_lost += sample.field[FIELD_PM] - last_pm - 1;
+                }
+            }
+            last_pm = sample.field[FIELD_PM];
+            have_last = true;
+        }
+
+        if ( !store->append( now_us, sample ) )
+        {
+            store_errors++;
+        }
+    }
+
+    void on_debug( const char *text, size_t length )
+    {
+        if ( !quiet )
+        {
+            printf( "d,%.*s\n", (int)length, text );
+        }
+    }
+
+    void on_other( const char *line, size_t length )
+    {
+        char text[32];
+        int seq, result;
+
+        if ( ( length < 2 ) || ( line[0] != 'a' ) || ( line[1] != ',' ) || ( length >= sizeof(text) ) )
+        {
+            return;
+        }
+
+        memcpy( text, line, length );
+        text[length] = '\0';
+        if ( sscanf( text, "a,%d,%d", &seq, &result ) == 2 )
+        {
+            on_ack( seq, result );
+        }
+    }
+};
+
+static void print_stats( const char *label, const telemetry::ParserStats &stats, const IngestSink &sink, double seconds )
+{
+    fprintf( stderr, "%s: %.1fs bytes:%llu v:%llu (%.0f/s, %.0f B/s) d:%llu unknown:%llu malformed:%llu overlong:%llu",
+             label, seconds,
+             (unsigned long long)stats.bytes, (unsigned long long)stats.values,
+             seconds > 0 ? stats.values / seconds : 0.0, seconds > 0 ? stats.bytes / seconds : 0.0,
+             (unsigned long long)stats.debug, (unsigned long long)stats.unknown,
+             (unsigned long long)stats.malformed, (unsigned long long)stats.overlong );
+
+    if ( stats.packed || stats.packed_dropped )
+    {
+        fprintf( stderr, " packed:%llu dropped:%llu", (unsigned long long)stats.packed, (unsigned long long)stats.packed_dropped );
+    }
+
+    if ( sink.check_ramp )
+    {
+        fprintf( stderr, " gaps:%llu lost:%llu", (unsigned long long)sink.ramp_gaps, (unsigned long long)sink.ramp_lost );
+    }
+
+    if ( sink.store_errors )
+    {
+        fprintf( stderr, " store_errors:%llu", (unsigned long long)sink.store_errors );
+    }
+
+    fprintf( stderr, "\n" );
+}
+
+static void usage( const char *name )
+{
+    fprintf( stderr, "usage: %s <device> <capture file> [--baud n] [--stats ms] [--check-ramp] [--quiet] [--record file] [--ping n]\n", name );
+}
+
+static void print_frames( const IngestSink &sink, uint64_t lost )
+{
+    if ( !sink.acks && !sink.rejects && !lost )
+    {
+        return;
+    }
+
+    fprintf( stderr, "frames: %llu acked, %llu rejected, %llu lost, %llu unmatched acks",
+             (unsigned long long)sink.acks, (unsigned long long)sink.rejects,
+             (unsigned long long)lost, (unsigned long long)sink.unmatched_acks );
+    if ( sink.acks )
+    {
+        fprintf( stderr, ", round trip min %.1f mean %.1f max %.1f ms",
+                 sink.rtt_min_us / 1000.0, sink.rtt_sum_us / 1000.0 / sink.acks, sink.rtt_max_us / 1000.0 );
+    }
+    fprintf( stderr, "\n" );
+}
+
+// Write one command line to the board and record it; frames are timed
+static bool send_command( int fd, IngestSink &sink, char *command, size_t command_length )
+{
+    command[command_length] = '\n';
+    if ( write( fd, command, command_length + 1 ) != (ssize_t)( command_length + 1 ) )
+    {
+        return false;
+    }
+
+    if ( ( command_length > 2 ) && ( ( command[0] == 'F' ) || ( command[0] == 'f' ) ) && ( command[1] == ',' ) )
+    {
+        sink.frame_sent( atoi( command + 2 ) & 0xFFFF );
+    }
+
+    if ( sink.recorder != NULL )
+    {
+        sink.recorder->write( sink.now_us - sink.start_us, SESSION_TX, command, command_length );
+    }
+
+    return true;
+}
+
+// Forward one stdin line to the board.  Returns false when stdin is closed.
+static bool forward_command( int fd, IngestSink &sink, char *command, size_t &command_length )
+{
+    char c;
+    ssize_t got;
+
+    got = read( STDIN_FILENO, &c, 1 );
+    if ( got <= 0 )
+    {
+        return false;
+    }
+
+    if ( ( c != '\n' ) && ( c != '\r' ) )
+    {
+        if ( command_length < COMMAND_MAX - 1 )
+        {
+            command[command_length++] = c;
+        }
+        return true;
+    }
+
+    if ( command_length > 0 )
+    {
+        sink.now_us = monotonic_us();
+        send_command( fd, sink, command, command_length );
+        command_length = 0;
+    }
+
+    return true;
+}
+
+int main( int argc, char **argv )
+{
+    static char read_buffer[READ_CHUNK_SIZE];
+    const char *device;
+    const char *capture_path;
+    const char *record_path = NULL;
+    char command[COMMAND_MAX];
+    size_t command_length = 0;
+    bool stdin_open = true;
+    int baud = SERIAL_PORT_DEFAULT_BAUD;
+    int stats_ms = 1000;
+    int ping_left = 0;
+    int ping_seq = 1;
+    int64_t ping_sent_us = 0;
+    uint64_t ping_lost = 0;
+    int fd;
+    int64_t start_us, last_stats_us;
+    SampleStore store;
+    SessionWriter recorder;
+    IngestSink sink;
+
+    if ( argc < 3 )
+    {
+        usage( argv[0] );
+        return 1;
+    }
+
+    device = argv[1];
+    capture_path = argv[2];
+
+    memset( &sink, 0, sizeof(sink) );
+    sink.store = &store;
+    sink.ping_outstanding = -1;
+
+    for ( int i = 3; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--baud" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            baud = atoi( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--stats" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            stats_ms = atoi( argv[++i] );
+        }
+        else if ( strcmp( argv[i], "--check-ramp" ) == 0 )
+        {
+            sink.check_ramp = true;
+        }
+        else if ( strcmp( argv[i], "--quiet" ) == 0 )
+        {
+            sink.quiet = true;
+        }
+        else if ( ( strcmp( argv[i], "--record" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            record_path = argv[++i];
+        }
+        else if ( ( strcmp( argv[i], "--ping" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            ping_left = atoi( argv[++i] );
+        }
+        else
+        {
+            usage( argv[0] );
+            return 1;
+        }
+    }
+
+    fd = serial_port_open( device, baud );
+    if ( fd < 0 )
+    {
+        fprintf( stderr, "Could not open %s: %s\n", device, strerror( errno ) );
+        return 1;
+    }
+
+    if ( !store.create( capture_path ) )
+    {
+        fprintf( stderr, "Could not create %s: %s\n", capture_path, strerror( errno ) );
+        return 1;
+    }
+
+    start_us = last_stats_us = monotonic_us();
+    sink.start_us = start_us;
+
+    if ( record_path != NULL )
+    {
+        if ( !recorder.create( record_path, unix_us() ) )
+        {
+            fprintf( stderr, "Could not create %s: %s\n", record_path, strerror( errno ) );
+            return 1;
+        }
+        sink.recorder = &recorder;
+    }
+
+    signal( SIGINT, handle_signal );
+    signal( SIGTERM, handle_signal );
+
+    LineParser<IngestSink> parser( sink );
+
+    while ( !stop_requested )
+    {
+        struct pollfd pfd[2];
+        ssize_t got;
+        int ready;
+
+        pfd[0].fd = fd;
+        pfd[0].events = POLLIN;
+        pfd[0].revents = 0;
+        pfd[1].fd = STDIN_FILENO;
+        pfd[1].events = POLLIN;
+        pfd[1].revents = 0;
+        ready = poll( pfd, stdin_open ? 2 : 1, 100 );
+
+        sink.now_us = monotonic_us();
+
+        if ( ( sink.ping_outstanding >= 0 ) && ( sink.now_us - ping_sent_us >= PING_TIMEOUT_US ) )
+        {
+            ping_lost++;
+            sink.ping_outstanding = -1;
+        }
+        if ( ( ping_left > 0 ) && ( sink.ping_outstanding < 0 ) )
+        {
+            char ping[16];
+
+            if ( send_command( fd, sink, ping, snprintf( ping, sizeof(ping) - 1, "F,%d", ping_seq ) ) )
+            {
+                sink.ping_outstanding = ping_seq;
+                ping_sent_us = sink.now_us;
+            }
+            ping_seq = ( ping_seq + 1 ) & 0xFFFF;
+            ping_left--;
+        }
+
+        if ( ( stats_ms > 0 ) && ( sink.now_us - last_stats_us >= (int64_t)stats_ms * 1000 ) )
+        {
+            last_stats_us = sink.now_us;
+            print_stats( "stats", parser.stats(), sink, ( sink.now_us - start_us ) / 1e6 );
+        }
+
+        if ( ready <= 0 )
+        {
+            continue;
+        }
+
+        if ( stdin_open && ( pfd[1].revents & ( POLLIN | POLLHUP ) ) )
+        {
+            stdin_open = forward_command( fd, sink, command, command_length );
+        }
+
+        if ( ( pfd[0].revents & ( POLLIN | POLLHUP | POLLERR ) ) == 0 )
+        {
+            continue;
+        }
+
+        // Drain everything the driver has buffered in one go so we never
+        // fall behind the line rate
+        got = read( fd, read_buffer, sizeof(read_buffer) );
+        if ( got > 0 )
+        {
+            parser.feed( read_buffer, got );
+        }
+        else if ( ( got == 0 ) || ( ( errno != EINTR ) && ( errno != EAGAIN ) ) )
+        {
+            // Device unplugged or pty master closed
+            break;
+        }
+    }
+
+    print_stats( "total", parser.stats(), sink, ( monotonic_us() - start_us ) / 1e6 );
+    print_frames( sink, ping_lost );
+    fprintf( stderr, "%llu samples written to %s\n", (unsigned long long)store.sample_count(), capture_path );
+
+    store.sync();
+    store.close();
+    recorder.close();
+    close( fd );
+
+    return 0;
+}
@@ -0,0 +1,284 @@
+/* telemetry_parser.h
+ *
+ * Zero allocation parser for the Lab2 serial stream.
+ *
+ * Lab2 sends two kinds of lines over USB_COMM:
+ *
+ *   v,<Pe>,<Pr>,<Pm>,<Vm>,<T>,<Kp*1000>,<Kd*1000>\r\n   - controller values
+ *   d,<free form text>\r\n                              - debug text
+ *
+ * and, with logging mode 2, packed binary samples in place of the "v,"
+ * lines (packed_frame.h).
+ *
+ * LineParser is fed raw bytes as they come off the port (any chunking) and
+ * calls back into a sink for every complete line.  Partial lines are kept in
+ * a fixed buffer inside the parser, so nothing is allocated per line.  A
+ * packed record is recognised by its first byte and decoded into
+ * on_values().  Text lines never hold the record type bytes, so one seen
+ * part way through a line starts a record too.
+ */
+
+#ifndef __TELEMETRY_PARSER_H
+#define __TELEMETRY_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "packed_frame.h"
+
+namespace telemetry
+{
+
+// Field order matches the "v," line and real_time_data_plot.m
+typedef enum
+{
+    FIELD_PE,
+    FIELD_PR,
+    FIELD_PM,
+    FIELD_VM,
+    FIELD_T,
+    FIELD_KP,
+    FIELD_KD,
+    FIELD_NUM
+} FIELD_E;
+
+static const char * const FIELD_NAMES[FIELD_NUM] = { "Pe", "Pr", "Pm", "Vm", "T", "Kp", "Kd" };
+
+static_assert( (int)FIELD_NUM == (int)PACK_FIELDS, "packed records carry every field" );
+
+struct Sample
+{
+    int32_t field[FIELD_NUM];
+};
+
+// Longest line we will buffer.  Lab2 lines are well under 64 bytes
+// (BUFFER_SIZE in controller.h), anything longer is counted and thrown away.
+#define TELEMETRY_LINE_MAX 128
+
+struct ParserStats
+{
+    uint64_t bytes;
+    uint64_t values;
+    uint64_t debug;
+    uint64_t unknown;
+    uint64_t malformed;
+    uint64_t overlong;
+    uint64_t packed;            // samples from packed records
+    uint64_t packed_dropped;    // packed records that did not decode
+};
+
+// Parse the body of a "v," line (without the leading "v,").  Returns false
+// if the line does not hold exactly FIELD_NUM integers, or one of them is
+// out of int32_t range.
+static inline bool parse_values( const char *p, const char *end, Sample &sample )
+{
+    for ( int i = 0; i < FIELD_NUM; i++ )
+    {
+        bool negative = false;
+        int32_t value = 0;
+        const char *start;
+
+        if ( ( p < end ) && ( ( *p == '-' ) || ( *p == '+' ) ) )
+        {
+            negative = ( *p == '-' );
+            p++;
+        }
+
+        start = p;
+        while ( ( p < end ) && ( *p >= '0' ) && ( *p <= '9' ) )
+        {
+            int32_t digit = *p - '0';
+
+            if ( value > ( INT32_MAX - digit ) / 10 )
+            {
+                return false;
+            }
+            value = value * 10 + digit;
+            p++;
+        }
+
+        if ( p == start )
+        {
+            return false;
+        }
+
+        sample.field[i] = negative ? -value : value;
+
+        if ( i < FIELD_NUM - 1 )
+        {
+            if ( ( p >= end ) || ( *p != ',' ) )
+            {
+                return false;
+            }
+            p++;
+        }
+    }
+
+    return ( p == end );
+}
+
+// Sink must provide:
+//   void on_line( const char *line, size_t length );     (every line, raw)
+//   void on_values( const Sample & );
+//   void on_debug( const char *text, size_t length );
+//   void on_other( const char *line, size_t length );   (optional use)
+template <typename Sink>
+class LineParser
+{
+public:
+    LineParser( Sink &sink ) : sink_( sink ), length_( 0 ), discarding_( false ), packing_( false )
+    {
+        stats_ = ParserStats();
+    }
+
+    void feed( const char *data, size_t size )
+    {
+        const char *end = data + size;
+
+        stats_.bytes += size;
+
+        while ( data < end )
+        {
+            char c = *data++;
+
+            if ( packing_ )
+            {
+                feed_packed( (uint8_t)c );
+            }
+            else if ( is_pack_type( (uint8_t)c ) )
+            {
+                // Never part of a text line; after lost bytes this is how
+                // the parser gets back in step with the records
+                if ( ( length_ > 0 ) || discarding_ )
+                {
+                    stats_.unknown++;
+                }
+                discarding_ = false;
+                packing_ = true;
+                length_ = 0;
+                line_[length_++] = c;
+            }
+            else if ( ( c == '\r' ) || ( c == '\n' ) )
+            {
+                if ( discarding_ )
+                {
+                    discarding_ = false;
+                }
+                else if ( length_ > 0 )
+                {
+                    dispatch( line_, line_ + length_ );
+                }
+                length_ = 0;
+            }
+            else if ( discarding_ )
+            {
+                // Drop bytes until the next terminator
+            }
+            else if ( length_ < TELEMETRY_LINE_MAX )
+            {
+                line_[length_++] = c;
+            }
+            else
+            {
+                stats_.overlong++;
+                discarding_ = true;
+                length_ = 0;
+            }
+        }
+    }
+
+    const ParserStats &stats() const
+    {
+        return stats_;
+    }
+
+    const PackStats &pack_stats() const
+    {
+        return decoder_.stats();
+    }
+
+private:
+    // Collect a packed record in line_: type, length, then 'length' bytes
+    void feed_packed( uint8_t byte )
+    {
+        Sample sample;
+
+        line_[length_++] = (char)byte;
+
+        if ( ( length_ == 2 ) && ( byte + 2u > PACK_MAX_RECORD ) )
+        {
+            // Not a record after all; drop it like an overlong line
+            stats_.packed_dropped++;
+            decoder_.reset();
+            packing_ = false;
+            discarding_ = true;
+            length_ = 0;
+            return;
+        }
+
+        if ( ( length_ < 2 ) || ( length_ < (size_t)(uint8_t)line_[1] + 2 ) )
+        {
+            return;
+        }
+
+        if ( decoder_.decode( (const uint8_t *)line_, length_, sample.field ) )
+        {
+            stats_.values++;
+            stats_.packed++;
+            sink_.on_values( sample );
+        }
+        else
+        {
+            stats_.packed_dropped++;
+        }
+
+        packing_ = false;
+        length_ = 0;
+    }
+
+    void dispatch( const char *line, const char *end )
+    {
+        Sample sample;
+
+        sink_.on_line( line, end - line );
+
+        if ( ( end - line >= 2 ) && ( line[1] == ',' ) )
+        {
+            switch ( line[0] )
+            {
+                case 'v':
+                    if ( parse_values( line + 2, end, sample ) )
+                    {
+                        stats_.values++;
+                        sink_.on_values( sample );
+                    }
+                    else
+                    {
+                        stats_.malformed++;
+                    }
+                    return;
+                case 'd':
+                    stats_.debug++;
+                    sink_.on_debug( line + 2, end - line - 2 );
+                    return;
+                default:
+                    break;
+            }
+        }
+
+        stats_.unknown++;
+        sink_.on_other( line, end - line );
+    }
+
+    Sink &sink_;
+    char line_[TELEMETRY_LINE_MAX];
+    size_t length_;
+    bool discarding_;
+    bool packing_;
+    PackDecoder decoder_;
+    ParserStats stats_;
+};
+
+} // namespace telemetry
+
+#endif //__TELEMETRY_PARSER_H
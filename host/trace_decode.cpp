@@ -0,0 +1,511 @@
+/* trace_decode.cpp
+ *
+ * Turns a Lab2 binary trace dump ('T,0', see Lab2/trace.h) into a timeline:
+ *
+ *   --json  Chrome trace event format, for chrome://tracing or
+ *           ui.perfetto.dev.  calculate() and service_serial() are slices
+ *           on their own tracks, the motor command T a counter, menu
+ *           commands and marks instant events.
+ *   --vcd   Value change dump for GTKWave and friends: control and serial
+ *           as 1 bit signals, T, Pm, the last command and the last mark as
+ *           vectors.
+ *
+ * A summary (records, time span, count per event, calculate() and
+ * service_serial() durations) is always printed.
+ *
+ * Usage:
+ *   trace_decode <dump file> [--json out.json] [--vcd out.vcd]
+ *   trace_decode --device <tty> [--baud n] [--save dump.bin] [--json ...] [--vcd ...]
+ *
+ * The dump file is raw bytes from the port (e.g. "cat /dev/ttyACM0 > dump.bin"
+ * while sending T,0, or lab2_sim trace); anything around the frame is
+ * skipped.  With --device the tool sends "T,0" itself and waits up to
+ * DEVICE_TIMEOUT_MS for the frame; --save keeps the bytes received.
+ *
+ * Build (from host/):
+ *   g++ -O2 -o trace_decode trace_decode.cpp serial_port.cpp
+ */
+
+#include "serial_port.h"
+#include "trace_frame.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+using trace::EVENT_COMMAND;
+using trace::EVENT_CONTROL_BEGIN;
+using trace::EVENT_CONTROL_END;
+using trace::EVENT_MARK;
+using trace::EVENT_NAMES;
+using trace::EVENT_NUM;
+using trace::EVENT_SERIAL_BEGIN;
+using trace::EVENT_SERIAL_END;
+using trace::Frame;
+using trace::Record;
+
+#define DEVICE_TIMEOUT_MS   3000
+#define READ_CHUNK          4096
+
+// Chrome trace tracks
+#define TID_CONTROL         1
+#define TID_SERIAL          2
+#define TID_EVENTS          3
+
+static bool read_file( const char *path, std::vector<uint8_t> &data )
+{
+    FILE *file = fopen( path, "rb" );
+    uint8_t buffer[READ_CHUNK];
+    size_t got;
+
+    if ( !file )
+    {
+        perror( path );
+        return false;
+    }
+
+    while ( ( got = fread( buffer, 1, sizeof(buffer), file ) ) > 0 )
+    {
+        data.insert( data.end(), buffer, buffer + got );
+    }
+
+    fclose( file );
+    return true;
+}
+
+static bool write_file( const char *path, const std::vector<uint8_t> &data )
+{
+    FILE *file = fopen( path, "wb" );
+
+    if ( !file )
+    {
+        perror( path );
+        return false;
+    }
+
+    fwrite( data.data(), 1, data.size(), file );
+    fclose( file );
+    return true;
+}
+
+static int64_t monotonic_ms( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Ask the board for a dump and read until a whole frame is in
+static bool read_device( const char *path, int baud, std::vector<uint8_t> &data, Frame &frame )
+{
+    int fd = serial_port_open( path, baud );
+    int64_t deadline;
+    size_t used;
+    trace::FRAME_RESULT_E result;
+
+    if ( fd < 0 )
+    {
+        perror( path );
+        return false;
+    }
+
+    if ( write( fd, "T,0\n", 4 ) != 4 )
+    {
+        perror( "write" );
+        close( fd );
+        return false;
+    }
+
+    deadline = monotonic_ms() + DEVICE_TIMEOUT_MS;
+
+    while ( monotonic_ms() < deadline )
+    {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        uint8_t buffer[READ_CHUNK];
+        ssize_t got;
+
+        if ( poll( &pfd, 1, 100 ) <= 0 )
+        {
+            continue;
+        }
+
+        got = read( fd, buffer, sizeof(buffer) );
+        if ( got <= 0 )
+        {
+            break;
+        }
+        data.insert( data.end(), buffer, buffer + got );
+
+        result = trace::parse_frame( data.data(), data.size(), frame, used );
+        if ( ( result == trace::FRAME_OK ) || ( result == trace::FRAME_BAD_SUM ) )
+        {
+            break;
+        }
+    }
+
+    close( fd );
+    return true;
+}
+
+static const char *event_name( uint8_t id )
+{
+    return ( id < EVENT_NUM ) ? EVENT_NAMES[id] : "unknown";
+}
+
+//------------------------------------------------------------------------------------------
+// Summary
+
+struct Durations
+{
+    int count;
+    int64_t total_ns;
+    int64_t min_ns;
+    int64_t max_ns;
+
+    Durations() : count( 0 ), total_ns( 0 ), min_ns( 0 ), max_ns( 0 ) {}
+
+    void add( int64_t ns )
+    {
+        if ( !count || ( ns < min_ns ) )
+        {
+            min_ns = ns;
+        }
+        if ( !count || ( ns > max_ns ) )
+        {
+            max_ns = ns;
+        }
+        total_ns += ns;
+        count++;
+    }
+
+    void print( const char *name ) const
+    {
+        if ( count )
+        {
+            printf( "%-8s %5d slices  min %8.1f us  avg %8.1f us  max %8.1f us\n", name, count,
+                    min_ns / 1000.0, total_ns / 1000.0 / count, max_ns / 1000.0 );
+        }
+        else
+        {
+            printf( "%-8s     0 slices\n", name );
+        }
+    }
+};
+
+static void print_summary( const Frame &frame )
+{
+    int counts[256] = { 0 };
+    Durations control, serial;
+    int64_t control_start = -1, serial_start = -1;
+
+    for ( const Record &record : frame.records )
+    {
+        counts[record.id]++;
+
+        switch ( record.id )
+        {
+            case EVENT_CONTROL_BEGIN:
+                control_start = record.time_ns;
+                break;
+            case EVENT_CONTROL_END:
+                if ( control_start >= 0 )
+                {
+                    control.add( record.time_ns - control_start );
+                }
+                control_start = -1;
+                break;
+            case EVENT_SERIAL_BEGIN:
+                serial_start = record.time_ns;
+                break;
+            case EVENT_SERIAL_END:
+                if ( serial_start >= 0 )
+                {
+                    serial.add( record.time_ns - serial_start );
+                }
+                serial_start = -1;
+                break;
+        }
+    }
+
+    printf( "%zu records, %.3f ms, %u ns per tick\n", frame.records.size(),
+            frame.records.empty() ? 0.0 : frame.records.back().time_ns / 1e6, frame.tick_ns );
+
+    for ( int id = 0; id < 256; id++ )
+    {
+        if ( counts[id] )
+        {
+            printf( "  %-14s %5d\n", event_name( id ), counts[id] );
+        }
+    }
+
+    control.print( "control" );
+    serial.print( "serial" );
+}
+
+//------------------------------------------------------------------------------------------
+// Chrome trace JSON
+
+static void json_event( FILE *out, bool &first, const char *name, const char *ph, int64_t ns, int tid, const char *args )
+{
+    fprintf( out, "%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%d%s%s}",
+             first ? "" : ",", name, ph, ns / 1000.0, tid, args ? ",\"args\":" : "", args ? args : "" );
+    first = false;
+}
+
+static bool write_json( const char *path, const Frame &frame )
+{
+    FILE *out = fopen( path, "w" );
+    static const char * const tracks[] = { NULL, "control", "serial", "events" };
+    char args[64];
+    char name[32];
+    bool first = true;
+
+    if ( !out )
+    {
+        perror( path );
+        return false;
+    }
+
+    fprintf( out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" );
+
+    for ( int tid = TID_CONTROL; tid <= TID_EVENTS; tid++ )
+    {
+        snprintf( args, sizeof(args), "{\"name\":\"%s\"}", tracks[tid] );
+        json_event( out, first, "thread_name", "M", 0, tid, args );
+    }
+
+    for ( const Record &record : frame.records )
+    {
+        int16_t value = (int16_t)record.payload;
+
+        switch ( record.id )
+        {
+            case EVENT_CONTROL_BEGIN:
+                snprintf( args, sizeof(args), "{\"Pm\":%d}", value );
+                json_event( out, first, "calculate", "B", record.time_ns, TID_CONTROL, args );
+                break;
+            case EVENT_CONTROL_END:
+                snprintf( args, sizeof(args), "{\"T\":%d}", value );
+                json_event( out, first, "calculate", "E", record.time_ns, TID_CONTROL, args );
+                json_event( out, first, "T", "C", record.time_ns, TID_CONTROL, args );
+                break;
+            case EVENT_SERIAL_BEGIN:
+                json_event( out, first, "service_serial", "B", record.time_ns, TID_SERIAL, NULL );
+                break;
+            case EVENT_SERIAL_END:
+                json_event( out, first, "service_serial", "E", record.time_ns, TID_SERIAL, NULL );
+                break;
+            case EVENT_COMMAND:
+                snprintf( name, sizeof(name), "command %c", ( record.payload >= ' ' && record.payload < 0x7F ) ? record.payload : '?' );
+                json_event( out, first, name, "i", record.time_ns, TID_EVENTS, NULL );
+                break;
+            default:
+                snprintf( args, sizeof(args), "{\"id\":%d,\"payload\":%u}", record.id, record.payload );
+                json_event( out, first, event_name( record.id ), "i", record.time_ns, TID_EVENTS, args );
+                break;
+        }
+    }
+
+    fprintf( out, "\n]}\n" );
+    fclose( out );
+    return true;
+}
+
+//------------------------------------------------------------------------------------------
+// VCD
+
+struct VcdSignal
+{
+    const char *name;
+    int width;
+    char code;
+};
+
+static const VcdSignal VCD_CONTROL = { "control", 1, '!' };
+static const VcdSignal VCD_SERIAL  = { "serial", 1, '"' };
+static const VcdSignal VCD_T       = { "T", 16, '#' };
+static const VcdSignal VCD_PM      = { "Pm", 16, '$' };
+static const VcdSignal VCD_COMMAND = { "command", 8, '%' };
+static const VcdSignal VCD_MARK    = { "mark", 16, '&' };
+
+static void vcd_value( FILE *out, const VcdSignal &signal, unsigned value )
+{
+    if ( signal.width == 1 )
+    {
+        fprintf( out, "%u%c\n", value & 1, signal.code );
+        return;
+    }
+
+    fputc( 'b', out );
+    for ( int bit = signal.width - 1; bit >= 0; bit-- )
+    {
+        fputc( ( value >> bit ) & 1 ? '1' : '0', out );
+    }
+    fprintf( out, " %c\n", signal.code );
+}
+
+static bool write_vcd( const char *path, const Frame &frame )
+{
+    FILE *out = fopen( path, "w" );
+    const VcdSignal *signals[] = { &VCD_CONTROL, &VCD_SERIAL, &VCD_T, &VCD_PM, &VCD_COMMAND, &VCD_MARK };
+    int64_t last_ns = -1;
+
+    if ( !out )
+    {
+        perror( path );
+        return false;
+    }
+
+    fprintf( out, "$comment Lab2 trace, %u ns per tick $end\n", frame.tick_ns );
+    fprintf( out, "$timescale 1ns $end\n$scope module lab2 $end\n" );
+    for ( const VcdSignal *signal : signals )
+    {
+        fprintf( out, "$var wire %d %c %s $end\n", signal->width, signal->code, signal->name );
+    }
+    fprintf( out, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n" );
+    for ( const VcdSignal *signal : signals )
+    {
+        vcd_value( out, *signal, 0 );
+    }
+    fprintf( out, "$end\n" );
+
+    for ( const Record &record : frame.records )
+    {
+        if ( record.time_ns != last_ns )
+        {
+            fprintf( out, "#%lld\n", (long long)record.time_ns );
+            last_ns = record.time_ns;
+        }
+
+        switch ( record.id )
+        {
+            case EVENT_CONTROL_BEGIN:
+                vcd_value( out, VCD_CONTROL, 1 );
+                vcd_value( out, VCD_PM, record.payload );
+                break;
+            case EVENT_CONTROL_END:
+                vcd_value( out, VCD_CONTROL, 0 );
+                vcd_value( out, VCD_T, record.payload );
+                break;
+            case EVENT_SERIAL_BEGIN:
+                vcd_value( out, VCD_SERIAL, 1 );
+                break;
+            case EVENT_SERIAL_END:
+                vcd_value( out, VCD_SERIAL, 0 );
+                break;
+            case EVENT_COMMAND:
+                vcd_value( out, VCD_COMMAND, record.payload );
+                break;
+            case EVENT_MARK:
+                vcd_value( out, VCD_MARK, record.payload );
+                break;
+        }
+    }
+
+    fclose( out );
+    return true;
+}
+
+//------------------------------------------------------------------------------------------
+
+static void usage( const char *name )
+{
+    fprintf( stderr, "usage: %s <dump file> [--json out.json] [--vcd out.vcd]\n"
+                     "       %s --device <tty> [--baud n] [--save dump.bin] [--json out.json] [--vcd out.vcd]\n",
+             name, name );
+}
+
+int main( int argc, char **argv )
+{
+    const char *input = NULL, *device = NULL, *save = NULL, *json = NULL, *vcd = NULL;
+    int baud = SERIAL_PORT_DEFAULT_BAUD;
+    std::vector<uint8_t> data;
+    Frame frame;
+    size_t used;
+    trace::FRAME_RESULT_E result;
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( ( strcmp( argv[i], "--device" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            device = argv[++i];
+        }
+        else if ( ( strcmp( argv[i], "--baud" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            baud = atoi( argv[++i] );
+        }
+        else if ( ( strcmp( argv[i], "--save" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            save = argv[++i];
+        }
+        else if ( ( strcmp( argv[i], "--json" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            json = argv[++i];
+        }
+        else if ( ( strcmp( argv[i], "--vcd" ) == 0 ) && ( i + 1 < argc ) )
+        {
+            vcd = argv[++i];
+        }
+        else if ( !input && ( argv[i][0] != '-' ) )
+        {
+            input = argv[i];
+        }
+        else
+        {
+            usage( argv[0] );
+            return 1;
+        }
+    }
+
+    if ( !input == !device )
+    {
+        usage( argv[0] );
+        return 1;
+    }
+
+    if ( device ? !read_device( device, baud, data, frame ) : !read_file( input, data ) )
+    {
+        return 1;
+    }
+
+    if ( save && !write_file( save, data ) )
+    {
+        return 1;
+    }
+
+    result = trace::parse_frame( data.data(), data.size(), frame, used );
+    switch ( result )
+    {
+        case trace::FRAME_OK:
+            break;
+        case trace::FRAME_NOT_FOUND:
+            fprintf( stderr, "no trace frame in %zu bytes\n", data.size() );
+            return 2;
+        case trace::FRAME_TRUNCATED:
+            fprintf( stderr, "trace frame truncated\n" );
+            return 2;
+        case trace::FRAME_BAD_SUM:
+            fprintf( stderr, "trace frame checksum mismatch\n" );
+            return 2;
+    }
+
+    print_summary( frame );
+
+    if ( json && !write_json( json, frame ) )
+    {
+        return 1;
+    }
+
+    if ( vcd && !write_vcd( vcd, frame ) )
+    {
+        return 1;
+    }
+
+    return 0;
+}
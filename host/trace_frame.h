@@ -0,0 +1,150 @@
+/* trace_frame.h
+ *
+ * Parser for the binary trace dump Lab2 sends for 'T,0' (Lab2/trace.h):
+ *
+ *   "TRC1"  uint16 count  uint16 tick_ns
+ *   count x { uint16 time, uint8 id, uint16 payload }
+ *   uint16 sum of the bytes above
+ *
+ * all little endian.  The 16 bit times are unwrapped into ns from the first
+ * record, counting a wrap whenever a time is below the one before.
+ */
+
+#ifndef __TRACE_FRAME_H
+#define __TRACE_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+namespace trace
+{
+
+// TRACE_EVENT_E in Lab2/trace.h
+typedef enum
+{
+    EVENT_NONE,
+    EVENT_CONTROL_BEGIN,
+    EVENT_CONTROL_END,
+    EVENT_SERIAL_BEGIN,
+    EVENT_SERIAL_END,
+    EVENT_COMMAND,
+    EVENT_MARK,
+    EVENT_NUM
+} EVENT_E;
+
+static const char * const EVENT_NAMES[EVENT_NUM] =
+{
+    "none", "control_begin", "control_end", "serial_begin", "serial_end", "command", "mark"
+};
+
+#define TRACE_FRAME_HEADER  8
+#define TRACE_FRAME_RECORD  5
+#define TRACE_FRAME_SUM     2
+
+struct Record
+{
+    int64_t time_ns;            // from the first record
+    uint16_t raw_time;
+    uint8_t id;
+    uint16_t payload;
+};
+
+struct Frame
+{
+    uint16_t tick_ns;
+    std::vector<Record> records;
+};
+
+typedef enum
+{
+    FRAME_OK,
+    FRAME_NOT_FOUND,            // no "TRC1" in the data
+    FRAME_TRUNCATED,            // data ends inside the frame
+    FRAME_BAD_SUM
+} FRAME_RESULT_E;
+
+static inline uint16_t get16( const uint8_t *p )
+{
+    return (uint16_t)( p[0] | ( p[1] << 8 ) );
+}
+
+// Find and decode the first frame in 'data'.  'used' is set to the offset
+// just past the frame (or past the data when the frame is truncated).
+static inline FRAME_RESULT_E parse_frame( const uint8_t *data, size_t length, Frame &frame, size_t &used )
+{
+    const uint8_t *start = NULL;
+    size_t count, size;
+    uint16_t sum = 0;
+    uint16_t previous = 0;
+    int64_t ticks = 0;
+
+    used = length;
+
+    for ( size_t i = 0; i + 4 <= length; i++ )
+    {
+        if ( memcmp( data + i, "TRC1", 4 ) == 0 )
+        {
+            start = data + i;
+            break;
+        }
+    }
+
+    if ( !start )
+    {
+        return FRAME_NOT_FOUND;
+    }
+
+    length -= start - data;
+    if ( length < TRACE_FRAME_HEADER )
+    {
+        return FRAME_TRUNCATED;
+    }
+
+    count = get16( start + 4 );
+    size = TRACE_FRAME_HEADER + count * TRACE_FRAME_RECORD;
+    if ( length < size + TRACE_FRAME_SUM )
+    {
+        return FRAME_TRUNCATED;
+    }
+
+    for ( size_t i = 0; i < size; i++ )
+    {
+        sum += start[i];
+    }
+
+    used = ( start - data ) + size + TRACE_FRAME_SUM;
+
+    if ( sum != get16( start + size ) )
+    {
+        return FRAME_BAD_SUM;
+    }
+
+    frame.tick_ns = get16( start + 6 );
+    frame.records.resize( count );
+
+    for ( size_t i = 0; i < count; i++ )
+    {
+        const uint8_t *p = start + TRACE_FRAME_HEADER + i * TRACE_FRAME_RECORD;
+        Record &record = frame.records[i];
+
+        record.raw_time = get16( p );
+        record.id = p[2];
+        record.payload = get16( p + 3 );
+
+        if ( i > 0 )
+        {
+            ticks += (uint16_t)( record.raw_time - previous );
+        }
+        previous = record.raw_time;
+        record.time_ns = ticks * frame.tick_ns;
+    }
+
+    return FRAME_OK;
+}
+
+} // namespace trace
+
+#endif //__TRACE_FRAME_H
@@ -14,6 +14,8 @@
 #include <pololu/orangutan.h>
 #include <pololu/OrangutanPushbuttons/OrangutanPushbuttons.h>
 
+#include "quadrature.h"
+
 
 // Defines for the system
 
@@ -93,7 +95,10 @@ int main()
     // Declare inputs
     unsigned char button_dbc_press, button_dbc_release, button_pressed;
     int motor_speed_output, motor_speed_magnitude, motor_speed_stored, motor_speed_req;
-    int count_value, count_error;
+    long count_value;
+    int count_error;
+    uint16_t count_errors_seen;
+    quadrature_snapshot_t encoders;
     int str_len_count, str_len_speed;
     int motor_disable, motor_enable, motor_no_change, speed_up, speed_down, speed_no_change;
     DIRECTION_E direction;
@@ -112,7 +117,11 @@ int main()
     str_len_speed = strlen( SPEED_STRING );
 
     // Initialize the encoders and specify the four input pins, first two are for motor 1, second two are for motor 2
-    encoders_init( PIN_ENCODER_1A, PIN_ENCODER_1B, PIN_ENCODER_2A, PIN_ENCODER_2B );
+    quadrature_init( PIN_ENCODER_1A, PIN_ENCODER_1B, PIN_ENCODER_2A, PIN_ENCODER_2B );
+    count_errors_seen = 0;
+
+    // The encoder ISR needs interrupts on
+    sei();
 
     // Initialize the motor speed and print
     motor_speed_magnitude = MOTOR_SPEED_INIT;
@@ -130,9 +139,11 @@ int main()
         button_dbc_press        = get_single_debounced_button_press( ALL_BUTTONS );
         button_dbc_release      = get_single_debounced_button_release( ALL_BUTTONS );
 
-        // Count inputs
-        count_value             = encoders_get_counts_m2() + ENCODER_START;
-        count_error             = encoders_check_error_m2();
+        // Count inputs, an error is any illegal transition since the last pass
+        quadrature_get_snapshot( &encoders );
+        count_value             = encoders.counts[QUADRATURE_M2] + ENCODER_START;
+        count_error             = ( encoders.errors[QUADRATURE_M2] != count_errors_seen );
+        count_errors_seen       = encoders.errors[QUADRATURE_M2];
 
         // Input Logic
         motor_disable           =  ( button_dbc_press   & BUTTON_DISABLE_MOTOR                      ) == BUTTON_DISABLE_MOTOR;
@@ -144,7 +155,7 @@ int main()
 
         // Print count
         lcd_goto_xy( str_len_count, LCD_ROW_COUNT );
-        printf("%5d", count_value);
+        printf("%5ld", count_value);
 
         // Print count error information
         if( count_error )